@@ -0,0 +1,594 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         -------------------------------------------------------------
+        / Automatic bans. Every time client is rejected for something \
+        | it did wrong, like sending too big file, nothing at all or  |
+        | going silent, its address gets a point. Points leak away    |
+        | with time, so honest mistakes are forgotten, but address    |
+        | that collects enough of them is banned for a while, and is  |
+        | dropped right after accept(), before it takes upload slot.  |
+        | Bans can be stored in a file, so restart doesn't forgive    |
+        \ anyone.                                                     /
+         -------------------------------------------------------------
+             \
+              \   .--.
+                 |o_o |
+                 |:_/ |
+                //   \ \
+               (|     | )
+              /'\_   _/`\
+              \___)=(___/
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "feature.h"
+
+#include <arpa/inet.h>
+#include <embedlog.h>
+#include <errno.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if HAVE_LINUX_LIMITS_H
+#   include <linux/limits.h>
+#endif
+
+#include "autoban.h"
+#include "globals.h"
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+struct autoban_entry
+{
+    unsigned char  ip[16];  /* address, ipv4 is mapped into ipv6 */
+    int            used;    /* slot is used */
+    double         score;   /* points collected by address */
+    time_t         scored;  /* when score was last leaked */
+    time_t         until;   /* address is banned until then, 0 - not banned */
+};
+
+static struct autoban_entry  *tab;    /* hash table, AUTOBAN_SLOTS long */
+static unsigned               nused;  /* number of used slots */
+static int                    dirty;  /* bans changed since last save */
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Converts 'sa' into key used in table
+
+    returns
+            0       key stored in 'ip'
+           -1       unsupported address family
+   ========================================================================== */
+
+
+static int autoban_key
+(
+    const struct sockaddr  *sa,  /* address to convert */
+    unsigned char          *ip   /* converted address */
+)
+{
+    memset(ip, 0, 16);
+
+    if (sa->sa_family == AF_INET)
+    {
+        ip[10] = 0xff;
+        ip[11] = 0xff;
+        memcpy(ip + 12, &((const struct sockaddr_in *)sa)->sin_addr.s_addr, 4);
+        return 0;
+    }
+
+#ifdef AF_INET6
+    if (sa->sa_family == AF_INET6)
+    {
+        memcpy(ip, &((const struct sockaddr_in6 *)sa)->sin6_addr, 16);
+        return 0;
+    }
+#endif
+
+    return -1;
+}
+
+
+/* ==========================================================================
+    Converts key 'ip' to string, ipv4 addresses are printed in dotted
+    notation. Returns pointer to statically allocated buffer.
+   ========================================================================== */
+
+
+static const char *autoban_ntop
+(
+    const unsigned char  *ip           /* key to convert */
+)
+{
+    static char           s[64];       /* converted address */
+    static unsigned char  v4[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (memcmp(ip, v4, sizeof(v4)) == 0)
+        sprintf(s, "%d.%d.%d.%d", ip[12], ip[13], ip[14], ip[15]);
+    else if (inet_ntop(AF_INET6, ip, s, sizeof(s)) == NULL)
+        strcpy(s, "?");
+
+    return s;
+}
+
+
+/* ==========================================================================
+    Finds slot for address 'ip'. When address is not in table, free slot
+    where it should be put is returned.
+
+    returns
+            slot with 'ip' or free slot
+   ========================================================================== */
+
+
+static struct autoban_entry *autoban_find
+(
+    const unsigned char  *ip  /* address to look for */
+)
+{
+    unsigned long         h;  /* hash of address, then slot */
+    int                   i;  /* current byte of address */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    h = 2166136261ul;
+    for (i = 0; i != 16; ++i)
+        h = ((h ^ ip[i]) * 16777619ul) & 0xfffffffful;
+
+    for (h &= AUTOBAN_SLOTS - 1; tab[h].used;
+            h = (h + 1) & (AUTOBAN_SLOTS - 1))
+        if (memcmp(tab[h].ip, ip, 16) == 0)
+            break;
+
+    return &tab[h];
+}
+
+
+/* ==========================================================================
+    Leaks points of 'e' that should be gone by 'now'
+   ========================================================================== */
+
+
+static void autoban_leak
+(
+    struct autoban_entry  *e,   /* entry to leak points from */
+    time_t                 now  /* current time */
+)
+{
+    if (now <= e->scored)
+        return;
+
+    e->score -= (double)(now - e->scored) / AUTOBAN_DECAY;
+    e->score = e->score < 0.0 ? 0.0 : e->score;
+    e->scored = now;
+}
+
+
+/* ==========================================================================
+    Puts ban of 'ip' until 'until' into table, used when loading bans
+    from file.
+   ========================================================================== */
+
+
+static void autoban_put
+(
+    const unsigned char   *ip,    /* banned address */
+    time_t                 until  /* end of ban */
+)
+{
+    struct autoban_entry  *e;     /* slot for address */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (nused >= AUTOBAN_SLOTS / 4 * 3)
+        return;
+
+    e = autoban_find(ip);
+    if (e->used == 0)
+    {
+        memcpy(e->ip, ip, 16);
+        e->used = 1;
+        e->score = 0.0;
+        e->scored = 0;
+        e->until = 0;
+        ++nused;
+    }
+
+    if (e->until == 0)
+        ++g_stats.autoban_active;
+
+    e->until = until > e->until ? until : e->until;
+}
+
+
+/* ==========================================================================
+    Loads bans from autoban file, bans that ended by 'now' are skipped.
+    File is ours, so malformed lines are only reported and ignored.
+   ========================================================================== */
+
+
+static void autoban_load
+(
+    time_t          now        /* current time */
+)
+{
+    FILE           *f;         /* autoban file */
+    char            line[128]; /* single line from file */
+    char            ips[64];   /* address from line */
+    unsigned char   ip[16];    /* converted address */
+    long            until;     /* end of ban from line */
+    unsigned long   lineno;    /* current line number */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if ((f = fopen(g_config.autoban_file, "r")) == NULL)
+    {
+        if (errno != ENOENT)
+            el_perror(ELW, "autoban: couldn't open %s", g_config.autoban_file);
+
+        return;
+    }
+
+    for (lineno = 1; fgets(line, sizeof(line), f) != NULL; ++lineno)
+    {
+        memset(ip, 0, sizeof(ip));
+
+        if (sscanf(line, "%63s %ld", ips, &until) != 2)
+        {
+            el_print(ELW, "autoban: malformed line %lu in %s",
+                    lineno, g_config.autoban_file);
+            continue;
+        }
+
+        if (inet_pton(AF_INET, ips, ip + 12) == 1)
+            ip[10] = ip[11] = 0xff;
+        else if (inet_pton(AF_INET6, ips, ip) != 1)
+        {
+            el_print(ELW, "autoban: malformed address %s in line %lu in %s",
+                    ips, lineno, g_config.autoban_file);
+            continue;
+        }
+
+        if ((time_t)until > now)
+            autoban_put(ip, (time_t)until);
+    }
+
+    fclose(f);
+    el_print(ELN, "autoban: loaded %lu bans from %s",
+            g_stats.autoban_active, g_config.autoban_file);
+}
+
+
+/* ==========================================================================
+                       __     __ _          ____
+        ____   __  __ / /_   / /(_)_____   / __/__  __ ____   _____ _____
+       / __ \ / / / // __ \ / // // ___/  / /_ / / / // __ \ / ___// ___/
+      / /_/ // /_/ // /_/ // // // /__   / __// /_/ // / / // /__ (__  )
+     / .___/ \__,_//_.___//_//_/ \___/  /_/   \__,_//_/ /_/ \___//____/
+    /_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Initializes autoban, and loads bans that still hold from autoban file,
+    when it's configured.
+
+    returns
+            0       success, or autoban is disabled
+           -1       couldn't allocate memory for table
+   ========================================================================== */
+
+
+int autoban_init
+(
+    time_t  now  /* current time */
+)
+{
+    tab = NULL;
+    nused = 0;
+    dirty = 0;
+    g_stats.autoban_active = 0;
+
+    if (autoban_enabled() == 0)
+        return 0;
+
+    if ((tab = calloc(AUTOBAN_SLOTS, sizeof(*tab))) == NULL)
+        return -1;
+
+    if (g_config.autoban_file[0] != '\0')
+        autoban_load(now);
+
+    el_print(ELN, "autoban enabled, %ld points bans for %ld seconds",
+            g_config.autoban_threshold, g_config.autoban_time);
+
+    return 0;
+}
+
+
+/* ==========================================================================
+    Saves bans and frees table
+   ========================================================================== */
+
+
+void autoban_destroy(void)
+{
+    if (tab == NULL)
+        return;
+
+    autoban_save();
+    free(tab);
+    tab = NULL;
+}
+
+
+/* ==========================================================================
+    Checks if autoban is configured
+
+    returns
+            1       autoban is enabled
+            0       autoban is disabled
+   ========================================================================== */
+
+
+int autoban_enabled(void)
+{
+    return g_config.autoban_threshold > 0;
+}
+
+
+/* ==========================================================================
+    Checks if address 'sa' is banned right now.
+
+    returns
+            1       address is banned
+            0       address is not banned
+   ========================================================================== */
+
+
+int autoban_is_banned
+(
+    const struct sockaddr  *sa,       /* address to check */
+    time_t                  now       /* current time */
+)
+{
+    struct autoban_entry   *e;        /* entry of address */
+    unsigned char           ip[16];   /* address converted to key */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (tab == NULL || autoban_key(sa, ip) != 0)
+        return 0;
+
+    e = autoban_find(ip);
+    if (e->used == 0 || e->until == 0)
+        return 0;
+
+    if (e->until <= now)
+    {
+        /* ban has just ended */
+
+        e->until = 0;
+        --g_stats.autoban_active;
+        dirty = 1;
+        return 0;
+    }
+
+    ++g_stats.autoban_rejects;
+    return 1;
+}
+
+
+/* ==========================================================================
+    Gives address 'sa' a point for misbehaving, and bans it, when it has
+    collected enough of them.
+
+    returns
+            1       address has just been banned
+            0       address is not banned (yet)
+   ========================================================================== */
+
+
+int autoban_offense
+(
+    const struct sockaddr  *sa,       /* address of offender */
+    time_t                  now       /* current time */
+)
+{
+    struct autoban_entry   *e;        /* entry of address */
+    unsigned char           ip[16];   /* address converted to key */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (tab == NULL || autoban_key(sa, ip) != 0)
+        return 0;
+
+    e = autoban_find(ip);
+    if (e->used == 0)
+    {
+        /* try to make some room first, sweep rebuilds table,
+         * so slot must be found again
+         */
+
+        if (nused >= AUTOBAN_SLOTS / 4 * 3)
+        {
+            autoban_sweep(now);
+            if (nused >= AUTOBAN_SLOTS / 4 * 3)
+            {
+                el_print(ELW, "autoban: table full, offense of %s ignored",
+                        autoban_ntop(ip));
+                return 0;
+            }
+
+            e = autoban_find(ip);
+        }
+
+        memcpy(e->ip, ip, 16);
+        e->used = 1;
+        e->score = 0.0;
+        e->scored = now;
+        e->until = 0;
+        ++nused;
+    }
+
+    if (e->until > now)
+        return 0;
+
+    autoban_leak(e, now);
+    e->score += 1.0;
+
+    if (e->score < g_config.autoban_threshold)
+        return 0;
+
+    if (e->until == 0)
+        ++g_stats.autoban_active;
+
+    e->until = now + g_config.autoban_time;
+    e->score = 0.0;
+    dirty = 1;
+    ++g_stats.autoban_bans;
+    el_print(ELN, "autoban: banning %s for %ld seconds",
+            autoban_ntop(ip), g_config.autoban_time);
+
+    return 1;
+}
+
+
+/* ==========================================================================
+    Forgets addresses that are not banned and have no points left, ends
+    bans that have expired, and saves bans when they changed. Table is
+    rebuilt from scratch, so there are no holes in probe sequences.
+   ========================================================================== */
+
+
+void autoban_sweep
+(
+    time_t                 now   /* current time */
+)
+{
+    struct autoban_entry  *old;  /* table before sweep */
+    struct autoban_entry  *e;    /* slot in new table */
+    unsigned               i;    /* current slot in old table */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (tab == NULL)
+        return;
+
+    if ((old = malloc(AUTOBAN_SLOTS * sizeof(*old))) == NULL)
+        return;
+
+    memcpy(old, tab, AUTOBAN_SLOTS * sizeof(*old));
+    memset(tab, 0, AUTOBAN_SLOTS * sizeof(*tab));
+    nused = 0;
+
+    for (i = 0; i != AUTOBAN_SLOTS; ++i)
+    {
+        if (old[i].used == 0)
+            continue;
+
+        if (old[i].until && old[i].until <= now)
+        {
+            old[i].until = 0;
+            --g_stats.autoban_active;
+            dirty = 1;
+        }
+
+        autoban_leak(&old[i], now);
+        if (old[i].until == 0 && old[i].score == 0.0)
+            continue;
+
+        e = autoban_find(old[i].ip);
+        *e = old[i];
+        ++nused;
+    }
+
+    free(old);
+    autoban_save();
+}
+
+
+/* ==========================================================================
+    Writes bans to autoban file, if they changed since last save. File is
+    replaced atomically, so crash never leaves half of bans.
+
+    returns
+            0       bans saved, or there was nothing to save
+           -1       error writing file
+   ========================================================================== */
+
+
+int autoban_save(void)
+{
+    FILE      *f;                 /* temporary file with bans */
+    char       tmp[PATH_MAX + 8]; /* path to temporary file */
+    unsigned   i;                 /* current slot */
+    int        e;                 /* error while writing */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (tab == NULL || dirty == 0 || g_config.autoban_file[0] == '\0')
+        return 0;
+
+    sprintf(tmp, "%s.tmp", g_config.autoban_file);
+    if ((f = fopen(tmp, "w")) == NULL)
+    {
+        el_perror(ELE, "autoban: couldn't create %s", tmp);
+        return -1;
+    }
+
+    for (i = 0; i != AUTOBAN_SLOTS; ++i)
+        if (tab[i].used && tab[i].until)
+            fprintf(f, "%s %ld\n", autoban_ntop(tab[i].ip),
+                    (long)tab[i].until);
+
+    e = fflush(f) != 0 || ferror(f);
+    if (fclose(f) != 0 || e)
+    {
+        el_perror(ELE, "autoban: couldn't write %s", tmp);
+        remove(tmp);
+        return -1;
+    }
+
+    if (rename(tmp, g_config.autoban_file) != 0)
+    {
+        el_perror(ELE, "autoban: couldn't rename %s", tmp);
+        remove(tmp);
+        return -1;
+    }
+
+    dirty = 0;
+    return 0;
+}
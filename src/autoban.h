@@ -0,0 +1,28 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef AUTOBAN_H
+#define AUTOBAN_H 1
+
+#include <sys/socket.h>
+#include <time.h>
+
+/* number of addresses that can have score or ban at the same time */
+
+#define AUTOBAN_SLOTS 16384
+
+/* score of address drops by one every that many seconds */
+
+#define AUTOBAN_DECAY 300
+
+int autoban_init(time_t now);
+void autoban_destroy(void);
+int autoban_enabled(void);
+int autoban_is_banned(const struct sockaddr *sa, time_t now);
+int autoban_offense(const struct sockaddr *sa, time_t now);
+void autoban_sweep(time_t now);
+int autoban_save(void);
+
+#endif
@@ -4,9 +4,10 @@
    ==========================================================================
          ------------------------------------------------------------
         / This module is responsible for loading black or white list \
-        | from file, parse it and convert to sorted array of         |
-        | in_addr_t. It also allows to check if given IP address is  |
-        \ allowed, depening on mode, to upload or not                /
+        | from file, parse it and convert IPs and CIDR prefixes into |
+        | sorted array of non-overlapping address ranges. It also    |
+        | allows to check if given IP address is allowed, depening   |
+        \ on mode, to upload or not                                  /
          ------------------------------------------------------------
               \                      ,+*^^*+___+++_
                \               ,*^^^^              )
@@ -45,393 +46,2330 @@
 #include <embedlog.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <string.h>
 
+#if HAVE_LINUX_FILTER_H
+    /* SO_ATTACH_FILTER is hidden by sys/socket.h in strict posix mode */
+#   include <asm/socket.h>
+#   include <linux/filter.h>
+#endif
+
+#if HAVE_LINUX_LIMITS_H
+#   include <linux/limits.h>
+#endif
+
 #include "bnwlist.h"
 #include "valid.h"
 
 
 /* ==========================================================================
-          __             __                     __   _
-     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
-    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
-   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
-   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
-
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* number of lookups that bnw_is_allowed_batch() runs side by side, so
+ * cache misses of one lookup overlap with others
+ */
+
+#define BNW_BATCH 8
+
+/* maximum number of lists that can be combined, one bit for each */
+
+#define BNW_MAX_LISTS 32
+
+/* lists with more ipv4 ranges than that are not compiled into kernel
+ * socket filter, kernel accepts at most 4096 instructions, and every
+ * range costs 3 of them and is checked for every SYN
+ */
+
+#define BNW_FILTER_MAX 1024
+
+/* max number of threads that can do lookups, see bnw_reader_add() */
+
+#define BNW_READERS_MAX 64
+
+/* list is published with release store and read with acquire load, so
+ * thread that sees new pointer also sees fully built list behind it.
+ * Without gcc atomics only single threaded use is safe.
+ */
+
+#if defined(__GNUC__)
+#   define BNW_PREFETCH(addr) __builtin_prefetch(addr)
+#   define BNW_LOAD(var) __atomic_load_n(&(var), __ATOMIC_ACQUIRE)
+#   define BNW_STORE(var, val) __atomic_store_n(&(var), (val), __ATOMIC_RELEASE)
+#   define BNW_INC(var) __atomic_add_fetch(&(var), 1, __ATOMIC_SEQ_CST)
+#   define BNW_TRYLOCK(flag) __atomic_test_and_set(&(flag), __ATOMIC_ACQUIRE)
+#   define BNW_UNLOCK(flag) __atomic_clear(&(flag), __ATOMIC_RELEASE)
+#else
+#   define BNW_PREFETCH(addr)
+#   define BNW_LOAD(var) (var)
+#   define BNW_STORE(var, val) ((var) = (val))
+#   define BNW_INC(var) (++(var))
+#   define BNW_TRYLOCK(flag) ((flag) ? 1 : ((flag) = 1, 0))
+#   define BNW_UNLOCK(flag) ((flag) = 0)
+#endif
+
+#define BNW_MAGIC    "TSIPLST"
+#define BNW_VERSION  2
+#define BNW_ENDIAN   0x01020304u
+
+/* header of precompiled list image (see termsend-listc), it is followed
+ * by range_lo and range_hi arrays in eytzinger order, and then by sorted
+ * range6_lo and range6_hi arrays, each aligned to 64 bytes from start of
+ * file, so they can be used straight from memory mapped file. Version 1
+ * images have no ipv6 ranges and nrange6 is 0 there.
+ */
+
+struct bnw_hdr
+{
+    char           magic[8];      /* BNW_MAGIC */
+    uint32_t       version;       /* BNW_VERSION */
+    uint32_t       endian;        /* BNW_ENDIAN, in byte order of writer */
+    uint32_t       nrange;        /* number of ranges */
+    uint32_t       checksum;      /* fnv-1a of all arrays */
+    uint32_t       nrange6;       /* number of ipv6 ranges */
+    unsigned char  reserved[36];  /* must be 0 */
+};
+
+typedef char bnw_hdr_size_check[sizeof(struct bnw_hdr) == 64 ? 1 : -1];
+
+struct bnw_prefix
+{
+    uint32_t  lo;      /* first address of prefix, host endianess */
+    uint32_t  hi;      /* last address of prefix, host endianess */
+    int       except;  /* prefix is excluded from list ('!' entry) */
+};
+
+/* ipv6 address as two host endian halves, so it can be compared and
+ * incremented as number
+ */
+
+struct bnw_ip6
+{
+    uint64_t  hi;  /* first 8 bytes of address */
+    uint64_t  lo;  /* last 8 bytes of address */
+};
+
+struct bnw_prefix6
+{
+    struct bnw_ip6  lo;      /* first address of prefix */
+    struct bnw_ip6  hi;      /* last address of prefix */
+    int             except;  /* prefix is excluded from list ('!' entry) */
+};
+
+/* start or end of listed range, used when lists are combined */
+
+struct bnw_edge
+{
+    uint64_t  addr;  /* first address of range, or one past its last */
+    uint32_t  flip;  /* bit of list this range belongs to */
+};
+
+struct bnw_edge6
+{
+    struct bnw_ip6  addr;  /* first address, or one past last of range */
+    int             top;   /* edge is one past last ipv6 address */
+    uint32_t        flip;  /* bit of list this range belongs to */
+};
+
+/* loaded list, it is never modified once published. Listed ipv4
+ * ranges are kept in eytzinger order (implicit binary tree, where
+ * children of node k are 2k and 2k + 1, root is at index 1, index 0 is
+ * unused), so first levels of search tree share few cache lines, and
+ * nodes of next levels can be prefetched before they are needed. ipv6
+ * lists are usually short, so ipv6 ranges are simply kept sorted.
+ */
+
+struct bnw_list
+{
+    uint32_t        *range_lo;   /* first addresses of listed ranges */
+    uint32_t        *range_hi;   /* last addresses of listed ranges */
+    size_t           num_range;  /* number of ranges in range_lo/hi */
+    unsigned         full_depth; /* number of completely filled tree levels */
+    struct bnw_ip6  *range6_lo;  /* first addresses of ipv6 ranges */
+    struct bnw_ip6  *range6_hi;  /* last addresses of ipv6 ranges */
+    size_t           num_range6; /* number of ranges in range6_lo/hi */
+    int              mode;       /* 0 - no filtering, -1 black, 1 white */
+    void            *image;      /* mapped list image, NULL when parsed */
+    size_t           image_len;  /* length of mapped image */
+    unsigned long    retired_at; /* grace period in which list was replaced */
+    struct bnw_list *retired_next; /* next replaced list waiting to be freed */
+};
+
+static struct bnw_list  *list;       /* current list, NULL - no filtering */
+static struct bnw_list  *retired;    /* replaced lists, not yet freed */
+static unsigned char     publishing; /* lock for list and retired */
+static unsigned long     gp;         /* current grace period */
+static unsigned long     readers[BNW_READERS_MAX]; /* grace period each
+                                      * reader saw at its last quiescent
+                                      * point */
+static int               nreaders;   /* number of registered readers */
+static const char       *list_path;  /* path to list, for reload */
+static const char       *list_spec;  /* combined lists, for reload */
+static int               list_mode;  /* configured mode, for reload */
+
+
+/* ==========================================================================
+                           _           ____
+             ____   _____ (_)_   __   / __/__  __ ____   _____ _____
+            / __ \ / ___// /| | / /  / /_ / / / // __ \ / ___// ___/
+           / /_/ // /   / / | |/ /  / __// /_/ // / / // /__ (__  )
+          / .___//_/   /_/  |___/  /_/   \__,_//_/ /_/ \___//____/
+         /_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    comparator for sorting prefixes. Prefixes are sorted by first address,
+    and when that is equal, wider prefix goes first, so every prefix comes
+    after all prefixes that contain it. Exception goes after listed prefix
+    of the same size, so it wins when both are in list.
+   ========================================================================== */
+
+
+static int bnw_prefix_comp
+(
+    const void               *a,  /* prefix a */
+    const void               *b   /* prefix b */
+)
+{
+    const struct bnw_prefix  *pa; /* prefix a */
+    const struct bnw_prefix  *pb; /* prefix b */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    pa = a;
+    pb = b;
+
+    if (pa->lo != pb->lo)
+        return pa->lo < pb->lo ? -1 : 1;
+
+    if (pa->hi != pb->hi)
+        return pa->hi > pb->hi ? -1 : 1;
+
+    return pa->except - pb->except;
+}
+
+
+/* ==========================================================================
+    Appends range lo-hi to ranges of list 'l', range touching previous
+    one is merged with it.
+   ========================================================================== */
+
+
+static void bnw_emit
+(
+    struct bnw_list  *l,   /* list to add range to */
+    uint32_t          lo,  /* first address of range */
+    uint32_t          hi   /* last address of range */
+)
+{
+    size_t            n;   /* number of ranges in list */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    n = l->num_range;
+
+    if (n && (uint64_t)l->range_hi[n - 1] + 1 == lo)
+    {
+        l->range_hi[n - 1] = hi;
+        return;
+    }
+
+    l->range_lo[n] = lo;
+    l->range_hi[n] = hi;
+    ++l->num_range;
+}
+
+
+/* ==========================================================================
+    Flattens sorted prefixes 'p' into sorted, non-overlapping ranges of
+    listed addresses, so that every address is covered by range only when
+    the longest prefix that contains it is not an exception.
+
+    CIDR prefixes are either disjoint or one contains the other, so single
+    pass with stack of currently open prefixes is enough. Address space
+    between prefixes belongs to the innermost open one.
+   ========================================================================== */
+
+
+static void bnw_flatten
+(
+    struct bnw_list    *l,      /* list to store ranges in */
+    struct bnw_prefix  *p,      /* sorted prefixes */
+    size_t              n,      /* number of prefixes in p */
+    struct bnw_prefix **stack   /* space for n prefixes */
+)
+{
+    size_t              i;      /* current prefix */
+    size_t              depth;  /* number of open prefixes on stack */
+    uint64_t            pos;    /* first address not yet assigned */
+    struct bnw_prefix  *top;    /* innermost open prefix */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    l->num_range = 0;
+    depth = 0;
+    pos = 0;
+
+    for (i = 0; i <= n; ++i)
+    {
+        /* close all prefixes that end before current one starts,
+         * at the end (i == n) close all of them
+         */
+
+        while (depth)
+        {
+            top = stack[depth - 1];
+            if (i != n && top->hi >= p[i].lo)
+                break;
+
+            if (pos <= top->hi && top->except == 0)
+                bnw_emit(l, (uint32_t)pos, top->hi);
+
+            pos = pos > top->hi ? pos : (uint64_t)top->hi + 1;
+            --depth;
+        }
+
+        if (i == n)
+            break;
+
+        /* space between enclosing prefix and start of current one */
+
+        if (depth && pos < p[i].lo && stack[depth - 1]->except == 0)
+            bnw_emit(l, (uint32_t)pos, p[i].lo - 1);
+
+        pos = p[i].lo;
+        stack[depth++] = &p[i];
+    }
+}
+
+
+/* ==========================================================================
+    Compares ipv6 addresses 'a' and 'b', returns -1, 0 or 1 when 'a' is
+    lower, equal or bigger than 'b'.
+   ========================================================================== */
+
+
+static int bnw_ip6_cmp
+(
+    const struct bnw_ip6  *a,  /* first address */
+    const struct bnw_ip6  *b   /* second address */
+)
+{
+    if (a->hi != b->hi)
+        return a->hi < b->hi ? -1 : 1;
+
+    return (a->lo > b->lo) - (a->lo < b->lo);
+}
+
+
+/* ==========================================================================
+    Adds 'd' (1 or -1) to ipv6 address 'a', wraps around on overflow
+   ========================================================================== */
+
+
+static struct bnw_ip6 bnw_ip6_add
+(
+    struct bnw_ip6  a,  /* address to add to */
+    int             d   /* 1 or -1 */
+)
+{
+    if (d > 0)
+        a.hi += ++a.lo == 0;
+    else
+        a.hi -= a.lo-- == 0;
+
+    return a;
+}
+
+
+/* ==========================================================================
+    Returns non-zero when 'a' is last ipv6 address (all ones)
+   ========================================================================== */
+
+
+static int bnw_ip6_is_max
+(
+    const struct bnw_ip6  *a  /* address to check */
+)
+{
+    return a->hi == ~(uint64_t)0 && a->lo == ~(uint64_t)0;
+}
+
+
+/* ==========================================================================
+    Converts ipv6 address in network byte order 'b' into bnw_ip6
+   ========================================================================== */
+
+
+static struct bnw_ip6 bnw_ip6_from
+(
+    const unsigned char  *b  /* 16 bytes of address */
+)
+{
+    struct bnw_ip6        a; /* converted address */
+    int                   i; /* current byte */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    a.hi = 0;
+    a.lo = 0;
+
+    for (i = 0; i != 8; ++i)
+    {
+        a.hi = a.hi << 8 | b[i];
+        a.lo = a.lo << 8 | b[i + 8];
+    }
+
+    return a;
+}
+
+
+/* ==========================================================================
+    Same as bnw_prefix_comp(), but for ipv6 prefixes
+   ========================================================================== */
+
+
+static int bnw_prefix6_comp
+(
+    const void                *a,  /* prefix a */
+    const void                *b   /* prefix b */
+)
+{
+    const struct bnw_prefix6  *pa; /* prefix a */
+    const struct bnw_prefix6  *pb; /* prefix b */
+    int                        c;  /* result of comparison */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    pa = a;
+    pb = b;
+
+    if ((c = bnw_ip6_cmp(&pa->lo, &pb->lo)) != 0)
+        return c;
+
+    if ((c = bnw_ip6_cmp(&pb->hi, &pa->hi)) != 0)
+        return c;
+
+    return pa->except - pb->except;
+}
+
+
+/* ==========================================================================
+    Same as bnw_emit(), but for ipv6 range
+   ========================================================================== */
+
+
+static void bnw_emit6
+(
+    struct bnw_list  *l,     /* list to add range to */
+    struct bnw_ip6    lo,    /* first address of range */
+    struct bnw_ip6    hi     /* last address of range */
+)
+{
+    size_t            n;     /* number of ranges in list */
+    struct bnw_ip6    next;  /* address right after previous range */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    n = l->num_range6;
+
+    if (n && !bnw_ip6_is_max(&l->range6_hi[n - 1]))
+    {
+        next = bnw_ip6_add(l->range6_hi[n - 1], 1);
+        if (bnw_ip6_cmp(&next, &lo) == 0)
+        {
+            l->range6_hi[n - 1] = hi;
+            return;
+        }
+    }
+
+    l->range6_lo[n] = lo;
+    l->range6_hi[n] = hi;
+    ++l->num_range6;
+}
+
+
+/* ==========================================================================
+    Same as bnw_flatten(), but for ipv6 prefixes. Address right after
+    last one does not fit in 128 bits, so 'end' marks that 'pos' went
+    past the end of address space.
+   ========================================================================== */
+
+
+static void bnw_flatten6
+(
+    struct bnw_list     *l,      /* list to store ranges in */
+    struct bnw_prefix6  *p,      /* sorted prefixes */
+    size_t               n,      /* number of prefixes in p */
+    struct bnw_prefix6 **stack   /* space for n prefixes */
+)
+{
+    size_t               i;      /* current prefix */
+    size_t               depth;  /* number of open prefixes on stack */
+    struct bnw_ip6       pos;    /* first address not yet assigned */
+    int                  end;    /* pos is past last address */
+    struct bnw_prefix6  *top;    /* innermost open prefix */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    l->num_range6 = 0;
+    depth = 0;
+    pos.hi = 0;
+    pos.lo = 0;
+    end = 0;
+
+    for (i = 0; i <= n; ++i)
+    {
+        while (depth)
+        {
+            top = stack[depth - 1];
+            if (i != n && bnw_ip6_cmp(&top->hi, &p[i].lo) >= 0)
+                break;
+
+            if (!end && bnw_ip6_cmp(&pos, &top->hi) <= 0)
+            {
+                if (top->except == 0)
+                    bnw_emit6(l, pos, top->hi);
+
+                end = bnw_ip6_is_max(&top->hi);
+                pos = bnw_ip6_add(top->hi, 1);
+            }
+
+            --depth;
+        }
+
+        if (i == n)
+            break;
+
+        if (depth && !end && bnw_ip6_cmp(&pos, &p[i].lo) < 0 &&
+                stack[depth - 1]->except == 0)
+            bnw_emit6(l, pos, bnw_ip6_add(p[i].lo, -1));
+
+        pos = p[i].lo;
+        end = 0;
+        stack[depth++] = &p[i];
+    }
+}
+
+
+/* ==========================================================================
+    Computes number of completely filled levels of tree of list 'l'
+   ========================================================================== */
+
+
+static void bnw_set_depth
+(
+    struct bnw_list  *l  /* list to compute depth of */
+)
+{
+    l->full_depth = 0;
+    while (((size_t)2 << l->full_depth) - 1 <= l->num_range)
+        ++l->full_depth;
+}
+
+
+/* ==========================================================================
+    Returns offset from start of list image, of range_hi array, for
+    image with 'n' ranges. Both arrays have n + 1 elements, since index 0
+    is unused.
+   ========================================================================== */
+
+
+static size_t bnw_image_hi
+(
+    size_t  n  /* number of ranges */
+)
+{
+    return sizeof(struct bnw_hdr) + ((n + 1) * sizeof(uint32_t) + 63) / 64 * 64;
+}
+
+
+/* ==========================================================================
+    Returns offset of range6_lo array in image with 'n' ipv4 ranges,
+    range6_hi follows it right away.
+   ========================================================================== */
+
+
+static size_t bnw_image_v6
+(
+    size_t  n  /* number of ipv4 ranges */
+)
+{
+    return (bnw_image_hi(n) + (n + 1) * sizeof(uint32_t) + 63) / 64 * 64;
+}
+
+
+/* ==========================================================================
+    Continues fnv-1a hash 'h' with 'len' bytes of 'data'
+   ========================================================================== */
+
+
+static uint32_t bnw_fnv
+(
+    uint32_t              h,     /* hash so far */
+    const void           *data,  /* data to hash */
+    size_t                len    /* length of data */
+)
+{
+    const unsigned char  *d;     /* data as bytes */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (d = data; len; --len)
+        h = (h ^ *d++) * 16777619u;
+
+    return h;
+}
+
+
+/* ==========================================================================
+    Uses list image 'f' of 'flen' bytes, mapped from list file, as list 'l'.
+    Arrays are used directly from mapping, so nothing is parsed nor
+    copied.
+
+    errno
+            EINVAL      image has incompatible format or wrong size
+            EFAULT      image is corrupted
+   ========================================================================== */
+
+
+static int bnw_load_image
+(
+    struct bnw_list       *l,      /* list to load image to */
+    void                  *f,      /* mapped image */
+    size_t                 flen    /* length of f */
+)
+{
+    struct bnw_hdr        *h;      /* image header */
+    size_t                 hi;     /* offset of range_hi in image */
+    size_t                 v6;     /* offset of range6_lo in image */
+    size_t                 asize;  /* size of single array */
+    size_t                 a6size; /* size of single ipv6 array */
+    size_t                 len;    /* expected length of image */
+    uint32_t               sum;    /* computed checksum */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    h = f;
+
+    /* version 1 images are the same, but without ipv6 ranges */
+
+    if ((h->version != BNW_VERSION && h->version != 1) ||
+            h->endian != BNW_ENDIAN || (h->version == 1 && h->nrange6))
+    {
+        el_print(ELF, "list image has unsupported version or byte order");
+        errno = EINVAL;
+        return -1;
+    }
+
+    hi = bnw_image_hi(h->nrange);
+    v6 = bnw_image_v6(h->nrange);
+    asize = ((size_t)h->nrange + 1) * sizeof(uint32_t);
+    a6size = (size_t)h->nrange6 * sizeof(struct bnw_ip6);
+    len = h->nrange6 ? v6 + 2 * a6size : hi + asize;
+
+    if (flen != len)
+    {
+        el_print(ELF, "list image has %lu bytes, expected %lu",
+                (unsigned long)flen, (unsigned long)len);
+        errno = EINVAL;
+        return -1;
+    }
+
+    sum = bnw_fnv(2166136261u, (char *)f + sizeof(*h), asize);
+    sum = bnw_fnv(sum, (char *)f + hi, asize);
+    if (h->nrange6)
+        sum = bnw_fnv(sum, (char *)f + v6, 2 * a6size);
+
+    if (sum != h->checksum)
+    {
+        el_print(ELF, "list image checksum mismatch, image is corrupted");
+        errno = EFAULT;
+        return -1;
+    }
+
+    l->image = f;
+    l->image_len = flen;
+    l->range_lo = (uint32_t *)((char *)f + sizeof(*h));
+    l->range_hi = (uint32_t *)((char *)f + hi);
+    l->num_range = h->nrange;
+    l->range6_lo = (struct bnw_ip6 *)((char *)f + v6);
+    l->range6_hi = l->range6_lo + h->nrange6;
+    l->num_range6 = h->nrange6;
+    bnw_set_depth(l);
+
+    el_print(ELN, "loaded precompiled list with %zu ipv4 and %zu ipv6 "
+        "ranges", l->num_range, l->num_range6);
+    return 0;
+}
+
+
+/* ==========================================================================
+    Copies sorted ranges 'lo' and 'hi' into eytzinger ordered 'elo' and
+    'ehi', in-order walk of implicit tree visits nodes in sorted order.
+
+    returns
+            index of next sorted range to copy
+   ========================================================================== */
+
+
+static size_t bnw_eytz_fill
+(
+    size_t           n,    /* number of ranges */
+    const uint32_t  *lo,   /* sorted first addresses */
+    const uint32_t  *hi,   /* sorted last addresses */
+    uint32_t        *elo,  /* eytzinger ordered first addresses */
+    uint32_t        *ehi,  /* eytzinger ordered last addresses */
+    size_t           i,    /* next sorted range to copy */
+    size_t           k     /* current node of tree */
+)
+{
+    if (k > n)
+        return i;
+
+    i = bnw_eytz_fill(n, lo, hi, elo, ehi, i, 2 * k);
+    elo[k] = lo[i];
+    ehi[k] = hi[i];
+    return bnw_eytz_fill(n, lo, hi, elo, ehi, i + 1, 2 * k + 1);
+}
+
+
+/* ==========================================================================
+    Rebuilds sorted ranges of list 'l' into eytzinger order.
+    Arrays are aligned to cache line, so each prefetch brings exactly 16
+    nodes of single subtree.
+
+    errno
+            ENOMEM      not enough memory for new arrays
+   ========================================================================== */
+
+
+static int bnw_layout
+(
+    struct bnw_list  *l     /* list to rebuild */
+)
+{
+    void             *elo;  /* eytzinger ordered first addresses */
+    void             *ehi;  /* eytzinger ordered last addresses */
+    size_t            n;    /* number of ranges */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    elo = NULL;
+    ehi = NULL;
+    n = l->num_range;
+
+    if (posix_memalign(&elo, 64, (n + 1) * sizeof(uint32_t)) != 0 ||
+        posix_memalign(&ehi, 64, (n + 1) * sizeof(uint32_t)) != 0)
+    {
+        free(elo);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    ((uint32_t *)elo)[0] = 0;
+    ((uint32_t *)ehi)[0] = 0;
+    bnw_eytz_fill(n, l->range_lo, l->range_hi, elo, ehi, 0, 1);
+
+    free(l->range_lo);
+    free(l->range_hi);
+    l->range_lo = elo;
+    l->range_hi = ehi;
+    bnw_set_depth(l);
+    return 0;
+}
+
+
+/* ==========================================================================
+    Parses single list entry 'ip' (address, or address with prefix length
+    after '/', optionally preceded by '!') into prefix 'p'. Host part of
+    address must be zero.
+
+    returns
+            0       entry parsed
+           -1       entry is malformed
+   ========================================================================== */
+
+
+static int bnw_parse_entry
+(
+    char               *ip,   /* null terminated entry */
+    struct bnw_prefix  *p     /* parsed prefix */
+)
+{
+    char               *len;  /* prefix length part of ip */
+    char               *end;  /* end of prefix length */
+    long                plen; /* parsed prefix length */
+    uint32_t            mask; /* network mask of prefix */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    p->except = ip[0] == '!';
+    ip += p->except;
+    plen = 32;
+
+    if ((len = strchr(ip, '/')) != NULL)
+    {
+        *len++ = '\0';
+        if (*len < '0' || *len > '9')
+            return -1;
+
+        plen = strtol(len, &end, 10);
+        if (*end != '\0' || plen > 32)
+            return -1;
+    }
+
+    /* some systems - like AIX - thinks that 10.1.1. ip is a
+     * valid IP address. Well, no, it's not, screw AIX.
+     */
+
+    if (ip[0] == '\0' || ip[strlen(ip) - 1] == '.')
+        return -1;
+
+    if (inet_pton(AF_INET, ip, &p->lo) != 1)
+        return -1;
+
+    p->lo = ntohl(p->lo);
+    mask = plen ? 0xffffffffu << (32 - plen) : 0;
+
+    if (p->lo & ~mask)
+        return -1;
+
+    p->hi = p->lo | ~mask;
+    return 0;
+}
+
+
+/* ==========================================================================
+    Same as bnw_parse_entry(), but for ipv6 entry ("2001:db8::1",
+    "2001:db8::/32" or "!2001:db8:1::/48")
+   ========================================================================== */
+
+
+static int bnw_parse_entry6
+(
+    char                *ip,    /* null terminated entry */
+    struct bnw_prefix6  *p      /* parsed prefix */
+)
+{
+    char                *len;   /* prefix length part of ip */
+    char                *end;   /* end of prefix length */
+    long                 plen;  /* parsed prefix length */
+    uint64_t             mhi;   /* network mask of first half */
+    uint64_t             mlo;   /* network mask of second half */
+    unsigned char        b[16]; /* address in network byte order */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    p->except = ip[0] == '!';
+    ip += p->except;
+    plen = 128;
+
+    if ((len = strchr(ip, '/')) != NULL)
+    {
+        *len++ = '\0';
+        if (*len < '0' || *len > '9')
+            return -1;
+
+        plen = strtol(len, &end, 10);
+        if (*end != '\0' || plen > 128)
+            return -1;
+    }
+
+    if (inet_pton(AF_INET6, ip, b) != 1)
+        return -1;
+
+    /* shift by whole width is undefined, so handle edges */
+
+    mhi = plen >= 64 ? ~(uint64_t)0 : plen ? ~(uint64_t)0 << (64 - plen) : 0;
+    mlo = plen >= 128 ? ~(uint64_t)0 :
+        plen > 64 ? ~(uint64_t)0 << (128 - plen) : 0;
+
+    p->lo = bnw_ip6_from(b);
+
+    if ((p->lo.hi & ~mhi) || (p->lo.lo & ~mlo))
+        return -1;
+
+    p->hi.hi = p->lo.hi | ~mhi;
+    p->hi.lo = p->lo.lo | ~mlo;
+    return 0;
+}
+
+
+/* ==========================================================================
+   function parses file with list and converts entries there from string
+   representation ("127.0.0.1", "10.0.0.0/8", "!10.1.2.0/24" or ipv6
+   "2001:db8::/32") to ranges of listed addresses, stored in heap
+   allocated memory of list 'l'. Ranges are sorted, caller rebuilds ipv4
+   ones with bnw_layout() before use. If sytax error is found in list
+   file, nothing is allocated and -1 is returned.
+
+    errno
+            ENOMEM      not enough memory to store all ranges
+            EFAULT      found entry which is not an ip address or prefix
+   ========================================================================== */
+
+
+static int bnw_parse_list
+(
+    struct bnw_list     *l,      /* list to store ranges in */
+    char                *f,      /* memory mapped list file */
+    off_t                flen    /* length of f buffer */
+)
+{
+    struct bnw_prefix   *p;      /* parsed prefixes */
+    struct bnw_prefix  **stack;  /* stack for bnw_flatten() */
+    struct bnw_prefix6  *p6;     /* parsed ipv6 prefixes */
+    struct bnw_prefix6 **stack6; /* stack for bnw_flatten6() */
+    size_t               n;      /* number of entries in file */
+    size_t               n6;     /* number of ipv6 entries in file */
+    size_t               line;   /* current line in file */
+    off_t                i;      /* helper iterator for loop */
+    int                  e;      /* errno cache */
+    int                  v6;     /* current line is ipv6 entry */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    /* first count number of lines so we can allocate enough
+     * memory, last line may not end with new line. Flattening
+     * can split each prefix into at most two ranges, plus one.
+     * Only ipv6 entries have ':', so count these lines too.
+     */
+
+    for (i = 0, n = 1, n6 = 0, v6 = 0; i != flen; ++i)
+    {
+        if (f[i] == ':' && v6 == 0)
+        {
+            v6 = 1;
+            ++n6;
+        }
+
+        v6 = f[i] == '\n' ? 0 : v6;
+        n += f[i] == '\n';
+    }
+
+    p = malloc(n * sizeof(*p));
+    stack = malloc(n * sizeof(*stack));
+    p6 = malloc((n6 + 1) * sizeof(*p6));
+    stack6 = malloc((n6 + 1) * sizeof(*stack6));
+    l->range_lo = malloc((2 * n + 1) * sizeof(*l->range_lo));
+    l->range_hi = malloc((2 * n + 1) * sizeof(*l->range_hi));
+    l->range6_lo = malloc((2 * n6 + 1) * sizeof(*l->range6_lo));
+    l->range6_hi = malloc((2 * n6 + 1) * sizeof(*l->range6_hi));
+
+    if (p == NULL || stack == NULL || p6 == NULL || stack6 == NULL ||
+            l->range_lo == NULL || l->range_hi == NULL ||
+            l->range6_lo == NULL || l->range6_hi == NULL)
+    {
+        el_print(ELF, "malloc error for list of %zu entries", n);
+        errno = ENOMEM;
+        goto error;
+    }
+
+    /* now we can parse file and convert string entries into
+     * prefixes
+     */
+
+    for (i = 0, n = 0, n6 = 0, line = 1; i < flen; ++i, ++line)
+    {
+        int   j;               /* iterator for loop */
+        char  ip[1 + INET6_ADDRSTRLEN + 4]; /* !ipv6/128 + null */
+        /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+        /* copy next entry into ip buffer */
+
+        for (j = 0; i != flen && f[i] != '\n'; ++j, ++i)
+        {
+            if (j == sizeof(ip) - 1)
+            {
+                el_print(ELF, "error parsing list file in line %zu", line);
+                errno = EFAULT;
+                goto error;
+            }
+
+            ip[j] = f[i];
+        }
+
+        if (j == 0)
+        {
+            /* this is empty line, ignore it and go to next line */
+
+            continue;
+        }
+
+        /* null terminate ip, '\n' in f will be skiped inside for
+         * loop
+         */
+
+        ip[j] = '\0';
+        el_print(ELD, "adding entry to list: %s", ip);
+
+        if (strchr(ip, ':') ? bnw_parse_entry6(ip, &p6[n6++]) != 0 :
+                bnw_parse_entry(ip, &p[n++]) != 0)
+        {
+            el_print(ELF, "malformed entry in list on line %zu", line);
+            errno = EFAULT;
+            goto error;
+        }
+    }
+
+    qsort(p, n, sizeof(*p), bnw_prefix_comp);
+    bnw_flatten(l, p, n, stack);
+    qsort(p6, n6, sizeof(*p6), bnw_prefix6_comp);
+    bnw_flatten6(l, p6, n6, stack6);
+    free(stack);
+    free(p);
+    free(stack6);
+    free(p6);
+
+    el_print(ELN, "%zu entries added to the list as %zu ipv4 and %zu ipv6 "
+        "ranges", n + n6, l->num_range, l->num_range6);
+
+    return 0;
+
+error:
+    e = errno;
+    free(p);
+    free(stack);
+    free(p6);
+    free(stack6);
+    free(l->range_lo);
+    free(l->range_hi);
+    free(l->range6_lo);
+    free(l->range6_hi);
+    l->range_lo = NULL;
+    l->range_hi = NULL;
+    l->range6_lo = NULL;
+    l->range6_hi = NULL;
+    errno = e;
+    return -1;
+}
+
+
+/* ==========================================================================
+    Frees list 'l' with all its ranges
+   ========================================================================== */
+
+
+static void bnw_free
+(
+    struct bnw_list  *l  /* list to free */
+)
+{
+    if (l == NULL)
+        return;
+
+    if (l->image)
+        munmap(l->image, l->image_len);
+    else
+    {
+        free(l->range_lo);
+        free(l->range_hi);
+        free(l->range6_lo);
+        free(l->range6_hi);
+    }
+
+    free(l);
+}
+
+
+/* ==========================================================================
+    Reads list file 'flist' into 'l'. Text list is parsed, and unless
+    'sorted' is set, its ranges are rebuilt into eytzinger order.
+    Precompiled image is used in place, only when 'sorted' is not set,
+    as its ranges are already in eytzinger order.
+
+    errno
+            ENOENT      flist does not exist, nothing is logged
+            EINVAL      flist is image, but sorted ranges were requested
+            EINVAL      image is broken
+            EFAULT      syntax error in list, or image checksum mismatch
+   ========================================================================== */
+
+
+static int bnw_read
+(
+    struct bnw_list  *l,      /* list to read ranges into */
+    const char       *flist,  /* path to file with IPs list to parse */
+    int               sorted  /* keep ranges sorted */
+)
+{
+    char             *f;      /* pointer to mmaped flist file */
+    int               fd;     /* opened flist file descriptor */
+    int               e;      /* errno cache */
+    struct stat       st;     /* information about flist file */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    el_print(ELN, "loading list file %s", flist);
+
+    if (stat(flist, &st) == -1)
+    {
+        if (errno == ENOENT)
+            return -1;
+
+        e = errno;
+        el_perror(ELF, "couldn't stat list file");
+        errno = e;
+        return -1;
+    }
+
+    if (st.st_size == 0)
+    {
+        el_print(ELW, "file %s is empty", flist);
+        return 0;
+    }
+
+    if ((fd = open(flist, O_RDONLY)) == -1)
+    {
+        e = errno;
+        el_perror(ELF, "couldn't open list file");
+        errno = e;
+        return -1;
+    }
+
+    f = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    e = errno;
+    close(fd);
+
+    if (f == MAP_FAILED)
+    {
+        errno = e;
+        el_perror(ELF, "couldn't mmap flist file");
+        errno = e;
+        return -1;
+    }
+
+    /* precompiled image is used in place, so mapping is
+     * kept until list is freed
+     */
+
+    if ((size_t)st.st_size >= sizeof(struct bnw_hdr) &&
+            memcmp(f, BNW_MAGIC, sizeof(BNW_MAGIC)) == 0)
+    {
+        if (sorted)
+        {
+            el_print(ELF, "precompiled list %s cannot be combined with "
+                "other lists, use text list", flist);
+            munmap(f, st.st_size);
+            errno = EINVAL;
+            return -1;
+        }
+
+        if (bnw_load_image(l, f, st.st_size) == -1)
+        {
+            e = errno;
+            munmap(f, st.st_size);
+            errno = e;
+            return -1;
+        }
+
+        return 0;
+    }
+
+    if (bnw_parse_list(l, f, st.st_size) == -1)
+    {
+        e = errno;
+        el_print(ELF, "parsing list failed");
+        munmap(f, st.st_size);
+        errno = e;
+        return -1;
+    }
+
+    munmap(f, st.st_size);
+
+    if (sorted)
+        return 0;
+
+    if (bnw_layout(l) != 0)
+    {
+        el_print(ELF, "malloc error for list of %zu ranges", l->num_range);
+        free(l->range_lo);
+        free(l->range_hi);
+        l->range_lo = NULL;
+        l->range_hi = NULL;
+        errno = ENOMEM;
+        return -1;
+    }
+
+    el_print(ELN, "list size in mem %zu bytes",
+        l->num_range * 2 * sizeof(uint32_t));
+
+    return 0;
+}
+
+
+/* ==========================================================================
+    Builds new list from file 'flist' in mode 'm'. List is built off to
+    the side and current list is not touched, so it can still be used
+    while new one is being built.
+
+    When 'missing_ok' is set, non-existing 'flist' is not an error, and
+    list with filtering turned off is returned.
+
+    returns
+            list    built list
+            NULL    error, errno is set
+   ========================================================================== */
+
+
+static struct bnw_list *bnw_build
+(
+    const char       *flist,      /* path to file with IPs list to parse */
+    int               m,          /* operation mode */
+    int               missing_ok  /* non-existing list is not an error */
+)
+{
+    struct bnw_list  *l;          /* new list */
+    int               e;          /* errno cache */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if ((l = calloc(1, sizeof(*l))) == NULL)
+        return NULL;
+
+    if ((l->mode = m) == 0)
+    {
+        el_print(ELN, "ip filtering is off");
+        return l;
+    }
+
+    if (bnw_read(l, flist, 0) == 0)
+        return l;
+
+    if (errno == ENOENT && missing_ok)
+    {
+        el_print(ELW, "file list doesn't exist, assuming no filter");
+        l->mode = 0;
+        return l;
+    }
+
+    if (errno == ENOENT)
+        el_print(ELF, "list file %s doesn't exist", flist);
+
+    e = errno;
+    free(l);
+    errno = e;
+    return NULL;
+}
+
+
+/* ==========================================================================
+    Compares two list boundaries by address, for qsort()
+   ========================================================================== */
+
+
+static int bnw_edge_comp
+(
+    const void             *a,  /* first edge */
+    const void             *b   /* second edge */
+)
+{
+    const struct bnw_edge  *e1 = a;
+    const struct bnw_edge  *e2 = b;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    return (e1->addr > e2->addr) - (e1->addr < e2->addr);
+}
+
+
+/* ==========================================================================
+    Compares two ipv6 list boundaries by address, for qsort()
+   ========================================================================== */
+
+
+static int bnw_edge6_comp
+(
+    const void              *a,  /* first edge */
+    const void              *b   /* second edge */
+)
+{
+    const struct bnw_edge6  *e1 = a;
+    const struct bnw_edge6  *e2 = b;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (e1->top != e2->top)
+        return e1->top - e2->top;
+
+    return bnw_ip6_cmp(&e1->addr, &e2->addr);
+}
+
+
+/* ==========================================================================
+    ipv6 part of bnw_combine(), 'def' is default action of table.
+
+    errno
+            ENOMEM      not enough memory for table
+   ========================================================================== */
+
+
+static int bnw_combine6
+(
+    struct bnw_list    *l,       /* list to store combined table in */
+    struct bnw_list   **src,     /* sorted ranges of lists, by precedence */
+    const int          *allow,   /* action of each list, 1 allow 0 deny */
+    int                 n,       /* number of lists */
+    int                 def      /* default action */
+)
+{
+    struct bnw_edge6   *edges;   /* starts and ends of all ranges */
+    struct bnw_edge6    pos;     /* start of current segment */
+    size_t              nedges;  /* number of edges */
+    size_t              i;       /* current edge */
+    size_t              r;       /* current range of list */
+    int                 j;       /* current list */
+    uint32_t            active;  /* bit j set - inside range of list j */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (j = 0, nedges = 0; j != n; ++j)
+        nedges += 2 * src[j]->num_range6;
+
+    edges = malloc((nedges + 1) * sizeof(*edges));
+    l->range6_lo = malloc((nedges + 1) * sizeof(*l->range6_lo));
+    l->range6_hi = malloc((nedges + 1) * sizeof(*l->range6_hi));
+
+    if (edges == NULL || l->range6_lo == NULL || l->range6_hi == NULL)
+    {
+        free(edges);
+        free(l->range6_lo);
+        free(l->range6_hi);
+        l->range6_lo = NULL;
+        l->range6_hi = NULL;
+        errno = ENOMEM;
+        return -1;
+    }
+
+    /* one past last address does not fit in 128 bits, 'top'
+     * marks such edge
+     */
+
+    for (j = 0, i = 0; j != n; ++j)
+        for (r = 0; r != src[j]->num_range6; ++r)
+        {
+            edges[i].addr = src[j]->range6_lo[r];
+            edges[i].top = 0;
+            edges[i++].flip = (uint32_t)1 << j;
+            edges[i].addr = bnw_ip6_add(src[j]->range6_hi[r], 1);
+            edges[i].top = bnw_ip6_is_max(&src[j]->range6_hi[r]);
+            edges[i++].flip = (uint32_t)1 << j;
+        }
+
+    qsort(edges, nedges, sizeof(*edges), bnw_edge6_comp);
+    l->num_range6 = 0;
+    active = 0;
+    memset(&pos, 0, sizeof(pos));
+
+    for (i = 0; i != nedges;)
+    {
+        if (bnw_edge6_comp(&edges[i], &pos) != 0 && active)
+        {
+            for (j = 0; (active >> j & 1) == 0;)
+                ++j;
+
+            if (allow[j] != def)
+                bnw_emit6(l, pos.addr, bnw_ip6_add(edges[i].addr, -1));
+        }
+
+        pos = edges[i];
+        for (; i != nedges && bnw_edge6_comp(&edges[i], &pos) == 0; ++i)
+            active ^= edges[i].flip;
+    }
+
+    free(edges);
+    return 0;
+}
+
+
+/* ==========================================================================
+    Combines sorted ranges of 'n' lists 'src' into one decision table
+    stored in 'l'. Every address gets action of first list that has it,
+    and addresses that are not on any list get default action. Only
+    ranges with action other than default are stored, so combined table
+    is ordinary black or white list and lookup does not change:
+
+        - when there is any allow list, default is deny, and table is
+          white list of allowed addresses
+        - otherwise default is allow, and table is black list
+
+    errno
+            ENOMEM      not enough memory for table
+   ========================================================================== */
+
+
+static int bnw_combine
+(
+    struct bnw_list    *l,       /* list to store combined table in */
+    struct bnw_list   **src,     /* sorted ranges of lists, by precedence */
+    const int          *allow,   /* action of each list, 1 allow 0 deny */
+    int                 n        /* number of lists */
+)
+{
+    struct bnw_edge    *edges;   /* starts and ends of all ranges */
+    size_t              nedges;  /* number of edges */
+    size_t              i;       /* current edge */
+    size_t              r;       /* current range of list */
+    int                 j;       /* current list */
+    int                 def;     /* default action */
+    int                 act;     /* action of current segment */
+    uint32_t            active;  /* bit j set - inside range of list j */
+    uint64_t            pos;     /* start of current segment */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (j = 0, nedges = 0, def = 1; j != n; ++j)
+    {
+        nedges += 2 * src[j]->num_range;
+        def = allow[j] ? 0 : def;
+    }
+
+    /* every edge can start new segment, so this is enough */
+
+    edges = malloc((nedges + 1) * sizeof(*edges));
+    l->range_lo = malloc((nedges + 1) * sizeof(*l->range_lo));
+    l->range_hi = malloc((nedges + 1) * sizeof(*l->range_hi));
+
+    if (edges == NULL || l->range_lo == NULL || l->range_hi == NULL)
+    {
+        free(edges);
+        free(l->range_lo);
+        free(l->range_hi);
+        l->range_lo = NULL;
+        l->range_hi = NULL;
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (j = 0, i = 0; j != n; ++j)
+        for (r = 0; r != src[j]->num_range; ++r)
+        {
+            edges[i].addr = src[j]->range_lo[r];
+            edges[i++].flip = (uint32_t)1 << j;
+            edges[i].addr = (uint64_t)src[j]->range_hi[r] + 1;
+            edges[i++].flip = (uint32_t)1 << j;
+        }
+
+    /* ranges within one list never overlap nor touch, so every
+     * edge of one list flips its bit, sweep through address
+     * space and store segments whose action is not default
+     */
+
+    qsort(edges, nedges, sizeof(*edges), bnw_edge_comp);
+    l->mode = def ? -1 : 1;
+    l->num_range = 0;
+    active = 0;
+    pos = 0;
+
+    for (i = 0; i != nedges;)
+    {
+        if (edges[i].addr != pos && active)
+        {
+            /* lowest bit is list with highest precedence */
+
+            for (j = 0; (active >> j & 1) == 0;)
+                ++j;
+
+            act = allow[j];
+
+            if (act != def)
+                bnw_emit(l, (uint32_t)pos, (uint32_t)(edges[i].addr - 1));
+        }
+
+        pos = edges[i].addr;
+        for (; i != nedges && edges[i].addr == pos; ++i)
+            active ^= edges[i].flip;
+    }
+
+    free(edges);
+
+    if (bnw_combine6(l, src, allow, n, def) != 0)
+    {
+        free(l->range_lo);
+        free(l->range_hi);
+        l->range_lo = NULL;
+        l->range_hi = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* ==========================================================================
+    Builds decision table from lists in 'spec', which is comma separated
+    list of "allow:<path>" and "deny:<path>" entries, first entry has
+    highest precedence. Paths must be absolute, as lists are read again
+    on reload, when server is already in output directory.
+
+    returns
+            list    built list
+            NULL    error, errno is set
+
+    errno
+            EINVAL      malformed spec or relative path
+            E2BIG       more than BNW_MAX_LISTS lists
+   ========================================================================== */
+
+
+static struct bnw_list *bnw_build_lists
+(
+    const char       *spec                   /* lists and their actions */
+)
+{
+    struct bnw_list  *l;                     /* new list */
+    struct bnw_list  *src[BNW_MAX_LISTS];    /* lists to combine */
+    int               allow[BNW_MAX_LISTS];  /* action of each list */
+    char             *buf;                   /* copy of spec for strtok */
+    char             *entry;                 /* current entry of spec */
+    char             *path;                  /* path of current entry */
+    int               n;                     /* number of lists */
+    int               e;                     /* errno cache */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    n = 0;
+    l = NULL;
+
+    if ((buf = malloc(strlen(spec) + 1)) == NULL)
+        return NULL;
+
+    strcpy(buf, spec);
+
+    for (entry = strtok(buf, ","); entry; entry = strtok(NULL, ","))
+    {
+        if (n == BNW_MAX_LISTS)
+        {
+            el_print(ELF, "too many lists, max is %d", BNW_MAX_LISTS);
+            errno = E2BIG;
+            goto error;
+        }
+
+        if (strncmp(entry, "allow:", 6) == 0)
+        {
+            allow[n] = 1;
+            path = entry + 6;
+        }
+        else if (strncmp(entry, "deny:", 5) == 0)
+        {
+            allow[n] = 0;
+            path = entry + 5;
+        }
+        else
+        {
+            el_print(ELF, "list entry %s is not allow:<path> "
+                "nor deny:<path>", entry);
+            errno = EINVAL;
+            goto error;
+        }
+
+        if (path[0] != '/')
+        {
+            el_print(ELF, "list path %s must be absolute", path);
+            errno = EINVAL;
+            goto error;
+        }
+
+        if ((src[n] = calloc(1, sizeof(*src[n]))) == NULL)
+            goto error;
+
+        ++n;
+
+        if (bnw_read(src[n - 1], path, 1) != 0)
+        {
+            if (errno == ENOENT)
+                el_print(ELF, "list file %s doesn't exist", path);
+
+            goto error;
+        }
+    }
+
+    if (n == 0)
+    {
+        el_print(ELF, "no lists in %s", spec);
+        errno = EINVAL;
+        goto error;
+    }
+
+    if ((l = calloc(1, sizeof(*l))) == NULL)
+        goto error;
+
+    if (bnw_combine(l, src, allow, n) != 0 || bnw_layout(l) != 0)
+    {
+        el_print(ELF, "malloc error for combined list");
+        errno = ENOMEM;
+        goto error;
+    }
+
+    el_print(ELN, "%d lists combined into %zu ipv4 and %zu ipv6 ranges of "
+        "%s addresses", n, l->num_range, l->num_range6,
+        l->mode == 1 ? "allowed" : "denied");
+
+    while (n--)
+        bnw_free(src[n]);
+
+    free(buf);
+    return l;
+
+error:
+    e = errno;
+    while (n--)
+        bnw_free(src[n]);
+
+    bnw_free(l);
+    free(buf);
+    errno = e;
+    return NULL;
+}
+
+
+/* ==========================================================================
+    Frees replaced lists that no reader can still be walking, that is
+    lists replaced before grace period, which every registered reader
+    has already seen at its quiescent point. With no registered readers,
+    all replaced lists are freed. Must be called with 'publishing' lock
+    held.
+   ========================================================================== */
+
+
+static void bnw_reclaim(void)
+{
+    struct bnw_list  **pp;   /* link to current replaced list */
+    struct bnw_list   *l;    /* current replaced list */
+    unsigned long      min;  /* oldest grace period seen by readers */
+    unsigned long      seen; /* grace period seen by reader */
+    int                n;    /* number of registered readers */
+    int                i;    /* current reader */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    n = BNW_LOAD(nreaders);
+    n = n > BNW_READERS_MAX ? BNW_READERS_MAX : n;
+    min = BNW_LOAD(gp);
+
+    for (i = 0; i != n; ++i)
+        if ((seen = BNW_LOAD(readers[i])) < min)
+            min = seen;
+
+    for (pp = &retired; (l = *pp) != NULL;)
+    {
+        if (l->retired_at > min)
+        {
+            /* some reader did not pass quiescent point since
+             * list was replaced, it may still be looking at it
+             */
+
+            pp = &l->retired_next;
+            continue;
+        }
+
+        *pp = l->retired_next;
+        bnw_free(l);
+    }
+}
+
+
+/* ==========================================================================
+    Makes 'l' current list. Previous list is not freed right away, as
+    lookup that started before swap may still be walking it. It starts
+    new grace period, and is freed once every reader passes quiescent
+    point in it, see bnw_quiescent().
+   ========================================================================== */
+
+
+static void bnw_publish
+(
+    struct bnw_list  *l    /* list to make current */
+)
+{
+    struct bnw_list  *old; /* replaced list */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    /* concurrent reloads are serialized here, lists are built
+     * outside of the lock, so it's held only for a moment
+     */
+
+    while (BNW_TRYLOCK(publishing))
+        ;
+
+    old = list;
+    BNW_STORE(list, l);
+
+    if (old)
+    {
+        /* grace period is bumped after new list is stored,
+         * so reader that sees new grace period, will also see
+         * new list from now on
+         */
+
+        old->retired_at = BNW_INC(gp);
+        old->retired_next = retired;
+        retired = old;
+    }
+
+    bnw_reclaim();
+    BNW_UNLOCK(publishing);
+}
+
+
+/* ==========================================================================
+                       __     __ _          ____
+        ____   __  __ / /_   / /(_)_____   / __/__  __ ____   _____ _____
+       / __ \ / / / // __ \ / // // ___/  / /_ / / / // __ \ / ___// ___/
+      / /_/ // /_/ // /_/ // // // /__   / __// /_/ // / / // /__ (__  )
+     / .___/ \__,_//_.___//_//_/ \___/  /_/   \__,_//_/ /_/ \___//____/
+    /_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    initializes all private data in this module. It allocates memory for
+    IP list from file, and loads it as current list. If mode is set to 0
+    (no filtering) no ranges are allocated. Path is remembered, so list
+    can later be reloaded with bnw_reload().
    ========================================================================== */
 
 
-static in_addr_t  *ip_list;  /* list containing IPs in host endianess */
-static size_t      num_ip;   /* number of ips in ip_list */
-static int         mode;     /* operation mode, 0 - none, -1 black, 1 white */
+int bnw_init
+(
+    const char       *flist,  /* path to file with IPs list to parse */
+    int               m       /* operation mode */
+)
+{
+    struct bnw_list  *l;      /* new list */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    VALID(EINVAL, m == 0 || flist);
 
+    if ((l = bnw_build(flist, m, 1)) == NULL)
+        return -1;
 
-/* ==========================================================================
-                           _           ____
-             ____   _____ (_)_   __   / __/__  __ ____   _____ _____
-            / __ \ / ___// /| | / /  / /_ / / / // __ \ / ___// ___/
-           / /_/ // /   / / | |/ /  / __// /_/ // / / // /__ (__  )
-          / .___//_/   /_/  |___/  /_/   \__,_//_/ /_/ \___//____/
-         /_/
-   ========================================================================== */
+    list_path = flist;
+    list_spec = NULL;
+    list_mode = m;
+    bnw_publish(l);
+    return 0;
+}
 
 
 /* ==========================================================================
-    comparator for sorting ip list
+    Same as bnw_init(), but combines multiple allow and deny lists from
+    'spec' (like "deny:/etc/termsend/ban,allow:/etc/termsend/corp") into
+    one table, so lookup costs the same as with single list. For lists
+    that overlap, first one in 'spec' decides. Addresses that are not
+    on any list are denied when there is at least one allow list, and
+    allowed otherwise.
+
+    returns
+            0       lists loaded
+           -1       error, errno is set
    ========================================================================== */
 
 
-static int bnw_ip_comp
+int bnw_init_lists
 (
-    const void       *a,    /* ip a */
-    const void       *b     /* ip b */
+    const char       *spec  /* lists and their actions */
 )
 {
-    const in_addr_t  *ipa;  /* ip a */
-    const in_addr_t  *ipb;  /* ip b */
+    struct bnw_list  *l;    /* new list */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    VALID(EINVAL, spec);
+
+    if ((l = bnw_build_lists(spec)) == NULL)
+        return -1;
+
+    list_path = NULL;
+    list_spec = spec;
+    list_mode = l->mode;
+    bnw_publish(l);
+    return 0;
+}
+
+
+/* ==========================================================================
+    Reads list again from file passed to bnw_init() (or lists passed to
+    bnw_init_lists()) and swaps it with current list. New list is fully
+    built before it replaces current one, so when anything goes wrong
+    (like syntax error in list, or list file being deleted) old list
+    stays in use.
+
+    Old list is freed only after every reader registered with
+    bnw_reader_add() passed quiescent point, so this can be called from
+    any thread, also concurrently with itself, but not from signal
+    handler.
+
+    returns
+            0       list reloaded
+           -1       error, old list is still used, errno is set
+   ========================================================================== */
+
+
+int bnw_reload(void)
+{
+    struct bnw_list  *l;  /* new list */
     /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 
 
-    ipa = a;
-    ipb = b;
+    if (list_spec)
+    {
+        if ((l = bnw_build_lists(list_spec)) == NULL)
+        {
+            el_print(ELE, "reloading lists failed, old list is still used");
+            return -1;
+        }
+
+        bnw_publish(l);
+        el_print(ELN, "lists reloaded");
+        return 0;
+    }
 
-    if (*ipa == *ipb)
+    if (list_mode == 0)
     {
+        el_print(ELN, "ip filtering is off, nothing to reload");
         return 0;
     }
 
-    if (*ipa < *ipb)
+    /* server changes working directory after list is loaded
+     * for the first time, so relative path now points to
+     * something else
+     */
+
+    if (list_path[0] != '/')
+    {
+        el_print(ELE, "list path %s is not absolute, cannot reload",
+            list_path);
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ((l = bnw_build(list_path, list_mode, 0)) == NULL)
     {
+        el_print(ELE, "reloading list failed, old list is still used");
         return -1;
     }
 
-    return 1;
+    bnw_publish(l);
+    el_print(ELN, "list reloaded");
+    return 0;
 }
 
 
 /* ==========================================================================
-   function parses file with list and converts IPs there from string
-   representation ("127.0.0.1") to in_addr_t type (uint32_t). Parsed IPs are
-   stored in heap allocated memory 'ip_list'. If sytax error is found in
-   list file, nothing is allocated and -1 is returned.
+    determines wheter ip should be allowed to upload to server or not.
 
-    errno
-            ENOMEM      not enough memory to store all ips
-            EFAULT      found entry which is not an ip address
+    Search goes down the eytzinger tree without branching on comparison
+    result, remembering last node which starts at or before ip. ip is
+    listed when that range also ends at or after ip.
    ========================================================================== */
 
 
-static int bnw_parse_list
+int bnw_is_allowed
 (
-    char  *f,    /* memory mapped list file */
-    off_t  flen  /* length of f buffer */
+    in_addr_t               ip      /* ip address to check, network endianess */
 )
 {
-    size_t  n;   /* number of entries in file */
-    int     i;   /* helper iterator for loop */
-    int     e;   /* errno cache */
+    const struct bnw_list  *l;      /* current list */
+    size_t                  k;      /* current node of tree */
+    size_t                  last;   /* last range that starts at or before ip */
+    uint32_t                h;      /* ip in host endianess */
+    int                     le;     /* node starts at or before ip */
+    int                     listed; /* ip is covered by list */
     /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 
 
-    /* first count number of entries so we can allocate enough
-     * memory
+    /* list is read once, so whole lookup uses the same list,
+     * even if it is swapped in the meantime
      */
 
-    for (i = 0, n = 0; i != flen; ++i)
-    {
-        if (f[i] == '\n')
-        {
-            /* new line encoutered assuming it's an ip */
+    l = BNW_LOAD(list);
 
-            ++n;
+    if (l == NULL || l->mode == 0)
+    {
+        /* filtering is off, ip is always allowed */
 
-            if (i == 0)
-            {
-                /* but wait! new line at the very first character?
-                 * empty line that is!
-                 */
+        return 1;
+    }
 
-                --n;
-                continue;
-            }
+    h = ntohl(ip);
+    last = 0;
 
-            if (f[i - 1] == '\n')
-            {
-                /* this character is a newline and previous one was
-                 * new line too? double new lines means this is an
-                 * empty line
-                 */
+    for (k = 1; k <= l->num_range; k = 2 * k + le)
+    {
+        /* 16 nodes in one cache line, so this is node of
+         * fourth level below current one
+         */
 
-                --n;
-            }
-        }
+        BNW_PREFETCH(l->range_lo + 16 * k);
+        le = l->range_lo[k] <= h;
+        last = le ? k : last;
     }
 
-    if ((ip_list = malloc(n * sizeof(in_addr_t))) == NULL)
-    {
-        e = errno;
-        el_print(ELF, "malloc error %d bytes for list", n * sizeof(in_addr_t));
-        errno = e;
-        return -1;
-    }
+    listed = last != 0 && l->range_hi[last] >= h;
 
-    /* no we can parse file and convert string IPs into small
-     * in_addr_t
+    /* in white list mode only listed ips are allowed, in black
+     * list mode listed ips are not allowed
      */
 
-    for (i = 0, n = 0; i != flen; ++i)
-    {
-        int   j;           /* iterator for loop */
-        char  ip[15 + 1];  /* 123.123.123.123 => 3 * 4 + 3 + null */
-        /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
-
+    return l->mode == 1 ? listed : !listed;
+}
 
-        /* copy next address into ip buffer */
 
-        for (j = 0; f[i] != '\n'; ++j, ++i)
-        {
-            if (j == 15)
-            {
-                el_print(ELF, "error parsing list file in line %d", n + 1);
-                goto parse_error;
-            }
+/* ==========================================================================
+    Same as bnw_is_allowed(), but for 'n' ips at once. Lookups of
+    BNW_BATCH ips go down the tree side by side, so memory latency of
+    one is hidden behind others. Result for ips[i] is stored in
+    allowed[i].
+   ========================================================================== */
 
-            ip[j] = f[i];
-        }
 
-        if (j == 0)
-        {
-            /* this is empty line, ignore it and go to next line */
+void bnw_is_allowed_batch
+(
+    const in_addr_t        *ips,             /* ip addresses to check */
+    int                    *allowed,         /* result for each ip */
+    size_t                  n                /* number of ips */
+)
+{
+    const struct bnw_list  *l;               /* current list */
+    size_t                  k[BNW_BATCH];    /* current node of each lookup */
+    size_t                  last[BNW_BATCH]; /* last range at or before ip */
+    uint32_t                h[BNW_BATCH];    /* ips in host endianess */
+    size_t                  b;               /* first ip of current batch */
+    size_t                  j;               /* current lookup in batch */
+    unsigned                d;               /* current level of tree */
+    size_t                  le;              /* node starts at or before ip */
+    int                     listed;          /* ip is covered by list */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 
-            continue;
-        }
 
-        /* some systems - like AIX - thinks that 10.1.1. ip is a
-         * valid IP address. Well, no, it's not, screw AIX.
-         */
+    l = BNW_LOAD(list);
 
-        if (ip[j - 1] == '.')
+    for (b = 0; l && l->mode != 0 && n - b >= BNW_BATCH; b += BNW_BATCH)
+    {
+        for (j = 0; j != BNW_BATCH; ++j)
         {
-            el_print(ELF, "error parsing list file in line %d", n + 1);
-            goto parse_error;
+            h[j] = ntohl(ips[b + j]);
+            k[j] = 1;
+            last[j] = 0;
         }
 
-        /* null terminate ip, and convert string to in_addr_t. '\n'
-         * in f will be skiped inside for loop
+        /* completely filled levels are walked by all lookups in
+         * lockstep, with fixed number of iterations, so compiler
+         * can unroll inner loop. Mask instead of ternary makes
+         * sure there is no branch on comparison result.
          */
 
-        ip[j] = '\0';
-
-        if ((ip_list[n] = ntohl(inet_addr(ip))) == INADDR_NONE)
+        for (d = 0; d != l->full_depth; ++d)
         {
-            el_print(ELF, "malformed ip (%s) in list on line %d", ip, n + 1);
-            goto parse_error;
+            for (j = 0; j != BNW_BATCH; ++j)
+            {
+                BNW_PREFETCH(l->range_lo + 16 * k[j]);
+                le = l->range_lo[k[j]] <= h[j];
+                last[j] ^= (last[j] ^ k[j]) & -le;
+                k[j] = 2 * k[j] + le;
+            }
         }
 
-        ++n;
-        el_print(ELD, "adding ip to list: %s", ip);
-    }
+        /* last level may be only partially filled */
 
-    /* sort IPs for faster search */
+        for (j = 0; j != BNW_BATCH; ++j)
+        {
+            if (k[j] <= l->num_range && l->range_lo[k[j]] <= h[j])
+                last[j] = k[j];
 
-    num_ip = n;
-    qsort(ip_list, n, sizeof(in_addr_t), bnw_ip_comp);
-    el_print(ELN, "%d IPs added to the list, list size in mem %zu bytes",
-        n, n * sizeof(in_addr_t));
+            listed = last[j] != 0 && l->range_hi[last[j]] >= h[j];
+            allowed[b + j] = l->mode == 1 ? listed : !listed;
+        }
+    }
 
-    return 0;
+    /* whatever is left, or everything when filtering is off,
+     * tail is looked up in current list, but it will only be
+     * different after reload, which happens between batches
+     */
 
-parse_error:
-    free(ip_list);
-    ip_list = NULL;
-    errno = EFAULT;
-    return -1;
+    for (; b != n; ++b)
+        allowed[b] = bnw_is_allowed(ips[b]);
 }
 
 
 /* ==========================================================================
-                       __     __ _          ____
-        ____   __  __ / /_   / /(_)_____   / __/__  __ ____   _____ _____
-       / __ \ / / / // __ \ / // // ___/  / /_ / / / // __ \ / ___// ___/
-      / /_/ // /_/ // /_/ // // // /__   / __// /_/ // / / // /__ (__  )
-     / .___/ \__,_//_.___//_//_/ \___/  /_/   \__,_//_/ /_/ \___//____/
-    /_/
+    Same as bnw_is_allowed(), but for ipv6 address. ipv6 ranges are
+    sorted, so this is ordinary binary search.
    ========================================================================== */
 
 
+int bnw_is_allowed6
+(
+    const struct in6_addr  *ip      /* ip address to check */
+)
+{
+    const struct bnw_list  *l;      /* current list */
+    struct bnw_ip6          h;      /* ip as number */
+    size_t                  lo;     /* first range not known to be before */
+    size_t                  hi;     /* first range known to start after ip */
+    size_t                  mid;    /* range in the middle */
+    int                     listed; /* ip is covered by list */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    l = BNW_LOAD(list);
+
+    if (l == NULL || l->mode == 0)
+        return 1;
+
+    h = bnw_ip6_from(ip->s6_addr);
+
+    for (lo = 0, hi = l->num_range6; lo != hi;)
+    {
+        mid = lo + (hi - lo) / 2;
+
+        if (bnw_ip6_cmp(&l->range6_lo[mid], &h) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    /* lo is now first range that starts after ip, so the one
+     * before it is the only one that can contain ip
+     */
+
+    listed = lo != 0 && bnw_ip6_cmp(&l->range6_hi[lo - 1], &h) >= 0;
+    return l->mode == 1 ? listed : !listed;
+}
+
+
 /* ==========================================================================
-    initializes all private data in this module. It allocates memory for
-    IP list from file, and loads list to private ip_list variable. If mode
-    is set to 0 (no filtering) no data is allocated.
+    Compiles ipv4 ranges of current list into classic BPF program and
+    attaches it to listening socket 'fd', so SYNs from addresses that are
+    not allowed are dropped by kernel, before any connection is made.
+    Only SYNs are checked, other packets, and ipv6 packets, are passed
+    untouched, so bnw_is_allowed() still has the final word. When list is
+    too big, or filtering is off, filter attached earlier is removed,
+    so kernel never uses stale list.
+
+    returns
+            0       filter attached
+           -1       filter not attached, errno is set
+
+    errno
+            ENOSYS  system has no socket filters
+            E2BIG   list has more than BNW_FILTER_MAX ipv4 ranges
+            ENOENT  filtering is disabled
    ========================================================================== */
 
 
-int bnw_init
+int bnw_filter_attach
 (
-    const char  *flist,  /* path to file with IPs list to parse */
-    int          m       /* operation mode */
+    int                     fd     /* listening socket to attach filter to */
 )
 {
-    char        *f;      /* pointer to mmaped flist file */
-    int          fd;     /* opened flist file descriptor */
-    int          e;      /* errno cache */
-    struct stat  st;     /* information about flist file */
+#if HAVE_LINUX_FILTER_H
+    const struct bnw_list  *l;     /* current list */
+    struct sock_filter     *prog;  /* compiled filter */
+    struct sock_fprog       fprog; /* filter passed to kernel */
+    unsigned                n;     /* number of instructions in prog */
+    size_t                  i;     /* current range */
+    uint32_t                pass;  /* verdict for allowed SYN */
+    uint32_t                drop;  /* verdict for denied SYN */
+    int                     ret;   /* return code */
     /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 
 
-    if ((mode = m) == 0)
+    l = BNW_LOAD(list);
+
+    if (l == NULL || l->mode == 0 || l->num_range > BNW_FILTER_MAX)
     {
-        el_print(ELN, "ip filtering is off");
-        return 0;
+        (void)setsockopt(fd, SOL_SOCKET, SO_DETACH_FILTER, NULL, 0);
+        errno = l == NULL || l->mode == 0 ? ENOENT : E2BIG;
+        return -1;
     }
 
-    VALID(EINVAL, flist);
+    if ((prog = malloc((9 + 3 * l->num_range) * sizeof(*prog))) == NULL)
+        return -1;
+
+    /* socket filter returns number of bytes to keep, 0 drops
+     * whole packet
+     */
 
-    el_print(ELN, "loading list file %s", flist);
+    pass = 0xffffffffu;
+    drop = 0;
+    n = 0;
 
-    if (stat(flist, &st) == -1)
+    /* filter of tcp socket sees packet from tcp header, and
+     * ip header is reachable with SKF_NET_OFF. Anything that is
+     * not SYN over ipv4 is let through.
+     */
+
+#define BNW_STMT(c, k) do { struct sock_filter f = \
+        BPF_STMT(c, k); prog[n++] = f; } while (0)
+#define BNW_JUMP(c, k, jt, jf) do { struct sock_filter f = \
+        BPF_JUMP(c, k, jt, jf); prog[n++] = f; } while (0)
+
+    BNW_STMT(BPF_LD | BPF_B | BPF_ABS, 13);
+    BNW_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x02, 1, 0);
+    BNW_STMT(BPF_RET | BPF_K, pass);
+    BNW_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF);
+    BNW_STMT(BPF_ALU | BPF_RSH | BPF_K, 4);
+    BNW_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 4, 1, 0);
+    BNW_STMT(BPF_RET | BPF_K, pass);
+    BNW_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12);
+
+    /* order of ranges doesn't matter here, so they are taken as
+     * they are in eytzinger layout, each range only jumps over
+     * its own instructions, so jump offsets never overflow
+     */
+
+    for (i = 1; i <= l->num_range; ++i)
     {
-        if (errno == ENOENT)
-        {
-            el_print(ELW, "file list doesn't exist, assuming no filter");
-            mode = 0;
-            return 0;
-        }
+        BNW_JUMP(BPF_JMP | BPF_JGE | BPF_K, l->range_lo[i], 0, 2);
+        BNW_JUMP(BPF_JMP | BPF_JGT | BPF_K, l->range_hi[i], 1, 0);
+        BNW_STMT(BPF_RET | BPF_K, l->mode == 1 ? pass : drop);
+    }
 
-        el_perror(ELF, "couldn't stat list file");
+    BNW_STMT(BPF_RET | BPF_K, l->mode == 1 ? drop : pass);
+
+#undef BNW_STMT
+#undef BNW_JUMP
+
+    fprog.len = n;
+    fprog.filter = prog;
+    ret = setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog));
+    free(prog);
+    return ret == 0 ? 0 : -1;
+#else
+    (void)fd;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+
+/* ==========================================================================
+    Writes currently loaded list as image to 'path', that can later be
+    passed to bnw_init() instead of text list. Image is written to
+    temporary file first and then renamed, so list file can be replaced
+    while server is running.
+
+    returns
+            0       image written
+           -1       error, errno is set
+   ========================================================================== */
+
+
+int bnw_write_image
+(
+    const char      *path               /* where to write image */
+)
+{
+    FILE            *f;                 /* temporary image file */
+    struct bnw_hdr   h;                 /* image header */
+    char             tmp[PATH_MAX + 8]; /* path to temporary file */
+    static char      zero[64];          /* padding and unused element */
+    size_t           asize;             /* size of single array */
+    size_t           pad;               /* padding after range_lo */
+    size_t           pad6;              /* padding after range_hi */
+    size_t           num_range;         /* number of ranges in list */
+    size_t           num_range6;        /* number of ipv6 ranges in list */
+    const uint32_t  *range_lo;          /* first addresses of ranges */
+    const uint32_t  *range_hi;          /* last addresses of ranges */
+    int              e;                 /* error while writing */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    VALID(EINVAL, path);
+    VALID(ENAMETOOLONG, strlen(path) < PATH_MAX);
+
+    num_range = list ? list->num_range : 0;
+    num_range6 = list ? list->num_range6 : 0;
+    range_lo = list ? list->range_lo : NULL;
+    range_hi = list ? list->range_hi : NULL;
+
+    if (num_range > UINT32_MAX - 1 || num_range6 > UINT32_MAX)
+    {
+        errno = EOVERFLOW;
         return -1;
     }
 
-    if (st.st_size == 0)
+    /* element 0 is never read, but it is always there, even
+     * when list is empty and there are no arrays at all
+     */
+
+    asize = (num_range + 1) * sizeof(uint32_t);
+    pad = bnw_image_hi(num_range) - sizeof(h) - asize;
+    pad6 = bnw_image_v6(num_range) - bnw_image_hi(num_range) - asize;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, BNW_MAGIC, sizeof(BNW_MAGIC));
+    h.version = BNW_VERSION;
+    h.endian = BNW_ENDIAN;
+    h.nrange = num_range;
+    h.nrange6 = num_range6;
+    h.checksum = 2166136261u;
+
+    if (num_range)
     {
-        num_ip = 0;
-        el_print(ELW, "file %s is empty", flist);
-        return 0;
+        h.checksum = bnw_fnv(h.checksum, range_lo, asize);
+        h.checksum = bnw_fnv(h.checksum, range_hi, asize);
     }
+    else
+        h.checksum = bnw_fnv(bnw_fnv(h.checksum, zero, 4), zero, 4);
 
-    if ((fd = open(flist, O_RDONLY)) == -1)
+    if (num_range6)
     {
-        e = errno;
-        el_perror(ELF, "couldn't open list file");
-        errno = e;
+        h.checksum = bnw_fnv(h.checksum, list->range6_lo,
+            num_range6 * sizeof(struct bnw_ip6));
+        h.checksum = bnw_fnv(h.checksum, list->range6_hi,
+            num_range6 * sizeof(struct bnw_ip6));
+    }
+
+    sprintf(tmp, "%s.tmp", path);
+    if ((f = fopen(tmp, "w")) == NULL)
         return -1;
+
+    fwrite(&h, sizeof(h), 1, f);
+
+    if (num_range)
+    {
+        fwrite(range_lo, asize, 1, f);
+        fwrite(zero, pad, 1, f);
+        fwrite(range_hi, asize, 1, f);
+    }
+    else
+    {
+        fwrite(zero, 4 + pad, 1, f);
+        fwrite(zero, 4, 1, f);
     }
 
-    f = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    if (f == MAP_FAILED)
+    if (num_range6)
     {
-        el_perror(ELF, "couldn't mmap flist file");
-        close(fd);
+        fwrite(zero, pad6, 1, f);
+        fwrite(list->range6_lo, sizeof(struct bnw_ip6), num_range6, f);
+        fwrite(list->range6_hi, sizeof(struct bnw_ip6), num_range6, f);
+    }
+
+    e = fflush(f) != 0 || ferror(f);
+    if (fclose(f) != 0 || e)
+    {
+        e = errno;
+        remove(tmp);
+        errno = e;
         return -1;
     }
 
-    if (bnw_parse_list(f, st.st_size) == -1)
+    if (rename(tmp, path) != 0)
     {
         e = errno;
-        el_print(ELF, "parsing list failed");
-        munmap(f, st.st_size);
-        close(fd);
+        remove(tmp);
         errno = e;
         return -1;
     }
 
-    munmap(f, st.st_size);
-    close(fd);
     return 0;
 }
 
 
 /* ==========================================================================
-    determines wheter ip should be allowed to upload to server or not.
+    Registers calling thread as reader, that is thread that does lookups.
+    Reader must call bnw_quiescent() with returned id regularly, when it
+    does not hold on to any list, or replaced lists will never be freed.
+    Lookups from threads that did not register, are only safe when they
+    never run concurrently with bnw_reload().
+
+    returns
+            >=0     id of reader
+           -1       too many readers registered, errno is set
    ========================================================================== */
 
 
-int bnw_is_allowed
-(
-    in_addr_t ip      /* ip address to check */
-)
+int bnw_reader_add(void)
 {
-    int       begin;  /* begin index for binary search */
-    int       end;    /* end index for binary search */
-    int       i;      /* middle index to check for binary search */
+    int  id;  /* id of new reader */
     /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 
 
-    if (mode == 0)
-    {
-        /* filtering is off, ip is always allowed */
-
-        return 1;
-    }
+    /* until reader stores grace period, its slot holds 0, which
+     * keeps every replaced list alive, so that is safe
+     */
 
-    if (num_ip == 0)
+    if ((id = BNW_INC(nreaders) - 1) >= BNW_READERS_MAX)
     {
-        return mode == 1 ? 0 : 1;
+        errno = ENOSPC;
+        return -1;
     }
 
-    ip = ntohl(ip);
-    begin = 0;
-    end = num_ip - 1;
-
-    while (begin <= end)
-    {
-        i = (begin + end) / 2;
+    BNW_STORE(readers[id], BNW_LOAD(gp));
+    return id;
+}
 
-        if (ip_list[i] == ip)
-        {
-            if (mode == 1)
-            {
-                /* ip was found in white list mode, ip is allowed */
 
-                return 1;
-            }
-            else
-            {
-                /* ip was found in black list mode, ip is not
-                 * allowed
-                 */
+/* ==========================================================================
+    Tells that reader 'id' finished all lookups it started, so lists that
+    were replaced before this point can be freed. Server calls this once
+    every loop round. Freeing is done here too, when nobody else is just
+    publishing new list.
+   ========================================================================== */
 
-                return 0;
-            }
-        }
 
-        if (ip_list[i] > ip)
-        {
-            end = i - 1;
-        }
-        else
-        {
-            begin = i + 1;
-        }
-    }
+void bnw_quiescent
+(
+    int  id  /* reader that passed quiescent point */
+)
+{
+    BNW_STORE(readers[id], BNW_LOAD(gp));
 
-    if (mode == 1)
-    {
-        /* ip was not found in white list, do not allow */
+    if (BNW_TRYLOCK(publishing))
+        return;
 
-        return 0;
-    }
-    else
-    {
-        /* ip was not found in black list, allow ip */
+    if (retired)
+        bnw_reclaim();
 
-        return 1;
-    }
+    BNW_UNLOCK(publishing);
 }
 
 
 /* ==========================================================================
-    frees all resources allocated by this module
+    frees all resources allocated by this module, no lookups may be in
+    progress
    ========================================================================== */
 
 
 void bnw_destroy(void)
 {
-    free(ip_list);
-    ip_list = NULL;
+    struct bnw_list  *l;  /* replaced list to free */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    while ((l = retired) != NULL)
+    {
+        retired = l->retired_next;
+        bnw_free(l);
+    }
+
+    bnw_free(list);
+    list = NULL;
+    nreaders = 0;
+    list_path = NULL;
+    list_spec = NULL;
+    list_mode = 0;
 }
@@ -7,9 +7,18 @@
 #define BNWLIST_H 1
 
 #include <arpa/inet.h>
+#include <stddef.h>
 
 int bnw_init(const char *, int);
+int bnw_init_lists(const char *);
 void bnw_destroy(void);
 int bnw_is_allowed(in_addr_t);
+int bnw_is_allowed6(const struct in6_addr *);
+void bnw_is_allowed_batch(const in_addr_t *, int *, size_t);
+int bnw_write_image(const char *);
+int bnw_reload(void);
+int bnw_reader_add(void);
+void bnw_quiescent(int);
+int bnw_filter_attach(int);
 
 #endif
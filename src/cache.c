@@ -0,0 +1,458 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         -------------------------------------------------------------
+        / Cache for freshly uploaded files. Almost all downloads of a \
+        | paste happen few minutes after link is printed, so we keep  |
+        | content of recent uploads in memory and serve it from here  |
+        | without touching filesystem at all. Cache is bounded by     |
+        | number of bytes and uses CLOCK algorithm to evict entries - |
+        | it's almost as good as LRU but hits cost only setting one   |
+        \ bit, no list juggling.                                      /
+         -------------------------------------------------------------
+            \    ,-^-.
+             \   !oYo!
+              \ /./=\.\______
+                   ##        )\/\
+                    ||-----w||
+                    ||      ||
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "feature.h"
+
+#include <embedlog.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "globals.h"
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* number of hash buckets, must be power of 2 */
+
+#define CACHE_NBUCKETS 1024
+
+static struct cache_entry  *buckets[CACHE_NBUCKETS]; /* hash table */
+static struct cache_entry  *hand;     /* clock hand, next eviction candidate */
+static size_t               max_size; /* max bytes cache can hold, 0 - off */
+static size_t               used;     /* bytes currently held by cache */
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Calculates hash bucket for file 'name' (djb2)
+   ========================================================================== */
+
+
+static unsigned cache_hash
+(
+    const char  *name  /* name to calculate hash for */
+)
+{
+    unsigned     h;    /* calculated hash */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (h = 5381; *name; ++name)
+        h = h * 33 + (unsigned char)*name;
+
+    return h & (CACHE_NBUCKETS - 1);
+}
+
+
+/* ==========================================================================
+    Removes entry 'e' from hash table and from the clock. Entry memory is
+    not freed.
+   ========================================================================== */
+
+
+static void cache_unlink
+(
+    struct cache_entry   *e   /* entry to unlink */
+)
+{
+    struct cache_entry  **pp; /* pointer to pointer that points to e */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (pp = &buckets[cache_hash(e->name)]; *pp != e; pp = &(*pp)->hnext)
+        ;
+
+    *pp = e->hnext;
+
+    if (e->next == e)
+    {
+        /* it was the last entry on the clock */
+
+        hand = NULL;
+    }
+    else
+    {
+        e->prev->next = e->next;
+        e->next->prev = e->prev;
+
+        if (hand == e)
+            hand = e->next;
+    }
+
+    used -= e->len;
+    --g_stats.cache_entries;
+    g_stats.cache_bytes = used;
+}
+
+
+/* ==========================================================================
+    Frees entry and its data
+   ========================================================================== */
+
+
+static void cache_free
+(
+    struct cache_entry  *e  /* entry to free */
+)
+{
+    free(e->data);
+    free(e);
+}
+
+
+/* ==========================================================================
+    Evicts entries until there is at least 'len' free bytes in cache. Entry
+    that has reference bit set, gets second chance, entries that are
+    currently being sent are never evicted.
+
+    returns
+            0       there is enough space for 'len' bytes
+           -1       couldn't free enough space, all entries are in use
+   ========================================================================== */
+
+
+static int cache_make_room
+(
+    size_t               len     /* number of bytes we need */
+)
+{
+    struct cache_entry  *e;      /* entry to evict */
+    unsigned long        misses; /* entries passed without eviction */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    misses = 0;
+    while (used + len > max_size)
+    {
+        /* hand went around twice, and didn't manage to evict
+         * anything - all entries are pinned, first pass clears
+         * reference bits, so second pass would evict anything
+         * that is not pinned
+         */
+
+        if (hand == NULL || misses > 2 * g_stats.cache_entries)
+            return -1;
+
+        e = hand;
+
+        if (e->pin || e->ref)
+        {
+            /* entry in use, or recently used, give it second
+             * chance and move on
+             */
+
+            e->ref = 0;
+            hand = e->next;
+            ++misses;
+            continue;
+        }
+
+        el_print(ELD, "cache: evicting %s, %lu bytes",
+                e->name, (unsigned long)e->len);
+        cache_unlink(e);
+        cache_free(e);
+        ++g_stats.cache_evictions;
+        misses = 0;
+    }
+
+    return 0;
+}
+
+
+/* ==========================================================================
+                       __     __ _          ____
+        ____   __  __ / /_   / /(_)_____   / __/__  __ ____   _____ _____
+       / __ \ / / / // __ \ / // // ___/  / /_ / / / // __ \ / ___// ___/
+      / /_/ // /_/ // /_/ // // // /__   / __// /_/ // / / // /__ (__  )
+     / .___/ \__,_//_.___//_//_/ \___/  /_/   \__,_//_/ /_/ \___//____/
+    /_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Initializes cache, that will hold no more than 'max_bytes' of uploaded
+    data. If 'max_bytes' is 0, cache is disabled and all other functions
+    become no-ops.
+   ========================================================================== */
+
+
+int cache_init
+(
+    size_t  max_bytes  /* maximum number of bytes cache can hold */
+)
+{
+    memset(buckets, 0, sizeof(buckets));
+    hand = NULL;
+    used = 0;
+    max_size = max_bytes;
+
+    if (max_size)
+        el_print(ELN, "upload cache initialized, size %lu bytes",
+                (unsigned long)max_size);
+
+    return 0;
+}
+
+
+/* ==========================================================================
+    Frees all cached entries. Entries that are still pinned will be
+    destroyed anyway, so all users must be gone by the time this is called.
+   ========================================================================== */
+
+
+void cache_destroy(void)
+{
+    struct cache_entry  *e;  /* entry to free */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    while ((e = hand) != NULL)
+    {
+        cache_unlink(e);
+        cache_free(e);
+    }
+
+    max_size = 0;
+}
+
+
+/* ==========================================================================
+    Returns maximum size of single upload that can be cached. We don't
+    want one upload to wipe out whole cache, so single entry can take at
+    most 1/8 of cache. Returns 0 when cache is disabled.
+   ========================================================================== */
+
+
+size_t cache_max_entry(void)
+{
+    return max_size / 8;
+}
+
+
+/* ==========================================================================
+    Puts upload 'name' with content 'data' of 'len' bytes into cache. Cache
+    takes ownership of 'data' - it must be allocated with malloc() and
+    caller must not touch it after this call, even when function fails.
+
+    returns
+            0       entry added to cache
+           -1       entry not added, 'data' has been freed
+
+    errno
+            EINVAL  'len' is 0 or entry is too big to be cached
+            ENOSPC  all entries are in use and nothing could be evicted
+            ENOMEM  couldn't allocate memory for entry
+   ========================================================================== */
+
+
+int cache_put
+(
+    const char          *name,  /* name of uploaded file */
+    unsigned char       *data,  /* content of uploaded file */
+    size_t               len,   /* length of data */
+    time_t               mtime  /* modification time of file on disk */
+)
+{
+    struct cache_entry  *e;     /* new cache entry */
+    unsigned             h;     /* hash bucket of new entry */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (len == 0 || len > cache_max_entry() ||
+            strlen(name) >= sizeof(e->name))
+    {
+        free(data);
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (cache_make_room(len) != 0)
+    {
+        el_print(ELD, "cache: no room for %s, all entries in use", name);
+        free(data);
+        errno = ENOSPC;
+        return -1;
+    }
+
+    if ((e = malloc(sizeof(*e))) == NULL)
+    {
+        el_perror(ELW, "cache: couldn't allocate entry for %s", name);
+        free(data);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    strcpy(e->name, name);
+    e->data = data;
+    e->len = len;
+    e->mtime = mtime;
+    e->pin = 0;
+    e->ref = 0;
+    e->removed = 0;
+
+    h = cache_hash(name);
+    e->hnext = buckets[h];
+    buckets[h] = e;
+
+    /* new entry goes just behind the hand, so it will be checked
+     * last - it's the freshest one after all
+     */
+
+    if (hand == NULL)
+    {
+        e->next = e;
+        e->prev = e;
+        hand = e;
+    }
+    else
+    {
+        e->next = hand;
+        e->prev = hand->prev;
+        hand->prev->next = e;
+        hand->prev = e;
+    }
+
+    used += len;
+    ++g_stats.cache_inserts;
+    ++g_stats.cache_entries;
+    g_stats.cache_bytes = used;
+    return 0;
+}
+
+
+/* ==========================================================================
+    Looks for upload 'name' in cache. When entry is found, it is pinned
+    and will not be evicted until cache_release() is called on it.
+
+    returns
+            !NULL   pinned cache entry
+            NULL    entry not in cache
+   ========================================================================== */
+
+
+struct cache_entry *cache_get
+(
+    const char          *name  /* name of upload to look for */
+)
+{
+    struct cache_entry  *e;    /* iterated entry */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (max_size == 0)
+        return NULL;
+
+    for (e = buckets[cache_hash(name)]; e != NULL; e = e->hnext)
+    {
+        if (strcmp(e->name, name) == 0)
+        {
+            e->ref = 1;
+            ++e->pin;
+            ++g_stats.cache_hits;
+            return e;
+        }
+    }
+
+    ++g_stats.cache_misses;
+    return NULL;
+}
+
+
+/* ==========================================================================
+    Unpins entry previously returned by cache_get(). If entry has been
+    removed in the meantime, it is freed now.
+   ========================================================================== */
+
+
+void cache_release
+(
+    struct cache_entry  *e  /* entry to release */
+)
+{
+    if (--e->pin == 0 && e->removed)
+        cache_free(e);
+}
+
+
+/* ==========================================================================
+    Removes upload 'name' from cache, should be called whenever file is
+    removed from disk, so we don't serve files that no longer exist.
+    Entry that is currently being sent is freed when last user releases
+    it.
+   ========================================================================== */
+
+
+void cache_remove
+(
+    const char          *name  /* name of upload to remove */
+)
+{
+    struct cache_entry  *e;    /* iterated entry */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (max_size == 0)
+        return;
+
+    for (e = buckets[cache_hash(name)]; e != NULL; e = e->hnext)
+        if (strcmp(e->name, name) == 0)
+            break;
+
+    if (e == NULL)
+        return;
+
+    cache_unlink(e);
+
+    if (e->pin)
+    {
+        e->removed = 1;
+        return;
+    }
+
+    cache_free(e);
+}
@@ -0,0 +1,34 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef CACHE_H
+#define CACHE_H 1
+
+#include <stddef.h>
+#include <time.h>
+
+struct cache_entry
+{
+    char                 name[32];  /* file name, as generated by server */
+    unsigned char       *data;      /* file content */
+    size_t               len;       /* length of data */
+    time_t               mtime;     /* modification time of file on disk */
+    unsigned             pin;       /* number of users sending this entry */
+    int                  ref;       /* clock reference bit */
+    int                  removed;   /* removed while pinned, free on release */
+    struct cache_entry  *hnext;     /* next entry in the same hash bucket */
+    struct cache_entry  *next;      /* next entry on the clock */
+    struct cache_entry  *prev;      /* previous entry on the clock */
+};
+
+int cache_init(size_t max_bytes);
+void cache_destroy(void);
+size_t cache_max_entry(void);
+int cache_put(const char *name, unsigned char *data, size_t len, time_t mtime);
+struct cache_entry *cache_get(const char *name);
+void cache_release(struct cache_entry *e);
+void cache_remove(const char *name);
+
+#endif
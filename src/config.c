@@ -73,6 +73,51 @@ static const char  *shortopts =
 #endif
     ;
 
+/* options that have no short equivalent, values are outside of
+ * char range so they never clash with short options
+ */
+
+enum longopt_only
+{
+    OPT_HTTP_PORT = 256,
+    OPT_HTTP_MAX_CONNECTIONS,
+    OPT_CACHE_SIZE,
+    OPT_STATS_FILE,
+    OPT_HTTP_UPLOAD_PORT,
+    OPT_PACK_MAX_SIZE,
+    OPT_EXPIRE_MAX_AGE,
+    OPT_EXPIRE_MIN_AGE,
+    OPT_STORE_BUDGET,
+    OPT_SEARCH_MAX_SIZE,
+    OPT_IP_CONN_RATE,
+    OPT_IP_MAX_CONN,
+    OPT_IP_BANDWIDTH,
+    OPT_NET_CONN_RATE,
+    OPT_NET_MAX_CONN,
+    OPT_NET_BANDWIDTH,
+    OPT_AUTOBAN_THRESHOLD,
+    OPT_AUTOBAN_TIME,
+    OPT_AUTOBAN_FILE,
+    OPT_LISTS,
+    OPT_PROXY_PORTS,
+    OPT_PROXY_TRUSTED,
+    OPT_KERNEL_FILTER,
+    OPT_REJECT_RATE,
+    OPT_BACKLOG,
+    OPT_DEFER_ACCEPT,
+    OPT_FASTOPEN,
+    OPT_ACCEPT_BATCH,
+    OPT_READ_BUDGET,
+    OPT_SHORT_UPLOAD,
+    OPT_MIN_RATE,
+    OPT_RATE_WINDOW,
+    OPT_UPLOAD_DEADLINE,
+    OPT_WAIT_QUEUE,
+    OPT_WAIT_TIMEOUT,
+    OPT_BUSY_THRESHOLD,
+    OPT_BUSY_TIMEOUT
+};
+
 /* array of long options for getopt_long */
 
 struct option       longopts[] =
@@ -99,6 +144,44 @@ struct option       longopts[] =
     {"output-dir",            required_argument, NULL, 'o'},
     {"list-file",             required_argument, NULL, 'L'},
     {"ft-based-url",          no_argument,       NULL, 'F'},
+    {"http-port",             required_argument, NULL, OPT_HTTP_PORT},
+    {"http-max-connections",  required_argument, NULL,
+        OPT_HTTP_MAX_CONNECTIONS},
+    {"cache-size",            required_argument, NULL, OPT_CACHE_SIZE},
+    {"stats-file",            required_argument, NULL, OPT_STATS_FILE},
+    {"http-upload-port",      required_argument, NULL, OPT_HTTP_UPLOAD_PORT},
+    {"pack-max-size",         required_argument, NULL, OPT_PACK_MAX_SIZE},
+    {"expire-max-age",        required_argument, NULL, OPT_EXPIRE_MAX_AGE},
+    {"expire-min-age",        required_argument, NULL, OPT_EXPIRE_MIN_AGE},
+    {"store-budget",          required_argument, NULL, OPT_STORE_BUDGET},
+    {"search-max-size",       required_argument, NULL, OPT_SEARCH_MAX_SIZE},
+    {"ip-conn-rate",          required_argument, NULL, OPT_IP_CONN_RATE},
+    {"ip-max-conn",           required_argument, NULL, OPT_IP_MAX_CONN},
+    {"ip-bandwidth",          required_argument, NULL, OPT_IP_BANDWIDTH},
+    {"net-conn-rate",         required_argument, NULL, OPT_NET_CONN_RATE},
+    {"net-max-conn",          required_argument, NULL, OPT_NET_MAX_CONN},
+    {"net-bandwidth",         required_argument, NULL, OPT_NET_BANDWIDTH},
+    {"autoban-threshold",     required_argument, NULL, OPT_AUTOBAN_THRESHOLD},
+    {"autoban-time",          required_argument, NULL, OPT_AUTOBAN_TIME},
+    {"autoban-file",          required_argument, NULL, OPT_AUTOBAN_FILE},
+    {"lists",                 required_argument, NULL, OPT_LISTS},
+    {"proxy-ports",           required_argument, NULL, OPT_PROXY_PORTS},
+    {"proxy-trusted",         required_argument, NULL, OPT_PROXY_TRUSTED},
+    {"kernel-filter",         no_argument,       NULL, OPT_KERNEL_FILTER},
+    {"reject-rate",           required_argument, NULL, OPT_REJECT_RATE},
+    {"backlog",               required_argument, NULL, OPT_BACKLOG},
+    {"defer-accept",          required_argument, NULL, OPT_DEFER_ACCEPT},
+    {"fastopen",              required_argument, NULL, OPT_FASTOPEN},
+    {"accept-batch",          required_argument, NULL, OPT_ACCEPT_BATCH},
+    {"read-budget",           required_argument, NULL, OPT_READ_BUDGET},
+    {"short-upload",          required_argument, NULL, OPT_SHORT_UPLOAD},
+    {"min-rate",              required_argument, NULL, OPT_MIN_RATE},
+    {"rate-window",           required_argument, NULL, OPT_RATE_WINDOW},
+    {"upload-deadline",       required_argument, NULL, OPT_UPLOAD_DEADLINE},
+    {"wait-queue",            required_argument, NULL, OPT_WAIT_QUEUE},
+    {"wait-timeout",          required_argument, NULL, OPT_WAIT_TIMEOUT},
+    {"busy-threshold",        required_argument, NULL, OPT_BUSY_THRESHOLD},
+    {"busy-timeout",          required_argument, NULL, OPT_BUSY_TIMEOUT},
 #if HAVE_SSL
     {"ssl-listen-port",       required_argument, NULL, 'I'},
     {"timed-ssl-listen-port", required_argument, NULL, 'A'},
@@ -225,6 +308,48 @@ static int config_parse_arguments
         case 'P': PARSE_STR(pid_file); break;
         case 'o': PARSE_STR(output_dir); break;
         case 'L': PARSE_STR(list_file); break;
+        case OPT_HTTP_PORT: PARSE_INT(http_port, 0, UINT16_MAX); break;
+        case OPT_HTTP_MAX_CONNECTIONS:
+            PARSE_INT(http_max_connections, 1, LONG_MAX); break;
+        case OPT_CACHE_SIZE: PARSE_INT(cache_size, 0, LONG_MAX); break;
+        case OPT_STATS_FILE: PARSE_STR(stats_file); break;
+        case OPT_HTTP_UPLOAD_PORT:
+            PARSE_INT(http_upload_port, 0, UINT16_MAX); break;
+        case OPT_PACK_MAX_SIZE: PARSE_INT(pack_max_size, 0, LONG_MAX); break;
+        case OPT_EXPIRE_MAX_AGE: PARSE_INT(expire_max_age, 0, LONG_MAX); break;
+        case OPT_EXPIRE_MIN_AGE: PARSE_INT(expire_min_age, 0, LONG_MAX); break;
+        case OPT_STORE_BUDGET: PARSE_INT(store_budget, 0, LONG_MAX); break;
+        case OPT_SEARCH_MAX_SIZE:
+            PARSE_INT(search_max_size, 0, LONG_MAX); break;
+        case OPT_IP_CONN_RATE: PARSE_INT(ip_conn_rate, 0, LONG_MAX); break;
+        case OPT_IP_MAX_CONN: PARSE_INT(ip_max_conn, 0, LONG_MAX); break;
+        case OPT_IP_BANDWIDTH: PARSE_INT(ip_bandwidth, 0, LONG_MAX); break;
+        case OPT_NET_CONN_RATE: PARSE_INT(net_conn_rate, 0, LONG_MAX); break;
+        case OPT_NET_MAX_CONN: PARSE_INT(net_max_conn, 0, LONG_MAX); break;
+        case OPT_NET_BANDWIDTH: PARSE_INT(net_bandwidth, 0, LONG_MAX); break;
+        case OPT_AUTOBAN_THRESHOLD:
+            PARSE_INT(autoban_threshold, 0, LONG_MAX); break;
+        case OPT_AUTOBAN_TIME: PARSE_INT(autoban_time, 1, LONG_MAX); break;
+        case OPT_AUTOBAN_FILE: PARSE_STR(autoban_file); break;
+        case OPT_LISTS: PARSE_STR(lists); break;
+        case OPT_PROXY_PORTS: PARSE_STR(proxy_ports); break;
+        case OPT_PROXY_TRUSTED: PARSE_STR(proxy_trusted); break;
+        case OPT_KERNEL_FILTER: g_config.kernel_filter = 1; break;
+        case OPT_REJECT_RATE: PARSE_INT(reject_rate, 0, LONG_MAX); break;
+        case OPT_BACKLOG: PARSE_INT(backlog, 1, INT_MAX); break;
+        case OPT_DEFER_ACCEPT: PARSE_INT(defer_accept, 0, INT_MAX); break;
+        case OPT_FASTOPEN: PARSE_INT(fastopen, 0, INT_MAX); break;
+        case OPT_ACCEPT_BATCH: PARSE_INT(accept_batch, 1, LONG_MAX); break;
+        case OPT_READ_BUDGET: PARSE_INT(read_budget, 1, LONG_MAX); break;
+        case OPT_SHORT_UPLOAD: PARSE_INT(short_upload, 0, LONG_MAX); break;
+        case OPT_MIN_RATE: PARSE_INT(min_rate, 0, LONG_MAX); break;
+        case OPT_RATE_WINDOW: PARSE_INT(rate_window, 1, 86400); break;
+        case OPT_UPLOAD_DEADLINE:
+            PARSE_INT(upload_deadline, 0, LONG_MAX); break;
+        case OPT_WAIT_QUEUE: PARSE_INT(wait_queue, 0, 65536); break;
+        case OPT_WAIT_TIMEOUT: PARSE_INT(wait_timeout, 1, LONG_MAX); break;
+        case OPT_BUSY_THRESHOLD: PARSE_INT(busy_threshold, 0, 100); break;
+        case OPT_BUSY_TIMEOUT: PARSE_INT(busy_timeout, 1, LONG_MAX); break;
 #if HAVE_SSL
         case 'I': PARSE_INT(ssl_listen_port, 0, UINT16_MAX); break;
         case 'A': PARSE_INT(timed_ssl_listen_port, 0, UINT16_MAX); break;
@@ -263,7 +388,46 @@ static int config_parse_arguments
 "\t-M, --timed-max-timeout=<seconds>  inactivity time before accepting data\n"
 "\t-T, --list-type=<type>           type of the list_file (black or white)\n"
 "\t-L, --list_file=<path>           path with ip list for black/white list\n"
-"\t-b, --bind-ip=<ip-list>          comma separated list of ips to bind to\n");
+"\t    --lists=<spec>               combine allow and deny lists\n"
+"\t-b, --bind-ip=<ip-list>          comma separated list of ips to bind to\n"
+"\t    --proxy-ports=<port-list>    ports that expect PROXY protocol header\n"
+"\t    --proxy-trusted=<ip-list>    networks allowed to send PROXY header\n"
+"\t    --kernel-filter              drop denied ipv4 SYNs in kernel\n");
+            printf(
+"\t    --http-port=<port>           port serving uploads over http\n"
+"\t    --http-max-connections=<number>  max number of http connections\n"
+"\t    --cache-size=<size>          memory for caching fresh uploads\n"
+"\t    --stats-file=<path>          where to periodically dump statistics\n"
+"\t    --http-upload-port=<port>    port accepting uploads with http PUT/POST\n"
+"\t    --pack-max-size=<size>       pack uploads up to size into segments\n"
+"\t    --expire-max-age=<seconds>   delete uploads older than that\n"
+"\t    --expire-min-age=<seconds>   max age for biggest uploads\n"
+"\t    --store-budget=<size>        delete oldest uploads above that size\n"
+"\t    --search-max-size=<size>     index text uploads up to size\n");
+            printf(
+"\t    --ip-conn-rate=<number>      new connections per minute from single ip\n"
+"\t    --ip-max-conn=<number>       concurrent uploads from single ip\n"
+"\t    --ip-bandwidth=<size>        bytes per second uploaded by single ip\n"
+"\t    --net-conn-rate=<number>     new connections per minute from network\n"
+"\t    --net-max-conn=<number>      concurrent uploads from network\n"
+"\t    --net-bandwidth=<size>       bytes per second uploaded by network\n"
+"\t    --autoban-threshold=<number> ban ip after that many offenses\n"
+"\t    --autoban-time=<seconds>     how long automatic ban lasts\n"
+"\t    --autoban-file=<path>        where to keep automatic bans\n"
+"\t    --reject-rate=<number>       replies to rejected clients per second\n"
+"\t    --backlog=<number>           length of listen queue\n"
+"\t    --defer-accept=<seconds>     accept only when client sends data\n"
+"\t    --fastopen=<number>          queue length for TCP fast open\n"
+"\t    --accept-batch=<number>      max connections accepted at once\n"
+"\t    --read-budget=<size>         bytes read from client in one round\n"
+"\t    --short-upload=<size>        serve uploads up to size first\n"
+"\t    --min-rate=<size>            slowest accepted upload in bytes/s\n"
+"\t    --rate-window=<seconds>      period over which rate is measured\n"
+"\t    --upload-deadline=<seconds>  upload must finish in that time\n"
+"\t    --wait-queue=<number>        clients that can wait for free slot\n"
+"\t    --wait-timeout=<seconds>     how long client can wait for slot\n"
+"\t    --busy-threshold=<percent>   busy slots above which timeouts shrink\n"
+"\t    --busy-timeout=<seconds>     timeout when all slots are busy\n");
             printf(
 "\t-d, --domain=<domain>            domain on which server works\n"
 "\t-u, --user=<user>                user that should run daemon\n"
@@ -305,7 +469,14 @@ static int config_parse_arguments
 #else
                     "-"
 #endif
-                    "ssl\n");
+                    "ssl\n\t");
+            fprintf(stdout,
+#if HAVE_SYS_SENDFILE_H
+                    "+"
+#else
+                    "-"
+#endif
+                    "sendfile\n");
 
             exit(0);
 
@@ -375,10 +546,46 @@ int config_init
     g_config.max_connections = 10;
     g_config.max_timeout = 60;
     g_config.timed_max_timeout = 3;
+    g_config.http_port = 0;
+    g_config.http_max_connections = 64;
+    g_config.cache_size = 8 * 1024 * 1024; /* 8MiB */
+    g_config.stats_file[0] = '\0';
+    g_config.autoban_file[0] = '\0';
+    g_config.proxy_ports[0] = '\0';
+    g_config.http_upload_port = 0;
+    g_config.pack_max_size = 0;
+    g_config.expire_max_age = 0;
+    g_config.expire_min_age = 0;
+    g_config.store_budget = 0;
+    g_config.search_max_size = 0;
+    g_config.ip_conn_rate = 0;
+    g_config.ip_max_conn = 0;
+    g_config.ip_bandwidth = 0;
+    g_config.net_conn_rate = 0;
+    g_config.net_max_conn = 0;
+    g_config.net_bandwidth = 0;
+    g_config.autoban_threshold = 0;
+    g_config.autoban_time = 3600;
+    g_config.reject_rate = 0;
+    g_config.backlog = 256;
+    g_config.defer_accept = 0;
+    g_config.fastopen = 0;
+    g_config.accept_batch = 16;
+    g_config.read_budget = 262144;
+    g_config.short_upload = 0;
+    g_config.min_rate = 0;
+    g_config.rate_window = 30;
+    g_config.upload_deadline = 0;
+    g_config.wait_queue = 0;
+    g_config.wait_timeout = 10;
+    g_config.busy_threshold = 0;
+    g_config.busy_timeout = 5;
     g_config.pem_pass_file[0] = '\0';
     g_config.ft_based_url = 0;
+    g_config.kernel_filter = 0;
     strcpy(g_config.domain, "localhost");
     strcpy(g_config.bind_ip, "0.0.0.0");
+    strcpy(g_config.proxy_trusted, "127.0.0.1,::1");
     strcpy(g_config.user, "termsend");
     strcpy(g_config.group, "termsend");
     strcpy(g_config.query_log, "/var/log/termsend-query.log");
@@ -421,7 +628,7 @@ int config_validate(void)
 
     /* if list filtering is used, check if we can read IPs from it */
 
-    if (g_config.list_type != 0)
+    if (g_config.list_type != 0 && g_config.lists[0] == '\0')
     {
         if (access(g_config.list_file, R_OK) != 0)
         {
@@ -431,6 +638,36 @@ int config_validate(void)
         }
     }
 
+    /* we chdir() to output dir, so relative path would point to
+     * some unexpected place
+     */
+
+    if (g_config.stats_file[0] != '\0' && g_config.stats_file[0] != '/')
+    {
+        el_print(ELF, "stats file (%s) must be an absolute path",
+                g_config.stats_file);
+        return -1;
+    }
+
+    if (g_config.autoban_file[0] != '\0' && g_config.autoban_file[0] != '/')
+    {
+        el_print(ELF, "autoban file (%s) must be an absolute path",
+                g_config.autoban_file);
+        return -1;
+    }
+
+    /* min age only scales max age, it makes no sense alone, nor
+     * when bigger uploads would live longer than small ones
+     */
+
+    if (g_config.expire_min_age > g_config.expire_max_age)
+    {
+        el_print(ELF, "expire min age (%ld) must not be bigger than "
+                "expire max age (%ld)", g_config.expire_min_age,
+                g_config.expire_max_age);
+        return -1;
+    }
+
     /* if any of the ssl port is used, check if mandatory key and
      * cert files are accessible
      */
@@ -490,10 +727,47 @@ void config_print(void)
     CONFIG_PRINT(program_log, "%s");
     CONFIG_PRINT(list_file, "%s");
     CONFIG_PRINT(list_type, "%ld");
+    CONFIG_PRINT(lists, "%s");
+    CONFIG_PRINT(proxy_ports, "%s");
+    CONFIG_PRINT(proxy_trusted, "%s");
+    CONFIG_PRINT(kernel_filter, "%d");
     CONFIG_PRINT(output_dir, "%s");
     CONFIG_PRINT(pid_file, "%s");
     CONFIG_PRINT(bind_ip, "%s");
     CONFIG_PRINT(ft_based_url, "%d");
+    CONFIG_PRINT(http_port, "%ld");
+    CONFIG_PRINT(http_max_connections, "%ld");
+    CONFIG_PRINT(cache_size, "%ld");
+    CONFIG_PRINT(stats_file, "%s");
+    CONFIG_PRINT(autoban_file, "%s");
+    CONFIG_PRINT(http_upload_port, "%ld");
+    CONFIG_PRINT(pack_max_size, "%ld");
+    CONFIG_PRINT(expire_max_age, "%ld");
+    CONFIG_PRINT(expire_min_age, "%ld");
+    CONFIG_PRINT(store_budget, "%ld");
+    CONFIG_PRINT(search_max_size, "%ld");
+    CONFIG_PRINT(ip_conn_rate, "%ld");
+    CONFIG_PRINT(ip_max_conn, "%ld");
+    CONFIG_PRINT(ip_bandwidth, "%ld");
+    CONFIG_PRINT(net_conn_rate, "%ld");
+    CONFIG_PRINT(net_max_conn, "%ld");
+    CONFIG_PRINT(net_bandwidth, "%ld");
+    CONFIG_PRINT(autoban_threshold, "%ld");
+    CONFIG_PRINT(autoban_time, "%ld");
+    CONFIG_PRINT(reject_rate, "%ld");
+    CONFIG_PRINT(backlog, "%ld");
+    CONFIG_PRINT(defer_accept, "%ld");
+    CONFIG_PRINT(fastopen, "%ld");
+    CONFIG_PRINT(accept_batch, "%ld");
+    CONFIG_PRINT(read_budget, "%ld");
+    CONFIG_PRINT(short_upload, "%ld");
+    CONFIG_PRINT(min_rate, "%ld");
+    CONFIG_PRINT(rate_window, "%ld");
+    CONFIG_PRINT(upload_deadline, "%ld");
+    CONFIG_PRINT(wait_queue, "%ld");
+    CONFIG_PRINT(wait_timeout, "%ld");
+    CONFIG_PRINT(busy_threshold, "%ld");
+    CONFIG_PRINT(busy_timeout, "%ld");
 #if HAVE_SSL
     CONFIG_PRINT(ssl_listen_port, "%ld");
     CONFIG_PRINT(timed_ssl_listen_port, "%ld");
@@ -38,9 +38,43 @@ struct config
     long            max_connections;
     long            max_timeout;
     long            timed_max_timeout;
+    long            http_port;
+    long            http_max_connections;
+    long            cache_size;
+    long            http_upload_port;
+    long            pack_max_size;
+    long            expire_max_age;
+    long            expire_min_age;
+    long            store_budget;
+    long            search_max_size;
+    long            ip_conn_rate;
+    long            ip_max_conn;
+    long            ip_bandwidth;
+    long            net_conn_rate;
+    long            net_max_conn;
+    long            net_bandwidth;
+    long            autoban_threshold;
+    long            autoban_time;
+    long            reject_rate;
+    long            backlog;
+    long            defer_accept;
+    long            fastopen;
+    long            accept_batch;
+    long            read_budget;
+    long            short_upload;
+    long            min_rate;
+    long            rate_window;
+    long            upload_deadline;
+    long            wait_queue;
+    long            wait_timeout;
+    long            busy_threshold;
+    long            busy_timeout;
     int             ft_based_url;
+    int             kernel_filter;
     char            domain[4096 + 1];
     char            bind_ip[1024 + 1];
+    char            proxy_ports[1024 + 1];
+    char            proxy_trusted[4096 + 1];
     char            user[255 + 1];
     char            group[255 + 1];
     char            query_log[PATH_MAX];
@@ -48,6 +82,9 @@ struct config
     char            pid_file[PATH_MAX];
     char            output_dir[PATH_MAX];
     char            list_file[PATH_MAX];
+    char            lists[4096 + 1];
+    char            stats_file[PATH_MAX];
+    char            autoban_file[PATH_MAX];
     char            key_file[PATH_MAX];
     char            cert_file[PATH_MAX];
     char            pem_pass_file[PATH_MAX];
@@ -0,0 +1,587 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         -------------------------------------------------------------
+        / Retention of uploads. Every upload gets expiry time based   \
+        | on its age and size, and all of them are kept in min-heap   |
+        | ordered by that time, so finding what to delete next costs  |
+        | nothing, no matter how many files there are. Heap is not    |
+        | stored anywhere, it's rebuilt on startup from upload index, |
+        | which already holds creation time and size of each upload.  |
+        | Uploads are deleted in small batches, and unlink() itself   |
+        | is done by separate reaper process, so network loop never   |
+        \ waits for filesystem to update huge directory.              /
+         -------------------------------------------------------------
+             \   ^__^
+              \  (oo)\_______
+                 (__)\       )\/\
+                     ||----w |
+                     ||     ||
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "feature.h"
+
+#include <embedlog.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "expire.h"
+#include "globals.h"
+#include "segstore.h"
+#include "upidx.h"
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* upload waiting for its time, recno points to upload index, where
+ * name and flags of the upload are, so they are not kept in memory
+ */
+
+struct expire_entry
+{
+    time_t         at;     /* when upload expires */
+    unsigned long  size;   /* size of upload */
+    unsigned long  recno;  /* record number in upload index */
+};
+
+static struct expire_entry  *heap;      /* min-heap ordered by 'at' */
+static size_t                nheap;     /* number of entries in heap */
+static size_t                heapcap;   /* number of allocated entries */
+static unsigned long long    total;     /* size of all uploads in heap */
+static int                   rfd = -1;  /* pipe to reaper, write end */
+static pid_t                 reaper = -1; /* pid of reaper process */
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Calculates when upload created at 'ctime' with 'size' bytes expires.
+    When min age is set, bigger uploads live shorter, from max age for
+    empty upload down to min age for the biggest one allowed, with cubic
+    curve, so small uploads keep close to max age for quite a while.
+    Without max age, nothing expires by age and uploads are ordered by
+    creation time, so oldest go first when store is over budget.
+   ========================================================================== */
+
+
+static time_t expire_at
+(
+    time_t         ctime,  /* upload creation time */
+    unsigned long  size    /* upload size */
+)
+{
+    double         r;      /* 1 - size relative to max size */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (g_config.expire_max_age == 0)
+        return ctime;
+
+    if (g_config.expire_min_age == 0 || g_config.max_size == 0)
+        return ctime + g_config.expire_max_age;
+
+    r = 1.0 - (double)size / g_config.max_size;
+    r = r < 0.0 ? 0.0 : r;
+
+    return ctime + g_config.expire_min_age +
+        (time_t)((g_config.expire_max_age - g_config.expire_min_age) * r*r*r);
+}
+
+
+/* ==========================================================================
+    Moves entry 'i' down the heap until both children expire later.
+   ========================================================================== */
+
+
+static void expire_sift_down
+(
+    size_t               i     /* index of entry to move */
+)
+{
+    struct expire_entry  e;    /* entry being moved */
+    size_t               c;    /* child of i that expires sooner */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    e = heap[i];
+    while ((c = 2 * i + 1) < nheap)
+    {
+        if (c + 1 < nheap && heap[c + 1].at < heap[c].at)
+            ++c;
+
+        if (e.at <= heap[c].at)
+            break;
+
+        heap[i] = heap[c];
+        i = c;
+    }
+
+    heap[i] = e;
+}
+
+
+/* ==========================================================================
+    Moves entry 'i' up the heap until its parent expires sooner.
+   ========================================================================== */
+
+
+static void expire_sift_up
+(
+    size_t               i     /* index of entry to move */
+)
+{
+    struct expire_entry  e;    /* entry being moved */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    e = heap[i];
+    while (i && heap[(i - 1) / 2].at > e.at)
+    {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+
+    heap[i] = e;
+}
+
+
+/* ==========================================================================
+    Appends entry to the end of heap array, without restoring heap order.
+
+    returns
+            0       entry added
+           -1       no memory for entry
+   ========================================================================== */
+
+
+static int expire_push
+(
+    unsigned long        recno,  /* upload index record number */
+    time_t               ctime,  /* upload creation time */
+    unsigned long        size    /* upload size */
+)
+{
+    struct expire_entry *h;      /* reallocated heap */
+    size_t               ncap;   /* new heap capacity */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (nheap == heapcap)
+    {
+        ncap = heapcap ? heapcap * 2 : 1024;
+        if ((h = realloc(heap, ncap * sizeof(*heap))) == NULL)
+            return -1;
+
+        heap = h;
+        heapcap = ncap;
+    }
+
+    heap[nheap].at = expire_at(ctime, size);
+    heap[nheap].size = size;
+    heap[nheap].recno = recno;
+    ++nheap;
+    total += size;
+    return 0;
+}
+
+
+/* ==========================================================================
+    Child process that unlinks files, which names are received over pipe
+    'fd'. Unlinking file from huge directory can take a while, and we
+    don't want whole server to wait for it. Process exits once parent
+    closes its end of the pipe.
+   ========================================================================== */
+
+
+static void expire_reaper
+(
+    int      fd              /* pipe to read names from */
+)
+{
+    char     name[32 * 64];  /* names read from pipe */
+    size_t   have;           /* bytes in name buffer */
+    size_t   i;              /* offset of current name */
+    ssize_t  r;              /* return from read() */
+    int      i_fd;           /* fd to close */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    /* we don't need any sockets nor files parent has opened, and
+     * holding them would keep clients connected after server exits
+     */
+
+    for (i_fd = 3; i_fd != 1024; ++i_fd)
+        if (i_fd != fd)
+            close(i_fd);
+
+    /* ctrl-c goes to whole process group, but we want to finish
+     * what parent gave us, and parent will close pipe anyway
+     */
+
+    signal(SIGINT, SIG_IGN);
+    signal(SIGTERM, SIG_IGN);
+
+    have = 0;
+    for (;;)
+    {
+        r = read(fd, name + have, sizeof(name) - have);
+        if (r == 0)
+            _exit(0);
+
+        if (r < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            _exit(1);
+        }
+
+        /* names are written in one go, and are smaller than
+         * PIPE_BUF, so they are never interleaved, but read can
+         * still return in the middle of a name
+         */
+
+        have += r;
+        for (i = 0; i + 32 <= have; i += 32)
+        {
+            name[i + 31] = '\0';
+            unlink(name + i);
+        }
+
+        memmove(name, name + i, have - i);
+        have -= i;
+    }
+}
+
+
+/* ==========================================================================
+    Deletes upload described by 'e'. Packed uploads are removed from
+    segstore right away (that's cheap), regular files are handed over to
+    the reaper, or unlinked here when there is no reaper.
+
+    returns
+            0       upload deleted (or already gone)
+           -1       upload not deleted, errno is set
+
+    errno
+            EAGAIN  reaper is busy, try again later
+   ========================================================================== */
+
+
+static int expire_delete
+(
+    const struct expire_entry  *e     /* upload to delete */
+)
+{
+    struct upidx_rec            rec;  /* upload index record */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (upidx_read(e->recno, &rec) != 0)
+    {
+        el_perror(ELE, "couldn't read upload index record %lu", e->recno);
+        return 0;
+    }
+
+    if (rec.flags & UPIDX_DELETED)
+        return 0;
+
+    rec.name[sizeof(rec.name) - 1] = '\0';
+
+    if (rec.flags & UPIDX_PACKED)
+    {
+        if (segstore_remove(rec.name) != 0 && errno != ENOENT)
+            el_perror(ELE, "couldn't remove packed %s", rec.name);
+    }
+    else if (rfd != -1)
+    {
+        if (write(rfd, rec.name, sizeof(rec.name)) != sizeof(rec.name))
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                errno = EAGAIN;
+                return -1;
+            }
+
+            /* reaper is dead, from now on we unlink ourselves */
+
+            el_perror(ELE, "reaper is gone, deleting in server");
+            close(rfd);
+            rfd = -1;
+
+            if (unlink(rec.name) != 0 && errno != ENOENT)
+                el_perror(ELE, "couldn't unlink %s", rec.name);
+        }
+    }
+    else if (unlink(rec.name) != 0 && errno != ENOENT)
+        el_perror(ELE, "couldn't unlink %s", rec.name);
+
+    /* file is gone, or will be in a moment, so it must not be
+     * served from cache any more
+     */
+
+    cache_remove(rec.name);
+    if (upidx_mark_deleted(e->recno) != 0)
+        el_perror(ELE, "couldn't mark %s as deleted", rec.name);
+
+    el_print(ELD, "expired %s, %lu bytes", rec.name, e->size);
+    ++g_stats.expired;
+    return 0;
+}
+
+
+/* ==========================================================================
+                       __     __ _          ____
+        ____   __  __ / /_   / /(_)_____   / __/__  __ ____   _____ _____
+       / __ \ / / / // __ \ / // // ___/  / /_ / / / // __ \ / ___// ___/
+      / /_/ // /_/ // /_/ // // // /__   / __// /_/ // / / // /__ (__  )
+     / .___/ \__,_//_.___//_//_/ \___/  /_/   \__,_//_/ /_/ \___//____/
+    /_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Returns 1 when any retention policy is configured
+   ========================================================================== */
+
+
+int expire_enabled(void)
+{
+    return g_config.expire_max_age > 0 || g_config.store_budget > 0;
+}
+
+
+/* ==========================================================================
+    Builds expiry heap from all not yet deleted uploads in upload index
+    'idx'. Missing index is not an error, there is simply nothing to
+    expire yet.
+
+    returns
+            0       heap built, or expiry is disabled
+           -1       error, errno is set
+   ========================================================================== */
+
+
+int expire_init
+(
+    const char        *idx  /* path to upload index */
+)
+{
+    struct upidx_map   m;   /* mapped upload index */
+    size_t             i;   /* current record */
+    size_t             n;   /* number of live uploads */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (!expire_enabled())
+        return 0;
+
+    if (upidx_map(&m, idx) != 0)
+        return errno == ENOENT ? 0 : -1;
+
+    /* count first, so heap is allocated once, there may be
+     * millions of uploads
+     */
+
+    for (n = 0, i = 0; i != m.nrec; ++i)
+        n += !(m.rec[i].flags & UPIDX_DELETED);
+
+    if (n && (heap = malloc(n * sizeof(*heap))) == NULL)
+    {
+        upidx_unmap(&m);
+        return -1;
+    }
+
+    heapcap = n;
+    for (i = 0; i != m.nrec; ++i)
+        if (!(m.rec[i].flags & UPIDX_DELETED))
+            expire_push(i, m.rec[i].ctime, m.rec[i].size);
+
+    upidx_unmap(&m);
+
+    /* bottom-up heapify, O(n), and since index is ordered by
+     * creation time, without size scaling it's already a heap
+     */
+
+    for (i = nheap / 2; i-- != 0;)
+        expire_sift_down(i);
+
+    g_stats.expire_pending = nheap;
+    g_stats.store_bytes = total;
+    el_print(ELN, "%lu uploads with %llu bytes scheduled for expiry",
+            (unsigned long)nheap, total);
+    return 0;
+}
+
+
+/* ==========================================================================
+    Starts reaper process. Must be called after privileges are dropped,
+    so reaper cannot delete anything server couldn't. When reaper cannot
+    be started, files are unlinked by server itself.
+
+    returns
+            0       reaper started, or expiry is disabled
+           -1       error, errno is set
+   ========================================================================== */
+
+
+int expire_start(void)
+{
+    int  fd[2];  /* pipe between server and reaper */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (!expire_enabled())
+        return 0;
+
+    if (pipe(fd) != 0)
+        return -1;
+
+    if ((reaper = fork()) < 0)
+    {
+        close(fd[0]);
+        close(fd[1]);
+        return -1;
+    }
+
+    if (reaper == 0)
+    {
+        close(fd[1]);
+        expire_reaper(fd[0]);
+    }
+
+    close(fd[0]);
+    rfd = fd[1];
+
+    /* never block server on full pipe, we will retry next time */
+
+    fcntl(rfd, F_SETFL, fcntl(rfd, F_GETFL) | O_NONBLOCK);
+    fcntl(rfd, F_SETFD, FD_CLOEXEC);
+    return 0;
+}
+
+
+/* ==========================================================================
+    Stops reaper, waiting for it to delete what it has been given, and
+    frees heap.
+   ========================================================================== */
+
+
+void expire_destroy(void)
+{
+    if (rfd != -1)
+        close(rfd);
+
+    if (reaper > 0)
+        waitpid(reaper, NULL, 0);
+
+    free(heap);
+    heap = NULL;
+    nheap = heapcap = 0;
+    total = 0;
+    rfd = -1;
+    reaper = -1;
+}
+
+
+/* ==========================================================================
+    Schedules freshly finished upload, stored in upload index under
+    'recno', for expiry. Failure only means upload will not expire until
+    restart, so it's only logged.
+   ========================================================================== */
+
+
+void expire_add
+(
+    unsigned long  recno,  /* upload index record number */
+    time_t         ctime,  /* upload creation time */
+    unsigned long  size    /* upload size */
+)
+{
+    if (!expire_enabled())
+        return;
+
+    if (expire_push(recno, ctime, size) != 0)
+    {
+        el_perror(ELW, "no memory to schedule upload %lu for expiry", recno);
+        return;
+    }
+
+    expire_sift_up(nheap - 1);
+    g_stats.expire_pending = nheap;
+    g_stats.store_bytes = total;
+}
+
+
+/* ==========================================================================
+    Deletes uploads which time has come, and oldest ones while whole
+    store is over budget. At most EXPIRE_BATCH uploads are deleted at
+    once, so call it once a second or so, and rest will be deleted on
+    subsequent calls.
+   ========================================================================== */
+
+
+void expire_run
+(
+    time_t    now   /* current time */
+)
+{
+    unsigned  n;    /* number of uploads deleted so far */
+    int       due;  /* upload on top has expired */
+    int       over; /* store is over budget */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (n = 0; n != EXPIRE_BATCH && nheap; ++n)
+    {
+        due = g_config.expire_max_age && heap[0].at <= now;
+        over = g_config.store_budget &&
+            total > (unsigned long long)g_config.store_budget;
+
+        if (!due && !over)
+            break;
+
+        if (expire_delete(&heap[0]) != 0)
+            break;
+
+        total -= heap[0].size;
+        heap[0] = heap[--nheap];
+        if (nheap)
+            expire_sift_down(0);
+    }
+
+    g_stats.expire_pending = nheap;
+    g_stats.store_bytes = total;
+}
@@ -0,0 +1,22 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef EXPIRE_H
+#define EXPIRE_H 1
+
+#include <time.h>
+
+/* max number of uploads deleted in single expire_run() call */
+
+#define EXPIRE_BATCH 128
+
+int expire_enabled(void);
+int expire_init(const char *idx);
+int expire_start(void);
+void expire_destroy(void);
+void expire_add(unsigned long recno, time_t ctime, unsigned long size);
+void expire_run(time_t now);
+
+#endif
@@ -17,6 +17,11 @@
 
 #define _POSIX_C_SOURCE 200112L
 
+/* pread() in POSIX.1-2001 is part of XSI extension
+ */
+
+#define _XOPEN_SOURCE 600
+
 /* on freebsd INADDR_NONE is not visible without __BSD_VISIBLE
  */
 
@@ -44,3 +49,10 @@
 #if sun || __sun
 #   define __EXTENSIONS__ 1
 #endif
+
+/* accept4() is not in posix, glibc declares it only with _GNU_SOURCE
+ */
+
+#if __linux__ && HAVE_ACCEPT4
+#   define _GNU_SOURCE 1
+#endif
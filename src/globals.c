@@ -17,6 +17,7 @@
 #include "feature.h"
 
 #include "config.h"
+#include "stats.h"
 #include <embedlog.h>
 
 
@@ -35,3 +36,5 @@ struct el      g_qlog;      /* options for embedlog to print query logs */
 int            g_shutdown;  /* flag indicating that program should die */
 int            g_stfu;      /* someone relly want to kill us FAST */
 int            g_sigalrm;   /* sigalrm has been received */
+int            g_sighup;    /* sighup has been received, reload list */
+struct stats   g_stats;     /* runtime statistics */
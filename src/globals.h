@@ -7,12 +7,15 @@
 #define GLOBALS_H 1
 
 #include "config.h"
+#include "stats.h"
 #include <embedlog.h>
 
 extern struct config  g_config;
 extern int            g_shutdown;
 extern int            g_stfu;
 extern int            g_sigalrm;
+extern int            g_sighup;
 extern struct el      g_qlog;
+extern struct stats   g_stats;
 
 #endif
@@ -0,0 +1,710 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         -------------------------------------------------------------
+        / Bare minimum of HTTP/1.1 we need to speak with curl and web \
+        | browsers. Request parsing is done in place, on the buffer   |
+        | received from client, so nothing is allocated here.         |
+        \ There are also some helpers for dates and ranges.           /
+         -------------------------------------------------------------
+          \
+           \   ^__^
+            \  (oo)\_______
+               (__)\       )\/\
+                   ||----w |
+                   ||     ||
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "feature.h"
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "http.h"
+
+/* biggest value of off_t, its size depends on platform and on
+ * _FILE_OFFSET_BITS, and it's signed, so it's built without
+ * shifting into sign bit
+ */
+
+#define HTTP_OFF_MAX \
+    ((((off_t)1 << (sizeof(off_t) * CHAR_BIT - 2)) - 1) * 2 + 1)
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+static const char  *wdays[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri",
+    "Sat" };
+
+static const char  *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Returns number of days since 1970-01-01 for given civil date. We cannot
+    use timegm() as it's not portable, and mktime() works in local time,
+    which is of no use to us, since http dates are always in GMT.
+   ========================================================================== */
+
+
+static long http_days_from_civil
+(
+    long      y,    /* full year, like 1994 */
+    unsigned  m,    /* month 1-12 */
+    unsigned  d     /* day of month 1-31 */
+)
+{
+    long      era;  /* 400 years era */
+    unsigned  yoe;  /* year of era */
+    unsigned  doy;  /* day of year, counting from march */
+    unsigned  doe;  /* day of era */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    y -= m <= 2;
+    era = (y >= 0 ? y : y - 399) / 400;
+    yoe = (unsigned)(y - era * 400);
+    doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + (long)doe - 719468;
+}
+
+
+/* ==========================================================================
+    Parses decimal number from 's', 'end' will point to first character
+    after the number. Returns -1 when there is no number at 's' or it is
+    too big to fit off_t.
+   ========================================================================== */
+
+
+static off_t http_parse_off
+(
+    const char   *s,    /* string to parse */
+    const char  **end   /* first character after number will be here */
+)
+{
+    off_t         v;    /* parsed value */
+    int           d;    /* current digit */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (!isdigit((unsigned char)*s))
+        return -1;
+
+    for (v = 0; isdigit((unsigned char)*s); ++s)
+    {
+        /* check before multiplying, v * 10 + d would
+         * overflow off_t, and that is undefined
+         */
+
+        d = *s - '0';
+        if (v > (HTTP_OFF_MAX - d) / 10)
+            return -1;
+
+        v = v * 10 + d;
+    }
+
+    *end = s;
+    return v;
+}
+
+
+/* ==========================================================================
+                       __     __ _          ____
+        ____   __  __ / /_   / /(_)_____   / __/__  __ ____   _____ _____
+       / __ \ / / / // __ \ / // // ___/  / /_ / / / // __ \ / ___// ___/
+      / /_/ // /_/ // /_/ // // // /__   / __// /_/ // / / // /__ (__  )
+     / .___/ \__,_//_.___//_//_/ \___/  /_/   \__,_//_/ /_/ \___//____/
+    /_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Searches 'buf' for the end of request head, that is empty line. Both
+    "\r\n\r\n" and "\n\n" are accepted, as rfc says we should be lenient.
+
+    return
+            >0      length of request head, including empty line
+            -1      request head is not yet complete
+   ========================================================================== */
+
+
+ssize_t http_request_end
+(
+    const char  *buf,  /* buffer with data received from client */
+    size_t       len   /* number of bytes in buf */
+)
+{
+    size_t       i;    /* current position in buf */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (i = 0; i < len; ++i)
+    {
+        if (buf[i] != '\n')
+            continue;
+
+        if (i + 1 < len && buf[i + 1] == '\n')
+            return i + 2;
+
+        if (i + 2 < len && buf[i + 1] == '\r' && buf[i + 2] == '\n')
+            return i + 3;
+    }
+
+    return -1;
+}
+
+
+/* ==========================================================================
+    Parses request head stored in 'buf' of 'len' length (as returned by
+    http_request_end()). Parsing is done in place, 'buf' is modified and
+    'req' will contain pointers to it, so 'buf' must be valid as long as
+    'req' is used. Headers that don't fit into 'req' are silently ignored.
+
+    return
+            0       request parsed
+           -1       malformed request
+   ========================================================================== */
+
+
+int http_parse_request
+(
+    char                 *buf,   /* request head to parse */
+    size_t                len,   /* length of request head */
+    struct http_request  *req    /* parsed request will be stored here */
+)
+{
+    char                 *line;  /* current line being parsed */
+    char                 *next;  /* next line to parse */
+    char                 *end;   /* end of request head */
+    char                 *p;     /* helper pointer */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    memset(req, 0x00, sizeof(*req));
+    end = buf + len;
+
+    for (line = buf; line < end; line = next)
+    {
+        /* cut line at '\n', and also remove '\r' from the end */
+
+        if ((next = memchr(line, '\n', end - line)) == NULL)
+            return -1;
+
+        *next++ = '\0';
+        if (next - 2 >= line && next[-2] == '\r')
+            next[-2] = '\0';
+
+        if (*line == '\0')
+        {
+            /* empty line, end of request head, we are done here if
+             * we managed to parse request line, or go on if this is
+             * empty line before request line, rfc allows that
+             */
+
+            if (req->method)
+                return 0;
+
+            continue;
+        }
+
+        if (req->method == NULL)
+        {
+            /* first line is always a request line
+             * METHOD SP TARGET SP HTTP/1.x
+             */
+
+            req->method = line;
+            if ((p = strchr(line, ' ')) == NULL)
+                return -1;
+
+            *p++ = '\0';
+            req->target = p;
+            if ((p = strchr(p, ' ')) == NULL)
+                return -1;
+
+            *p++ = '\0';
+            if (strncmp(p, "HTTP/1.", 7) != 0 || !isdigit((unsigned char)p[7]))
+                return -1;
+
+            req->minor = p[7] - '0';
+            continue;
+        }
+
+        /* header line, "Name: value" */
+
+        if ((p = strchr(line, ':')) == NULL)
+            return -1;
+
+        if (p == line || isspace((unsigned char)p[-1]))
+        {
+            /* rfc 7230 3.2.4, no whitespace is allowed between
+             * name and colon
+             */
+
+            return -1;
+        }
+
+        if (req->nhdr == HTTP_MAX_HEADERS)
+            continue;
+
+        *p++ = '\0';
+        while (*p == ' ' || *p == '\t')
+            ++p;
+
+        req->hdr[req->nhdr].name = line;
+        req->hdr[req->nhdr].value = p;
+        ++req->nhdr;
+
+        /* trim trailing whitespaces from value */
+
+        for (p += strlen(p); p != req->hdr[req->nhdr - 1].value &&
+                (p[-1] == ' ' || p[-1] == '\t'); --p)
+            p[-1] = '\0';
+    }
+
+    /* we never reached empty line */
+
+    return -1;
+}
+
+
+/* ==========================================================================
+    Returns value of header 'name' or NULL if there is no such header in
+    request. Header names are case insensitive.
+   ========================================================================== */
+
+
+const char *http_header
+(
+    const struct http_request  *req,   /* request to search header in */
+    const char                 *name   /* header name to look for */
+)
+{
+    int                         i;     /* current header index */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (i = 0; i != req->nhdr; ++i)
+        if (strcasecmp(req->hdr[i].name, name) == 0)
+            return req->hdr[i].value;
+
+    return NULL;
+}
+
+
+/* ==========================================================================
+    Checks whether connection should be kept open after response is sent.
+    HTTP/1.1 is persistent by default, HTTP/1.0 needs to explicitly ask for
+    it.
+   ========================================================================== */
+
+
+int http_keep_alive
+(
+    const struct http_request  *req   /* request to check */
+)
+{
+    const char                 *conn; /* value of Connection header */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    conn = http_header(req, "Connection");
+
+    if (req->minor == 0)
+        return conn && strcasecmp(conn, "keep-alive") == 0;
+
+    return conn == NULL || strcasecmp(conn, "close") != 0;
+}
+
+
+/* ==========================================================================
+    Returns reason phrase for http status 'code'
+   ========================================================================== */
+
+
+const char *http_status_text
+(
+    int  code  /* http status code */
+)
+{
+    switch (code)
+    {
+    case 200: return "OK";
+    case 201: return "Created";
+    case 206: return "Partial Content";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 408: return "Request Timeout";
+    case 411: return "Length Required";
+    case 413: return "Payload Too Large";
+    case 416: return "Range Not Satisfiable";
+    case 429: return "Too Many Requests";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 503: return "Service Unavailable";
+    default:  return "Unknown";
+    }
+}
+
+
+/* ==========================================================================
+    Formats time 't' into IMF-fixdate, like "Sun, 06 Nov 1994 08:49:37 GMT".
+    'buf' must be at least HTTP_DATE_LEN bytes long. We don't use strftime()
+    since it's locale dependant, and http is not.
+   ========================================================================== */
+
+
+void http_format_date
+(
+    time_t      t,    /* time to format */
+    char       *buf   /* formatted time will be stored here */
+)
+{
+    struct tm   tm;   /* broken down time 't' */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    gmtime_r(&t, &tm);
+    sprintf(buf, "%s, %02d %s %04d %02d:%02d:%02d GMT",
+            wdays[tm.tm_wday], tm.tm_mday, months[tm.tm_mon],
+            tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+
+/* ==========================================================================
+    Parses IMF-fixdate (the only format we send, so the only one browsers
+    will send back to us in If-Modified-Since). Obsolete rfc850 and asctime
+    formats are not supported.
+
+    return
+            >=0     parsed time
+            -1      date is not in IMF-fixdate format
+   ========================================================================== */
+
+
+time_t http_parse_date
+(
+    const char  *date    /* date to parse */
+)
+{
+    char         mon[4]; /* month name */
+    int          d;      /* day of month */
+    int          y;      /* year */
+    int          h;      /* hour */
+    int          mi;     /* minute */
+    int          s;      /* second */
+    int          m;      /* month index */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    /* sscanf() can't tell us if literal after last conversion
+     * matched, so " GMT" is checked by hand
+     */
+
+    if (strlen(date) != HTTP_DATE_LEN - 1 || date[3] != ',' ||
+            strcmp(date + 25, " GMT") != 0)
+        return -1;
+
+    if (sscanf(date + 5, "%2d %3s %4d %2d:%2d:%2d",
+                &d, mon, &y, &h, &mi, &s) != 6)
+        return -1;
+
+    for (m = 0; m != 12; ++m)
+        if (strcmp(mon, months[m]) == 0)
+            break;
+
+    /* %d happily takes sign, so negative values must be
+     * rejected too, dates before epoch can't be returned
+     */
+
+    if (m == 12 || d < 1 || d > 31 || y < 1970 || h < 0 || h > 23 ||
+            mi < 0 || mi > 59 || s < 0 || s > 60)
+        return -1;
+
+    return (time_t)http_days_from_civil(y, m + 1, d) * 86400 +
+        h * 3600 + mi * 60 + s;
+}
+
+
+/* ==========================================================================
+    Parses value of Range header for resource of 'size' bytes. Only single
+    byte range is supported, for multiple ranges we would have to respond
+    with multipart/byteranges, which is not worth it - nobody really uses
+    it and rfc allows us to ignore Range header altogether.
+
+    return
+            0       range is valid, 'first' and 'last' are set (inclusive)
+            1       range should be ignored, send whole resource
+           -1       range is not satisfiable, respond with 416
+   ========================================================================== */
+
+
+int http_parse_range
+(
+    const char  *range,  /* value of Range header */
+    off_t        size,   /* size of the resource */
+    off_t       *first,  /* first byte of range will be stored here */
+    off_t       *last    /* last byte (inclusive) will be stored here */
+)
+{
+    const char  *p;      /* current position in range */
+    off_t        f;      /* parsed first byte position */
+    off_t        l;      /* parsed last byte position */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (strncmp(range, "bytes=", 6) != 0 || strchr(range, ',') != NULL)
+        return 1;
+
+    p = range + 6;
+
+    if (*p == '-')
+    {
+        /* suffix range, "bytes=-500" means last 500 bytes */
+
+        if ((l = http_parse_off(p + 1, &p)) < 0 || *p != '\0')
+            return 1;
+
+        if (l == 0 || size == 0)
+            return -1;
+
+        *first = l > size ? 0 : size - l;
+        *last = size - 1;
+        return 0;
+    }
+
+    if ((f = http_parse_off(p, &p)) < 0 || *p++ != '-')
+        return 1;
+
+    if (*p == '\0')
+    {
+        /* open range, "bytes=500-" means from 500 to the end */
+
+        l = size - 1;
+    }
+    else if ((l = http_parse_off(p, &p)) < 0 || *p != '\0' || l < f)
+    {
+        return 1;
+    }
+
+    if (f >= size)
+        return -1;
+
+    *first = f;
+    *last = l >= size ? size - 1 : l;
+    return 0;
+}
+
+
+/* ==========================================================================
+    Parses value of Content-Length header.
+
+    return
+            >=0     parsed length
+            -1      value is not a valid length
+   ========================================================================== */
+
+
+off_t http_content_length
+(
+    const char  *value  /* value of Content-Length header */
+)
+{
+    const char  *end;   /* first character after number */
+    off_t        len;   /* parsed length */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if ((len = http_parse_off(value, &end)) < 0 || *end != '\0')
+        return -1;
+
+    return len;
+}
+
+
+/* ==========================================================================
+    Initializes chunked decoder, must be called before first call to
+    http_chunked_decode()
+   ========================================================================== */
+
+
+void http_chunked_init
+(
+    struct http_chunked  *ch  /* decoder to initialize */
+)
+{
+    ch->state = http_chunked_size;
+    ch->left = 0;
+    ch->ndigits = 0;
+}
+
+
+/* ==========================================================================
+    Decodes chunked transfer encoding. Data in 'buf' of '*len' bytes is
+    decoded in place, so after function returns, 'buf' holds '*len' bytes
+    of payload, with all chunk sizes, extensions and trailers stripped.
+    Data can be passed in pieces of any size, decoder state is kept in
+    'ch'. Anything after last chunk is ignored.
+
+    return
+            0       all data decoded, more chunks are expected
+            1       last chunk has been decoded, body is complete
+           -1       malformed chunked encoding
+   ========================================================================== */
+
+
+int http_chunked_decode
+(
+    struct http_chunked  *ch,    /* decoder state */
+    unsigned char        *buf,   /* data to decode in place */
+    size_t               *len    /* in: length of buf, out: payload length */
+)
+{
+    unsigned char        *in;    /* next byte to decode */
+    unsigned char        *out;   /* where next payload byte goes */
+    unsigned char        *end;   /* end of data in buf */
+    size_t                n;     /* number of payload bytes to copy */
+    int                   c;     /* current character */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    in = buf;
+    out = buf;
+    end = buf + *len;
+
+    while (in != end && ch->state != http_chunked_done)
+    {
+        if (ch->state == http_chunked_data)
+        {
+            /* payload is copied in bulk, no need to look at it */
+
+            n = (size_t)(end - in) < ch->left ? (size_t)(end - in) : ch->left;
+            memmove(out, in, n);
+            out += n;
+            in += n;
+
+            if ((ch->left -= n) == 0)
+                ch->state = http_chunked_data_end;
+
+            continue;
+        }
+
+        c = *in++;
+
+        switch (ch->state)
+        {
+        case http_chunked_size:
+            if (isxdigit(c))
+            {
+                /* 15 hex digits is more than enough for any upload,
+                 * and won't overflow 64bit value
+                 */
+
+                if (++ch->ndigits > 15)
+                    return -1;
+
+                ch->left = ch->left * 16 +
+                    (isdigit(c) ? c - '0' : tolower(c) - 'a' + 10);
+                break;
+            }
+
+            if (ch->ndigits == 0)
+                return -1;
+
+            /* chunk extension, or end of chunk size line, we
+             * don't care about extensions, so just skip them
+             */
+
+            if (c == ';' || c == ' ' || c == '\t' || c == '\r')
+                ch->state = http_chunked_ext;
+            else if (c == '\n')
+                ch->state = ch->left ? http_chunked_data : http_chunked_trailer;
+            else
+                return -1;
+
+            break;
+
+        case http_chunked_ext:
+            if (c == '\n')
+                ch->state = ch->left ? http_chunked_data : http_chunked_trailer;
+
+            break;
+
+        case http_chunked_data_end:
+            /* every chunk data ends with CRLF, we also accept
+             * bare LF
+             */
+
+            if (c == '\r')
+                break;
+
+            if (c != '\n')
+                return -1;
+
+            ch->state = http_chunked_size;
+            ch->ndigits = 0;
+            ch->left = 0;
+            break;
+
+        case http_chunked_trailer:
+            /* beginning of trailer line, empty line ends body */
+
+            if (c == '\r')
+                break;
+
+            ch->state = c == '\n' ?
+                http_chunked_done : http_chunked_trailer_line;
+            break;
+
+        case http_chunked_trailer_line:
+            if (c == '\n')
+                ch->state = http_chunked_trailer;
+
+            break;
+
+        default:
+            return -1;
+        }
+    }
+
+    *len = out - buf;
+    return ch->state == http_chunked_done;
+}
@@ -0,0 +1,70 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef HTTP_H
+#define HTTP_H 1
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+/* maximum number of headers we care to parse from single request */
+
+#define HTTP_MAX_HEADERS 32
+
+/* enough to hold "Sun, 06 Nov 1994 08:49:37 GMT" and null */
+
+#define HTTP_DATE_LEN (29 + 1)
+
+struct http_header
+{
+    const char  *name;   /* header name, like "Content-Length" */
+    const char  *value;  /* header value with leading spaces stripped */
+};
+
+struct http_request
+{
+    const char          *method;   /* request method, like "GET" */
+    const char          *target;   /* request target, like "/x-c/f3jds" */
+    int                  minor;    /* http minor version, 1.0 or 1.1 */
+    int                  nhdr;     /* number of parsed headers in hdr */
+    struct http_header   hdr[HTTP_MAX_HEADERS];  /* parsed headers */
+};
+
+/* states of chunked transfer encoding decoder */
+
+enum http_chunked_state
+{
+    http_chunked_size,          /* reading hex chunk size */
+    http_chunked_ext,           /* skipping chunk extension */
+    http_chunked_data,          /* reading chunk data */
+    http_chunked_data_end,      /* reading CRLF after chunk data */
+    http_chunked_trailer,       /* at the beginning of trailer line */
+    http_chunked_trailer_line,  /* skipping trailer line */
+    http_chunked_done           /* last chunk and trailers decoded */
+};
+
+struct http_chunked
+{
+    enum http_chunked_state  state;    /* current decoder state */
+    unsigned long long       left;     /* bytes left in current chunk */
+    int                      ndigits;  /* digits read in chunk size */
+};
+
+ssize_t http_request_end(const char *buf, size_t len);
+int http_parse_request(char *buf, size_t len, struct http_request *req);
+const char *http_header(const struct http_request *req, const char *name);
+int http_keep_alive(const struct http_request *req);
+const char *http_status_text(int code);
+void http_format_date(time_t t, char *buf);
+time_t http_parse_date(const char *date);
+int http_parse_range(const char *range, off_t size, off_t *first,
+    off_t *last);
+off_t http_content_length(const char *value);
+void http_chunked_init(struct http_chunked *ch);
+int http_chunked_decode(struct http_chunked *ch, unsigned char *buf,
+    size_t *len);
+
+#endif
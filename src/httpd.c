@@ -0,0 +1,999 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         -------------------------------------------------------------
+        / Tiny http server that serves files uploaded to termsend. It \
+        | only knows GET and HEAD, but does it well - files are sent  |
+        | with sendfile() so data never leaves kernel, conditional    |
+        | and range requests are supported so browsers and download   |
+        | managers are happy. All sockets are non-blocking and are    |
+        \ processed in the same select() loop as uploads.             /
+         -------------------------------------------------------------
+             \
+              \    .--.
+               \  |o_o |
+                  |:_/ |
+                 //   \ \
+                (|     | )
+               /'\_   _/`\
+               \___)=(___/
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "feature.h"
+
+#include <arpa/inet.h>
+#include <embedlog.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#if HAVE_SYS_SENDFILE_H
+#   include <sys/sendfile.h>
+#endif
+
+#include "cache.h"
+#include "globals.h"
+#include "http.h"
+#include "httpd.h"
+#include "segstore.h"
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* maximum number of bytes we send to single client in one loop
+ * iteration, so one fast client cannot starve others
+ */
+
+#define HTTPD_SEND_BUDGET (512 * 1024)
+
+enum hstate
+{
+    hstate_free,  /* slot is not used */
+    hstate_read,  /* waiting for (rest of) request head */
+    hstate_send   /* sending response */
+};
+
+/* struct holding info about connected http client */
+
+struct hinfo
+{
+    int                  cfd;         /* client socket */
+    int                  ffd;         /* file we send to client, -1 if none */
+    struct cache_entry  *ce;          /* cached file we send, NULL if none */
+    enum hstate          state;       /* current state of connection */
+    int                  keep_alive;  /* keep connection after response? */
+    char                 ips[INET6_ADDRSTRLEN]; /* client's ip, for logs */
+    char                 req[4096];   /* buffer for request head(s) */
+    size_t               reqlen;      /* number of bytes in req */
+    char                 hdr[1024];   /* response head to send */
+    size_t               hdrlen;      /* length of response head */
+    size_t               hdrsent;     /* bytes of response head already sent */
+    off_t                base;        /* where upload starts in ffd */
+    off_t                off;         /* next byte of file to send */
+    off_t                end;         /* byte after last byte to send */
+    time_t               timeout_at;  /* client is disconnected after that */
+};
+
+static struct hinfo  *hi;    /* http clients info array */
+static unsigned       nhi;   /* number of allocated hi elements */
+static unsigned       nconn; /* number of connected http clients */
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Returns current monotonic time in seconds. Seconds resolution is all we
+    need for http timeouts.
+   ========================================================================== */
+
+
+static time_t httpd_now(void)
+{
+    struct timespec  now;  /* current time */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+
+/* ==========================================================================
+    Formats address of client 'ss' into 'ips'. ipv4 client connected to
+    dual stack socket is printed as plain ipv4, without ::ffff: prefix.
+   ========================================================================== */
+
+
+static void httpd_format_ip
+(
+    const struct sockaddr_storage  *ss,    /* address to format */
+    char                           *ips    /* INET6_ADDRSTRLEN buffer */
+)
+{
+    const struct in6_addr          *a6;    /* ss as ipv6 address */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (ss->ss_family != AF_INET6)
+    {
+        inet_ntop(AF_INET, &((const struct sockaddr_in *)ss)->sin_addr,
+                ips, INET6_ADDRSTRLEN);
+        return;
+    }
+
+    a6 = &((const struct sockaddr_in6 *)ss)->sin6_addr;
+    if (IN6_IS_ADDR_V4MAPPED(a6))
+        inet_ntop(AF_INET, a6->s6_addr + 12, ips, INET6_ADDRSTRLEN);
+    else
+        inet_ntop(AF_INET6, a6, ips, INET6_ADDRSTRLEN);
+}
+
+
+/* ==========================================================================
+    Releases source of response body, be it file or cache entry
+   ========================================================================== */
+
+
+static void httpd_release_body
+(
+    struct hinfo  *h   /* client to release body for */
+)
+{
+    if (h->ffd != -1)
+        close(h->ffd);
+
+    if (h->ce)
+        cache_release(h->ce);
+
+    h->ffd = -1;
+    h->ce = NULL;
+}
+
+
+/* ==========================================================================
+    Closes connection with client and frees its slot
+   ========================================================================== */
+
+
+static void httpd_close
+(
+    struct hinfo  *h   /* client to close */
+)
+{
+    httpd_release_body(h);
+    close(h->cfd);
+    h->cfd = -1;
+    h->state = hstate_free;
+    --nconn;
+}
+
+
+/* ==========================================================================
+    Checks if 'name' looks like a file name generated by server. We don't
+    allow anything else to be downloaded, so there is no way for anyone to
+    use ".." or any other trick to escape output directory.
+   ========================================================================== */
+
+
+static int httpd_valid_fname
+(
+    const char  *name,  /* name to check */
+    size_t       len    /* length of name */
+)
+{
+    size_t       i;     /* iterator */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    /* server generates names up to 31 characters */
+
+    if (len == 0 || len > 31)
+        return 0;
+
+    for (i = 0; i != len; ++i)
+        if (!((name[i] >= '0' && name[i] <= '9') ||
+                (name[i] >= 'a' && name[i] <= 'z')))
+            return 0;
+
+    return 1;
+}
+
+
+/* ==========================================================================
+    Checks if 'mime' looks like a mime subtype, like "x-c" or "x-shellscript"
+    which is prepended by server to the link when ft based urls are enabled.
+   ========================================================================== */
+
+
+static int httpd_valid_mime
+(
+    const char  *mime,  /* mime subtype to check */
+    size_t       len    /* length of mime */
+)
+{
+    size_t       i;     /* iterator */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (len == 0 || len > 64)
+        return 0;
+
+    for (i = 0; i != len; ++i)
+        if (!((mime[i] >= '0' && mime[i] <= '9') ||
+                (mime[i] >= 'a' && mime[i] <= 'z') ||
+                (mime[i] >= 'A' && mime[i] <= 'Z') ||
+                mime[i] == '-' || mime[i] == '.' || mime[i] == '+'))
+            return 0;
+
+    return 1;
+}
+
+
+/* ==========================================================================
+    Prepares response without body (or with short text body) for client.
+    Used for errors and 304. After this, client is in send state.
+   ========================================================================== */
+
+
+static void httpd_prepare_status
+(
+    struct hinfo  *h,      /* client to prepare response for */
+    int            code,   /* http status code */
+    int            body,   /* add short body describing error? */
+    const char    *extra   /* extra headers to add, with \r\n, or NULL */
+)
+{
+    char           date[HTTP_DATE_LEN];  /* current date */
+    const char    *text;   /* status text */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    text = http_status_text(code);
+    http_format_date(time(NULL), date);
+
+    h->hdrlen = sprintf(h->hdr,
+            "HTTP/1.1 %d %s\r\n"
+            "Server: termsend\r\n"
+            "Date: %s\r\n"
+            "%s"
+            "Content-Length: %lu\r\n"
+            "%s"
+            "Connection: %s\r\n"
+            "\r\n"
+            "%s%s",
+            code, text, date,
+            body ? "Content-Type: text/plain\r\n" : "",
+            body ? (unsigned long)strlen(text) + 1 : 0lu,
+            extra ? extra : "",
+            h->keep_alive ? "keep-alive" : "close",
+            body ? text : "", body ? "\n" : "");
+
+    h->hdrsent = 0;
+    h->off = 0;
+    h->end = 0;
+    h->state = hstate_send;
+}
+
+
+/* ==========================================================================
+    Processes single, complete request head of 'len' bytes stored at the
+    beginning of h->req. Function prepares response (opens file, generates
+    head) and switches client to send state. Actual sending is done by
+    httpd_send().
+   ========================================================================== */
+
+
+static void httpd_prepare_response
+(
+    struct hinfo         *h,         /* client to prepare response for */
+    size_t                len        /* length of request head in h->req */
+)
+{
+    struct http_request   req;       /* parsed request */
+    struct stat           st;        /* info about requested file */
+    char                 *path;      /* requested path */
+    char                 *name;      /* requested file name */
+    char                 *p;         /* helper pointer */
+    const char           *mime;      /* mime subtype from path or NULL */
+    const char           *v;         /* value of some header */
+    char                  etag[64];  /* entity tag of requested file */
+    char                  lmod[HTTP_DATE_LEN];  /* file modification date */
+    char                  date[HTTP_DATE_LEN];  /* current date */
+    char                  range[128];  /* Content-Range header */
+    off_t                 first;     /* first byte of range to send */
+    off_t                 last;      /* last byte of range to send */
+    int                   code;      /* response status code */
+    int                   r;         /* return from range parsing */
+    int                   head;      /* is this HEAD request? */
+    off_t                 size;      /* size of requested file */
+    size_t                plen;      /* size of packed upload */
+    time_t                mtime;     /* modification time of requested file */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    h->keep_alive = 0;
+
+    if (http_parse_request(h->req, len, &req) != 0)
+    {
+        el_print(ELD, "[%s] malformed http request", h->ips);
+        httpd_prepare_status(h, 400, 1, NULL);
+        return;
+    }
+
+    el_print(ELD, "[%s] %s %s", h->ips, req.method, req.target);
+    h->keep_alive = http_keep_alive(&req);
+
+    /* we don't read request bodies, if client sends one we
+     * will not be able to find next request in the stream,
+     * so in that case we close connection after response
+     */
+
+    if (http_header(&req, "Transfer-Encoding") ||
+            ((v = http_header(&req, "Content-Length")) && strcmp(v, "0")))
+        h->keep_alive = 0;
+
+    head = strcmp(req.method, "HEAD") == 0;
+    if (!head && strcmp(req.method, "GET") != 0)
+    {
+        httpd_prepare_status(h, 405, 1, "Allow: GET, HEAD\r\n");
+        return;
+    }
+
+    /* we don't care about query string */
+
+    path = (char *)req.target;
+    if ((p = strchr(path, '?')) != NULL)
+        *p = '\0';
+
+    if (*path++ != '/')
+    {
+        httpd_prepare_status(h, 400, 1, NULL);
+        return;
+    }
+
+    /* link generated by server can be either "/f3jds" or, when
+     * ft based urls are enabled "/x-c/f3jds". Mime part is used
+     * to tell client what content type it is. Anything else is
+     * not something we generated, so it cannot exist.
+     */
+
+    mime = NULL;
+    name = path;
+    if ((p = strchr(path, '/')) != NULL)
+    {
+        *p = '\0';
+        mime = path;
+        name = p + 1;
+
+        if (!httpd_valid_mime(mime, strlen(mime)))
+        {
+            httpd_prepare_status(h, 404, 1, NULL);
+            return;
+        }
+    }
+
+    if (!httpd_valid_fname(name, strlen(name)))
+    {
+        httpd_prepare_status(h, 404, 1, NULL);
+        return;
+    }
+
+    ++g_stats.http_requests;
+
+    /* fresh uploads are most likely in cache, and then we don't
+     * have to touch filesystem at all
+     */
+
+    h->base = 0;
+    if ((h->ce = cache_get(name)) != NULL)
+    {
+        size = h->ce->len;
+        mtime = h->ce->mtime;
+    }
+    else if ((h->ffd = segstore_open(name, &h->base, &plen, &mtime)) >= 0)
+    {
+        /* small upload, packed together with others in segment
+         * file, it's sent just like regular file, only starting
+         * at different offset
+         */
+
+        size = plen;
+    }
+    else
+    {
+        /* we are chdir()ed into output directory, so name can be
+         * opened directly
+         */
+
+        if ((h->ffd = open(name, O_RDONLY)) < 0)
+        {
+            httpd_prepare_status(h, errno == ENOENT ? 404 : 500, 1, NULL);
+            return;
+        }
+
+        if (fstat(h->ffd, &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            httpd_release_body(h);
+            httpd_prepare_status(h, 404, 1, NULL);
+            return;
+        }
+
+        size = st.st_size;
+        mtime = st.st_mtime;
+    }
+
+    sprintf(etag, "\"%lx-%lx\"", (unsigned long)mtime, (unsigned long)size);
+    http_format_date(mtime, lmod);
+
+    /* conditional requests, If-None-Match takes precedence over
+     * If-Modified-Since as rfc 7232 6 says.
+     */
+
+    if ((v = http_header(&req, "If-None-Match")) != NULL)
+    {
+        if (strcmp(v, "*") == 0 || strstr(v, etag) != NULL)
+            goto not_modified;
+    }
+    else if ((v = http_header(&req, "If-Modified-Since")) != NULL)
+    {
+        time_t  ims;  /* if modified since time */
+        /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+        ims = http_parse_date(v);
+        if (ims != (time_t)-1 && mtime <= ims)
+            goto not_modified;
+    }
+
+    /* by default send whole file */
+
+    code = 200;
+    first = 0;
+    last = size - 1;
+    range[0] = '\0';
+
+    v = http_header(&req, "Range");
+    if (v && !head)
+    {
+        const char  *ifr;  /* If-Range header value */
+        /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+        /* If-Range means, send range only when file didn't change,
+         * otherwise send whole file
+         */
+
+        ifr = http_header(&req, "If-Range");
+        r = 1;
+        if (ifr == NULL || strcmp(ifr, etag) == 0 || strcmp(ifr, lmod) == 0)
+            r = http_parse_range(v, size, &first, &last);
+
+        if (r == -1)
+        {
+            httpd_release_body(h);
+            sprintf(range, "Content-Range: bytes */%lld\r\n", (long long)size);
+            httpd_prepare_status(h, 416, 1, range);
+            return;
+        }
+
+        if (r == 0)
+        {
+            code = 206;
+            sprintf(range, "Content-Range: bytes %lld-%lld/%lld\r\n",
+                    (long long)first, (long long)last, (long long)size);
+        }
+    }
+
+    http_format_date(time(NULL), date);
+    h->hdrlen = sprintf(h->hdr,
+            "HTTP/1.1 %d %s\r\n"
+            "Server: termsend\r\n"
+            "Date: %s\r\n"
+            "Content-Type: text/%s\r\n"
+            "Content-Length: %lld\r\n"
+            "%s"
+            "Last-Modified: %s\r\n"
+            "ETag: %s\r\n"
+            "Accept-Ranges: bytes\r\n"
+            "Connection: %s\r\n"
+            "\r\n",
+            code, http_status_text(code), date, mime ? mime : "plain",
+            (long long)(last - first + 1), range, lmod, etag,
+            h->keep_alive ? "keep-alive" : "close");
+
+    h->hdrsent = 0;
+    h->off = h->base + first;
+    h->end = h->base + (head ? first : last + 1);
+    h->state = hstate_send;
+    return;
+
+not_modified:
+    httpd_release_body(h);
+    sprintf(range, "Last-Modified: %s\r\nETag: %s\r\n", lmod, etag);
+    httpd_prepare_status(h, 304, 0, range);
+}
+
+
+/* ==========================================================================
+    Checks if there is complete request in client's buffer and if so,
+    prepares response for it. If buffer is full and there is still no
+    complete request, client gets an error.
+   ========================================================================== */
+
+
+static void httpd_process_request
+(
+    struct hinfo  *h     /* client to process */
+)
+{
+    ssize_t        len;  /* length of request head */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    len = http_request_end(h->req, h->reqlen);
+    if (len == -1)
+    {
+        if (h->reqlen == sizeof(h->req))
+        {
+            /* request head does not fit into our buffer, no
+             * sane client sends that much to download a file
+             */
+
+            h->keep_alive = 0;
+            h->reqlen = 0;
+            httpd_prepare_status(h, 431, 1, NULL);
+        }
+
+        return;
+    }
+
+    httpd_prepare_response(h, len);
+
+    /* remove processed request from buffer, anything left
+     * there is a pipelined request, we will process it after
+     * this response is sent
+     */
+
+    memmove(h->req, h->req + len, h->reqlen - len);
+    h->reqlen -= len;
+}
+
+
+/* ==========================================================================
+    Sends as much of the response as socket buffer allows us to send (but
+    no more than HTTPD_SEND_BUDGET). When whole response is sent, client is
+    either disconnected or switched back to read state.
+   ========================================================================== */
+
+
+static void httpd_send
+(
+    struct hinfo  *h       /* client to send response to */
+)
+{
+    ssize_t        w;      /* number of bytes sent */
+    size_t         sent;   /* bytes sent in this call */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    /* first send response head */
+
+    while (h->hdrsent != h->hdrlen)
+    {
+        w = write(h->cfd, h->hdr + h->hdrsent, h->hdrlen - h->hdrsent);
+        if (w == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+
+            el_perror(ELD, "[%s] error sending http head", h->ips);
+            httpd_close(h);
+            return;
+        }
+
+        h->hdrsent += w;
+        h->timeout_at = httpd_now() + g_config.max_timeout;
+    }
+
+    /* and now body, if there is anything to send */
+
+    for (sent = 0; h->off < h->end && sent < HTTPD_SEND_BUDGET; sent += w)
+    {
+        size_t  n;  /* number of bytes to send in this iteration */
+        /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+        n = HTTPD_SEND_BUDGET - sent;
+        if ((off_t)n > h->end - h->off)
+            n = h->end - h->off;
+
+        if (h->ce)
+        {
+            /* upload is cached, send it straight from memory */
+
+            if ((w = write(h->cfd, h->ce->data + h->off, n)) > 0)
+                h->off += w;
+        }
+        else
+        {
+#if HAVE_SYS_SENDFILE_H
+            /* zero copy, data goes directly from page cache to
+             * socket buffer, sendfile() also moves h->off for us
+             */
+
+            w = sendfile(h->cfd, h->ffd, &h->off, n);
+#else
+            static char  buf[64 * 1024];  /* buffer for file data */
+            ssize_t      r;               /* bytes read from file */
+            /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+            /* no sendfile() on this system, so do it old way,
+             * data that cannot be sent now will be read again
+             * next time, page cache will make it cheap
+             */
+
+            if (n > sizeof(buf))
+                n = sizeof(buf);
+
+            if ((r = pread(h->ffd, buf, n, h->off)) <= 0)
+            {
+                el_perror(ELE, "[%s] error reading file", h->ips);
+                httpd_close(h);
+                return;
+            }
+
+            if ((w = write(h->cfd, buf, r)) > 0)
+                h->off += w;
+#endif
+        }
+
+        if (w == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+
+        if (w <= 0)
+        {
+            /* error, or file got truncated under us, either way
+             * there is nothing we can do now, client already got
+             * headers
+             */
+
+            el_perror(ELD, "[%s] error sending file", h->ips);
+            httpd_close(h);
+            return;
+        }
+
+        /* client keeps receiving, so it's not idle, no matter
+         * how long the whole download takes
+         */
+
+        h->timeout_at = httpd_now() + g_config.max_timeout;
+    }
+
+    if (h->off < h->end)
+    {
+        /* budget exhausted, continue in next loop iteration */
+
+        return;
+    }
+
+    /* whole response sent */
+
+    httpd_release_body(h);
+
+    if (h->keep_alive == 0)
+    {
+        httpd_close(h);
+        return;
+    }
+
+    h->state = hstate_read;
+    h->timeout_at = httpd_now() + g_config.max_timeout;
+
+    /* client might have pipelined next request already */
+
+    if (h->reqlen)
+        httpd_process_request(h);
+}
+
+
+/* ==========================================================================
+    Reads data from client, and processes request if it's complete.
+   ========================================================================== */
+
+
+static void httpd_read
+(
+    struct hinfo  *h   /* client to read data from */
+)
+{
+    ssize_t        r;  /* return from read() */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    r = read(h->cfd, h->req + h->reqlen, sizeof(h->req) - h->reqlen);
+
+    if (r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+
+    if (r <= 0)
+    {
+        /* client closed connection or error, nothing to
+         * respond to in both cases
+         */
+
+        httpd_close(h);
+        return;
+    }
+
+    h->reqlen += r;
+    h->timeout_at = httpd_now() + g_config.max_timeout;
+    httpd_process_request(h);
+}
+
+
+/* ==========================================================================
+                       __     __ _          ____
+        ____   __  __ / /_   / /(_)_____   / __/__  __ ____   _____ _____
+       / __ \ / / / // __ \ / // // ___/  / /_ / / / // __ \ / ___// ___/
+      / /_/ // /_/ // /_/ // // // /__   / __// /_/ // / / // /__ (__  )
+     / .___/ \__,_//_.___//_//_/ \___/  /_/   \__,_//_/ /_/ \___//____/
+    /_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Allocates memory for http clients. Should be called only when http port
+    is enabled.
+   ========================================================================== */
+
+
+int httpd_init(void)
+{
+    unsigned  i;  /* iterator */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    nhi = g_config.http_max_connections;
+    nconn = 0;
+
+    if ((hi = malloc(nhi * sizeof(*hi))) == NULL)
+    {
+        el_print(ELF, "couldn't allocate memory for %u http client(s)", nhi);
+        return -1;
+    }
+
+    for (i = 0; i != nhi; ++i)
+    {
+        hi[i].cfd = -1;
+        hi[i].ffd = -1;
+        hi[i].ce = NULL;
+        hi[i].state = hstate_free;
+    }
+
+    el_print(ELN, "http server initialized, max connections %u", nhi);
+    return 0;
+}
+
+
+/* ==========================================================================
+    Disconnects all http clients and frees resources
+   ========================================================================== */
+
+
+void httpd_destroy(void)
+{
+    unsigned  i;  /* iterator */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (i = 0; i != nhi; ++i)
+        if (hi[i].state != hstate_free)
+            httpd_close(&hi[i]);
+
+    free(hi);
+    hi = NULL;
+    nhi = 0;
+}
+
+
+/* ==========================================================================
+    Accepts new http connection from server socket 'sfd'. If there is no
+    free slot for the client, 503 is sent and connection is closed.
+
+    returns
+            0       connection was taken from backlog queue
+           -1       queue is empty, or accept() failed
+   ========================================================================== */
+
+
+int httpd_accept
+(
+    int                       sfd      /* server socket with pending conn */
+)
+{
+    int                       cfd;     /* accepted client socket */
+    unsigned                  i;       /* iterator */
+    socklen_t                 clen;    /* length of 'client' variable */
+    struct sockaddr_storage   client;  /* address of remote client */
+    char                      ips[INET6_ADDRSTRLEN]; /* client as string */
+    struct hinfo             *h;       /* slot for new client */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    clen = sizeof(client);
+#if HAVE_ACCEPT4
+    cfd = accept4(sfd, (struct sockaddr *)&client, &clen,
+            SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    cfd = accept(sfd, (struct sockaddr *)&client, &clen);
+    if (cfd >= 0 && (fcntl(cfd, F_SETFL, fcntl(cfd, F_GETFL) | O_NONBLOCK) ||
+                fcntl(cfd, F_SETFD, FD_CLOEXEC)))
+    {
+        el_perror(ELE, "couldn't make http socket non-blocking");
+        close(cfd);
+        return 0;
+    }
+#endif
+
+    if (cfd < 0)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            el_perror(ELC, "couldn't accept http connection");
+        return -1;
+    }
+
+    httpd_format_ip(&client, ips);
+
+    for (i = 0, h = NULL; i != nhi; ++i)
+    {
+        if (hi[i].state == hstate_free)
+        {
+            h = &hi[i];
+            break;
+        }
+    }
+
+    if (h == NULL || g_shutdown)
+    {
+        static const char  busy[] =
+            "HTTP/1.1 503 Service Unavailable\r\n"
+            "Content-Length: 0\r\n"
+            "Connection: close\r\n"
+            "\r\n";
+        /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+        /* fresh socket, so buffer is empty and this tiny write
+         * will not block
+         */
+
+        el_print(ELD, "no free http slot for %s", ips);
+        (void)write(cfd, busy, sizeof(busy) - 1);
+        close(cfd);
+        return 0;
+    }
+
+    h->cfd = cfd;
+    h->ffd = -1;
+    h->ce = NULL;
+    h->reqlen = 0;
+    h->keep_alive = 0;
+    h->state = hstate_read;
+    h->timeout_at = httpd_now() + g_config.max_timeout;
+    strcpy(h->ips, ips);
+    ++nconn;
+
+    el_print(ELD, "incoming http connection from %s socket id %d",
+            h->ips, cfd);
+    return 0;
+}
+
+
+/* ==========================================================================
+    Adds all connected http clients to select() sets, clients that wait
+    for request go to 'readfds', and these that we send data to go to
+    'writefds'. Returns new max fd.
+   ========================================================================== */
+
+
+int httpd_fdset
+(
+    fd_set    *readfds,   /* set for clients we read requests from */
+    fd_set    *writefds,  /* set for clients we send responses to */
+    int        maxfd      /* current max fd in sets */
+)
+{
+    unsigned   i;         /* iterator */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (i = 0; i != nhi; ++i)
+    {
+        if (hi[i].state == hstate_free)
+            continue;
+
+        FD_SET(hi[i].cfd, hi[i].state == hstate_read ? readfds : writefds);
+        maxfd = hi[i].cfd > maxfd ? hi[i].cfd : maxfd;
+    }
+
+    return maxfd;
+}
+
+
+/* ==========================================================================
+    Processes http clients with activity reported by select() and
+    disconnects clients that were inactive for too long.
+   ========================================================================== */
+
+
+void httpd_process
+(
+    fd_set        *readfds,   /* clients ready to be read */
+    fd_set        *writefds,  /* clients ready to be written to */
+    int            sact       /* return value from select() */
+)
+{
+    unsigned       i;         /* iterator */
+    time_t         now;       /* current time */
+    struct hinfo  *h;         /* current client */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    now = httpd_now();
+
+    for (i = 0; i != nhi; ++i)
+    {
+        h = &hi[i];
+
+        if (h->state == hstate_read && sact > 0 && FD_ISSET(h->cfd, readfds))
+            httpd_read(h);
+        else if (h->state == hstate_send && sact > 0 &&
+                FD_ISSET(h->cfd, writefds))
+            httpd_send(h);
+        else if (h->state != hstate_free && now >= h->timeout_at)
+        {
+            el_print(ELD, "[%s] http client inactive, disconnecting", h->ips);
+            httpd_close(h);
+        }
+    }
+}
+
+
+/* ==========================================================================
+    Returns number of connected http clients
+   ========================================================================== */
+
+
+unsigned httpd_num_conn(void)
+{
+    return nconn;
+}
@@ -0,0 +1,23 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef HTTPD_H
+#define HTTPD_H 1
+
+#if HAVE_SYS_SELECT_H
+#   include <sys/select.h>
+#endif
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+int httpd_init(void);
+void httpd_destroy(void);
+int httpd_accept(int sfd);
+int httpd_fdset(fd_set *readfds, fd_set *writefds, int maxfd);
+void httpd_process(fd_set *readfds, fd_set *writefds, int sact);
+unsigned httpd_num_conn(void);
+
+#endif
@@ -0,0 +1,767 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         -------------------------------------------------------------
+        / Per source limits. Every ip and every network (/24 for ipv4 \
+        | and /64 for ipv6) that connected to us recently has its own |
+        | token buckets for new connections and uploaded bytes, and a |
+        | counter of concurrent uploads. Sources are kept in a flat   |
+        | open addressing hash table, so checking a client costs one  |
+        | or two probes and no allocations. When table fills up,      |
+        | sources that were not seen for the longest time and have no |
+        \ clients connected are forgotten.                            /
+         -------------------------------------------------------------
+                \
+                 \  (\_/)
+                    (o.o)
+                    (> <)
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "feature.h"
+
+#include <embedlog.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "globals.h"
+#include "limit.h"
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* marks end of lru list */
+
+#define LIMIT_NIL ((unsigned)-1)
+
+/* number of least recently used entries checked for eviction, before
+ * we give up, every one of them has clients connected
+ */
+
+#define LIMIT_EVICT_SCAN 32
+
+enum limit_kind
+{
+    limit_free,  /* slot is not used */
+    limit_ip,    /* entry holds single address */
+    limit_net    /* entry holds network prefix */
+};
+
+struct limit_entry
+{
+    unsigned char  key[16];  /* address or masked network */
+    unsigned char  kind;     /* one of limit_kind */
+    unsigned       nconn;    /* number of connected clients */
+    double         conn;     /* tokens for new connections */
+    double         bw;       /* tokens for bytes to read */
+    double         last;     /* when tokens were last refilled */
+    unsigned       prev;     /* more recently used entry */
+    unsigned       next;     /* less recently used entry */
+};
+
+/* limits for single kind of entry, 0 means no limit */
+
+struct limit_conf
+{
+    long  conn_rate;  /* new connections per minute */
+    long  max_conn;   /* concurrent connections */
+    long  bandwidth;  /* bytes per second */
+};
+
+static struct limit_entry  *tab;      /* hash table */
+static unsigned             mask;     /* number of slots - 1 */
+static unsigned             nused;    /* number of used slots */
+static unsigned             head;     /* most recently used entry */
+static unsigned             tail;     /* least recently used entry */
+static struct limit_conf    conf[3];  /* limits indexed by limit_kind */
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Calculates home slot for 'key' of 'kind' (fnv-1a)
+   ========================================================================== */
+
+
+static unsigned limit_hash
+(
+    const unsigned char  *key,   /* address or network */
+    int                   kind   /* kind of key */
+)
+{
+    unsigned long         h;     /* calculated hash */
+    int                   i;     /* current byte of key */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    h = 2166136261ul;
+    for (i = 0; i != 16; ++i)
+        h = ((h ^ key[i]) * 16777619ul) & 0xfffffffful;
+
+    h = ((h ^ kind) * 16777619ul) & 0xfffffffful;
+    return (unsigned)(h ^ (h >> 16)) & mask;
+}
+
+
+/* ==========================================================================
+    Removes entry 'i' from lru list
+   ========================================================================== */
+
+
+static void limit_lru_unlink
+(
+    unsigned  i  /* entry to unlink */
+)
+{
+    if (tab[i].prev != LIMIT_NIL)
+        tab[tab[i].prev].next = tab[i].next;
+    else
+        head = tab[i].next;
+
+    if (tab[i].next != LIMIT_NIL)
+        tab[tab[i].next].prev = tab[i].prev;
+    else
+        tail = tab[i].prev;
+}
+
+
+/* ==========================================================================
+    Puts entry 'i' at the front of lru list
+   ========================================================================== */
+
+
+static void limit_lru_push
+(
+    unsigned  i  /* entry to put in front */
+)
+{
+    tab[i].prev = LIMIT_NIL;
+    tab[i].next = head;
+
+    if (head != LIMIT_NIL)
+        tab[head].prev = i;
+    else
+        tail = i;
+
+    head = i;
+}
+
+
+/* ==========================================================================
+    Moves entry from slot 'from' into free slot 'to', keeping its place
+    in lru list.
+   ========================================================================== */
+
+
+static void limit_move
+(
+    unsigned             from,  /* slot to move entry from */
+    unsigned             to     /* free slot to move entry to */
+)
+{
+    struct limit_entry  *e;     /* moved entry */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    e = &tab[to];
+    *e = tab[from];
+
+    if (e->prev != LIMIT_NIL)
+        tab[e->prev].next = to;
+    else
+        head = to;
+
+    if (e->next != LIMIT_NIL)
+        tab[e->next].prev = to;
+    else
+        tail = to;
+}
+
+
+/* ==========================================================================
+    Removes entry 'i' from the table. Entries that follow it in the same
+    probe sequence are shifted back, so lookups never have to skip over
+    deleted slots. This moves other entries around, so no pointers to
+    entries may be held across this call.
+   ========================================================================== */
+
+
+static void limit_remove
+(
+    unsigned  i  /* slot to free */
+)
+{
+    unsigned  j; /* slot checked for shifting back */
+    unsigned  k; /* home slot of entry in 'j' */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    limit_lru_unlink(i);
+    --nused;
+    --g_stats.limit_entries;
+
+    for (j = i;;)
+    {
+        j = (j + 1) & mask;
+        if (tab[j].kind == limit_free)
+            break;
+
+        /* entry can fill the hole only when its home slot is not
+         * between hole and entry, otherwise lookup, that starts in
+         * home slot, would never reach it
+         */
+
+        k = limit_hash(tab[j].key, tab[j].kind);
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+            continue;
+
+        limit_move(j, i);
+        i = j;
+    }
+
+    tab[i].kind = limit_free;
+}
+
+
+/* ==========================================================================
+    Makes sure there is room for 'n' more entries, without filling table
+    over 3/4, evicting least recently used sources if needed. Sources with
+    clients connected are never evicted, as we would lose count of their
+    connections.
+
+    returns
+            0       there is room for 'n' entries
+           -1       table is full of sources with clients connected
+   ========================================================================== */
+
+
+static int limit_reserve
+(
+    unsigned  n      /* number of entries we need */
+)
+{
+    unsigned  i;     /* eviction candidate */
+    unsigned  scan;  /* number of candidates checked */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    while (nused + n > (mask + 1) / 4 * 3)
+    {
+        for (i = tail, scan = 0; i != LIMIT_NIL; i = tab[i].prev, ++scan)
+            if (tab[i].nconn == 0 || scan == LIMIT_EVICT_SCAN)
+                break;
+
+        if (i == LIMIT_NIL || tab[i].nconn)
+            return -1;
+
+        limit_remove(i);
+    }
+
+    return 0;
+}
+
+
+/* ==========================================================================
+    Adds tokens that accumulated in 'e' since it was last refilled.
+    Buckets hold no more than one minute of connections and one second
+    of bandwidth.
+   ========================================================================== */
+
+
+static void limit_refill
+(
+    struct limit_entry       *e,   /* entry to refill */
+    double                    now  /* current time */
+)
+{
+    const struct limit_conf  *c;   /* limits for entry */
+    double                    dt;  /* time since last refill */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if ((dt = now - e->last) <= 0.0)
+        return;
+
+    c = &conf[e->kind];
+    e->last = now;
+
+    e->conn += dt * c->conn_rate / 60.0;
+    if (e->conn > c->conn_rate)
+        e->conn = c->conn_rate;
+
+    e->bw += dt * c->bandwidth;
+    if (e->bw > c->bandwidth)
+        e->bw = c->bandwidth;
+}
+
+
+/* ==========================================================================
+    Looks for entry with 'key' of 'kind'.
+
+    returns
+            slot with entry
+            LIMIT_NIL when there is no such entry
+   ========================================================================== */
+
+
+static unsigned limit_find
+(
+    const unsigned char  *key,   /* address or network */
+    int                   kind   /* kind of key */
+)
+{
+    unsigned              i;     /* probed slot */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (i = limit_hash(key, kind); tab[i].kind != limit_free;
+            i = (i + 1) & mask)
+        if (tab[i].kind == kind && memcmp(tab[i].key, key, 16) == 0)
+            return i;
+
+    return LIMIT_NIL;
+}
+
+
+/* ==========================================================================
+    Gets entry for 'key' of 'kind', creating it with full buckets when
+    this source is seen for the first time. Entry is refilled and marked
+    as most recently used. There must be room in the table for the new
+    entry, see limit_reserve().
+   ========================================================================== */
+
+
+static struct limit_entry *limit_get
+(
+    const unsigned char  *key,   /* address or network */
+    int                   kind,  /* kind of key */
+    double                now    /* current time */
+)
+{
+    struct limit_entry   *e;     /* found or created entry */
+    unsigned              i;     /* slot of entry */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if ((i = limit_find(key, kind)) != LIMIT_NIL)
+    {
+        e = &tab[i];
+        limit_refill(e, now);
+        limit_lru_unlink(i);
+        limit_lru_push(i);
+        return e;
+    }
+
+    for (i = limit_hash(key, kind); tab[i].kind != limit_free;
+            i = (i + 1) & mask)
+        ;
+
+    e = &tab[i];
+    memcpy(e->key, key, 16);
+    e->kind = kind;
+    e->nconn = 0;
+    e->conn = conf[kind].conn_rate;
+    e->bw = conf[kind].bandwidth;
+    e->last = now;
+    limit_lru_push(i);
+    ++nused;
+    ++g_stats.limit_entries;
+
+    return e;
+}
+
+
+/* ==========================================================================
+    Masks client address, so only its network prefix is left in 'net'
+   ========================================================================== */
+
+
+static void limit_net_key
+(
+    const struct limit_client  *lc,   /* client to get network of */
+    unsigned char              *net   /* network prefix of client */
+)
+{
+    memset(net, 0, 16);
+    memcpy(net, lc->ip, lc->plen);
+}
+
+
+/* ==========================================================================
+                       __     __ _          ____
+        ____   __  __ / /_   / /(_)_____   / __/__  __ ____   _____ _____
+       / __ \ / / / // __ \ / // // ___/  / /_ / / / // __ \ / ___// ___/
+      / /_/ // /_/ // /_/ // // // /__   / __// /_/ // / / // /__ (__  )
+     / .___/ \__,_//_.___//_//_/ \___/  /_/   \__,_//_/ /_/ \___//____/
+    /_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Initializes limits from config. Table is sized, so sources of all
+    connected clients always fit in it, with plenty room for sources
+    that disconnected but still have their buckets drained.
+
+    returns
+            0       success, or limits are disabled
+           -1       couldn't allocate memory for table
+   ========================================================================== */
+
+
+int limit_init(void)
+{
+    unsigned long  n;  /* number of slots in table */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    conf[limit_ip].conn_rate = g_config.ip_conn_rate;
+    conf[limit_ip].max_conn = g_config.ip_max_conn;
+    conf[limit_ip].bandwidth = g_config.ip_bandwidth;
+    conf[limit_net].conn_rate = g_config.net_conn_rate;
+    conf[limit_net].max_conn = g_config.net_max_conn;
+    conf[limit_net].bandwidth = g_config.net_bandwidth;
+
+    tab = NULL;
+    mask = 0;
+    nused = 0;
+    head = LIMIT_NIL;
+    tail = LIMIT_NIL;
+    g_stats.limit_entries = 0;
+
+    if (limit_enabled() == 0)
+        return 0;
+
+    /* every client takes two entries, ip and net, keep them
+     * under half of the table
+     */
+
+    for (n = LIMIT_MIN_ENTRIES; n < 4ul * g_config.max_connections; n *= 2)
+        ;
+
+    if ((tab = calloc(n, sizeof(*tab))) == NULL)
+        return -1;
+
+    mask = n - 1;
+    el_print(ELN, "per source limits enabled, tracking up to %lu sources",
+            n / 4 * 3);
+
+    return 0;
+}
+
+
+/* ==========================================================================
+    Frees table with all sources
+   ========================================================================== */
+
+
+void limit_destroy(void)
+{
+    free(tab);
+    tab = NULL;
+}
+
+
+/* ==========================================================================
+    Checks if any limit is configured
+
+    returns
+            1       at least one limit is set
+            0       limits are disabled
+   ========================================================================== */
+
+
+int limit_enabled(void)
+{
+    return g_config.ip_conn_rate || g_config.ip_max_conn ||
+        g_config.ip_bandwidth || g_config.net_conn_rate ||
+        g_config.net_max_conn || g_config.net_bandwidth;
+}
+
+
+/* ==========================================================================
+    Checks if client connecting from 'sa' can be let in, and if so,
+    counts it in its ip and network. Client must be released with
+    limit_disconnect() when it goes away, even if limits are disabled.
+
+    returns
+            0       client may connect
+           -1       client exceeded limit
+
+    errno
+            EAGAIN  source connects too often
+            EBUSY   source already has too many clients connected
+   ========================================================================== */
+
+
+int limit_connect
+(
+    struct limit_client        *lc,   /* client info to fill */
+    const struct sockaddr      *sa,   /* client address */
+    double                      now   /* current time */
+)
+{
+    struct limit_entry         *e[2]; /* ip and net entries */
+    const struct limit_conf    *c;    /* limits for current entry */
+    unsigned char               net[16]; /* network of client */
+    int                         i;    /* current entry */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    lc->active = 0;
+    memset(lc->ip, 0, sizeof(lc->ip));
+
+    if (sa->sa_family == AF_INET)
+    {
+        /* ipv4 is kept as ::ffff:a.b.c.d */
+
+        lc->ip[10] = 0xff;
+        lc->ip[11] = 0xff;
+        memcpy(lc->ip + 12,
+                &((const struct sockaddr_in *)sa)->sin_addr.s_addr, 4);
+        lc->plen = 12 + 3;
+    }
+#ifdef AF_INET6
+    else if (sa->sa_family == AF_INET6)
+    {
+        memcpy(lc->ip, &((const struct sockaddr_in6 *)sa)->sin6_addr, 16);
+        lc->plen = 8;
+    }
+#endif
+    else
+        return 0;
+
+    if (tab == NULL)
+        return 0;
+
+    if (limit_reserve(2) != 0)
+    {
+        /* cannot happen, table is bigger than twice max number
+         * of connections, but if it does, rather let client in
+         * than reject everybody
+         */
+
+        el_print(ELW, "limit: no room for new source, not limiting");
+        return 0;
+    }
+
+    limit_net_key(lc, net);
+    e[0] = limit_get(lc->ip, limit_ip, now);
+    e[1] = limit_get(net, limit_net, now);
+
+    for (i = 0; i != 2; ++i)
+    {
+        c = &conf[e[i]->kind];
+        if (c->max_conn && e[i]->nconn >= (unsigned long)c->max_conn)
+        {
+            ++g_stats.limit_rejects;
+            errno = EBUSY;
+            return -1;
+        }
+
+        if (c->conn_rate && e[i]->conn < 1.0)
+        {
+            ++g_stats.limit_rejects;
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+
+    for (i = 0; i != 2; ++i)
+    {
+        if (conf[e[i]->kind].conn_rate)
+            e[i]->conn -= 1.0;
+
+        ++e[i]->nconn;
+    }
+
+    lc->active = 1;
+    return 0;
+}
+
+
+/* ==========================================================================
+    Releases client, so it no longer counts against limit of concurrent
+    connections of its source.
+   ========================================================================== */
+
+
+void limit_disconnect
+(
+    struct limit_client  *lc       /* client that disconnected */
+)
+{
+    unsigned char         net[16]; /* network of client */
+    unsigned              i;       /* slot of entry */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (lc->active == 0)
+        return;
+
+    lc->active = 0;
+    limit_net_key(lc, net);
+
+    if ((i = limit_find(lc->ip, limit_ip)) != LIMIT_NIL)
+        --tab[i].nconn;
+
+    if ((i = limit_find(net, limit_net)) != LIMIT_NIL)
+        --tab[i].nconn;
+}
+
+
+/* ==========================================================================
+    Tells how many bytes client can read right now, without exceeding
+    bandwidth of its ip and network.
+
+    returns
+            number of bytes client can read, no more than 'want'
+   ========================================================================== */
+
+
+size_t limit_quota
+(
+    struct limit_client  *lc,      /* client that wants to read */
+    size_t                want,    /* number of bytes client wants */
+    double                now      /* current time */
+)
+{
+    unsigned char         net[16]; /* network of client */
+    const unsigned char  *key;     /* key of current entry */
+    unsigned              i;       /* slot of entry */
+    int                   kind;    /* kind of current entry */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (lc->active == 0)
+        return want;
+
+    limit_net_key(lc, net);
+
+    for (kind = limit_ip; kind <= limit_net; ++kind)
+    {
+        if (conf[kind].bandwidth == 0)
+            continue;
+
+        key = kind == limit_ip ? lc->ip : net;
+        if ((i = limit_find(key, kind)) == LIMIT_NIL)
+            continue;
+
+        limit_refill(&tab[i], now);
+        if (tab[i].bw < want)
+            want = tab[i].bw < 0.0 ? 0 : (size_t)tab[i].bw;
+    }
+
+    return want;
+}
+
+
+/* ==========================================================================
+    Takes 'n' read bytes from bandwidth of client's ip and network.
+   ========================================================================== */
+
+
+void limit_consume
+(
+    struct limit_client  *lc,      /* client that has read data */
+    size_t                n        /* number of bytes read */
+)
+{
+    unsigned char         net[16]; /* network of client */
+    unsigned              i;       /* slot of entry */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (lc->active == 0)
+        return;
+
+    limit_net_key(lc, net);
+
+    if (conf[limit_ip].bandwidth &&
+            (i = limit_find(lc->ip, limit_ip)) != LIMIT_NIL)
+        tab[i].bw -= n;
+
+    if (conf[limit_net].bandwidth &&
+            (i = limit_find(net, limit_net)) != LIMIT_NIL)
+        tab[i].bw -= n;
+}
+
+
+/* ==========================================================================
+    Calculates how long client has to wait, before it can read at least
+    LIMIT_MIN_READ bytes (or whole bandwidth if it's smaller).
+
+    returns
+            number of seconds to wait, 0 when client can read now
+   ========================================================================== */
+
+
+double limit_wait
+(
+    struct limit_client  *lc,      /* client that wants to read */
+    double                now      /* current time */
+)
+{
+    unsigned char         net[16]; /* network of client */
+    const unsigned char  *key;     /* key of current entry */
+    double                need;    /* tokens needed to read */
+    double                wait;    /* longest wait of all entries */
+    double                w;       /* wait for current entry */
+    unsigned              i;       /* slot of entry */
+    int                   kind;    /* kind of current entry */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (lc->active == 0)
+        return 0.0;
+
+    limit_net_key(lc, net);
+    wait = 0.0;
+
+    for (kind = limit_ip; kind <= limit_net; ++kind)
+    {
+        if (conf[kind].bandwidth == 0)
+            continue;
+
+        key = kind == limit_ip ? lc->ip : net;
+        if ((i = limit_find(key, kind)) == LIMIT_NIL)
+            continue;
+
+        limit_refill(&tab[i], now);
+        need = conf[kind].bandwidth < LIMIT_MIN_READ ?
+            conf[kind].bandwidth : LIMIT_MIN_READ;
+
+        if (tab[i].bw >= need)
+            continue;
+
+        w = (need - tab[i].bw) / conf[kind].bandwidth;
+        wait = w > wait ? w : wait;
+    }
+
+    return wait;
+}
@@ -0,0 +1,42 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef LIMIT_H
+#define LIMIT_H 1
+
+#include <stddef.h>
+#include <sys/socket.h>
+
+/* minimum number of sources tracked at once */
+
+#define LIMIT_MIN_ENTRIES 4096
+
+/* client is not let to read until it can read at least that many
+ * bytes (or whole bandwidth, when it's smaller), so throttled
+ * clients are not woken up for every few bytes
+ */
+
+#define LIMIT_MIN_READ 1024
+
+/* source of connected client, kept by server for the whole connection */
+
+struct limit_client
+{
+    unsigned char  ip[16];  /* client address, ipv4 is mapped into ipv6 */
+    int            plen;    /* length of network prefix in bytes */
+    int            active;  /* client is counted in limit entries */
+};
+
+int limit_init(void);
+void limit_destroy(void);
+int limit_enabled(void);
+int limit_connect(struct limit_client *lc, const struct sockaddr *sa,
+        double now);
+void limit_disconnect(struct limit_client *lc);
+size_t limit_quota(struct limit_client *lc, size_t want, double now);
+void limit_consume(struct limit_client *lc, size_t n);
+double limit_wait(struct limit_client *lc, double now);
+
+#endif
@@ -74,6 +74,9 @@ static void sigint_handler(int signo)
 
     if (signo == SIGALRM)
         g_sigalrm = 1;
+
+    if (signo == SIGHUP)
+        g_sighup = 1;
 }
 
 
@@ -152,6 +155,7 @@ int main(int argc, char *argv[])
     sigaction(SIGINT, &sa, NULL);
     sigaction(SIGTERM, &sa, NULL);
     sigaction(SIGALRM, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
     sigaction(SIGPIPE, &sa, NULL);
 
     config_print();
@@ -162,7 +166,18 @@ int main(int argc, char *argv[])
         goto config_validate_error;
     }
 
-    if (bnw_init(g_config.list_file, g_config.list_type) != 0)
+    if (g_config.lists[0] != '\0')
+    {
+        /* combined lists replace list_file and list_type */
+
+        if (bnw_init_lists(g_config.lists) != 0)
+        {
+            rv = 1;
+            el_print(ELF, "couldn't initialize lists %s", g_config.lists);
+            goto bnw_error;
+        }
+    }
+    else if (bnw_init(g_config.list_file, g_config.list_type) != 0)
     {
         rv = 1;
         el_print(ELF, "couldn't initialize list from file %s",
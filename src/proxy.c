@@ -0,0 +1,568 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         -------------------------------------------------------------
+        / PROXY protocol. When termsend runs behind L4 load balancer, \
+        | every connection comes from the balancer, and only PROXY    |
+        | header, sent by balancer before any client data, tells who  |
+        | the real client is. Both text (v1) and binary (v2) headers  |
+        | are understood. Header is only believed when it comes from  |
+        \ one of trusted networks, anyone else could lie about it.    /
+         -------------------------------------------------------------
+                \
+                 \    __
+                     (oo)
+                     /--\
+                    / |  \
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "feature.h"
+
+#include <arpa/inet.h>
+#include <embedlog.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "proxy.h"
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* v1 header, with terminating \r\n, is never longer than that */
+
+#define PROXY_V1_MAX 107
+
+/* v2 header starts with 12 bytes signature, followed by version and
+ * command, address family, and 2 bytes of length of the rest
+ */
+
+#define PROXY_V2_HEAD 16
+
+static const unsigned char proxy_v2_sig[12] =
+{
+    0x0d, 0x0a, 0x0d, 0x0a, 0x00, 0x0d, 0x0a, 0x51, 0x55, 0x49, 0x54, 0x0a
+};
+
+/* trusted network, ipv4 is mapped into ipv6 */
+
+struct proxy_net
+{
+    unsigned char  ip[16];  /* network address */
+    int            plen;    /* length of prefix in bits */
+};
+
+static struct proxy_net  *nets;   /* trusted networks */
+static size_t             nnets;  /* number of trusted networks */
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Checks if first 'plen' bits of 'a' and 'b' are equal
+   ========================================================================== */
+
+
+static int proxy_prefix_eq
+(
+    const unsigned char  *a,     /* first address */
+    const unsigned char  *b,     /* second address */
+    int                   plen   /* number of bits to compare */
+)
+{
+    int                   n;     /* number of whole bytes to compare */
+    int                   bits;  /* bits left in last byte */
+    unsigned char         mask;  /* mask of last byte */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    n = plen / 8;
+    bits = plen % 8;
+
+    if (memcmp(a, b, n) != 0)
+        return 0;
+
+    if (bits == 0)
+        return 1;
+
+    mask = (unsigned char)(0xff << (8 - bits));
+    return (a[n] & mask) == (b[n] & mask);
+}
+
+
+/* ==========================================================================
+    Parses single trusted network 'net', like "10.0.0.0/8", "::1" or
+    "127.0.0.1", into 'n'. Host part of prefix must be zero.
+
+    returns
+            0       network parsed
+           -1       'net' is not valid address or prefix
+   ========================================================================== */
+
+
+static int proxy_parse_net
+(
+    char              *net,   /* null terminated network */
+    struct proxy_net  *n      /* parsed network */
+)
+{
+    char              *len;   /* prefix length part of net */
+    char              *end;   /* end of prefix length */
+    long               plen;  /* parsed prefix length */
+    int                v6;    /* is it ipv6 network? */
+    struct proxy_net   host;  /* net with host part cleared */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    v6 = strchr(net, ':') != NULL;
+    plen = v6 ? 128 : 32;
+
+    if ((len = strchr(net, '/')) != NULL)
+    {
+        *len++ = '\0';
+        if (*len < '0' || *len > '9')
+            return -1;
+
+        plen = strtol(len, &end, 10);
+        if (*end != '\0' || plen > (v6 ? 128 : 32))
+            return -1;
+    }
+
+    memset(n->ip, 0, sizeof(n->ip));
+
+    if (v6)
+    {
+        if (inet_pton(AF_INET6, net, n->ip) != 1)
+            return -1;
+    }
+    else
+    {
+        n->ip[10] = 0xff;
+        n->ip[11] = 0xff;
+        if (inet_pton(AF_INET, net, n->ip + 12) != 1)
+            return -1;
+
+        plen += 96;
+    }
+
+    n->plen = plen;
+
+    /* network address with anything set in host part is most
+     * likely a typo, refuse it like black and white list does
+     */
+
+    memset(&host, 0, sizeof(host));
+    memcpy(host.ip, n->ip, n->plen / 8);
+    if (n->plen % 8)
+        host.ip[n->plen / 8] = n->ip[n->plen / 8] &
+            (unsigned char)(0xff << (8 - n->plen % 8));
+
+    return memcmp(host.ip, n->ip, sizeof(n->ip)) == 0 ? 0 : -1;
+}
+
+
+/* ==========================================================================
+    Parses text PROXY header (v1) from 'buf' of 'len' bytes. Header looks
+    like "PROXY TCP4 1.2.3.4 5.6.7.8 1234 80\r\n". For "PROXY UNKNOWN"
+    'src' family is set to AF_UNSPEC.
+   ========================================================================== */
+
+
+static int proxy_parse_v1
+(
+    const unsigned char      *buf,    /* received data */
+    size_t                    len,    /* number of bytes in buf */
+    struct sockaddr_storage  *src,    /* source address of client */
+    size_t                   *hlen    /* length of whole header */
+)
+{
+    char                      line[PROXY_V1_MAX + 1]; /* copy of header */
+    const unsigned char      *eol;    /* end of header */
+    char                     *tok[6]; /* split header fields */
+    char                     *end;    /* end of parsed port */
+    long                      port;   /* source port */
+    int                       ntok;   /* number of fields */
+    struct sockaddr_in       *sin;    /* src as ipv4 address */
+    struct sockaddr_in6      *sin6;   /* src as ipv6 address */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    eol = memchr(buf, '\n', len < PROXY_V1_MAX ? len : PROXY_V1_MAX);
+    if (eol == NULL)
+    {
+        errno = len < PROXY_V1_MAX ? EAGAIN : EINVAL;
+        return -1;
+    }
+
+    errno = EINVAL;
+    if (eol == buf || eol[-1] != '\r')
+        return -1;
+
+    *hlen = eol - buf + 1;
+    memcpy(line, buf, *hlen - 2);
+    line[*hlen - 2] = '\0';
+
+    /* fields are separated with exactly one space */
+
+    ntok = 0;
+    tok[ntok++] = line;
+    for (end = line; *end != '\0'; ++end)
+    {
+        if (*end != ' ')
+            continue;
+
+        if (ntok == 6)
+            return -1;
+
+        *end = '\0';
+        tok[ntok++] = end + 1;
+    }
+
+    memset(src, 0, sizeof(*src));
+
+    if (strcmp(tok[0], "PROXY") != 0 || ntok < 2)
+        return -1;
+
+    /* balancer doesn't know who connected, anything can follow */
+
+    if (strcmp(tok[1], "UNKNOWN") == 0)
+    {
+        src->ss_family = AF_UNSPEC;
+        return 0;
+    }
+
+    if (ntok != 6)
+        return -1;
+
+    if (tok[4][0] < '0' || tok[4][0] > '9')
+        return -1;
+
+    port = strtol(tok[4], &end, 10);
+    if (*end != '\0' || port > 65535)
+        return -1;
+
+    sin = (struct sockaddr_in *)src;
+    sin6 = (struct sockaddr_in6 *)src;
+
+    if (strcmp(tok[1], "TCP4") == 0)
+    {
+        if (inet_pton(AF_INET, tok[2], &sin->sin_addr) != 1)
+            return -1;
+
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(port);
+        return 0;
+    }
+
+    if (strcmp(tok[1], "TCP6") == 0)
+    {
+        if (inet_pton(AF_INET6, tok[2], &sin6->sin6_addr) != 1)
+            return -1;
+
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(port);
+        return 0;
+    }
+
+    return -1;
+}
+
+
+/* ==========================================================================
+    Parses binary PROXY header (v2) from 'buf' of 'len' bytes. LOCAL
+    command (health checks of balancer), and address families other than
+    TCP over ipv4 and ipv6, set 'src' family to AF_UNSPEC. TLVs are
+    skipped.
+   ========================================================================== */
+
+
+static int proxy_parse_v2
+(
+    const unsigned char      *buf,    /* received data */
+    size_t                    len,    /* number of bytes in buf */
+    struct sockaddr_storage  *src,    /* source address of client */
+    size_t                   *hlen    /* length of whole header */
+)
+{
+    size_t                    alen;   /* length of addresses and TLVs */
+    struct sockaddr_in       *sin;    /* src as ipv4 address */
+    struct sockaddr_in6      *sin6;   /* src as ipv6 address */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (len < PROXY_V2_HEAD)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    errno = EINVAL;
+
+    /* only version 2 exists, command is either LOCAL or PROXY */
+
+    if ((buf[12] >> 4) != 2 || (buf[12] & 0x0f) > 1)
+        return -1;
+
+    alen = (size_t)buf[14] << 8 | buf[15];
+    *hlen = PROXY_V2_HEAD + alen;
+
+    if (*hlen > PROXY_MAX_HEAD)
+        return -1;
+
+    if (len < *hlen)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    memset(src, 0, sizeof(*src));
+    src->ss_family = AF_UNSPEC;
+
+    if ((buf[12] & 0x0f) == 0)
+        return 0;
+
+    sin = (struct sockaddr_in *)src;
+    sin6 = (struct sockaddr_in6 *)src;
+
+    /* addresses are followed by ports, source goes first, all of
+     * them in network byte order already
+     */
+
+    if (buf[13] == 0x11)
+    {
+        if (alen < 12)
+            return -1;
+
+        sin->sin_family = AF_INET;
+        memcpy(&sin->sin_addr, buf + PROXY_V2_HEAD, 4);
+        memcpy(&sin->sin_port, buf + PROXY_V2_HEAD + 8, 2);
+    }
+    else if (buf[13] == 0x21)
+    {
+        if (alen < 36)
+            return -1;
+
+        sin6->sin6_family = AF_INET6;
+        memcpy(&sin6->sin6_addr, buf + PROXY_V2_HEAD, 16);
+        memcpy(&sin6->sin6_port, buf + PROXY_V2_HEAD + 32, 2);
+    }
+
+    return 0;
+}
+
+
+/* ==========================================================================
+                       __     __ _          ____
+        ____   __  __ / /_   / /(_)_____   / __/__  __ ____   _____ _____
+       / __ \ / / / // __ \ / // // ___/  / /_ / / / // __ \ / ___// ___/
+      / /_/ // /_/ // /_/ // // // /__   / __// /_/ // / / // /__ (__  )
+     / .___/ \__,_//_.___//_//_/ \___/  /_/   \__,_//_/ /_/ \___//____/
+    /_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Parses comma separated list of 'trusted' networks, that are allowed
+    to send PROXY header. Empty list means nobody is trusted.
+
+    returns
+            0       list parsed
+           -1       error
+
+    errno
+            EINVAL  'trusted' contains invalid address or prefix
+            ENOMEM  not enough memory for the list
+   ========================================================================== */
+
+
+int proxy_init
+(
+    const char  *trusted  /* comma separated trusted networks */
+)
+{
+    char        *copy;    /* copy of trusted, for strtok() */
+    char        *net;     /* current network */
+    size_t       n;       /* maximum number of networks */
+    const char  *s;       /* iterator over trusted */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    proxy_destroy();
+
+    for (n = 1, s = trusted; *s; ++s)
+        if (*s == ',')
+            ++n;
+
+    copy = malloc(strlen(trusted) + 1);
+    nets = malloc(n * sizeof(*nets));
+    if (copy == NULL || nets == NULL)
+    {
+        free(copy);
+        proxy_destroy();
+        errno = ENOMEM;
+        return -1;
+    }
+
+    strcpy(copy, trusted);
+
+    for (net = strtok(copy, ","); net; net = strtok(NULL, ","))
+    {
+        if (proxy_parse_net(net, &nets[nnets]) != 0)
+        {
+            el_print(ELF, "invalid trusted proxy %s", net);
+            free(copy);
+            proxy_destroy();
+            errno = EINVAL;
+            return -1;
+        }
+
+        ++nnets;
+    }
+
+    free(copy);
+    el_print(ELN, "proxy: %lu trusted networks", (unsigned long)nnets);
+    return 0;
+}
+
+
+/* ==========================================================================
+    Frees list of trusted networks
+   ========================================================================== */
+
+
+void proxy_destroy(void)
+{
+    free(nets);
+    nets = NULL;
+    nnets = 0;
+}
+
+
+/* ==========================================================================
+    Checks if 'sa' belongs to one of trusted networks.
+
+    returns
+            1       'sa' can send PROXY header
+            0       'sa' is not trusted
+   ========================================================================== */
+
+
+int proxy_trusted
+(
+    const struct sockaddr  *sa      /* address of connected peer */
+)
+{
+    unsigned char           ip[16]; /* sa, ipv4 is mapped into ipv6 */
+    size_t                  i;      /* current network */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    memset(ip, 0, sizeof(ip));
+
+    if (sa->sa_family == AF_INET)
+    {
+        ip[10] = 0xff;
+        ip[11] = 0xff;
+        memcpy(ip + 12, &((const struct sockaddr_in *)sa)->sin_addr, 4);
+    }
+    else if (sa->sa_family == AF_INET6)
+        memcpy(ip, &((const struct sockaddr_in6 *)sa)->sin6_addr, 16);
+    else
+        return 0;
+
+    for (i = 0; i != nnets; ++i)
+        if (proxy_prefix_eq(ip, nets[i].ip, nets[i].plen))
+            return 1;
+
+    return 0;
+}
+
+
+/* ==========================================================================
+    Parses PROXY header, v1 or v2, from 'buf' of 'len' bytes. When whole
+    header is there, source address of client is stored in 'src', and
+    length of header in 'hlen', data after header belongs to client. When
+    balancer didn't pass client address (health check, or unknown
+    protocol), 'src' family is AF_UNSPEC and connection address should
+    be used.
+
+    returns
+            0       whole header parsed
+           -1       error
+
+    errno
+            EAGAIN  'buf' holds valid, but incomplete header
+            EINVAL  'buf' does not start with valid PROXY header
+   ========================================================================== */
+
+
+int proxy_parse
+(
+    const unsigned char      *buf,  /* received data */
+    size_t                    len,  /* number of bytes in buf */
+    struct sockaddr_storage  *src,  /* source address of client */
+    size_t                   *hlen  /* length of whole header */
+)
+{
+    size_t                    n;    /* number of bytes to compare */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    /* check as much of signature as we have, so garbage is
+     * refused right away
+     */
+
+    n = len < sizeof(proxy_v2_sig) ? len : sizeof(proxy_v2_sig);
+    if (n && memcmp(buf, proxy_v2_sig, n) == 0)
+    {
+        if (n < sizeof(proxy_v2_sig))
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+
+        return proxy_parse_v2(buf, len, src, hlen);
+    }
+
+    n = len < 6 ? len : 6;
+    if (n && memcmp(buf, "PROXY ", n) == 0)
+    {
+        if (n < 6)
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+
+        return proxy_parse_v1(buf, len, src, hlen);
+    }
+
+    errno = len ? EINVAL : EAGAIN;
+    return -1;
+}
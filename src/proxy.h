@@ -0,0 +1,24 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef PROXY_H
+#define PROXY_H 1
+
+#include <stddef.h>
+#include <sys/socket.h>
+
+/* longest PROXY header that is accepted, v1 header is never longer
+ * than 107 bytes, v2 header can only get that long due to TLVs
+ */
+
+#define PROXY_MAX_HEAD 4096
+
+int proxy_init(const char *trusted);
+void proxy_destroy(void);
+int proxy_trusted(const struct sockaddr *sa);
+int proxy_parse(const unsigned char *buf, size_t len,
+        struct sockaddr_storage *src, size_t *hlen);
+
+#endif
@@ -0,0 +1,1301 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         -------------------------------------------------------------
+        / Full text search index. For every text upload, set of all   \
+        | trigrams (3 byte sequences) in it is stored. To find text,  |
+        | we only look at uploads that contain every trigram of the   |
+        | pattern, which usually are just a handful, instead of       |
+        | reading every upload there is. Fresh uploads go to journal, |
+        | which is turned into immutable segment file, once it gets   |
+        | big enough. Segment maps trigram to sorted list of upload   |
+        | index record numbers. Segments can be merged into one, so   |
+        | query doesn't have to open too many files. Module has no    |
+        \ other dependencies, so it can be used by external tools.    /
+         -------------------------------------------------------------
+             \   ^__^
+              \  (oo)\_______
+                 (__)\       )\/\
+                     ||----w |
+                     ||     ||
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "feature.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#if HAVE_LINUX_LIMITS_H
+#   include <linux/limits.h>
+#endif
+
+#include "search.h"
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+#define SEARCH_MAGIC    "TSSRCH"
+#define SEARCH_VERSION  1
+
+/* segment file starts with header, then there are postings, lists
+ * of record numbers, one after another, and at the end there is
+ * directory of trigrams, sorted, pointing to their postings
+ */
+
+struct search_hdr
+{
+    char      magic[8];   /* SEARCH_MAGIC */
+    uint32_t  version;    /* SEARCH_VERSION */
+    uint32_t  ntri;       /* number of trigrams in directory */
+    uint64_t  npost;      /* number of all postings */
+    uint64_t  reserved;   /* must be 0 */
+};
+
+struct search_dent
+{
+    uint32_t  tri;        /* trigram */
+    uint32_t  n;          /* number of uploads with that trigram */
+    uint64_t  off;        /* index of first posting for trigram */
+};
+
+typedef char search_hdr_size_check[sizeof(struct search_hdr) == 32 ? 1 : -1];
+typedef char search_dent_size_check[sizeof(struct search_dent) == 16 ? 1 : -1];
+
+/* directory is aligned to 8 bytes, so it can be accessed directly
+ * from mapped memory
+ */
+
+#define SEARCH_DIROFF(npost) \
+    ((sizeof(struct search_hdr) + (npost) * sizeof(uint32_t) + 7) & ~7ul)
+
+/* single posting waiting in journal */
+
+struct search_post
+{
+    uint32_t  tri;        /* trigram */
+    uint32_t  recno;      /* upload index record number */
+};
+
+/* segment file being written */
+
+struct search_writer
+{
+    FILE                *f;       /* segment file */
+    struct search_dent  *dir;     /* directory, written at the end */
+    size_t               ndir;    /* number of directory entries */
+    size_t               dircap;  /* allocated directory entries */
+    uint64_t             npost;   /* postings written so far */
+    uint32_t             last;    /* last written record number */
+    char                 tmp[PATH_MAX + 16];  /* temporary file name */
+};
+
+/* segment file mapped for reading */
+
+struct search_seg
+{
+    void                      *map;   /* whole mapped file */
+    size_t                     len;   /* size of map */
+    const uint32_t            *post;  /* postings */
+    const struct search_dent  *dir;   /* directory */
+    size_t                     ntri;  /* number of directory entries */
+    size_t                     pos;   /* merge cursor in directory */
+    unsigned long              first; /* first segment number it covers */
+    unsigned long              last;  /* last segment number it covers */
+    char                       name[32]; /* file name */
+};
+
+static char                 sdir[PATH_MAX]; /* index directory */
+static int                  jfd = -1;       /* journal file */
+static off_t                jsize;          /* size of journal */
+static struct search_post  *pend;           /* postings in journal */
+static size_t               npend;          /* number of postings in pend */
+static size_t               pendcap;        /* allocated postings */
+static unsigned long        nextseg;        /* number of next segment */
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Compares two uint32_t for qsort() and bsearch()
+   ========================================================================== */
+
+
+static int search_cmp_u32
+(
+    const void  *a,  /* first value */
+    const void  *b   /* second value */
+)
+{
+    uint32_t     x;  /* first value */
+    uint32_t     y;  /* second value */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    x = *(const uint32_t *)a;
+    y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+
+/* ==========================================================================
+    Compares two postings by trigram, and then by record number
+   ========================================================================== */
+
+
+static int search_cmp_post
+(
+    const void                *a,  /* first posting */
+    const void                *b   /* second posting */
+)
+{
+    const struct search_post  *x;  /* first posting */
+    const struct search_post  *y;  /* second posting */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    x = a;
+    y = b;
+    if (x->tri != y->tri)
+        return x->tri < y->tri ? -1 : 1;
+
+    return x->recno < y->recno ? -1 : x->recno > y->recno;
+}
+
+
+/* ==========================================================================
+    Extracts all distinct trigrams from 'data' into 'tri', which must have
+    room for at least 'len' - 2 entries. ASCII letters are folded to lower
+    case, so index can be used for case insensitive search as well.
+
+    returns
+            number of distinct trigrams stored in 'tri', sorted
+   ========================================================================== */
+
+
+static size_t search_trigrams
+(
+    const unsigned char  *data,  /* data to extract trigrams from */
+    size_t                len,   /* length of data */
+    uint32_t             *tri    /* extracted trigrams */
+)
+{
+    size_t                i;     /* current byte */
+    size_t                n;     /* number of distinct trigrams */
+    uint32_t              t;     /* current trigram */
+    unsigned char         c;     /* current byte, folded */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (len < 3)
+        return 0;
+
+    t = 0;
+    for (i = 0; i != len; ++i)
+    {
+        c = data[i];
+        c = c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+        t = ((t << 8) | c) & 0xffffff;
+
+        if (i >= 2)
+            tri[i - 2] = t;
+    }
+
+    qsort(tri, len - 2, sizeof(*tri), search_cmp_u32);
+
+    for (n = 1, i = 1; i != len - 2; ++i)
+        if (tri[i] != tri[n - 1])
+            tri[n++] = tri[i];
+
+    return n;
+}
+
+
+/* ==========================================================================
+    Adds posting to pending list, growing it if needed
+   ========================================================================== */
+
+
+static int search_pend
+(
+    uint32_t             tri,    /* trigram */
+    uint32_t             recno   /* upload record number */
+)
+{
+    struct search_post  *p;      /* reallocated pending list */
+    size_t               ncap;   /* new capacity */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (npend == pendcap)
+    {
+        ncap = pendcap ? pendcap * 2 : 4096;
+        if ((p = realloc(pend, ncap * sizeof(*pend))) == NULL)
+            return -1;
+
+        pend = p;
+        pendcap = ncap;
+    }
+
+    pend[npend].tri = tri;
+    pend[npend].recno = recno;
+    ++npend;
+    return 0;
+}
+
+
+/* ==========================================================================
+    Parses segment file name "first-last", both hex numbers.
+
+    returns
+            0       name is segment name
+           -1       name is not a segment
+   ========================================================================== */
+
+
+static int search_seg_name
+(
+    const char     *name,   /* file name to parse */
+    unsigned long  *first,  /* first segment number */
+    unsigned long  *last    /* last segment number */
+)
+{
+    char            c;      /* trailing garbage detection */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (strlen(name) != 17 ||
+            sscanf(name, "%8lx-%8lx%c", first, last, &c) != 2)
+        return -1;
+
+    return 0;
+}
+
+
+/* ==========================================================================
+    Maps segment 'name' in 'dir' into 's'.
+
+    returns
+            0       segment mapped
+           -1       error, errno is set
+
+    errno
+            EINVAL  file is not a segment
+   ========================================================================== */
+
+
+static int search_seg_map
+(
+    const char               *dir,   /* index directory */
+    const char               *name,  /* segment file name */
+    struct search_seg        *s      /* mapped segment */
+)
+{
+    const struct search_hdr  *h;     /* segment header */
+    struct stat               st;    /* segment file info */
+    char                      path[PATH_MAX + 32];  /* path to segment */
+    int                       fd;    /* segment file */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    memset(s, 0, sizeof(*s));
+    if (search_seg_name(name, &s->first, &s->last) != 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    strcpy(s->name, name);
+    sprintf(path, "%s/%s", dir, name);
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return -1;
+
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    s->len = st.st_size;
+    if (s->len < sizeof(*h))
+    {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    s->map = mmap(NULL, s->len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (s->map == MAP_FAILED)
+        return -1;
+
+    h = s->map;
+    if (memcmp(h->magic, SEARCH_MAGIC, sizeof(SEARCH_MAGIC)) != 0 ||
+            h->version != SEARCH_VERSION ||
+            SEARCH_DIROFF(h->npost) + h->ntri * sizeof(*s->dir) != s->len)
+    {
+        munmap(s->map, s->len);
+        errno = EINVAL;
+        return -1;
+    }
+
+    s->post = (const uint32_t *)((const char *)s->map + sizeof(*h));
+    s->dir = (const struct search_dent *)
+        ((const char *)s->map + SEARCH_DIROFF(h->npost));
+    s->ntri = h->ntri;
+    return 0;
+}
+
+
+/* ==========================================================================
+    Finds directory entry for trigram 't' in segment 's'.
+
+    returns
+            directory entry or NULL when there is no such trigram
+   ========================================================================== */
+
+
+static const struct search_dent *search_seg_find
+(
+    const struct search_seg  *s,    /* segment to look in */
+    uint32_t                  t     /* trigram to look for */
+)
+{
+    size_t                    lo;   /* lower bound */
+    size_t                    hi;   /* upper bound, exclusive */
+    size_t                    mid;  /* middle element */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    lo = 0;
+    hi = s->ntri;
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (s->dir[mid].tri == t)
+            return &s->dir[mid];
+
+        if (s->dir[mid].tri < t)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return NULL;
+}
+
+
+/* ==========================================================================
+    Opens temporary segment file 'tmp' in 'dir' for writing
+   ========================================================================== */
+
+
+static int search_w_open
+(
+    struct search_writer  *w,    /* writer to initialize */
+    const char            *dir,  /* index directory */
+    const char            *tmp   /* temporary file name */
+)
+{
+    struct search_hdr      h;    /* placeholder for header */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    memset(w, 0, sizeof(*w));
+    sprintf(w->tmp, "%s/%s", dir, tmp);
+    if ((w->f = fopen(w->tmp, "w")) == NULL)
+        return -1;
+
+    /* real header is written once we know all the numbers */
+
+    memset(&h, 0, sizeof(h));
+    if (fwrite(&h, sizeof(h), 1, w->f) != 1)
+    {
+        fclose(w->f);
+        unlink(w->tmp);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* ==========================================================================
+    Writes single posting. Postings must be given sorted by trigram and
+    then by record number, duplicates are skipped.
+
+    returns
+            0       posting written
+           -1       error, errno is set
+   ========================================================================== */
+
+
+static int search_w_post
+(
+    struct search_writer  *w,      /* writer */
+    uint32_t               tri,    /* trigram */
+    uint32_t               recno   /* record number */
+)
+{
+    struct search_dent    *d;      /* reallocated directory */
+    size_t                 ncap;   /* new directory capacity */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (w->ndir == 0 || w->dir[w->ndir - 1].tri != tri)
+    {
+        if (w->ndir == w->dircap)
+        {
+            ncap = w->dircap ? w->dircap * 2 : 4096;
+            if ((d = realloc(w->dir, ncap * sizeof(*d))) == NULL)
+                return -1;
+
+            w->dir = d;
+            w->dircap = ncap;
+        }
+
+        d = &w->dir[w->ndir++];
+        d->tri = tri;
+        d->n = 0;
+        d->off = w->npost;
+    }
+    else if (w->last == recno)
+        return 0;
+
+    if (fwrite(&recno, sizeof(recno), 1, w->f) != 1)
+        return -1;
+
+    ++w->dir[w->ndir - 1].n;
+    ++w->npost;
+    w->last = recno;
+    return 0;
+}
+
+
+/* ==========================================================================
+    Throws away segment that was being written
+   ========================================================================== */
+
+
+static void search_w_abort
+(
+    struct search_writer  *w  /* writer */
+)
+{
+    fclose(w->f);
+    unlink(w->tmp);
+    free(w->dir);
+}
+
+
+/* ==========================================================================
+    Finishes segment, writes directory and header, and moves it into
+    place as segment covering 'first' to 'last' segments. Segment is
+    synced before it replaces anything, so journal or merged segments
+    can be safely removed afterwards.
+
+    returns
+            0       segment written
+           -1       error, errno is set, segment is removed
+   ========================================================================== */
+
+
+static int search_w_close
+(
+    struct search_writer  *w,       /* writer */
+    const char            *dir,     /* index directory */
+    unsigned long          first,   /* first segment number it covers */
+    unsigned long          last     /* last segment number it covers */
+)
+{
+    struct search_hdr      h;       /* segment header */
+    static const char      pad[8];  /* zeros to align directory */
+    size_t                 npad;    /* bytes needed to align directory */
+    char                   path[PATH_MAX + 32];  /* final segment path */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    npad = SEARCH_DIROFF(w->npost) - sizeof(h) - w->npost * sizeof(uint32_t);
+    if (fwrite(pad, 1, npad, w->f) != npad)
+        goto error;
+
+    if (w->ndir && fwrite(w->dir, sizeof(*w->dir), w->ndir, w->f) != w->ndir)
+        goto error;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SEARCH_MAGIC, sizeof(SEARCH_MAGIC));
+    h.version = SEARCH_VERSION;
+    h.ntri = w->ndir;
+    h.npost = w->npost;
+
+    if (fseek(w->f, 0, SEEK_SET) != 0 || fwrite(&h, sizeof(h), 1, w->f) != 1)
+        goto error;
+
+    if (fflush(w->f) != 0 || fsync(fileno(w->f)) != 0)
+        goto error;
+
+    sprintf(path, "%s/%08lx-%08lx", dir, first, last);
+    if (rename(w->tmp, path) != 0)
+        goto error;
+
+    fclose(w->f);
+    free(w->dir);
+    return 0;
+
+error:
+    search_w_abort(w);
+    return -1;
+}
+
+
+/* ==========================================================================
+    Loads postings from journal into memory. Partial record left by a
+    crash is cut off.
+   ========================================================================== */
+
+
+static int search_journal_load(void)
+{
+    struct stat    st;    /* journal file info */
+    uint32_t      *buf;   /* whole journal */
+    size_t         nbuf;  /* number of words in journal */
+    size_t         i;     /* current word in journal */
+    uint32_t       j;     /* current trigram of record */
+    uint32_t       n;     /* number of trigrams in record */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (fstat(jfd, &st) != 0)
+        return -1;
+
+    if (st.st_size == 0)
+        return 0;
+
+    if ((buf = malloc(st.st_size)) == NULL)
+        return -1;
+
+    if (pread(jfd, buf, st.st_size, 0) != st.st_size)
+    {
+        free(buf);
+        return -1;
+    }
+
+    nbuf = st.st_size / sizeof(*buf);
+    for (i = 0; i + 2 <= nbuf; i += 2 + n)
+    {
+        n = buf[i + 1];
+        if (i + 2 + n > nbuf)
+            break;
+
+        for (j = 0; j != n; ++j)
+            if (search_pend(buf[i + 2 + j], buf[i]) != 0)
+            {
+                free(buf);
+                return -1;
+            }
+    }
+
+    free(buf);
+    jsize = i * sizeof(*buf);
+    if (jsize != st.st_size && ftruncate(jfd, jsize) != 0)
+        return -1;
+
+    return 0;
+}
+
+
+/* ==========================================================================
+    Reads whole journal from 'dir' and adds record numbers of uploads
+    that have all 'nq' trigrams from 'qt' to 'res'.
+   ========================================================================== */
+
+
+static int search_journal_query
+(
+    const char      *dir,    /* index directory */
+    const uint32_t  *qt,     /* pattern trigrams */
+    size_t           nq,     /* number of pattern trigrams */
+    unsigned long  **res,    /* found record numbers */
+    size_t          *nres,   /* number of found records */
+    size_t          *rescap  /* allocated records */
+)
+{
+    struct stat      st;     /* journal file info */
+    uint32_t        *buf;    /* whole journal */
+    size_t           nbuf;   /* number of words in journal */
+    size_t           i;      /* current word in journal */
+    size_t           j;      /* current pattern trigram */
+    uint32_t         n;      /* number of trigrams in record */
+    unsigned long   *r;      /* reallocated results */
+    char             path[PATH_MAX + 32];  /* path to journal */
+    int              fd;     /* journal file */
+    ssize_t          rd;     /* bytes read */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    sprintf(path, "%s/journal", dir);
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return errno == ENOENT ? 0 : -1;
+
+    buf = NULL;
+    if (fstat(fd, &st) != 0 || (st.st_size &&
+                (buf = malloc(st.st_size)) == NULL))
+    {
+        close(fd);
+        return -1;
+    }
+
+    /* journal is appended while we read it, we may get partial
+     * record at the end, but that's handled below
+     */
+
+    rd = st.st_size ? pread(fd, buf, st.st_size, 0) : 0;
+    close(fd);
+    if (rd < 0)
+    {
+        free(buf);
+        return -1;
+    }
+
+    nbuf = rd / sizeof(*buf);
+    for (i = 0; i + 2 <= nbuf; i += 2 + n)
+    {
+        n = buf[i + 1];
+        if (i + 2 + n > nbuf)
+            break;
+
+        for (j = 0; j != nq; ++j)
+            if (bsearch(&qt[j], buf + i + 2, n, sizeof(*buf),
+                        search_cmp_u32) == NULL)
+                break;
+
+        if (j != nq)
+            continue;
+
+        if (*nres == *rescap)
+        {
+            *rescap = *rescap ? *rescap * 2 : 64;
+            if ((r = realloc(*res, *rescap * sizeof(*r))) == NULL)
+            {
+                free(buf);
+                return -1;
+            }
+
+            *res = r;
+        }
+
+        (*res)[(*nres)++] = buf[i];
+    }
+
+    free(buf);
+    return 0;
+}
+
+
+/* ==========================================================================
+    Adds record numbers of uploads from segment 's' that have all 'nq'
+    trigrams from 'qt' to 'res'. Cost depends on number of uploads with
+    the rarest trigram, not on number of uploads in segment.
+   ========================================================================== */
+
+
+static int search_seg_query
+(
+    const struct search_seg   *s,      /* segment to search */
+    const uint32_t            *qt,     /* pattern trigrams */
+    size_t                     nq,     /* number of pattern trigrams */
+    unsigned long            **res,    /* found record numbers */
+    size_t                    *nres,   /* number of found records */
+    size_t                    *rescap  /* allocated records */
+)
+{
+    const struct search_dent **d;      /* entries for pattern trigrams */
+    const struct search_dent  *tmp;    /* for swapping */
+    const uint32_t            *p;      /* postings of rarest trigram */
+    unsigned long             *r;      /* reallocated results */
+    size_t                     i;      /* current posting */
+    size_t                     j;      /* current pattern trigram */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if ((d = malloc(nq * sizeof(*d))) == NULL)
+        return -1;
+
+    for (j = 0; j != nq; ++j)
+    {
+        if ((d[j] = search_seg_find(s, qt[j])) == NULL)
+        {
+            /* some trigram is not in any upload here */
+
+            free(d);
+            return 0;
+        }
+
+        if (d[j]->n < d[0]->n)
+        {
+            tmp = d[0];
+            d[0] = d[j];
+            d[j] = tmp;
+        }
+    }
+
+    p = s->post + d[0]->off;
+    for (i = 0; i != d[0]->n; ++i)
+    {
+        for (j = 1; j != nq; ++j)
+            if (bsearch(&p[i], s->post + d[j]->off, d[j]->n,
+                        sizeof(*p), search_cmp_u32) == NULL)
+                break;
+
+        if (j != nq)
+            continue;
+
+        if (*nres == *rescap)
+        {
+            *rescap = *rescap ? *rescap * 2 : 64;
+            if ((r = realloc(*res, *rescap * sizeof(*r))) == NULL)
+            {
+                free(d);
+                return -1;
+            }
+
+            *res = r;
+        }
+
+        (*res)[(*nres)++] = p[i];
+    }
+
+    free(d);
+    return 0;
+}
+
+
+/* ==========================================================================
+    Compares two unsigned long for qsort()
+   ========================================================================== */
+
+
+static int search_cmp_ul
+(
+    const void     *a,  /* first value */
+    const void     *b   /* second value */
+)
+{
+    unsigned long   x;  /* first value */
+    unsigned long   y;  /* second value */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    x = *(const unsigned long *)a;
+    y = *(const unsigned long *)b;
+    return x < y ? -1 : x > y;
+}
+
+
+/* ==========================================================================
+                       __     __ _          ____
+        ____   __  __ / /_   / /(_)_____   / __/__  __ ____   _____ _____
+       / __ \ / / / // __ \ / // // ___/  / /_ / / / // __ \ / ___// ___/
+      / /_/ // /_/ // /_/ // // // /__   / __// /_/ // / / // /__ (__  )
+     / .___/ \__,_//_.___//_//_/ \___/  /_/   \__,_//_/ /_/ \___//____/
+    /_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Opens search index in 'dir' for adding new uploads. Directory is
+    created when it does not exist. Postings from journal are loaded
+    into memory, so they can be turned into segment later.
+
+    returns
+            0       index opened
+           -1       error, errno is set
+   ========================================================================== */
+
+
+int search_init
+(
+    const char     *dir     /* index directory */
+)
+{
+    DIR            *d;      /* index directory */
+    struct dirent  *de;     /* directory entry */
+    unsigned long   first;  /* first segment number in file name */
+    unsigned long   last;   /* last segment number in file name */
+    char            path[PATH_MAX + 32];  /* path to journal */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (strlen(dir) >= sizeof(sdir))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    strcpy(sdir, dir);
+    if (mkdir(sdir, 0755) != 0 && errno != EEXIST)
+        return -1;
+
+    /* new segments must get numbers higher than any existing one,
+     * merged segments are named after range of segments they hold
+     */
+
+    if ((d = opendir(sdir)) == NULL)
+        return -1;
+
+    nextseg = 0;
+    while ((de = readdir(d)) != NULL)
+        if (search_seg_name(de->d_name, &first, &last) == 0 &&
+                last >= nextseg)
+            nextseg = last + 1;
+
+    closedir(d);
+
+    sprintf(path, "%s/journal", sdir);
+    if ((jfd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644)) < 0)
+        return -1;
+
+    if (search_journal_load() != 0)
+    {
+        search_destroy();
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* ==========================================================================
+    Closes index opened with search_init(). Postings stay in journal, so
+    nothing is lost.
+   ========================================================================== */
+
+
+void search_destroy(void)
+{
+    if (jfd != -1)
+        close(jfd);
+
+    free(pend);
+    pend = NULL;
+    npend = pendcap = 0;
+    jsize = 0;
+    jfd = -1;
+}
+
+
+/* ==========================================================================
+    Adds upload with record number 'recno' and content 'data' to the
+    index. Only text is indexed, data with nul byte in it is skipped.
+    Does nothing when index is not opened.
+
+    returns
+            0       upload indexed, or skipped
+           -1       error, errno is set
+   ========================================================================== */
+
+
+int search_add
+(
+    unsigned long   recno,  /* upload index record number */
+    const void     *data,   /* upload content */
+    size_t          len     /* length of data */
+)
+{
+    uint32_t       *rec;    /* journal record */
+    size_t          n;      /* number of trigrams */
+    ssize_t         w;      /* bytes written to journal */
+    size_t          i;      /* current trigram */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (jfd == -1 || len < SEARCH_MIN_PATTERN || memchr(data, '\0', len))
+        return 0;
+
+    /* journal record is recno, number of trigrams and trigrams */
+
+    if ((rec = malloc((2 + len - 2) * sizeof(*rec))) == NULL)
+        return -1;
+
+    n = search_trigrams(data, len, rec + 2);
+    rec[0] = recno;
+    rec[1] = n;
+
+    w = write(jfd, rec, (2 + n) * sizeof(*rec));
+    if (w != (ssize_t)((2 + n) * sizeof(*rec)))
+    {
+        /* don't leave partial record, it would be cut off on next
+         * load anyway, but records after it would be lost too
+         */
+
+        if (w > 0 && ftruncate(jfd, jsize) != 0)
+            goto error;
+
+        if (w >= 0)
+            errno = ENOSPC;
+
+        goto error;
+    }
+
+    jsize += w;
+
+    for (i = 0; i != n; ++i)
+        if (search_pend(rec[2 + i], recno) != 0)
+            goto error;
+
+    free(rec);
+
+    if (npend >= SEARCH_JOURNAL_MAX)
+        return search_flush();
+
+    return 0;
+
+error:
+    free(rec);
+    return -1;
+}
+
+
+/* ==========================================================================
+    Turns journal into new segment file, and empties journal.
+
+    returns
+            0       segment written, or journal is empty
+           -1       error, errno is set, journal is left intact
+   ========================================================================== */
+
+
+int search_flush(void)
+{
+    struct search_writer  w;  /* new segment */
+    size_t                i;  /* current posting */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (jfd == -1 || npend == 0)
+        return 0;
+
+    qsort(pend, npend, sizeof(*pend), search_cmp_post);
+
+    if (search_w_open(&w, sdir, ".tmp") != 0)
+        return -1;
+
+    for (i = 0; i != npend; ++i)
+        if (search_w_post(&w, pend[i].tri, pend[i].recno) != 0)
+        {
+            search_w_abort(&w);
+            return -1;
+        }
+
+    if (search_w_close(&w, sdir, nextseg, nextseg) != 0)
+        return -1;
+
+    /* if we crash before truncating journal, uploads will be in
+     * two segments, but queries and merge take care of duplicates
+     */
+
+    ++nextseg;
+    npend = 0;
+    jsize = 0;
+    if (ftruncate(jfd, 0) != 0)
+        return -1;
+
+    return 0;
+}
+
+
+/* ==========================================================================
+    Finds uploads that may contain 'pat', in index in 'dir'. Found record
+    numbers are sorted and stored in '*recs', which must be freed by
+    caller. Uploads must still be checked if they really contain pattern,
+    having all trigrams of pattern doesn't mean having them in the right
+    order. Search is case insensitive for ASCII letters.
+
+    returns
+            0       search done, even if nothing was found
+           -1       error, errno is set
+
+    errno
+            EINVAL  pattern is shorter than SEARCH_MIN_PATTERN
+   ========================================================================== */
+
+
+int search_query
+(
+    const char        *dir,    /* index directory */
+    const char        *pat,    /* pattern to search for */
+    unsigned long    **recs,   /* found record numbers */
+    size_t            *nrecs   /* number of found records */
+)
+{
+    DIR               *d;      /* index directory */
+    struct dirent     *de;     /* directory entry */
+    struct search_seg  s;      /* mapped segment */
+    uint32_t          *qt;     /* pattern trigrams */
+    size_t             nq;     /* number of pattern trigrams */
+    size_t             rescap; /* allocated results */
+    size_t             i;      /* current result */
+    size_t             n;      /* number of unique results */
+    int                ret;    /* return code */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    *recs = NULL;
+    *nrecs = 0;
+    rescap = 0;
+
+    if (strlen(pat) < SEARCH_MIN_PATTERN)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ((qt = malloc(strlen(pat) * sizeof(*qt))) == NULL)
+        return -1;
+
+    nq = search_trigrams((const unsigned char *)pat, strlen(pat), qt);
+
+    if ((d = opendir(dir)) == NULL)
+    {
+        free(qt);
+        return -1;
+    }
+
+    while ((de = readdir(d)) != NULL)
+    {
+        if (search_seg_map(dir, de->d_name, &s) != 0)
+        {
+            /* not a segment, or merge just removed it, its
+             * content is in merged segment we will find anyway
+             */
+
+            continue;
+        }
+
+        ret = search_seg_query(&s, qt, nq, recs, nrecs, &rescap);
+        munmap(s.map, s.len);
+        if (ret != 0)
+            goto error;
+    }
+
+    if (search_journal_query(dir, qt, nq, recs, nrecs, &rescap) != 0)
+        goto error;
+
+    closedir(d);
+    free(qt);
+
+    /* same upload can be in merged segment and in the ones it was
+     * merged from, when merge happens in the middle of query
+     */
+
+    qsort(*recs, *nrecs, sizeof(**recs), search_cmp_ul);
+    for (n = 0, i = 0; i != *nrecs; ++i)
+        if (n == 0 || (*recs)[i] != (*recs)[n - 1])
+            (*recs)[n++] = (*recs)[i];
+
+    *nrecs = n;
+    return 0;
+
+error:
+    closedir(d);
+    free(qt);
+    free(*recs);
+    *recs = NULL;
+    *nrecs = 0;
+    return -1;
+}
+
+
+/* ==========================================================================
+    Merges all segments in 'dir' into one. When upload index 'm' is not
+    NULL, uploads marked as deleted in it are dropped. Can be run while
+    server is adding new uploads to the index.
+
+    returns
+            0       segments merged, or there was nothing to merge
+           -1       error, errno is set
+   ========================================================================== */
+
+
+int search_merge
+(
+    const char                *dir,     /* index directory */
+    const struct upidx_map    *m        /* upload index, or NULL */
+)
+{
+    DIR                       *d;       /* index directory */
+    struct dirent             *de;      /* directory entry */
+    struct search_seg         *segs;    /* all mapped segments */
+    struct search_seg         *sp;      /* reallocated segments */
+    struct search_writer       w;       /* merged segment */
+    const struct search_dent  *e;       /* directory entry of segment */
+    uint32_t                  *list;    /* merged postings of one trigram */
+    uint32_t                  *lp;      /* reallocated list */
+    size_t                     listcap; /* allocated postings in list */
+    size_t                     nlist;   /* postings in list */
+    size_t                     nsegs;   /* number of mapped segments */
+    size_t                     i;       /* current segment */
+    size_t                     j;       /* current posting */
+    uint32_t                   tri;     /* trigram being merged */
+    unsigned long              first;   /* first segment in merged one */
+    unsigned long              last;    /* last segment in merged one */
+    int                        ret;     /* return code */
+    char                       path[PATH_MAX + 32];  /* segment to remove */
+    char                       name[32];  /* merged segment name */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if ((d = opendir(dir)) == NULL)
+        return -1;
+
+    segs = NULL;
+    list = NULL;
+    nsegs = listcap = 0;
+    first = ULONG_MAX;
+    last = 0;
+    ret = -1;
+
+    while ((de = readdir(d)) != NULL)
+    {
+        if ((sp = realloc(segs, (nsegs + 1) * sizeof(*segs))) == NULL)
+            goto error;
+
+        segs = sp;
+        if (search_seg_map(dir, de->d_name, &segs[nsegs]) != 0)
+            continue;
+
+        first = segs[nsegs].first < first ? segs[nsegs].first : first;
+        last = segs[nsegs].last > last ? segs[nsegs].last : last;
+        ++nsegs;
+    }
+
+    /* single segment is merged only to drop deleted uploads */
+
+    if (nsegs == 0 || (nsegs == 1 && m == NULL))
+    {
+        ret = 0;
+        goto error;
+    }
+
+    if (search_w_open(&w, dir, ".merge") != 0)
+        goto error;
+
+    for (;;)
+    {
+        /* find smallest trigram among all segments, there are not
+         * many segments when merge is done regularly, so linear
+         * scan is good enough
+         */
+
+        tri = UINT32_MAX;
+        for (i = 0; i != nsegs; ++i)
+            if (segs[i].pos != segs[i].ntri &&
+                    segs[i].dir[segs[i].pos].tri < tri)
+                tri = segs[i].dir[segs[i].pos].tri;
+
+        if (tri == UINT32_MAX)
+            break;
+
+        for (nlist = 0, i = 0; i != nsegs; ++i)
+        {
+            if (segs[i].pos == segs[i].ntri ||
+                    (e = &segs[i].dir[segs[i].pos])->tri != tri)
+                continue;
+
+            if (nlist + e->n > listcap)
+            {
+                listcap = (nlist + e->n) * 2;
+                if ((lp = realloc(list, listcap * sizeof(*list))) == NULL)
+                {
+                    search_w_abort(&w);
+                    goto error;
+                }
+
+                list = lp;
+            }
+
+            for (j = 0; j != e->n; ++j)
+            {
+                if (m && segs[i].post[e->off + j] < m->nrec &&
+                        m->rec[segs[i].post[e->off + j]].flags & UPIDX_DELETED)
+                    continue;
+
+                list[nlist++] = segs[i].post[e->off + j];
+            }
+
+            ++segs[i].pos;
+        }
+
+        /* segments are read in directory order, and may overlap
+         * after crash, so postings must be sorted again
+         */
+
+        qsort(list, nlist, sizeof(*list), search_cmp_u32);
+        for (j = 0; j != nlist; ++j)
+            if (search_w_post(&w, tri, list[j]) != 0)
+            {
+                search_w_abort(&w);
+                goto error;
+            }
+    }
+
+    if (search_w_close(&w, dir, first, last) != 0)
+        goto error;
+
+    /* merged segment is in place, old ones can go now */
+
+    sprintf(name, "%08lx-%08lx", first, last);
+    for (i = 0; i != nsegs; ++i)
+    {
+        if (strcmp(segs[i].name, name) == 0)
+            continue;
+
+        sprintf(path, "%s/%s", dir, segs[i].name);
+        unlink(path);
+    }
+
+    ret = 0;
+
+error:
+    for (i = 0; i != nsegs; ++i)
+        munmap(segs[i].map, segs[i].len);
+
+    free(segs);
+    free(list);
+    closedir(d);
+    return ret;
+}
@@ -0,0 +1,32 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef SEARCH_H
+#define SEARCH_H 1
+
+#include <stddef.h>
+
+#include "upidx.h"
+
+/* shortest pattern that can be searched for, that's one trigram */
+
+#define SEARCH_MIN_PATTERN 3
+
+/* number of postings in journal, after which journal is turned into
+ * immutable segment file
+ */
+
+#define SEARCH_JOURNAL_MAX (1024l * 1024)
+
+int search_init(const char *dir);
+void search_destroy(void);
+int search_add(unsigned long recno, const void *data, size_t len);
+int search_flush(void);
+
+int search_query(const char *dir, const char *pat, unsigned long **recs,
+        size_t *nrecs);
+int search_merge(const char *dir, const struct upidx_map *m);
+
+#endif
@@ -0,0 +1,1077 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         -------------------------------------------------------------
+        / Packed storage for tiny uploads. Most pastes are just few   \
+        | hundred bytes, and each of them, stored as separate file,   |
+        | costs inode, directory entry and whole filesystem block.    |
+        | Here small uploads are appended one after another into big  |
+        | segment files, and an append-only index file maps upload    |
+        | name to segment, offset and length. Removed entries leave   |
+        | holes in segments, so once segment is mostly holes, live    |
+        \ entries are moved to the newest segment and old one goes.   /
+         -------------------------------------------------------------
+                \   ^__^
+                 \  (oo)\_______
+                    (__)\       )\/\
+                        ||----w |
+                        ||     ||
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "feature.h"
+
+#include <embedlog.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#if HAVE_LINUX_LIMITS_H
+#   include <linux/limits.h>
+#endif
+
+#include "segstore.h"
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* initial number of hash buckets, must be power of 2, table grows
+ * when there are more entries than buckets
+ */
+
+#define SEGSTORE_NBUCKETS 1024
+
+/* single record in index file, records are only appended, record
+ * for name that already exists overrides previous one (that's how
+ * compaction moves entries), deleted record removes entry.
+ */
+
+struct segstore_rec
+{
+    char      name[32];  /* upload name */
+    uint32_t  seg;       /* segment number */
+    uint32_t  off;       /* offset of data in segment */
+    uint32_t  len;       /* length of data */
+    uint32_t  deleted;   /* 1 when this record removes entry */
+    uint64_t  mtime;     /* upload time */
+};
+
+/* in memory index entry */
+
+struct segstore_entry
+{
+    char                    name[32];  /* upload name */
+    unsigned long           seg;       /* segment number */
+    unsigned long           off;       /* offset of data in segment */
+    unsigned long           len;       /* length of data */
+    time_t                  mtime;     /* upload time */
+    struct segstore_entry  *hnext;     /* next entry in the same bucket */
+};
+
+struct segment
+{
+    unsigned long  size;  /* bytes used in segment, 0 - segment is gone */
+    unsigned long  dead;  /* bytes used by removed or moved entries */
+};
+
+static char                     sdir[PATH_MAX]; /* store directory */
+static unsigned long            seg_max;  /* max size of single segment */
+static struct segstore_entry  **buckets;  /* hash table */
+static size_t                   nbuckets; /* number of buckets */
+static size_t                   nentries; /* number of live entries */
+static struct segment          *segs;     /* info about all segments */
+static unsigned long            nsegs;    /* number of segs, last is active */
+static int                      afd = -1; /* active segment, append only */
+static int                      ifd = -1; /* index file, append only */
+static unsigned long            nrecs;    /* number of records in index */
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Calculates hash for file 'name' (djb2)
+   ========================================================================== */
+
+
+static unsigned long segstore_hash
+(
+    const char     *name  /* name to calculate hash for */
+)
+{
+    unsigned long   h;    /* calculated hash */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (h = 5381; *name; ++name)
+        h = h * 33 + (unsigned char)*name;
+
+    return h;
+}
+
+
+/* ==========================================================================
+    Finds entry with 'name'.
+
+    returns
+            pointer to pointer that points to found entry, or that points
+            to NULL when there is no entry with such name. This way, found
+            entry can be easily removed from the bucket.
+   ========================================================================== */
+
+
+static struct segstore_entry **segstore_find
+(
+    const char              *name  /* name of upload to find */
+)
+{
+    struct segstore_entry  **pp;   /* pointer to found entry */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    pp = &buckets[segstore_hash(name) & (nbuckets - 1)];
+    for (; *pp != NULL; pp = &(*pp)->hnext)
+        if (strcmp((*pp)->name, name) == 0)
+            break;
+
+    return pp;
+}
+
+
+/* ==========================================================================
+    Adds entry to hash table, doubling the table first when it's full.
+    When there is no memory to grow the table, we live with longer
+    chains.
+   ========================================================================== */
+
+
+static void segstore_insert
+(
+    struct segstore_entry   *e     /* entry to add */
+)
+{
+    struct segstore_entry  **nb;   /* new buckets */
+    struct segstore_entry   *n;    /* entry being rehashed */
+    struct segstore_entry  **pp;   /* bucket for entry */
+    size_t                   i;    /* bucket index */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (nentries >= nbuckets &&
+            (nb = calloc(nbuckets * 2, sizeof(*nb))) != NULL)
+    {
+        for (i = 0; i != nbuckets; ++i)
+        {
+            while ((n = buckets[i]) != NULL)
+            {
+                buckets[i] = n->hnext;
+                pp = &nb[segstore_hash(n->name) & (nbuckets * 2 - 1)];
+                n->hnext = *pp;
+                *pp = n;
+            }
+        }
+
+        free(buckets);
+        buckets = nb;
+        nbuckets *= 2;
+    }
+
+    pp = &buckets[segstore_hash(e->name) & (nbuckets - 1)];
+    e->hnext = *pp;
+    *pp = e;
+    ++nentries;
+}
+
+
+/* ==========================================================================
+    Makes sure 'segs' array can hold info about segment 'seg'.
+   ========================================================================== */
+
+
+static int segstore_grow_segs
+(
+    unsigned long    seg  /* segment number that must fit in segs */
+)
+{
+    struct segment  *ns;  /* reallocated segments */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (seg < nsegs)
+        return 0;
+
+    if ((ns = realloc(segs, (seg + 1) * sizeof(*ns))) == NULL)
+        return -1;
+
+    memset(ns + nsegs, 0, (seg + 1 - nsegs) * sizeof(*ns));
+    segs = ns;
+    nsegs = seg + 1;
+    return 0;
+}
+
+
+/* ==========================================================================
+    Builds path to segment 'seg'
+   ========================================================================== */
+
+
+static void segstore_seg_path
+(
+    unsigned long  seg,   /* segment number */
+    char          *path   /* path will be stored here */
+)
+{
+    /* segment number is only 32 bit in index record, so it never
+     * takes more than 8 characters in path
+     */
+
+    sprintf(path, "%s/%08lx", sdir, seg & 0xffffffffUL);
+}
+
+
+/* ==========================================================================
+    Fills index record 'rec' with info from entry 'e'.
+   ========================================================================== */
+
+
+static void segstore_fill_rec
+(
+    struct segstore_rec          *rec,     /* record to fill */
+    const struct segstore_entry  *e,       /* entry to take info from */
+    int                           deleted  /* is this delete record? */
+)
+{
+    memset(rec, 0, sizeof(*rec));
+    strcpy(rec->name, e->name);
+    rec->seg = e->seg;
+    rec->off = e->off;
+    rec->len = e->len;
+    rec->deleted = deleted;
+    rec->mtime = e->mtime;
+}
+
+
+/* ==========================================================================
+    Opens index file for appending, directory is created when it doesn't
+    exist yet. This is delayed until something is written to the store,
+    so no files are created when packing is not used, and external tools
+    can load the store to read uploads without modifying it.
+   ========================================================================== */
+
+
+static int segstore_open_index(void)
+{
+    char  path[PATH_MAX + 16];  /* path to index file */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (ifd != -1)
+        return 0;
+
+    if (mkdir(sdir, 0755) != 0 && errno != EEXIST)
+    {
+        el_perror(ELE, "segstore: couldn't create %s", sdir);
+        return -1;
+    }
+
+    sprintf(path, "%s/index", sdir);
+    if ((ifd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0)
+    {
+        el_perror(ELE, "segstore: couldn't open %s", path);
+        return -1;
+    }
+
+    /* partial record could have been left by crash, cut it off
+     * so new records are aligned
+     */
+
+    if (ftruncate(ifd, nrecs * sizeof(struct segstore_rec)) != 0)
+    {
+        el_perror(ELE, "segstore: couldn't truncate %s", path);
+        close(ifd);
+        ifd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* ==========================================================================
+    Appends record about entry 'e' to the index file.
+   ========================================================================== */
+
+
+static int segstore_write_rec
+(
+    const struct segstore_entry  *e,       /* entry to write */
+    int                           deleted  /* is this delete record? */
+)
+{
+    struct segstore_rec           rec;     /* record to write */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (segstore_open_index() != 0)
+        return -1;
+
+    segstore_fill_rec(&rec, e, deleted);
+    if (write(ifd, &rec, sizeof(rec)) != sizeof(rec))
+    {
+        /* don't leave partial record, or every record after it
+         * would be read wrong after restart
+         */
+
+        el_perror(ELE, "segstore: couldn't write index record");
+        if (ftruncate(ifd, nrecs * sizeof(rec)) != 0)
+            el_perror(ELC, "segstore: couldn't truncate index");
+        return -1;
+    }
+
+    ++nrecs;
+    return 0;
+}
+
+
+/* ==========================================================================
+    Appends 'len' bytes of 'data' to active segment. New segment is
+    started when data would not fit into the active one. Location of
+    stored data is returned via 'seg' and 'off'.
+   ========================================================================== */
+
+
+static int segstore_append
+(
+    const void     *data,  /* data to store */
+    unsigned long   len,   /* length of data */
+    unsigned long  *seg,   /* segment where data was stored */
+    unsigned long  *off    /* offset in segment where data begins */
+)
+{
+    char            path[PATH_MAX + 16];  /* path to segment */
+    unsigned long   active;               /* active segment number */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (nsegs && segs[nsegs - 1].size + len > seg_max)
+    {
+        /* active segment is full, start a new one */
+
+        close(afd);
+        afd = -1;
+        if (segstore_grow_segs(nsegs) != 0)
+            return -1;
+    }
+
+    if (nsegs == 0 && segstore_grow_segs(0) != 0)
+        return -1;
+
+    active = nsegs - 1;
+
+    if (afd == -1)
+    {
+        segstore_seg_path(active, path);
+        if ((afd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0)
+        {
+            el_perror(ELE, "segstore: couldn't open %s", path);
+            return -1;
+        }
+
+        /* there may be some garbage after last indexed entry, when
+         * we crashed between writing data and index record
+         */
+
+        if (ftruncate(afd, segs[active].size) != 0)
+        {
+            el_perror(ELE, "segstore: couldn't truncate %s", path);
+            close(afd);
+            afd = -1;
+            return -1;
+        }
+    }
+
+    if (write(afd, data, len) != (ssize_t)len)
+    {
+        el_perror(ELE, "segstore: couldn't write to segment %08lx", active);
+        if (ftruncate(afd, segs[active].size) != 0)
+            el_perror(ELC, "segstore: couldn't truncate segment");
+        return -1;
+    }
+
+    *seg = active;
+    *off = segs[active].size;
+    segs[active].size += len;
+    return 0;
+}
+
+
+/* ==========================================================================
+    Loads index file into memory. Missing index is not an error, it just
+    means nothing has been packed yet.
+   ========================================================================== */
+
+
+static int segstore_load(void)
+{
+    FILE                    *f;     /* index file */
+    struct segstore_rec      rec;   /* record read from index */
+    struct segstore_entry  **pp;    /* entry with name from record */
+    struct segstore_entry   *e;     /* entry to update */
+    char                     path[PATH_MAX + 16];  /* path to index */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    sprintf(path, "%s/index", sdir);
+    if ((f = fopen(path, "r")) == NULL)
+    {
+        if (errno == ENOENT)
+            return 0;
+
+        el_perror(ELE, "segstore: couldn't open %s", path);
+        return -1;
+    }
+
+    while (fread(&rec, sizeof(rec), 1, f) == 1)
+    {
+        ++nrecs;
+        rec.name[sizeof(rec.name) - 1] = '\0';
+
+        if (segstore_grow_segs(rec.seg) != 0)
+            goto error;
+
+        pp = segstore_find(rec.name);
+
+        if (*pp != NULL)
+        {
+            /* entry is either deleted or moved, either way, its
+             * old location is now dead space
+             */
+
+            segs[(*pp)->seg].dead += (*pp)->len;
+        }
+
+        if (rec.deleted)
+        {
+            if ((e = *pp) != NULL)
+            {
+                *pp = e->hnext;
+                --nentries;
+                free(e);
+            }
+
+            continue;
+        }
+
+        if (rec.off + rec.len > segs[rec.seg].size)
+            segs[rec.seg].size = rec.off + rec.len;
+
+        if ((e = *pp) == NULL)
+        {
+            if ((e = malloc(sizeof(*e))) == NULL)
+                goto error;
+
+            strcpy(e->name, rec.name);
+            segstore_insert(e);
+        }
+
+        e->seg = rec.seg;
+        e->off = rec.off;
+        e->len = rec.len;
+        e->mtime = (time_t)rec.mtime;
+    }
+
+    if (ferror(f))
+    {
+        el_perror(ELE, "segstore: couldn't read %s", path);
+        goto error;
+    }
+
+    fclose(f);
+
+    /* partial record crash could have left, is cut off when index
+     * is opened for writing
+     */
+
+    return 0;
+
+error:
+    fclose(f);
+    return -1;
+}
+
+
+/* ==========================================================================
+    Removes segment files that no longer hold any live entry. This must
+    be called only after index without records pointing to these segments
+    has been written, otherwise old records would make removed segment
+    look alive again after restart. Segments above the last live one are
+    not even known after restart, so if we didn't remove them here, they
+    would stay on the disk forever.
+   ========================================================================== */
+
+
+static void segstore_remove_dead_segs(void)
+{
+    struct segstore_entry  *e;      /* current entry */
+    unsigned char          *live;   /* does segment hold live entry? */
+    unsigned long           id;     /* segment number */
+    size_t                  i;      /* bucket index */
+    char                    path[PATH_MAX + 16];  /* path to segment */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    /* no memory is not fatal, files will be removed with next
+     * index rewrite
+     */
+
+    if (nsegs == 0 || (live = calloc(nsegs, 1)) == NULL)
+        return;
+
+    /* size and dead bytes cannot tell if segment is alive, as
+     * there may be live entries with 0 length in it
+     */
+
+    for (i = 0; i != nbuckets; ++i)
+        for (e = buckets[i]; e != NULL; e = e->hnext)
+            live[e->seg] = 1;
+
+    for (id = 0; id != nsegs; ++id)
+    {
+        if (live[id])
+            continue;
+
+        if (id == nsegs - 1 && afd != -1)
+        {
+            /* active segment is dead too, next append will
+             * create it again
+             */
+
+            close(afd);
+            afd = -1;
+        }
+
+        segstore_seg_path(id, path);
+        if (unlink(path) != 0 && errno != ENOENT)
+        {
+            el_perror(ELW, "segstore: couldn't remove %s", path);
+            continue;
+        }
+
+        segs[id].size = 0;
+        segs[id].dead = 0;
+    }
+
+    free(live);
+}
+
+
+/* ==========================================================================
+    Writes new index file with only live entries in it and replaces old
+    index with it. This gets rid of all records of removed and moved
+    entries, so index doesn't grow forever. Segments left without live
+    entries are removed once new index is in place.
+   ========================================================================== */
+
+
+static int segstore_rewrite_index(void)
+{
+    FILE                   *f;      /* new index file */
+    struct segstore_rec     rec;    /* record to write */
+    struct segstore_entry  *e;      /* current entry */
+    size_t                  i;      /* bucket index */
+    char                    tmp[PATH_MAX + 16];   /* new index path */
+    char                    path[PATH_MAX + 16];  /* index path */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    sprintf(tmp, "%s/index.tmp", sdir);
+    sprintf(path, "%s/index", sdir);
+
+    if ((f = fopen(tmp, "w")) == NULL)
+    {
+        el_perror(ELE, "segstore: couldn't open %s", tmp);
+        return -1;
+    }
+
+    for (i = 0; i != nbuckets; ++i)
+    {
+        for (e = buckets[i]; e != NULL; e = e->hnext)
+        {
+            segstore_fill_rec(&rec, e, 0);
+            if (fwrite(&rec, sizeof(rec), 1, f) != 1)
+                break;
+        }
+    }
+
+    if (fclose(f) != 0 || i != nbuckets)
+    {
+        el_perror(ELE, "segstore: couldn't write %s", tmp);
+        unlink(tmp);
+        return -1;
+    }
+
+    if (rename(tmp, path) != 0)
+    {
+        el_perror(ELE, "segstore: couldn't rename %s", tmp);
+        unlink(tmp);
+        return -1;
+    }
+
+    segstore_remove_dead_segs();
+
+    close(ifd);
+    ifd = -1;
+    nrecs = nentries;
+    return segstore_open_index();
+}
+
+
+/* ==========================================================================
+                       __     __ _          ____
+        ____   __  __ / /_   / /(_)_____   / __/__  __ ____   _____ _____
+       / __ \ / / / // __ \ / // // ___/  / /_ / / / // __ \ / ___// ___/
+      / /_/ // /_/ // /_/ // // // /__   / __// /_/ // / / // /__ (__  )
+     / .___/ \__,_//_.___//_//_/ \___/  /_/   \__,_//_/ /_/ \___//____/
+    /_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Initializes store kept in directory 'dir', index is loaded into
+    memory. Directory does not have to exist, it will be created when
+    first upload is stored. New segment is started when active one would
+    grow beyond 'segment_max' bytes.
+
+    returns
+            0       store initialized
+           -1       error, errno is set
+   ========================================================================== */
+
+
+int segstore_init
+(
+    const char  *dir,         /* directory for segments and index */
+    size_t       segment_max  /* max size of single segment */
+)
+{
+    if (strlen(dir) >= sizeof(sdir))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    strcpy(sdir, dir);
+    seg_max = segment_max;
+    nbuckets = SEGSTORE_NBUCKETS;
+    nentries = 0;
+    nrecs = 0;
+    nsegs = 0;
+    segs = NULL;
+    afd = -1;
+    ifd = -1;
+
+    if ((buckets = calloc(nbuckets, sizeof(*buckets))) == NULL)
+        return -1;
+
+    if (segstore_load() != 0)
+    {
+        segstore_destroy();
+        return -1;
+    }
+
+    el_print(ELN, "segstore: loaded %lu entries in %lu segments",
+            (unsigned long)nentries, nsegs);
+    return 0;
+}
+
+
+/* ==========================================================================
+    Frees all resources allocated by store. Everything is already on the
+    disk, so nothing to flush.
+   ========================================================================== */
+
+
+void segstore_destroy(void)
+{
+    struct segstore_entry  *e;  /* entry to free */
+    size_t                  i;  /* bucket index */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (i = 0; buckets && i != nbuckets; ++i)
+    {
+        while ((e = buckets[i]) != NULL)
+        {
+            buckets[i] = e->hnext;
+            free(e);
+        }
+    }
+
+    if (afd != -1)
+        close(afd);
+
+    if (ifd != -1)
+        close(ifd);
+
+    free(buckets);
+    free(segs);
+    buckets = NULL;
+    segs = NULL;
+    nbuckets = 0;
+    nentries = 0;
+    nsegs = 0;
+    afd = -1;
+    ifd = -1;
+}
+
+
+/* ==========================================================================
+    Stores upload 'name' with 'data' of 'len' bytes in the store. If
+    'name' already exists, it is replaced.
+
+    returns
+            0       data stored
+           -1       error, errno is set
+
+    errno
+            EINVAL  len is 0 or bigger than segment_max
+   ========================================================================== */
+
+
+int segstore_put
+(
+    const char             *name,   /* name of upload */
+    const void             *data,   /* upload content */
+    size_t                  len,    /* length of data */
+    time_t                  mtime   /* upload time */
+)
+{
+    struct segstore_entry   ne;     /* new entry */
+    struct segstore_entry **pp;     /* existing entry */
+    struct segstore_entry  *e;      /* entry to store in hash table */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (len == 0 || len > seg_max ||
+            strlen(name) >= sizeof(ne.name))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (segstore_open_index() != 0)
+        return -1;
+
+    strcpy(ne.name, name);
+    ne.len = len;
+    ne.mtime = mtime;
+
+    if (segstore_append(data, len, &ne.seg, &ne.off) != 0)
+        return -1;
+
+    if (segstore_write_rec(&ne, 0) != 0)
+    {
+        /* data is in segment, but nobody knows about it */
+
+        segs[ne.seg].dead += len;
+        return -1;
+    }
+
+    pp = segstore_find(name);
+    if ((e = *pp) != NULL)
+    {
+        segs[e->seg].dead += e->len;
+        ne.hnext = e->hnext;
+        *e = ne;
+        return 0;
+    }
+
+    if ((e = malloc(sizeof(*e))) == NULL)
+    {
+        /* record is in the index, so entry will show up after
+         * restart, we just can't serve it until then
+         */
+
+        el_print(ELC, "segstore: no memory for entry %s", name);
+        return -1;
+    }
+
+    *e = ne;
+    segstore_insert(e);
+    return 0;
+}
+
+
+/* ==========================================================================
+    Checks if upload 'name' is in the store.
+
+    returns
+            1       upload exists
+            0       no such upload
+   ========================================================================== */
+
+
+int segstore_exists
+(
+    const char  *name  /* upload name to check */
+)
+{
+    if (buckets == NULL)
+        return 0;
+
+    return *segstore_find(name) != NULL;
+}
+
+
+/* ==========================================================================
+    Opens upload 'name' for reading. Returned descriptor points to the
+    segment file, upload data starts at '*off' and is '*len' bytes long.
+    Caller must close descriptor when done. Descriptor stays valid even
+    if segment is compacted in the meantime.
+
+    returns
+            >=0     descriptor of segment with upload data
+           -1       error, errno is set
+
+    errno
+            ENOENT  no such upload in the store
+   ========================================================================== */
+
+
+int segstore_open
+(
+    const char             *name,   /* upload to open */
+    off_t                  *off,    /* offset of data in segment */
+    size_t                 *len,    /* length of data */
+    time_t                 *mtime   /* upload time */
+)
+{
+    struct segstore_entry  *e;      /* found entry */
+    int                     fd;     /* opened segment */
+    char                    path[PATH_MAX + 16];  /* path to segment */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (buckets == NULL || (e = *segstore_find(name)) == NULL)
+    {
+        errno = ENOENT;
+        return -1;
+    }
+
+    segstore_seg_path(e->seg, path);
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return -1;
+
+    *off = e->off;
+    *len = e->len;
+    *mtime = e->mtime;
+    return fd;
+}
+
+
+/* ==========================================================================
+    Removes upload 'name' from the store. Space it occupied is reclaimed
+    later by segstore_compact().
+
+    returns
+            0       upload removed
+           -1       error, errno is set
+
+    errno
+            ENOENT  no such upload in the store
+   ========================================================================== */
+
+
+int segstore_remove
+(
+    const char              *name  /* upload to remove */
+)
+{
+    struct segstore_entry  **pp;   /* entry to remove */
+    struct segstore_entry   *e;    /* entry to remove */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (buckets == NULL || (e = *(pp = segstore_find(name))) == NULL)
+    {
+        errno = ENOENT;
+        return -1;
+    }
+
+    if (segstore_write_rec(e, 1) != 0)
+        return -1;
+
+    segs[e->seg].dead += e->len;
+    *pp = e->hnext;
+    --nentries;
+    free(e);
+    return 0;
+}
+
+
+/* ==========================================================================
+    Performs one step of compaction. Single segment, that has at least
+    half of its space dead, has its live entries moved to the active
+    segment and is then deleted. When index file has a lot more records
+    than there are live entries, it is rewritten. Function does bounded
+    amount of work, so it is meant to be called periodically.
+
+    returns
+            0       step finished, or there was nothing to do
+           -1       error, errno is set
+   ========================================================================== */
+
+
+int segstore_compact(void)
+{
+    struct segstore_entry  *e;      /* current entry */
+    unsigned long           id;     /* segment to compact */
+    unsigned long           moved;  /* number of moved entries */
+    unsigned long           seg;    /* new segment of entry */
+    unsigned long           off;    /* new offset of entry */
+    unsigned long           oldoff; /* old offset of entry */
+    unsigned char          *buf;    /* entry data */
+    size_t                  i;      /* bucket index */
+    int                     fd;     /* segment being compacted */
+    char                    path[PATH_MAX + 16];  /* path to segment */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (buckets == NULL)
+        return 0;
+
+    /* active segment (the last one) is never compacted, we would
+     * be moving entries into the very same segment
+     */
+
+    for (id = 0; id + 1 < nsegs; ++id)
+        if (segs[id].size && segs[id].dead * 2 >= segs[id].size)
+            break;
+
+    if (id + 1 >= nsegs)
+        goto index;
+
+    segstore_seg_path(id, path);
+    if ((fd = open(path, O_RDONLY)) < 0)
+    {
+        if (errno == ENOENT)
+        {
+            /* segment was compacted already, but index was not
+             * rewritten before restart, so its old records made
+             * segment look alive again
+             */
+
+            segs[id].size = 0;
+            segs[id].dead = 0;
+            goto index;
+        }
+
+        el_perror(ELE, "segstore: couldn't open %s", path);
+        return -1;
+    }
+
+    moved = 0;
+    for (i = 0; i != nbuckets; ++i)
+    {
+        for (e = buckets[i]; e != NULL; e = e->hnext)
+        {
+            if (e->seg != id)
+                continue;
+
+            if ((buf = malloc(e->len)) == NULL)
+                goto error;
+
+            if (pread(fd, buf, e->len, e->off) != (ssize_t)e->len)
+            {
+                el_perror(ELE, "segstore: couldn't read %s from %s",
+                        e->name, path);
+                free(buf);
+                goto error;
+            }
+
+            if (segstore_append(buf, e->len, &seg, &off) != 0)
+            {
+                free(buf);
+                goto error;
+            }
+
+            free(buf);
+
+            /* record overrides previous location of entry, if we
+             * crash before old segment is removed, entry will be
+             * read from new place anyway
+             */
+
+            oldoff = e->off;
+            e->seg = seg;
+            e->off = off;
+            if (segstore_write_rec(e, 0) != 0)
+            {
+                /* that's bad, we moved the entry, but couldn't
+                 * tell index about it, so we cannot remove old
+                 * segment as index still points to it. Point
+                 * entry back to the old location.
+                 */
+
+                segs[seg].dead += e->len;
+                e->seg = id;
+                e->off = oldoff;
+                goto error;
+            }
+
+            segs[id].dead += e->len;
+            ++moved;
+        }
+    }
+
+    close(fd);
+    if (unlink(path) != 0)
+        el_perror(ELW, "segstore: couldn't remove %s", path);
+
+    el_print(ELI, "segstore: compacted segment %08lx, moved %lu entries",
+            id, moved);
+    segs[id].size = 0;
+    segs[id].dead = 0;
+
+index:
+    /* rewrite index only when most of its records are garbage */
+
+    if (nrecs > 2 * nentries + SEGSTORE_NBUCKETS)
+        return segstore_rewrite_index();
+
+    return 0;
+
+error:
+    close(fd);
+    return -1;
+}
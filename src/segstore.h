@@ -0,0 +1,27 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef SEGSTORE_H
+#define SEGSTORE_H 1
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+/* default max size of single segment file, uploads never cross
+ * segments
+ */
+
+#define SEGSTORE_SEGMENT_MAX (64l * 1024 * 1024)
+
+int segstore_init(const char *dir, size_t segment_max);
+void segstore_destroy(void);
+int segstore_put(const char *name, const void *data, size_t len, time_t mtime);
+int segstore_exists(const char *name);
+int segstore_open(const char *name, off_t *off, size_t *len, time_t *mtime);
+int segstore_remove(const char *name);
+int segstore_compact(void);
+
+#endif
@@ -40,6 +40,7 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stddef.h>
@@ -47,8 +48,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <time.h>
@@ -62,11 +65,22 @@
 #   include <sys/select.h>
 #endif
 
+#include "autoban.h"
 #include "bnwlist.h"
+#include "cache.h"
 #include "config.h"
 #include "globals.h"
+#include "http.h"
+#include "httpd.h"
+#include "limit.h"
+#include "proxy.h"
+#include "expire.h"
+#include "search.h"
+#include "segstore.h"
 #include "server.h"
 #include "ssl/ssl.h"
+#include "stats.h"
+#include "upidx.h"
 
 
 /* ==========================================================================
@@ -83,33 +97,131 @@
 
 #define EL_OPTIONS_OBJECT &g_qlog
 
+/* every client starts with reads of that size, and never goes below
+ * it, window grows up to g_config.read_budget for fast clients
+ */
+
+#define SERVER_RWIN_MIN 8192
+
+/* protocol spoken on server socket */
+
+enum sproto
+{
+    sproto_termsend,     /* raw upload, ends with "termsend\n", FIN or
+                          * timeout */
+    sproto_http,         /* http downloads */
+    sproto_http_upload   /* http PUT/POST uploads */
+};
+
+/* reasons for turning client away before it gets upload slot */
+
+enum reject
+{
+    reject_banned,       /* source is autobanned */
+    reject_busy,         /* source has too many uploads in progress */
+    reject_rate,         /* source connects too often */
+    reject_slots,        /* all upload slots are taken */
+    reject_denied,       /* source is not allowed by black or white list */
+    reject_max
+};
+
 /* struct holding info about server socket */
 
 struct sinfo
 {
-    int  fd;     /* systems file descriptor of socket */
-    int  ssl;    /* is this ssl connection? */
-    int  sslfd;  /* if ssl is enabled, holds ssl fd for ssl_* functions */
-    int  timed;  /* is this timed-enabled port? */
+    int          fd;     /* systems file descriptor of socket */
+    int          ssl;    /* is this ssl connection? */
+    int          sslfd;  /* if ssl is enabled, holds ssl fd for ssl_*
+                          * functions */
+    int          timed;  /* is this timed-enabled port? */
+    int          proxy;  /* connections start with PROXY header */
+    int          filter; /* list is also enforced by kernel filter */
+    enum sproto  proto;  /* protocol spoken on this port */
 };
 
 struct cinfo
 {
-    int              cfd;
-    int              ffd;
-    int              ssl;
-    int              sslfd;
-    int              timed;
-    char             fname[32];
-    struct timespec  timeout_at;
-    size_t           written;
+    int                  cfd;
+    int                  ffd;
+    int                  ssl;
+    int                  sslfd;
+    int                  timed;
+    char                 fname[32];
+    struct timespec      timeout_at;
+    size_t               written;
+    unsigned char       *mem;        /* in-memory copy of upload for cache */
+    size_t               memsize;    /* allocated size of mem */
+    int                  http;       /* is this http upload client? */
+    int                  head_done;  /* http request head received */
+    int                  body_done;  /* http request body received */
+    char                 head[4096]; /* http request head */
+    size_t               headlen;    /* number of bytes in head */
+    off_t                clen;       /* Content-Length, -1 if chunked */
+    struct http_chunked  chunk;      /* chunked encoding decoder */
+    struct limit_client  lim;        /* source of client for limits */
+    struct sockaddr_storage  addr;   /* address of client */
+    char                 ips[INET6_ADDRSTRLEN]; /* addr formatted for logs */
+    int                  proxy;      /* waiting for PROXY header */
+    struct sinfo        *srv;        /* server socket client came from */
+    size_t               rwin;       /* bytes read from client per round */
+    struct timespec      active_at;  /* when client was last active */
+    struct timespec      deadline_at; /* upload must finish before that */
+    double               rate_at;    /* when current rate window started */
+    size_t               rate_cur;   /* bytes received in current window */
+    size_t               rate_prev;  /* bytes received in previous window */
+    int                  rate_held;  /* we throttled client, bit 0 in
+                                      * current, bit 1 in previous window */
+};
+
+/* client that was accepted when all upload slots were taken, it
+ * waits in queue until one of them is freed
+ */
+
+struct winfo
+{
+    int                      acfd;   /* fd for accepted client */
+    struct sinfo            *srv;    /* server socket client came from */
+    struct limit_client      lim;    /* source of client for limits */
+    struct sockaddr_storage  addr;   /* address of client */
+    char                     ips[INET6_ADDRSTRLEN]; /* addr for logs */
+    double                   since;  /* when client started to wait */
 };
 
 static struct sinfo  *si;    /* server info array for all interfaces */
 static unsigned       nsi;   /* number of server info allocated */
 static struct cinfo  *ci;    /* client info array of connected clients sockets*/
 static unsigned       nci;   /* number of client info allocated */
+static unsigned char *rbuf;  /* buffer for data read from clients */
+static unsigned       first; /* slot from which clients are processed */
 static magic_t        magic; /* magics needed to detect file type */
+static struct winfo  *wq;    /* clients waiting for upload slot */
+static unsigned       wqhead; /* oldest client in wq */
+static unsigned       nwq;   /* number of clients in wq */
+static long           tmo[2]; /* inactivity timeout under current load, for
+                               * normal [0] and timed [1] clients */
+static int            upidx_ok; /* upload index could be opened */
+
+/* replies sent to rejected clients, they are formatted once in
+ * server_init(), so rejecting costs single send() no matter how
+ * many clients are turned away
+ */
+
+static const struct
+{
+    int          code;   /* http status code */
+    const char  *body;   /* message for the client */
+} reject_reply[reject_max] =
+{
+    { 403, "you are temporarily banned for misbehaving\n" },
+    { 429, "too many uploads from your network, wait for them to finish\n" },
+    { 429, "too many connections from your network, slow down\n" },
+    { 503, "all upload slots are taken, try again later\n" },
+    { 403, "you are not allowed to upload to this server\n" }
+};
+
+static char    reject_http[reject_max][256]; /* replies for http clients */
+static time_t  reject_sec;   /* second in which reject_sent is counted */
+static long    reject_sent;  /* replies sent in reject_sec */
 
 
 /* ==========================================================================
@@ -166,22 +278,73 @@ static const char *server_get_mime
 
 
 /* ==========================================================================
-    returns statically allocated string with IP related to fd
+    Turns ipv4 address mapped into ipv6 (::ffff:a.b.c.d), which is what
+    dual stack socket returns for ipv4 clients, back into plain ipv4
+    address in 'ss', so limits, bans and lists see the same address no
+    matter what socket client came from. Then formats address into 'ips',
+    which must be at least INET6_ADDRSTRLEN long.
    ========================================================================== */
 
 
-static const char *server_get_ips
+static void server_peer
 (
-    int                 fd      /* fd to get ip from */
+    struct sockaddr_storage  *ss,    /* client address from accept() */
+    char                     *ips    /* formatted address goes here */
 )
 {
-    socklen_t           clen;   /* size of client address */
-    struct sockaddr_in  client; /* client socket info */
+    struct sockaddr_in6      *sin6;  /* ss as ipv6 address */
+    struct sockaddr_in       *sin;   /* ss as ipv4 address */
+    struct sockaddr_in        v4;    /* unmapped ipv4 address */
     /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 
-    clen = sizeof(client);
-    getpeername(fd, (struct sockaddr *)&client, &clen);
-    return inet_ntoa(client.sin_addr);
+
+    sin6 = (struct sockaddr_in6 *)ss;
+    sin = (struct sockaddr_in *)ss;
+
+    if (ss->ss_family == AF_INET6 && IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr))
+    {
+        memset(&v4, 0, sizeof(v4));
+        v4.sin_family = AF_INET;
+        v4.sin_port = sin6->sin6_port;
+        memcpy(&v4.sin_addr, sin6->sin6_addr.s6_addr + 12, 4);
+        memset(ss, 0, sizeof(*ss));
+        memcpy(ss, &v4, sizeof(v4));
+    }
+
+    if (ss->ss_family == AF_INET6)
+        inet_ntop(AF_INET6, &sin6->sin6_addr, ips, INET6_ADDRSTRLEN);
+    else
+        inet_ntop(AF_INET, &sin->sin_addr, ips, INET6_ADDRSTRLEN);
+}
+
+
+/* ==========================================================================
+    Converts monotonic time 'ts' to seconds, as used by per source limits
+   ========================================================================== */
+
+
+static double server_mono
+(
+    const struct timespec  *ts  /* time to convert */
+)
+{
+    return ts->tv_sec + ts->tv_nsec / 1000000000.0;
+}
+
+
+/* ==========================================================================
+    Gives client 'c' a point for misbehaving, when its address collects
+    enough of them, it is banned for a while.
+   ========================================================================== */
+
+
+static void server_offense
+(
+    struct cinfo  *c  /* client that misbehaved */
+)
+{
+    if (autoban_offense((struct sockaddr *)&c->addr, time(NULL)))
+        el_oprint(OELI, "[%s] banned: too many offenses", c->ips);
 }
 
 
@@ -230,6 +393,249 @@ static int server_get_free_client(void)
 }
 
 
+/* ==========================================================================
+    Keeps copy of data 'buf' of 'len' bytes uploaded by the client in
+    memory, so it can be put into cache once upload finishes. When upload
+    gets too big to be cached, copy is dropped and we stop collecting.
+   ========================================================================== */
+
+
+static void server_keep_copy
+(
+    struct cinfo         *c,     /* client that uploaded data */
+    const unsigned char  *buf,   /* data uploaded by client */
+    size_t                len    /* length of buf */
+)
+{
+    size_t                need;  /* bytes needed to hold whole upload */
+    size_t                max;   /* max size of upload we can cache */
+    unsigned char        *p;     /* reallocated memory */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (c->memsize == (size_t)-1)
+    {
+        /* we've already given up on this upload */
+
+        return;
+    }
+
+    /* +9 is for "termsend\n", it still may be in the stream, and
+     * will be cut off later
+     */
+
+    need = c->written + len;
+    max = cache_max_entry() + 9;
+
+    if (need > max)
+    {
+        free(c->mem);
+        c->mem = NULL;
+        c->memsize = (size_t)-1;
+        return;
+    }
+
+    if (need > c->memsize)
+    {
+        /* grow geometrically, so big uploads in small chunks
+         * don't call realloc() for each chunk
+         */
+
+        c->memsize = c->memsize ? c->memsize * 2 : 8192;
+        c->memsize = c->memsize < need ? need : c->memsize;
+        c->memsize = c->memsize > max ? max : c->memsize;
+
+        if ((p = realloc(c->mem, c->memsize)) == NULL)
+        {
+            free(c->mem);
+            c->mem = NULL;
+            c->memsize = (size_t)-1;
+            return;
+        }
+
+        c->mem = p;
+    }
+
+    memcpy(c->mem + c->written, buf, len);
+}
+
+
+/* ==========================================================================
+    Moves finished upload from its own file into packed segment store.
+    When anything goes wrong, upload simply stays in its file, so this
+    never fails from client's point of view.
+
+    returns
+            0       upload has been packed
+           -1       upload stays in its own file
+   ========================================================================== */
+
+
+static int server_pack_upload
+(
+    struct cinfo    *c     /* client that finished upload */
+)
+{
+    struct stat      st;   /* uploaded file info */
+    unsigned char   *data; /* content of uploaded file */
+    int              ret;  /* return code */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (fstat(c->ffd, &st) != 0)
+    {
+        el_perror(ELW, "[%3d] fstat(%s)", c->cfd, c->fname);
+        return -1;
+    }
+
+    if ((data = c->mem) == NULL)
+    {
+        /* upload was not kept in memory, but it is small and was
+         * just written, so it's still in page cache
+         */
+
+        if ((data = malloc(c->written)) == NULL)
+            return -1;
+
+        if (pread(c->ffd, data, c->written, 0) != (ssize_t)c->written)
+        {
+            el_perror(ELW, "[%3d] couldn't read back %s", c->cfd, c->fname);
+            free(data);
+            return -1;
+        }
+    }
+
+    if ((ret = segstore_put(c->fname, data, c->written, st.st_mtime)) == 0)
+        unlink(c->fname);
+    else
+        el_perror(ELW, "[%3d] couldn't pack %s, keeping it as file",
+                c->cfd, c->fname);
+
+    if (data != c->mem)
+        free(data);
+
+    return ret;
+}
+
+
+/* ==========================================================================
+    Adds content of finished upload, stored in upload index under 'recno',
+    to the search index. Only small text uploads are indexed. Upload is
+    already stored, so failure here is only logged.
+   ========================================================================== */
+
+
+static void server_search_upload
+(
+    struct cinfo    *c,     /* client that finished upload */
+    unsigned long    recno  /* number of upload index record */
+)
+{
+    unsigned char   *data;  /* content of uploaded file */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (c->written < SEARCH_MIN_PATTERN ||
+            c->written > (size_t)g_config.search_max_size)
+        return;
+
+    if ((data = c->mem) == NULL)
+    {
+        /* file may already be packed and unlinked, but we still
+         * have it opened
+         */
+
+        if ((data = malloc(c->written)) == NULL)
+            return;
+
+        if (pread(c->ffd, data, c->written, 0) != (ssize_t)c->written)
+        {
+            el_perror(ELW, "[%3d] couldn't read back %s", c->cfd, c->fname);
+            free(data);
+            return;
+        }
+    }
+
+    if (search_add(recno, data, c->written) != 0)
+        el_perror(ELE, "[%3d] couldn't add %s to search index",
+                c->cfd, c->fname);
+
+    if (data != c->mem)
+        free(data);
+}
+
+
+/* ==========================================================================
+    Appends record about finished upload to the upload index, schedules
+    upload for expiry and adds it to the search index. Upload is already
+    stored, so failure here is only logged.
+   ========================================================================== */
+
+
+static void server_index_upload
+(
+    struct cinfo             *c,       /* client that finished upload */
+    const char               *mime,    /* detected mime subtype or NULL */
+    int                       packed   /* was upload packed in segstore? */
+)
+{
+    struct upidx_rec          rec;     /* record to add */
+    struct sockaddr_storage   addr;    /* our address */
+    struct sockaddr_in6      *sin6;    /* client or our address as ipv6 */
+    struct sockaddr_in       *sin;     /* client or our address as ipv4 */
+    socklen_t                 alen;    /* size of addr */
+    unsigned long             recno;   /* number of added index record */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    /* index couldn't be opened on startup, that was already
+     * logged, no need to repeat it for every upload
+     */
+
+    if (!upidx_ok)
+        return;
+
+    memset(&rec, 0, sizeof(rec));
+    strcpy(rec.name, c->fname);
+    if (mime)
+        sprintf(rec.mime, "%.*s", (int)sizeof(rec.mime) - 1, mime);
+
+    rec.size = c->written;
+    rec.ctime = time(NULL);
+    rec.flags = (c->ssl ? UPIDX_SSL : 0) | (c->timed ? UPIDX_TIMED : 0) |
+        (c->http ? UPIDX_HTTP : 0) | (packed ? UPIDX_PACKED : 0);
+
+    /* client address is already unmapped from ipv6, so ipv4
+     * clients of dual stack socket are indexed as ipv4
+     */
+
+    sin6 = (struct sockaddr_in6 *)&c->addr;
+    sin = (struct sockaddr_in *)&c->addr;
+    rec.family = c->addr.ss_family == AF_INET6 ? 6 : 4;
+    if (rec.family == 6)
+        memcpy(rec.ip, &sin6->sin6_addr, sizeof(sin6->sin6_addr));
+    else
+        memcpy(rec.ip, &sin->sin_addr, sizeof(sin->sin_addr));
+
+    sin6 = (struct sockaddr_in6 *)&addr;
+    sin = (struct sockaddr_in *)&addr;
+    alen = sizeof(addr);
+    if (getsockname(c->cfd, (struct sockaddr *)&addr, &alen) == 0)
+        rec.port = ntohs(addr.ss_family == AF_INET6 ?
+                sin6->sin6_port : sin->sin_port);
+
+    if (upidx_add(&rec, &recno) != 0)
+    {
+        el_perror(ELE, "[%3d] couldn't add %s to upload index",
+                c->cfd, c->fname);
+        return;
+    }
+
+    expire_add(recno, rec.ctime, c->written);
+    server_search_upload(c, recno);
+}
+
+
 /* ==========================================================================
     returns number of ip in g_config.bind_ip list. List is a comma separated
     list of ips.
@@ -251,6 +657,61 @@ static int server_bind_num(void)
 }
 
 
+/* ==========================================================================
+    Checks if connections on 'port' start with PROXY header, that is, if
+    port is listed in g_config.proxy_ports. When 'ports' is not NULL, it
+    also checks that every listed port is one of 'nports' upload 'ports'.
+
+    returns
+            1       port is behind load balancer
+            0       port is not listed
+           -1       g_config.proxy_ports lists something that is not
+                    an upload port
+   ========================================================================== */
+
+
+static int server_proxy_port
+(
+    long         port,    /* port to check */
+    const long  *ports,   /* upload ports, or NULL */
+    int          nports   /* number of elements in ports */
+)
+{
+    char         pp[sizeof(g_config.proxy_ports)];  /* copy of proxy_ports */
+    const char  *p;       /* tokenized port from pp */
+    char        *end;     /* end of parsed port */
+    long         n;       /* parsed port */
+    int          ret;     /* return value */
+    int          found;   /* listed port is upload port */
+    int          i;       /* current upload port */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    strcpy(pp, g_config.proxy_ports);
+    ret = 0;
+
+    for (p = strtok(pp, ","); p; p = strtok(NULL, ","))
+    {
+        if (*p < '0' || *p > '9')
+            return -1;
+
+        n = strtol(p, &end, 10);
+        if (*end != '\0')
+            return -1;
+
+        for (i = 0, found = ports == NULL; i != nports; ++i)
+            found |= ports[i] > 0 && ports[i] == n;
+
+        if (found == 0)
+            return -1;
+
+        ret |= n == port;
+    }
+
+    return ret;
+}
+
+
 /* ==========================================================================
     Function generates random string of length l that is stored in buffer s.
     Caller is responsible for making s big enoug to hold l + 1 number of
@@ -277,6 +738,64 @@ static void server_generate_fname
 }
 
 
+/* ==========================================================================
+    Adjusts read window of client 'c' after 'r' bytes were read, when
+    'want' were allowed. Client that fills whole window sends faster than
+    we read, so window is doubled, up to g_config.read_budget, and socket
+    receive buffer is made big enough to hold it. Client that sends much
+    less than its window, goes back towards SERVER_RWIN_MIN. All clients
+    read into one shared buffer, so big window costs no memory.
+   ========================================================================== */
+
+
+static void server_adapt_window
+(
+    struct cinfo  *c,     /* client to adjust window of */
+    size_t         want,  /* bytes client was allowed to send */
+    size_t         r      /* bytes actually read */
+)
+{
+    int            cur;   /* current size of receive buffer */
+    int            size;  /* new size of receive buffer */
+    socklen_t      len;   /* length of cur */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (r < c->rwin / 4 && c->rwin > SERVER_RWIN_MIN)
+    {
+        c->rwin /= 2;
+        return;
+    }
+
+    /* window limited by bandwidth quota, is not filled by fast
+     * client, but by limits, don't grow it then
+     */
+
+    if (r != c->rwin || want != c->rwin ||
+            c->rwin >= (size_t)g_config.read_budget)
+        return;
+
+    c->rwin *= 2;
+    if (c->rwin > (size_t)g_config.read_budget)
+        c->rwin = g_config.read_budget;
+
+    /* kernel usually autotunes receive buffer above our window,
+     * setting it explicitly turns autotuning off, so only do it
+     * when buffer is too small to hold whole window. Linux
+     * reports double of the size that was set.
+     */
+
+    len = sizeof(cur);
+    if (getsockopt(c->cfd, SOL_SOCKET, SO_RCVBUF, &cur, &len) != 0 ||
+            (size_t)cur >= 2 * c->rwin)
+        return;
+
+    size = c->rwin;
+    if (setsockopt(c->cfd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) != 0)
+        el_perror(ELD, "[%3d] couldn't set SO_RCVBUF to %d", c->cfd, size);
+}
+
+
 /* ==========================================================================
     Function sends FIN to the client and waits for FIN from client. This is
     done so we can know when client received all of our messages we sent to
@@ -352,35 +871,54 @@ static void server_linger
     formats message pointer by fmt and sends it all to client associated
     with fd. In case of any error from write function, we just log situation
     but sending is interrupted and client won't receive whole message (if he
-    receives anything at all)
+    receives anything at all). For http clients, message is sent as body of
+    http response with status 'code', for other clients 'code' is ignored.
    ========================================================================== */
 
 
 static void server_reply
 (
     struct cinfo  *fdi,        /* client to send message to */
+    int            code,       /* http status code for http clients */
     const char    *fmt,        /* message format (see printf(3)) */
                    ...         /* variadic arguments for fmt */
 )
 {
     size_t         written;    /* number of bytes written by write so far */
     size_t         mlen;       /* final size of the message to send */
-    char           msg[1024];  /* message to send to the client */
+    size_t         blen;       /* size of formatted message body */
+    char           body[1024]; /* formatted message */
+    char           msg[1024 + 256];  /* message to send to the client */
     va_list        ap;         /* variadic argument list from '...' */
     /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 
 
     va_start(ap, fmt);
-    mlen = vsprintf(msg, fmt, ap);
+    blen = vsprintf(body, fmt, ap);
     va_end(ap);
 
     /* temporarily remove last new line character as embedlog already
      * prints \n, and this leads to double \n in logs
      */
 
-    msg[mlen - 1] = '\0';
-    el_print(ELD, "sending message to client: %s", msg);
-    msg[mlen - 1] = '\n';
+    body[blen - 1] = '\0';
+    el_print(ELD, "sending message to client: %s", body);
+    body[blen - 1] = '\n';
+
+    /* http client will not understand raw message, wrap it in
+     * http response, there is only one response per connection
+     */
+
+    if (fdi->http)
+        mlen = sprintf(msg, "HTTP/1.1 %d %s\r\n"
+                "Server: termsend\r\n"
+                "Content-Type: text/plain\r\n"
+                "Content-Length: %lu\r\n"
+                "Connection: close\r\n"
+                "\r\n"
+                "%s", code, http_status_text(code), (unsigned long)blen, body);
+    else
+        mlen = sprintf(msg, "%s", body);
 
     /* send reply in loop until all bytes are commited to the
      * kernel for sending
@@ -408,68 +946,206 @@ static void server_reply
 
 
 /* ==========================================================================
-    this function creates server socket that is fully configured and is
-    ready to accept connections
+    Turns client 'acfd' away for 'reason'. Reply is sent with single
+    non-blocking send(), if it doesn't fit into socket buffer, client
+    just won't get it - we never wait for rejected client. Only
+    g_config.reject_rate replies are sent each second, once that is used
+    up, connections are reset without any reply, so flood of rejected
+    clients costs as little as possible.
    ========================================================================== */
 
 
-static int server_create_socket
+static void server_reject
 (
-    in_addr_t           ip,     /* local ip to bind server to */
-    unsigned            port    /* port to bind server to */
+    struct sinfo   *sfd,     /* server socket client came from */
+    int             acfd,    /* fd of rejected client */
+    enum reject     reason   /* why client is rejected */
 )
 {
-    int                 fd;     /* new server file descriptor */
-    int                 flags;  /* flags for setting socket options */
-    struct sockaddr_in  srv;    /* server address to bind to */
+    const char     *msg;     /* reply to send */
+    time_t          now;     /* current time */
+    struct linger   l;       /* linger option to reset connection */
     /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 
 
-    if ((fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+    now = time(NULL);
+    if (now != reject_sec)
     {
-        el_perror(ELF, "couldn't create server socket");
-        return -1;
+        reject_sec = now;
+        reject_sent = 0;
     }
 
-    /* as TCP is all about reliability, after server crashes (or is
-     * restarted), kernel still keeps our server tuple in TIME_WAIT
-     * state, to make sure all connections are closed properly
-     * disallowing us to bind to that address again. We don't need
-     * such behaviour, thus we allow SO_REUSEADDR
-     */
-
-    flags = 1;
-    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flags, sizeof(flags)) != 0)
+    if (g_config.reject_rate && reject_sent >= g_config.reject_rate)
     {
-        el_perror(ELF, "failed to set socket to SO_REUSEADDR");
-        close(fd);
-        return -1;
+        /* linger with 0 timeout makes close() send RST, and
+         * socket is freed right away, without TIME_WAIT
+         */
+
+        l.l_onoff = 1;
+        l.l_linger = 0;
+        setsockopt(acfd, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+        close(acfd);
+        return;
     }
 
+    ++reject_sent;
+    msg = sfd->proto == sproto_http_upload ?
+        reject_http[reason] : reject_reply[reason].body;
+    (void)send(acfd, msg, strlen(msg), MSG_DONTWAIT);
+    close(acfd);
+}
+
+
+/* ==========================================================================
+    this function creates server socket that is fully configured and is
+    ready to accept connections. 'ip' can be ipv4 or ipv6 address, when
+    it is "::" socket is dual stack and accepts ipv4 clients too.
+   ========================================================================== */
+
+
+static int server_create_socket
+(
+    const char          *ip,    /* local ip to bind server to */
+    unsigned             port   /* port to bind server to */
+)
+{
+    int                  fd;    /* new server file descriptor */
+    int                  flags; /* flags for setting socket options */
+    struct sockaddr_in   srv;   /* ipv4 server address to bind to */
+    struct sockaddr_in6  srv6;  /* ipv6 server address to bind to */
+    struct sockaddr     *sa;    /* srv or srv6, whichever is used */
+    socklen_t            salen; /* size of sa */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
     /* fill server address parameters for listening */
 
     memset(&srv, 0, sizeof(srv));
     srv.sin_family = AF_INET;
     srv.sin_port = htons(port);
-    srv.sin_addr.s_addr = ip;
 
-    /* bind socket to srv address, so it only accept connections
-     * from this ip/interface
-     */
+    memset(&srv6, 0, sizeof(srv6));
+    srv6.sin6_family = AF_INET6;
+    srv6.sin6_port = htons(port);
 
-    if (bind(fd, (struct sockaddr *)&srv, sizeof(srv)) != 0)
+    if (inet_pton(AF_INET, ip, &srv.sin_addr) == 1)
     {
-        el_perror(ELF, "failed to bind to socket");
-        close(fd);
+        sa = (struct sockaddr *)&srv;
+        salen = sizeof(srv);
+    }
+    else if (inet_pton(AF_INET6, ip, &srv6.sin6_addr) == 1)
+    {
+        sa = (struct sockaddr *)&srv6;
+        salen = sizeof(srv6);
+    }
+    else
+    {
+        el_print(ELF, "invalid bind address %s", ip);
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ((fd = socket(sa->sa_family, SOCK_STREAM, IPPROTO_TCP)) < 0)
+    {
+        el_perror(ELF, "couldn't create server socket");
+        return -1;
+    }
+
+    /* any ipv6 address "::" accepts ipv4 clients too, any other
+     * ipv6 address can only be reached over ipv6, so it does not
+     * clash with ipv4 address bound on the same port. Set it
+     * explicitly, as system default can be either.
+     */
+
+    if (sa->sa_family == AF_INET6)
+    {
+        flags = !IN6_IS_ADDR_UNSPECIFIED(&srv6.sin6_addr);
+        if (setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &flags,
+                    sizeof(flags)) != 0)
+        {
+            el_perror(ELF, "failed to set IPV6_V6ONLY on socket");
+            close(fd);
+            return -1;
+        }
+    }
+
+    /* as TCP is all about reliability, after server crashes (or is
+     * restarted), kernel still keeps our server tuple in TIME_WAIT
+     * state, to make sure all connections are closed properly
+     * disallowing us to bind to that address again. We don't need
+     * such behaviour, thus we allow SO_REUSEADDR
+     */
+
+    flags = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flags, sizeof(flags)) != 0)
+    {
+        el_perror(ELF, "failed to set socket to SO_REUSEADDR");
+        close(fd);
         return -1;
     }
 
-    /* mark socket to accept incoming connections. Backlog is set
-     * high enough so that no client can receive connection refused
-     * error.
+    /* bind socket to srv address, so it only accept connections
+     * from this ip/interface
+     */
+
+    if (bind(fd, sa, salen) != 0)
+    {
+        el_perror(ELF, "failed to bind to socket");
+        close(fd);
+        return -1;
+    }
+
+    /* server socket is drained until there is nothing to accept,
+     * it must not block when queue gets empty
+     */
+
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0)
+    {
+        el_perror(ELF, "failed to make server socket non-blocking");
+        close(fd);
+        return -1;
+    }
+
+    /* every protocol we speak starts with client sending data, so
+     * kernel may hold connection until that data arrives, client
+     * that connects and sends nothing never wakes us up, nor takes
+     * upload slot. It's only optimization, so failure is not fatal.
+     */
+
+    if (g_config.defer_accept)
+    {
+#ifdef TCP_DEFER_ACCEPT
+        flags = g_config.defer_accept;
+        if (setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &flags,
+                    sizeof(flags)) != 0)
+            el_perror(ELW, "failed to set TCP_DEFER_ACCEPT on socket");
+#else
+        el_print(ELW, "TCP_DEFER_ACCEPT is not supported, ignoring");
+#endif
+    }
+
+    /* with fast open, short paste can come with SYN, and we can
+     * answer with link without waiting for another round trip
+     */
+
+    if (g_config.fastopen)
+    {
+#ifdef TCP_FASTOPEN
+        flags = g_config.fastopen;
+        if (setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &flags,
+                    sizeof(flags)) != 0)
+            el_perror(ELW, "failed to set TCP_FASTOPEN on socket");
+#else
+        el_print(ELW, "TCP_FASTOPEN is not supported, ignoring");
+#endif
+    }
+
+    /* mark socket to accept incoming connections. Backlog should
+     * be high enough so that no client can receive connection
+     * refused error during bursts, overflows can be seen in stats.
      */
 
-    if (listen(fd, 256) != 0)
+    if (listen(fd, g_config.backlog) != 0)
     {
         el_perror(ELF, "failed to make socket to listen");
         close(fd);
@@ -560,6 +1236,359 @@ static void server_rearm_timer
 }
 
 
+/* ==========================================================================
+    Strips http framing from data 'buf' of 'len' bytes received from http
+    upload client. Until whole request head is received, data is buffered
+    in client info. Once head is parsed, 'buf' is decoded in place and it
+    contains only body of the request, that is data to store in file. When
+    whole body is received, c->body_done is set.
+
+    returns
+            >=0     number of body bytes in 'buf'
+           -1       invalid request, client has been informed about it
+   ========================================================================== */
+
+
+static ssize_t server_http_request
+(
+    struct cinfo         *c,     /* http upload client */
+    unsigned char        *buf,   /* data received from client */
+    size_t                len    /* number of bytes in buf */
+)
+{
+    struct http_request   req;   /* parsed request head */
+    const char           *v;     /* value of some header */
+    size_t                n;     /* number of bytes copied to c->head */
+    size_t                left;  /* bytes in c->head after request head */
+    ssize_t               hlen;  /* length of request head */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (c->head_done)
+        goto body;
+
+    n = sizeof(c->head) - c->headlen;
+    n = len < n ? len : n;
+    memcpy(c->head + c->headlen, buf, n);
+    c->headlen += n;
+
+    if ((hlen = http_request_end(c->head, c->headlen)) == -1)
+    {
+        if (c->headlen != sizeof(c->head))
+            return 0;
+
+        el_oprint(OELI, "[%s] rejected: http head too big", c->ips);
+        server_offense(c);
+        server_reply(c, 431, "request head too big\n");
+        return -1;
+    }
+
+    /* anything after request head is already body, move it to the
+     * beginning of buf, there are two parts of it, one copied to
+     * c->head and one that didn't fit there and is still in buf
+     */
+
+    left = c->headlen - hlen;
+    memmove(buf + left, buf + n, len - n);
+    memcpy(buf, c->head + hlen, left);
+    len = left + len - n;
+
+    c->head_done = 1;
+    if (http_parse_request(c->head, hlen, &req) != 0)
+    {
+        el_oprint(OELI, "[%s] rejected: malformed http request", c->ips);
+        server_offense(c);
+        server_reply(c, 400, "malformed http request\n");
+        return -1;
+    }
+
+    el_print(ELI, "[%3d] http %s %s", c->cfd, req.method, req.target);
+
+    if (strcmp(req.method, "PUT") != 0 && strcmp(req.method, "POST") != 0)
+    {
+        el_oprint(OELI, "[%s] rejected: http method %s",
+                c->ips, req.method);
+        server_offense(c);
+        server_reply(c, 405, "only PUT and POST are supported\n");
+        return -1;
+    }
+
+    if ((v = http_header(&req, "Transfer-Encoding")) != NULL)
+    {
+        /* chunked must be the last (and we only support only one)
+         * encoding, anything else we don't know how to decode
+         */
+
+        if (strcasecmp(v, "chunked") != 0)
+        {
+            el_oprint(OELI, "[%s] rejected: transfer encoding %s",
+                    c->ips, v);
+            server_offense(c);
+            server_reply(c, 501, "unsupported transfer encoding\n");
+            return -1;
+        }
+
+        c->clen = -1;
+        http_chunked_init(&c->chunk);
+    }
+    else if ((v = http_header(&req, "Content-Length")) != NULL)
+    {
+        if ((c->clen = http_content_length(v)) == -1)
+        {
+            el_oprint(OELI, "[%s] rejected: bad content length", c->ips);
+            server_offense(c);
+            server_reply(c, 400, "invalid Content-Length\n");
+            return -1;
+        }
+
+        if (c->clen > g_config.max_size)
+        {
+            /* we know it's too big, no need to receive even a
+             * single byte of it
+             */
+
+            el_oprint(OELI, "[%s] rejected: file too big", c->ips);
+            server_offense(c);
+            server_reply(c, 413, "file too big, max length is %ld bytes\n",
+                g_config.max_size);
+            return -1;
+        }
+
+        /* we know exact size of the file, so let filesystem
+         * allocate it in one go, this way file will not get
+         * fragmented when multiple uploads are written at the
+         * same time. Preallocation extends file, so O_APPEND must
+         * go, or data would be written after preallocated space.
+         * Nobody else writes to this file, so plain write() will
+         * do just fine.
+         */
+
+#if HAVE_POSIX_FALLOCATE
+        if (c->clen > 0)
+        {
+            int  e;  /* error from posix_fallocate() */
+            /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+            fcntl(c->ffd, F_SETFL, fcntl(c->ffd, F_GETFL) & ~O_APPEND);
+            if ((e = posix_fallocate(c->ffd, 0, c->clen)) != 0)
+                el_print(ELD, "[%3d] posix_fallocate(): %s",
+                        c->cfd, strerror(e));
+        }
+#endif
+    }
+    else
+    {
+        /* we don't know how much data client will send, and
+         * there is no way to tell end of body
+         */
+
+        el_oprint(OELI, "[%s] rejected: no content length", c->ips);
+        server_offense(c);
+        server_reply(c, 411, "Content-Length or chunked encoding required\n");
+        return -1;
+    }
+
+    if ((v = http_header(&req, "Expect")) != NULL &&
+            strcasecmp(v, "100-continue") == 0 && len == 0)
+    {
+        static const char  cont[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+        /* client waits for our permission to send body, curl
+         * does that for bigger uploads. It's first thing we
+         * send to that socket, so it surely fits into buffer.
+         */
+
+        if (write(c->cfd, cont, sizeof(cont) - 1) != sizeof(cont) - 1)
+            el_perror(ELW, "[%3d] couldn't send 100 continue", c->cfd);
+    }
+
+body:
+    if (c->clen == -1)
+    {
+        switch (http_chunked_decode(&c->chunk, buf, &len))
+        {
+        case -1:
+            el_oprint(OELI, "[%s] rejected: malformed chunked encoding",
+                    c->ips);
+            server_offense(c);
+            server_reply(c, 400, "malformed chunked encoding\n");
+            return -1;
+
+        case 1:
+            c->body_done = 1;
+            break;
+        }
+
+        return len;
+    }
+
+    /* anything client sends after body is ignored, there can
+     * be only one request per connection
+     */
+
+    if ((off_t)(c->written + len) >= c->clen)
+    {
+        len = c->clen - c->written;
+        c->body_done = 1;
+    }
+
+    return len;
+}
+
+
+/* ==========================================================================
+    Sets when client 'c' times out, counting from 'now', when client was
+    last active. Timeout never goes past client's upload deadline, so
+    timer fires at deadline even when client keeps sending.
+   ========================================================================== */
+
+
+static void server_set_timeout
+(
+    struct cinfo           *c,   /* client to set timeout for */
+    const struct timespec  *now  /* current time */
+)
+{
+    c->active_at = *now;
+    c->timeout_at.tv_sec = now->tv_sec + tmo[c->timed ? 1 : 0];
+    c->timeout_at.tv_nsec = now->tv_nsec;
+
+    if (g_config.upload_deadline == 0)
+        return;
+
+    if ((c->timeout_at.tv_sec > c->deadline_at.tv_sec) ||
+            (c->timeout_at.tv_sec == c->deadline_at.tv_sec &&
+             c->timeout_at.tv_nsec > c->deadline_at.tv_nsec))
+        c->timeout_at = c->deadline_at;
+}
+
+
+/* ==========================================================================
+    Scales inactivity timeouts to occupancy of upload slots. Below
+    busy_threshold percent of busy slots, configured timeouts are used,
+    above that, they shrink linearly down to busy_timeout when all slots
+    are taken, or clients wait for them. When timeouts change, timeouts
+    of connected clients are moved as well, counting from when they were
+    last active, so idle clients are dropped when slots are needed most.
+   ========================================================================== */
+
+
+static void server_scale_timeouts
+(
+    unsigned  busy    /* number of busy upload slots */
+)
+{
+    long      base;   /* configured timeout */
+    long      t[2];   /* timeouts for current load */
+    double    f;      /* how far between threshold and full load we are */
+    unsigned  i;      /* iterator */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (g_config.busy_threshold == 0 || nci == 0)
+        return;
+
+    f = nwq ? 100.0 : 100.0 * busy / nci;
+    if (g_config.busy_threshold == 100)
+        f = f >= 100.0 ? 1.0 : 0.0;
+    else
+        f = (f - g_config.busy_threshold) / (100 - g_config.busy_threshold);
+
+    f = f < 0.0 ? 0.0 : f;
+
+    for (i = 0; i != 2; ++i)
+    {
+        base = i ? g_config.timed_max_timeout : g_config.max_timeout;
+        t[i] = base;
+
+        if (f > 0.0 && base > g_config.busy_timeout)
+            t[i] = base - (long)((base - g_config.busy_timeout) * f + 0.5);
+    }
+
+    if (t[0] == tmo[0] && t[1] == tmo[1])
+        return;
+
+    el_print(ELN, "%u of %u slots busy, %u waiting, timeouts now %ld and "
+            "%ld seconds", busy, nci, nwq, t[0], t[1]);
+    tmo[0] = t[0];
+    tmo[1] = t[1];
+
+    for (i = 0; i != nci; ++i)
+    {
+        if (ci[i].cfd == -1)
+            continue;
+
+        /* clients waiting for PROXY header count from when they
+         * connected, they have no upload deadline yet
+         */
+
+        if (ci[i].proxy)
+            ci[i].timeout_at.tv_sec = ci[i].active_at.tv_sec + tmo[0];
+        else
+            server_set_timeout(&ci[i], &ci[i].active_at);
+
+        server_rearm_timer(&ci[i]);
+    }
+}
+
+
+/* ==========================================================================
+    Accounts 'r' bytes received from client 'c' and checks if client keeps
+    up with minimum upload rate. Rate is measured over sliding window of
+    rate_window seconds, which is estimated from bytes received in current
+    and previous window, as if bytes in previous window came evenly.
+
+    Client is not judged until it is connected for full window, nor when
+    we held it back ourselves, because its source used up its bandwidth,
+    in any part of measured window.
+
+    Returns 1 when client is too slow, 0 otherwise.
+   ========================================================================== */
+
+
+static int server_too_slow
+(
+    struct cinfo  *c,     /* client that sent data */
+    size_t         r,     /* number of bytes received */
+    double         now    /* current monotonic time */
+)
+{
+    double         win;   /* length of window */
+    double         part;  /* part of current window that has passed */
+    double         bytes; /* bytes received in last 'win' seconds */
+    long           n;     /* number of windows that passed */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (g_config.min_rate == 0)
+        return 0;
+
+    win = g_config.rate_window;
+
+    if ((n = (long)((now - c->rate_at) / win)) > 0)
+    {
+        /* current window is over, it becomes previous one,
+         * unless client was quiet for whole window after it
+         */
+
+        c->rate_prev = n == 1 ? c->rate_cur : 0;
+        c->rate_held = (c->rate_held & 1) << 1;
+        c->rate_cur = 0;
+        c->rate_at += n * win;
+    }
+
+    c->rate_cur += r;
+
+    if (c->rate_held)
+        return 0;
+
+    part = (now - c->rate_at) / win;
+    bytes = c->rate_prev * (1.0 - part) + c->rate_cur;
+
+    return bytes / win < g_config.min_rate;
+}
+
 /* ==========================================================================
     This is heart of the swarm... erm I mean of the server. This function is
     a threaded function, it is fired up everytime client connects and passes
@@ -579,9 +1608,11 @@ static void server_process_client
     struct timespec     now;         /* current time */
     char                url[8192 + 1];  /* generated link to uploaded data */
     char                ends[9 + 1]; /* buffer for end string detection */
-    unsigned char       buf[8192];   /* temp buffer we read uploaded data to */
+    unsigned char      *buf;         /* temp buffer we read uploaded data to */
     ssize_t             w;           /* return from write function */
     ssize_t             r;           /* return from read function */
+    size_t              want;        /* number of bytes we can read */
+    int                 packed;      /* upload packed into segstore? */
     /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 
 
@@ -611,6 +1642,25 @@ static void server_process_client
 
         /* yes, what should we do with it? */
 
+        if (g_config.upload_deadline &&
+                ((now.tv_sec > c->deadline_at.tv_sec) ||
+                 (now.tv_sec == c->deadline_at.tv_sec &&
+                  now.tv_nsec >= c->deadline_at.tv_nsec)))
+        {
+            /* client did not make it before deadline, no matter
+             * if it was still sending or not, slot is needed for
+             * someone else
+             */
+
+            el_print(ELN, "[%3d] upload took longer than %ld seconds",
+                    c->cfd, g_config.upload_deadline);
+            el_oprint(OELI, "[%s] rejected: deadline", c->ips);
+            server_offense(c);
+            server_reply(c, 408, "upload took longer than %ld seconds\n",
+                g_config.upload_deadline);
+            goto error;
+        }
+
         if (c->timed)
         {
             /* time upload was enabled, in that case we don't treat
@@ -623,17 +1673,17 @@ static void server_process_client
         }
         else
         {
-            /* no activity from client for max_timeout seconds,
+            /* no activity from client for tmo[0] seconds,
              * either client died and didn't tell us about it
              * (thanks!) or connection was abrupted by some higher
              * forces. We assume this is unrecoverable problem and
              * close connection
              */
 
-            el_print(ELN, "[%3d] client inactive for %d seconds",
-                    c->cfd, g_config.max_timeout);
-            el_oprint(OELI, "[%s] rejected: inactivity",
-                    server_get_ips(c->cfd));
+            el_print(ELN, "[%3d] client inactive for %ld seconds",
+                    c->cfd, tmo[0]);
+            el_oprint(OELI, "[%s] rejected: inactivity", c->ips);
+            server_offense(c);
 
             /* well, there may be one more case for inactivity from
              * clients side. It may be that he forgot to add ending
@@ -641,19 +1691,58 @@ static void server_process_client
              * as there is a chance he is still alive.
              */
 
-            server_reply(c, "disconnected due to inactivity for %d "
-                "seconds, did you forget to append termination "
-                "string - \"termsend\\n\"?\n", g_config.max_timeout);
+            if (c->http)
+                server_reply(c, 408, "disconnected due to inactivity "
+                    "for %ld seconds\n", tmo[0]);
+            else
+                server_reply(c, 408, "disconnected due to inactivity for %ld "
+                    "seconds, did you forget to append termination "
+                    "string - \"termsend\\n\"?\n", tmo[0]);
             goto error;
         }
     }
 
     /* no SIGALRM means there is data to be read from client.
-     * read() won't block since we've checked it with select()
+     * read() won't block since we've checked it with select().
+     * Don't read more than bandwidth of client's source allows,
+     * loop doesn't wait for data of throttled clients, so there
+     * always is some quota left here.
+     */
+
+    buf = rbuf;
+    want = limit_quota(&c->lim, c->rwin, server_mono(&now));
+    if (want == 0)
+        return;
+
+    r = c->ssl ? ssl_read(c->sslfd, buf, want) : read(c->cfd, buf, want);
+
+    /* client may have sent more than one read returns, take
+     * whatever kernel already has, up to client's budget for this
+     * round, but don't wait for more. FIN or error is seen by
+     * next read in next round. ssl is read once, it may have to
+     * wait for rest of the record otherwise.
+     */
+
+    while (c->ssl == 0 && r > 0 && (size_t)r < want)
+    {
+        ssize_t  n;  /* bytes read in this go */
+        /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+        if ((n = recv(c->cfd, buf + r, want - r, MSG_DONTWAIT)) <= 0)
+            break;
+
+        r += n;
+    }
+
+    if (r > 0)
+        server_adapt_window(c, want, r);
+
+    /* client sent all that bandwidth of its source allowed, so it
+     * could have sent more, it's not its fault if it's slow
      */
 
-    r = c->ssl ? ssl_read(c->sslfd, buf, sizeof(buf)) :
-        read(c->cfd, buf, sizeof(buf));
+    if (want < c->rwin && (size_t)r == want)
+        c->rate_held |= 1;
 
     if (r == -1)
     {
@@ -663,8 +1752,8 @@ static void server_process_client
          */
 
         el_perror(ELC, "[%3d] couldn't read from client", c->cfd);
-        el_oprint(OELI, "[%s] rejected: read error", server_get_ips(c->cfd));
-        server_reply(c, "internal server error, try again later\n");
+        el_oprint(OELI, "[%s] rejected: read error", c->ips);
+        server_reply(c, 500, "internal server error, try again later\n");
         goto error;
     }
 
@@ -674,21 +1763,59 @@ static void server_process_client
      */
 
     if (r == 0)
-        goto upload_finished_with_fin;
-
-    if (c->written + r > (size_t)g_config.max_size + 9)
     {
-        /* we received, in total, more bytes then we can accept, we
-         * remove such file and return error to the client. That +9
-         * is for ending string "termsend\n" as we will delete that
-         * anyway and file will not get more than g_config.max_size
-         * size.
+        /* for http, FIN is not a valid way to end upload, body
+         * length is known, and if we didn't get all of it, client
+         * must have given up or died
          */
 
-        el_oprint(OELI, "[%s] rejected: file too big", server_get_ips(c->cfd));
-        server_reply(c, "file too big, max length is %ld bytes\n",
-            g_config.max_size);
-        goto error;
+        if (c->http && c->body_done == 0)
+        {
+            el_oprint(OELI, "[%s] rejected: incomplete http request", c->ips);
+            server_offense(c);
+            server_reply(c, 400, "incomplete request body\n");
+            goto error;
+        }
+
+        goto upload_finished_with_fin;
+    }
+
+    limit_consume(&c->lim, r);
+
+    if (server_too_slow(c, r, server_mono(&now)))
+    {
+        /* client sends just enough to not trigger inactivity
+         * timeout, but that's too little to keep the slot
+         */
+
+        el_oprint(OELI, "[%s] rejected: too slow", c->ips);
+        server_offense(c);
+        server_reply(c, 408, "upload too slow, minimum rate is %ld bytes "
+            "per second\n", g_config.min_rate);
+        goto error;
+    }
+
+    /* for http clients, strip everything that is not upload data,
+     * like request head and chunk sizes
+     */
+
+    if (c->http && (r = server_http_request(c, buf, r)) == -1)
+        goto error;
+
+    if (c->written + r > (size_t)g_config.max_size + (c->http ? 0 : 9))
+    {
+        /* we received, in total, more bytes then we can accept, we
+         * remove such file and return error to the client. That +9
+         * is for ending string "termsend\n" as we will delete that
+         * anyway and file will not get more than g_config.max_size
+         * size. http clients don't send ending string.
+         */
+
+        el_oprint(OELI, "[%s] rejected: file too big", c->ips);
+        server_offense(c);
+        server_reply(c, 413, "file too big, max length is %ld bytes\n",
+            g_config.max_size);
+        goto error;
     }
 
     /* received some data, simply store them into file, right now
@@ -699,12 +1826,33 @@ static void server_process_client
     if ((w = write(c->ffd, buf, r)) != r)
     {
         el_perror(ELC, "[%3d] couldn't write to file", c->cfd);
-        el_oprint(OELI, "[%s] rejected: write to file failed",
-                server_get_ips(c->cfd));
-        server_reply(c, "internal server error, try again later\n");
+        el_oprint(OELI, "[%s] rejected: write to file failed", c->ips);
+        server_reply(c, 500, "internal server error, try again later\n");
         goto error;
     }
 
+    /* fresh uploads are downloaded the most, so keep a copy for
+     * http server's cache
+     */
+
+    if (cache_max_entry())
+        server_keep_copy(c, buf, r);
+
+    if (c->http)
+    {
+        /* http client tells us upfront how big body is, or sends
+         * last chunk, so there is no need to look for end string
+         */
+
+        c->written += w;
+        if (c->body_done)
+            goto upload_finished_with_fin;
+
+        server_set_timeout(c, &now);
+        server_rearm_timer(c);
+        return;
+    }
+
     /* write was successful, now let's check if data written to
      * file contains ending string "termsend\n". For that we read 9
      * last characters from data stored in file and if there are
@@ -714,10 +1862,8 @@ static void server_process_client
 
     if ((c->written += w) < 9)
     {
+        server_set_timeout(c, &now);
         server_rearm_timer(c);
-        c->timeout_at.tv_sec = now.tv_sec +
-                (c->timed ? g_config.timed_max_timeout : g_config.max_timeout);
-        c->timeout_at.tv_nsec = now.tv_nsec;
         el_print(ELD, "got data, now: %lld.%03d, next timeout at: %lld.%03d",
                 (long long)now.tv_sec, now.tv_nsec / 1000000l,
                 (long long)c->timeout_at.tv_sec,
@@ -742,9 +1888,8 @@ static void server_process_client
          */
 
         el_perror(ELC, "[%3d] couldn't read end string", c->cfd);
-        el_oprint(OELI, "[%s] rejected: end string read error",
-                server_get_ips(c->cfd));
-        server_reply(c, "internal server error, try again later\n");
+        el_oprint(OELI, "[%s] rejected: end string read error", c->ips);
+        server_reply(c, 500, "internal server error, try again later\n");
         goto error;
     }
 
@@ -752,18 +1897,12 @@ static void server_process_client
     if (strcmp(ends, "termsend\n") != 0)
     {
         /* ending string has not yet been received, we continue
-         * getting data from client. Reset timeout timer.
+         * getting data from client. Since we have received some
+         * data it means client is active, reset timeout timer.
          */
 
+        server_set_timeout(c, &now);
         server_rearm_timer(c);
-
-        /* since we have received some data it means client is
-         * active, reset timeout timer
-         */
-
-        c->timeout_at.tv_sec = now.tv_sec +
-                (c->timed ? g_config.timed_max_timeout : g_config.max_timeout);
-        c->timeout_at.tv_nsec = now.tv_nsec;
         el_print(ELD, "got data, now: %lld.%03d, next timeout at: %lld.%03d",
                 (long long)now.tv_sec, now.tv_nsec / 1000000l,
                 (long long)c->timeout_at.tv_sec,
@@ -787,9 +1926,8 @@ static void server_process_client
     {
         el_perror(ELC, "[%3d] couldn't truncate file from ending string",
                 c->cfd);
-        el_oprint(OELI, "[%s] rejected: truncate failed",
-                server_get_ips(c->cfd));
-        server_reply(c, "internal server error, try again later\n");
+        el_oprint(OELI, "[%s] rejected: truncate failed", c->ips);
+        server_reply(c, 500, "internal server error, try again later\n");
         goto error;
     }
 
@@ -816,12 +1954,46 @@ upload_finished_with_fin:
 
     if (c->written == 0)
     {
-        el_oprint(OELI, "[%s] rejected: no data has been sent",
-                server_get_ips(c->cfd));
-        server_reply(c, "no data has been sent\n");
+        el_oprint(OELI, "[%s] rejected: no data has been sent", c->ips);
+        server_offense(c);
+        server_reply(c, 400, "no data has been sent\n");
         goto error;
     }
 
+    /* if we could detect mime type, it will be added to the link.
+     * This must be done while upload still is a regular file,
+     * small uploads are moved to packed store in a moment.
+     */
+
+    mime = server_get_mime(c->fname);
+
+    packed = 0;
+    if (c->written <= (size_t)g_config.pack_max_size)
+        packed = server_pack_upload(c) == 0;
+
+    server_index_upload(c, mime, packed);
+
+    /* upload is complete, hand over its copy to the cache, cache
+     * takes ownership of memory regardless of result. Modification
+     * time must be the same as the one of the file, so http
+     * validators are the same no matter if file is served from
+     * cache or from disk.
+     */
+
+    if (c->mem)
+    {
+        struct stat  st;  /* uploaded file info */
+        /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+        if (fstat(c->ffd, &st) == 0)
+            cache_put(c->fname, c->mem, c->written, st.st_mtime);
+        else
+            free(c->mem);
+
+        c->mem = NULL;
+    }
+
+    ++g_stats.uploads;
     close(c->ffd);
 
     /* after upload is finished, we send the client, link where he
@@ -833,9 +2005,8 @@ upload_finished_with_fin:
     strcpy(url, g_config.domain);
     strcat(url, "/");
 
-    /* if we could detect mime type, add it to the path */
+    /* add mime type to the path, if we know it */
 
-    mime = server_get_mime(c->fname);
     strcat(url, mime ? mime : "");
     strcat(url, mime ? "/" : "");
 
@@ -843,12 +2014,13 @@ upload_finished_with_fin:
 
     strcat(url, c->fname);
 
-    el_oprint(OELI, "[%s] %s", server_get_ips(c->cfd), c->fname);
-    server_reply(c, "%s\n", url);
+    el_oprint(OELI, "[%s] %s", c->ips, c->fname);
+    server_reply(c, 201, "%s\n", url);
     server_linger(c);
     if (c->ssl) ssl_close(c->sslfd);
     close(c->cfd);
     c->cfd = -1;
+    limit_disconnect(&c->lim);
 
     return;
 
@@ -862,7 +2034,10 @@ error:
     close(c->cfd);
     close(c->ffd);
     c->cfd = -1;
+    limit_disconnect(&c->lim);
     unlink(c->fname);
+    free(c->mem);
+    c->mem = NULL;
 }
 
 
@@ -929,7 +2104,15 @@ static int server_init_client
 
         server_generate_fname(cfd->fname, flen);
 
-        cfd->ffd = open(cfd->fname, O_CREAT | O_EXCL | O_APPEND | O_RDWR, 0644);
+        /* name may be taken by packed upload, which has no file in
+         * output directory, treat it just like existing file
+         */
+
+        cfd->ffd = -1;
+        errno = EEXIST;
+        if (segstore_exists(cfd->fname) == 0)
+            cfd->ffd = open(cfd->fname,
+                    O_CREAT | O_EXCL | O_APPEND | O_RDWR, 0644);
 
         /* if file has opened with success, break out of the loop */
 
@@ -960,20 +2143,39 @@ static int server_init_client
 
         el_perror(ELA, "[%3d] couldn't open file %s/%s", cfd->cfd,
                 g_config.output_dir, cfd->fname);
-        el_oprint(OELI, "[%s] rejected: file open error",
-                server_get_ips(cfd->cfd));
-        server_reply(cfd, "internal server error, try again later\n");
+        el_oprint(OELI, "[%s] rejected: file open error", cfd->ips);
+        server_reply(cfd, 500, "internal server error, try again later\n");
         if (cfd->ssl) ssl_close(cfd->sslfd);
         close(cfd->cfd);
         cfd->cfd = -1;
+        limit_disconnect(&cfd->lim);
         return -1;
     }
 
+    /* file did not exist a moment ago, so anything we have in
+     * cache under that name is stale
+     */
+
+    cache_remove(cfd->fname);
+
     cfd->written = 0;
+    cfd->mem = NULL;
+    cfd->memsize = 0;
+    cfd->head_done = 0;
+    cfd->body_done = 0;
+    cfd->headlen = 0;
+    cfd->clen = 0;
+    cfd->rwin = SERVER_RWIN_MIN;
+    if (cfd->rwin > (size_t)g_config.read_budget)
+        cfd->rwin = g_config.read_budget;
     clock_gettime(CLOCK_MONOTONIC, &now);
-    cfd->timeout_at.tv_sec = now.tv_sec +
-            (cfd->timed ? g_config.timed_max_timeout : g_config.max_timeout);
-    cfd->timeout_at.tv_nsec = now.tv_nsec;
+    cfd->deadline_at.tv_sec = now.tv_sec + g_config.upload_deadline;
+    cfd->deadline_at.tv_nsec = now.tv_nsec;
+    cfd->rate_at = server_mono(&now);
+    cfd->rate_cur = 0;
+    cfd->rate_prev = 0;
+    cfd->rate_held = 2;
+    server_set_timeout(cfd, &now);
 
     /* if client connects but does not send anything, select() never
      * returns and we could have ghost connection that occupies slot
@@ -987,138 +2189,602 @@ static int server_init_client
 }
 
 /* ==========================================================================
-    in this function we accept connection from the backlog queue, check if
-    client is allowed to upload and if server has free upload slots. If all
-    checks pass, function starts thread that will handle upload on its own.
+    Puts client 'acfd' into slot 'slot' and starts its upload. Client has
+    passed all checks already, and its source is counted in 'lim'.
+   ========================================================================== */
+
+
+static void server_start
+(
+    struct sinfo                   *sfd,     /* server client came from */
+    int                             acfd,    /* fd for accepted client */
+    const struct sockaddr_storage  *client,  /* address of remote client */
+    const char                     *ips,     /* client as string */
+    const struct limit_client      *lim,     /* source of client */
+    int                             slot     /* slot for client */
+)
+{
+    struct cinfo                   *cfd;     /* current client information */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    cfd = &ci[slot];
+    cfd->cfd = acfd;
+    cfd->lim = *lim;
+    cfd->addr = *client;
+    strcpy(cfd->ips, ips);
+    cfd->proxy = 0;
+
+    /* at this point, we still have normal unencrypted connection,
+     * so set ssl to 0, so that server_reply() sends possible error
+     * data (without any sensitive informations) over non-ssl
+     * socket.
+     */
+
+    cfd->ssl = 0;
+    cfd->http = sfd->proto == sproto_http_upload;
+
+    /* perform ssl handshake */
+
+    if (sfd->ssl)
+    {
+        cfd->sslfd = ssl_accept(cfd->cfd);
+        if (cfd->sslfd == -1)
+        {
+            el_oprint(OELI, "[%s] rejected: ssl_accept() error", ips);
+            server_offense(cfd);
+
+            /* ssl negotation failed, reply in clear text */
+
+            server_reply(cfd, 400, "kurload: ssl negotation failed\n");
+            close(cfd->cfd);
+            cfd->cfd = -1;
+            limit_disconnect(&cfd->lim);
+            return;
+        }
+
+        /* now connection is encrypted, mark that in clients
+         * socket info
+         */
+
+        cfd->ssl = 1;
+    }
+
+    /* copy information if client should perform timed uploads
+     * or not
+     */
+
+    cfd->timed = sfd->timed;
+
+    /* client is connected, allowed and connection limit has
+     * not been reached, now initialize client's state struct
+     * so it can start transfering data.
+     */
+
+    server_init_client(cfd);
+}
+
+
+/* ==========================================================================
+    Puts client 'acfd' at the end of queue of clients that wait for upload
+    slot. Client stays connected and doesn't get any reply until it gets
+    slot, or waits for too long.
+
+    returns
+            0       client waits in queue
+           -1       queue is disabled or full
+   ========================================================================== */
+
+
+static int server_wait_push
+(
+    struct sinfo                   *sfd,     /* server client came from */
+    int                             acfd,    /* fd for accepted client */
+    const struct sockaddr_storage  *client,  /* address of remote client */
+    const char                     *ips,     /* client as string */
+    const struct limit_client      *lim      /* source of client */
+)
+{
+    struct winfo                   *w;       /* queued client */
+    struct timespec                 now;     /* current time */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (nwq == (unsigned)g_config.wait_queue)
+        return -1;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    w = &wq[(wqhead + nwq) % g_config.wait_queue];
+    w->acfd = acfd;
+    w->srv = sfd;
+    w->lim = *lim;
+    w->addr = *client;
+    strcpy(w->ips, ips);
+    w->since = server_mono(&now);
+
+    ++nwq;
+    ++g_stats.wait_queued;
+    g_stats.wait_depth = nwq;
+    el_print(ELI, "[%3d] all slots taken, %u client(s) waiting", acfd, nwq);
+    return 0;
+}
+
+
+/* ==========================================================================
+    Gives free upload slots to clients waiting in queue, oldest first.
+    Clients that waited for longer than wait_timeout are told to try again
+    later. When server is going down, everybody waiting is turned away.
+   ========================================================================== */
+
+
+static void server_wait_process(void)
+{
+    struct winfo     *w;       /* oldest client in queue */
+    struct timespec   now;     /* current time */
+    double            waited;  /* how long client waited */
+    int               slot;    /* free slot for client */
+    ssize_t           r;       /* return from recv() */
+    char              c;       /* byte peeked from client */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    while (nwq)
+    {
+        w = &wq[wqhead];
+        waited = server_mono(&now) - w->since;
+
+        /* everybody waits for the same time, so when oldest
+         * client did not wait too long yet, nobody else did
+         */
+
+        slot = g_shutdown ? -1 : server_get_free_client();
+        if (slot == -1 && g_shutdown == 0 && waited < g_config.wait_timeout)
+            break;
+
+        wqhead = (wqhead + 1) % g_config.wait_queue;
+        --nwq;
+        g_stats.wait_depth = nwq;
+
+        if (slot == -1)
+        {
+            el_oprint(OELI, "[%s] rejected: connection limit", w->ips);
+            server_reject(w->srv, w->acfd, reject_slots);
+            limit_disconnect(&w->lim);
+            ++g_stats.wait_expired;
+            continue;
+        }
+
+        /* client may have given up while waiting, don't start
+         * empty upload for it
+         */
+
+        r = recv(w->acfd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+        if (r == 0 || (r == -1 && errno != EAGAIN && errno != EWOULDBLOCK))
+        {
+            el_oprint(OELI, "[%s] rejected: gone while waiting", w->ips);
+            close(w->acfd);
+            limit_disconnect(&w->lim);
+            continue;
+        }
+
+        ++g_stats.wait_admitted;
+        g_stats.wait_msec += (unsigned long)(waited * 1000.0);
+        el_print(ELI, "[%3d] got slot after %.3f seconds", w->acfd, waited);
+        server_start(w->srv, w->acfd, &w->addr, w->ips, &w->lim, slot);
+    }
+}
+
+
+/* ==========================================================================
+    Checks if client 'acfd' with address 'client' is allowed to upload and
+    if server has free upload slots. If all checks pass, client gets its
+    slot and starts uploading. Client that sent PROXY header already has
+    its 'slot', for others it's -1.
+   ========================================================================== */
+
+
+static void server_admit
+(
+    struct sinfo             *sfd,     /* server socket client came from */
+    int                       acfd,    /* fd for accepted client */
+    struct sockaddr_storage  *client,  /* address of remote client */
+    const char               *ips,     /* client as string */
+    int                       slot     /* slot of client, or -1 */
+)
+{
+    int                       allowed; /* is client allowed by bnwlist */
+    struct limit_client       lim;     /* source of client for limits */
+    struct timespec           now;     /* current time */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    /* banned addresses are turned away right away, before they
+     * are even counted in limits
+     */
+
+    if (autoban_is_banned((struct sockaddr *)client, time(NULL)))
+    {
+        el_oprint(OELI, "[%s] rejected: banned", ips);
+        server_reject(sfd, acfd, reject_banned);
+        if (slot != -1) ci[slot].cfd = -1;
+        return;
+    }
+
+    /* after accepting connection, we have client's ip, now we
+     * check if this ip can upload (it can be banned, or not
+     * listed in the whitelist, depending on server config. It's
+     * done before limits, so clients that are not allowed
+     * anyway, don't count to them.
+     */
+
+    if (client->ss_family == AF_INET6)
+        allowed = bnw_is_allowed6(
+                &((struct sockaddr_in6 *)client)->sin6_addr);
+    else
+        allowed = bnw_is_allowed(
+                ((struct sockaddr_in *)client)->sin_addr.s_addr);
+
+    if (allowed == 0)
+    {
+        el_oprint(OELI, "[%s] rejected: not allowed", ips);
+        server_reject(sfd, acfd, reject_denied);
+        if (slot != -1) ci[slot].cfd = -1;
+        return;
+    }
+
+    /* check limits of client's source before it gets a slot, so
+     * single ip or network cannot take all of them, or connect
+     * over and over again
+     */
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (limit_connect(&lim, (struct sockaddr *)client,
+                server_mono(&now)) != 0)
+    {
+        struct cinfo  cfd;  /* temp cinfo object for server_offense() */
+        int           busy; /* source has too many clients connected */
+        /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+        busy = errno == EBUSY;
+        cfd.addr = *client;
+        strcpy(cfd.ips, ips);
+
+        el_oprint(OELI, "[%s] rejected: %s limit", ips,
+            busy ? "source connection" : "source rate");
+        server_offense(&cfd);
+        server_reject(sfd, acfd, busy ? reject_busy : reject_rate);
+        if (slot != -1) ci[slot].cfd = -1;
+        return;
+    }
+
+    /* get free upload slot for client, of no slot is available,
+     * that means connection limit is reached. Clients that already
+     * wait for slot are first in line, so newcomer goes to the
+     * end of the queue, even if slot is free at the moment.
+     */
+
+    if (slot == -1 && nwq == 0)
+        slot = server_get_free_client();
+
+    if (slot == -1)
+    {
+        if (server_wait_push(sfd, acfd, client, ips, &lim) == 0)
+            return;
+
+        el_oprint(OELI, "[%s] rejected: connection limit", ips);
+        server_reject(sfd, acfd, reject_slots);
+        limit_disconnect(&lim);
+        return;
+    }
+
+    server_start(sfd, acfd, client, ips, &lim, slot);
+}
+
+
+/* ==========================================================================
+    Takes slot for client 'acfd' that came through load balancer. Client
+    is not checked against anything yet, that happens once PROXY header
+    with real address of client is received.
+   ========================================================================== */
+
+
+static void server_proxy_accept
+(
+    struct sinfo             *sfd,     /* server socket client came from */
+    int                       acfd,    /* fd for accepted client */
+    struct sockaddr_storage  *client,  /* address of balancer */
+    const char               *ips      /* balancer as string */
+)
+{
+    int                       slot;    /* free slot for client */
+    struct cinfo             *cfd;     /* current client information */
+    struct timespec           now;     /* current time */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    /* anyone can send PROXY header, only trusted balancer can
+     * tell us who the client really is
+     */
+
+    if (proxy_trusted((struct sockaddr *)client) == 0)
+    {
+        el_oprint(OELI, "[%s] rejected: untrusted proxy", ips);
+        close(acfd);
+        return;
+    }
+
+    slot = server_get_free_client();
+    if (slot == -1)
+    {
+        el_oprint(OELI, "[%s] rejected: connection limit", ips);
+        server_reject(sfd, acfd, reject_slots);
+        return;
+    }
+
+    /* only fields that server_destroy() and server_reply() touch
+     * are set, rest is set when client is admitted
+     */
+
+    cfd = &ci[slot];
+    memset(&cfd->lim, 0, sizeof(cfd->lim));
+    cfd->cfd = acfd;
+    cfd->ffd = -1;
+    cfd->fname[0] = '\0';
+    cfd->mem = NULL;
+    cfd->ssl = 0;
+    cfd->http = sfd->proto == sproto_http_upload;
+    cfd->addr = *client;
+    strcpy(cfd->ips, ips);
+    cfd->proxy = 1;
+    cfd->srv = sfd;
+    cfd->headlen = 0;
+
+    /* balancer that connects and sends nothing must not hold
+     * slot forever, it gets the same, load scaled, timeout as
+     * any other client
+     */
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    cfd->active_at = now;
+    cfd->timeout_at.tv_sec = now.tv_sec + tmo[0];
+    cfd->timeout_at.tv_nsec = now.tv_nsec;
+    server_rearm_timer(cfd);
+}
+
+
+/* ==========================================================================
+    Drops client 'c' that was waiting for PROXY header
+   ========================================================================== */
+
+
+static void server_proxy_drop
+(
+    struct cinfo  *c,      /* client to drop */
+    const char    *reason  /* why client is dropped, for query log */
+)
+{
+    el_oprint(OELI, "[%s] rejected: %s", c->ips, reason);
+    close(c->cfd);
+    c->cfd = -1;
+}
+
+
+/* ==========================================================================
+    Reads PROXY header from client 'c'. Data is peeked first, and only
+    bytes that belong to header are taken from the socket, so anything
+    that comes after it (like ssl handshake) is still there for whoever
+    handles the client next. When whole header is received, client is
+    checked with address from the header, just like it connected to us
+    directly.
+   ========================================================================== */
+
+
+static void server_proxy_client
+(
+    struct cinfo             *c        /* client waiting for header */
+)
+{
+    struct sockaddr_storage   src;     /* client address from header */
+    char                      ips[INET6_ADDRSTRLEN]; /* src as string */
+    struct timespec           now;     /* current time */
+    unsigned char            *head;    /* received part of header */
+    size_t                    hlen;    /* length of whole header */
+    ssize_t                   r;       /* return from recv() */
+    int                       done;    /* whole header received */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (g_sigalrm)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if ((now.tv_sec < c->timeout_at.tv_sec) ||
+                (now.tv_sec == c->timeout_at.tv_sec &&
+                 now.tv_nsec < c->timeout_at.tv_nsec))
+        {
+            server_rearm_timer(c);
+            return;
+        }
+
+        /* balancer is not punished with autoban, it would
+         * ban all clients behind it
+         */
+
+        server_proxy_drop(c, "no proxy header");
+        return;
+    }
+
+    head = (unsigned char *)c->head;
+    r = recv(c->cfd, head + c->headlen, sizeof(c->head) - c->headlen,
+            MSG_PEEK);
+
+    if (r == -1 && errno == EINTR)
+        return;
+
+    if (r <= 0)
+    {
+        server_proxy_drop(c, "no proxy header");
+        return;
+    }
+
+    done = proxy_parse(head, c->headlen + r, &src, &hlen) == 0;
+    if (done == 0)
+    {
+        if (errno != EAGAIN)
+        {
+            server_proxy_drop(c, "malformed proxy header");
+            return;
+        }
+
+        /* everything we got so far is part of the header, take
+         * it from the socket, so select() doesn't wake us up
+         * until more data comes
+         */
+
+        hlen = c->headlen + r;
+    }
+
+    /* peeked data is in socket already, so this won't block */
+
+    r = recv(c->cfd, head + c->headlen, hlen - c->headlen, 0);
+    if (r != (ssize_t)(hlen - c->headlen))
+    {
+        server_proxy_drop(c, "read error");
+        return;
+    }
+
+    c->headlen = hlen;
+    if (done == 0)
+        return;
+
+    /* balancer may not know the client, like when it checks if
+     * we are alive, then balancer is treated as client
+     */
+
+    if (src.ss_family != AF_UNSPEC)
+    {
+        server_peer(&src, ips);
+        el_print(ELI, "[%3d] proxied connection from %s through %s",
+                c->cfd, ips, c->ips);
+    }
+    else
+    {
+        src = c->addr;
+        strcpy(ips, c->ips);
+    }
+
+    c->headlen = 0;
+    server_admit(c->srv, c->cfd, &src, ips, c - ci);
+}
+
+
+/* ==========================================================================
+    in this function we accept connection from the backlog queue, and
+    pass it for checks, or wait for PROXY header, when server socket is
+    behind load balancer.
+
+    returns
+            0       connection was taken from backlog queue
+           -1       queue is empty, or accept() failed
    ========================================================================== */
 
 
-static void server_process_connection
+static int server_process_connection
 (
-    struct sinfo       *sfd      /* server socket we accept connection from */
+    struct sinfo             *sfd      /* server socket we accept from */
 )
 {
-    int                 acfd;    /* fd for accepted client connection */
-    int                 slot;    /* free slot for client */
-    socklen_t           clen;    /* length of 'client' variable */
-    struct cinfo       *cfd;     /* current client information */
-    struct sockaddr_in  client;  /* address of remote client */
+    int                       acfd;    /* fd for accepted client */
+    socklen_t                 clen;    /* length of 'client' variable */
+    struct sockaddr_storage   client;  /* address of remote client */
+    char                      ips[INET6_ADDRSTRLEN]; /* client as string */
     /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 
 
     clen = sizeof(client);
-    el_print(ELD, "processing new connection");
 
-    /* accept incoming connection, it will be instant because we
-     * checked with select() ther client is awaiting.
+    /* server socket is non-blocking, so we can take connections
+     * until queue is empty. Client socket stays blocking, ssl
+     * handshake and replies depend on that.
      */
 
-    if ((acfd = accept(sfd->fd, (struct sockaddr *)&client, &clen)) < 0)
-    {
-        el_perror(ELC, "couldn't accept connection");
-        el_oprint(OELI, "[NULL] rejected: accept error");
-        return;
-    }
-
-    el_print(ELI, "incoming %sssl connection from %s socket id %d",
-        sfd->ssl ? "" : "non-", inet_ntoa(client.sin_addr), acfd);
-
-    /* server is going down, do not accept any new connections */
-
-    if (g_shutdown)
-        close(acfd);
-
-    /* get free upload slot for client, of no slot is available,
-     * that means connection limit is reached.
+#if HAVE_ACCEPT4
+    acfd = accept4(sfd->fd, (struct sockaddr *)&client, &clen, SOCK_CLOEXEC);
+#else
+    /* on BSDs, accepted socket inherits O_NONBLOCK from server
+     * socket, ssl handshake and replies need blocking one
      */
 
-    slot = server_get_free_client();
-    if (slot == -1)
+    acfd = accept(sfd->fd, (struct sockaddr *)&client, &clen);
+    if (acfd >= 0 && (fcntl(acfd, F_SETFL,
+                    fcntl(acfd, F_GETFL) & ~O_NONBLOCK) != 0 ||
+                fcntl(acfd, F_SETFD, FD_CLOEXEC) != 0))
     {
-        struct cinfo  cfd;  /* temp cinfo object for server_reply() */
-        /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
-
-
-        /* since we couldn't get free slot for the client, but
-         * we still want to reply to the user, and to the fact
-         * that server_reply() accepts struct cinfo, we
-         * create temporary cinfo, for that purpose. We only
-         * have to set fields needed by server_reply().
-         */
-
-        cfd.cfd = acfd;
-        cfd.ssl = 0;
-
-        el_oprint(OELI, "[%s] rejected: connection limit",
-            inet_ntoa(client.sin_addr));
-        server_reply(&cfd, "all upload slots are taken, try again later\n");
+        el_perror(ELE, "couldn't make client socket blocking");
         close(acfd);
-        return;
+        return 0;
     }
+#endif
 
-    cfd = &ci[slot];
-    cfd->cfd = acfd;
+    if (acfd < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return -1;
 
-    /* at this point, we still have normal unencrypted connection,
-     * so set ssl to 0, so that server_reply() sends possible error
-     * data (without any sensitive informations) over non-ssl
-     * socket.
-     */
+        el_perror(ELC, "couldn't accept connection");
+        el_oprint(OELI, "[NULL] rejected: accept error");
+        return -1;
+    }
 
-    cfd->ssl = 0;
+    el_print(ELD, "processing new connection");
 
-    /* after accepting connection, we have client's ip, now we
-     * check if this ip can upload (it can be banned, or not
-     * listed in the whitelist, depending on server config.
+    /* format address only once, it's used in every log line
+     * about this client
      */
 
-    if (bnw_is_allowed(ntohl(client.sin_addr.s_addr)) == 0)
-    {
-        el_oprint(OELI, "[%s] rejected: not allowed",
-            inet_ntoa(client.sin_addr));
-        server_reply(cfd, "you are not allowed to upload to this server\n");
-        close(cfd->cfd);
-        cfd->cfd = -1;
-        return;
-    }
+    server_peer(&client, ips);
+    el_print(ELI, "incoming %sssl connection from %s socket id %d",
+        sfd->ssl ? "" : "non-", ips, acfd);
 
-    /* perform ssl handshake */
+    /* server is going down, do not accept any new connections */
 
-    if (sfd->ssl)
+    if (g_shutdown)
     {
-        cfd->sslfd = ssl_accept(cfd->cfd);
-        if (cfd->sslfd == -1)
-        {
-            el_oprint(OELI, "[%s] rejected: ssl_accept() error",
-                inet_ntoa(client.sin_addr));
+        close(acfd);
+        return 0;
+    }
 
-            /* ssl negotation failed, reply in clear text */
+    if (sfd->proxy)
+        server_proxy_accept(sfd, acfd, &client, ips);
+    else
+        server_admit(sfd, acfd, &client, ips, -1);
 
-            server_reply(cfd, "kurload: ssl negotation failed\n");
-            close(cfd->cfd);
-            cfd->cfd = -1;
-            return;
-        }
+    return 0;
+}
 
-        /* now connection is encrypted, mark that in clients
-         * socket info
-         */
 
-        cfd->ssl = 1;
-    }
+/* ==========================================================================
+    Compiles current black and white list into kernel filter of server
+    socket 'sfd', if it was enabled for it. When list cannot be attached,
+    bnw_is_allowed() still checks every connection, so it's only warned.
+   ========================================================================== */
 
-    /* copy information if client should perform timed uploads
-     * or not
-     */
 
-    cfd->timed = sfd->timed;
+static void server_filter_attach
+(
+    struct sinfo  *sfd  /* server to attach filter to */
+)
+{
+    if (!sfd->filter)
+        return;
 
-    /* client is connected, allowed and connection limit has
-     * not been reached, now initialize client's state struct
-     * so it can start transfering data.
-     */
+    if (bnw_filter_attach(sfd->fd) == 0 || errno == ENOENT)
+        return;
 
-    server_init_client(cfd);
+    el_perror(ELW, "kernel filter not attached to fd %d, list will be "
+        "checked in userspace only", sfd->fd);
 }
 
 
@@ -1133,6 +2799,7 @@ static int create_socket_for_ips
     unsigned     port,       /* port to create sockets for */
     int          timed,      /* is this timed-enabled upload port? */
     int          ssl,        /* is this ssl port? */
+    enum sproto  proto,      /* protocol spoken on this port */
     unsigned     nips,       /* number of ips to listen on*/
     unsigned    *port_index  /* port index being parsed */
 )
@@ -1155,21 +2822,40 @@ static int create_socket_for_ips
 
     for (i = *port_index * nips; i != *port_index * nips + nips; ++i)
     {
-        in_addr_t    netip;  /* ip of the interface to listen on */
+        int          v6;     /* is ip an ipv6 address? */
         /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 
-        netip = inet_addr(ip);
+        /* ipv6 address is printed in brackets, so port can be
+         * told apart from the address
+         */
+
+        v6 = strchr(ip, ':') != NULL;
 
-        el_print(ELN, "creating server %s:%d (%s, %s)", ip, port,
-            timed ? "    timed" : "not timed", ssl ? "    ssl" : "non-ssl");
-        if ((si[i].fd = server_create_socket(netip, port)) < 0)
+        el_print(ELN, "creating server %s%s%s:%d (%s, %s)",
+            v6 ? "[" : "", ip, v6 ? "]" : "", port,
+            proto == sproto_http ? "     http" :
+            proto == sproto_http_upload ? "   upload" :
+            timed ? "    timed" : "not timed",
+            ssl ? "    ssl" : "non-ssl");
+        if ((si[i].fd = server_create_socket(ip, port)) < 0)
         {
-            el_print(ELF, "couldn't create socket for %s:%d", ip, port);
+            el_print(ELF, "couldn't create socket for %s%s%s:%d",
+                v6 ? "[" : "", ip, v6 ? "]" : "", port);
             return -1;
         }
 
         si[i].ssl = ssl;
         si[i].timed = timed;
+        si[i].proto = proto;
+        si[i].proxy = server_proxy_port(port, NULL, 0) == 1;
+
+        /* address seen by kernel is address of proxy, not the
+         * client, and http downloads are not filtered at all
+         */
+
+        si[i].filter = g_config.kernel_filter && !si[i].proxy &&
+            proto != sproto_http;
+        server_filter_attach(&si[i]);
 
         /* get next ip address on the list */
 
@@ -1216,6 +2902,49 @@ int server_init(void)
 
     el_print(ELN, "creating server");
 
+    /* http replies for rejected clients don't change, format
+     * them now, so there is nothing to format when server is
+     * flooded
+     */
+
+    for (i = 0; i != reject_max; ++i)
+        sprintf(reject_http[i], "HTTP/1.1 %d %s\r\n"
+                "Server: termsend\r\n"
+                "Content-Type: text/plain\r\n"
+                "Content-Length: %lu\r\n"
+                "Connection: close\r\n"
+                "\r\n"
+                "%s", reject_reply[i].code,
+                http_status_text(reject_reply[i].code),
+                (unsigned long)strlen(reject_reply[i].body),
+                reject_reply[i].body);
+
+    /* PROXY header can only come on upload ports, http server
+     * doesn't check clients, so it doesn't need their address
+     */
+
+    if (g_config.proxy_ports[0] != '\0')
+    {
+        long  ports[5];  /* upload ports */
+        /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+        ports[0] = g_config.listen_port;
+        ports[1] = g_config.ssl_listen_port;
+        ports[2] = g_config.timed_listen_port;
+        ports[3] = g_config.timed_ssl_listen_port;
+        ports[4] = g_config.http_upload_port;
+
+        if (server_proxy_port(0, ports, 5) == -1)
+        {
+            el_print(ELF, "proxy ports (%s) must list only upload ports",
+                    g_config.proxy_ports);
+            return -1;
+        }
+
+        if (proxy_init(g_config.proxy_trusted) != 0)
+            return -1;
+    }
+
     /* calculate how many listen ports do we have */
 
     nports = 0;
@@ -1223,6 +2952,8 @@ int server_init(void)
     nports = g_config.ssl_listen_port > 0       ? nports + 1 : nports;
     nports = g_config.timed_listen_port > 0     ? nports + 1 : nports;
     nports = g_config.timed_ssl_listen_port > 0 ? nports + 1 : nports;
+    nports = g_config.http_port > 0             ? nports + 1 : nports;
+    nports = g_config.http_upload_port > 0      ? nports + 1 : nports;
 
     /* number of server sockets to open, this is number of
      * ips we are going to listen on times number of ports
@@ -1233,6 +2964,8 @@ int server_init(void)
     nips = server_bind_num();
     nsi = nports * nips;
     nci = g_config.max_connections;
+    tmo[0] = g_config.max_timeout;
+    tmo[1] = g_config.timed_max_timeout;
 
     /* allocate memory for all server sockets, one interface equals
      * one server socket.
@@ -1255,6 +2988,19 @@ int server_init(void)
         return -1;
     }
 
+    /* clients are processed one by one, so single buffer for
+     * their data is enough
+     */
+
+    if ((rbuf = malloc(g_config.read_budget)) == NULL)
+    {
+        el_print(ELF, "couldn't allocate %ld bytes of read buffer",
+                g_config.read_budget);
+        free(ci);
+        free(si);
+        return -1;
+    }
+
     /* invalidate all allocated server and client sockets, so
      * closing such socket in case of an error won't crash the app.
      */
@@ -1265,19 +3011,65 @@ int server_init(void)
     for (i = 0; i != nci; ++i)
         ci[i].cfd = -1;
 
+    /* clients that come when all slots are taken, can wait in
+     * queue for a while, instead of being turned away right away
+     */
+
+    if (g_config.wait_queue &&
+            (wq = malloc(g_config.wait_queue * sizeof(*wq))) == NULL)
+    {
+        el_print(ELF, "couldn't allocate memory for %ld waiting client(s)",
+                g_config.wait_queue);
+        goto error;
+    }
+
     /* Now we create one server socket for each interface:port user
      * specified in configuration file.
      */
 
     pi = 0;
     e = 0;
-    e |= create_socket_for_ips(g_config.listen_port, 0, 0, nips, &pi);
-    e |= create_socket_for_ips(g_config.ssl_listen_port, 0, 1, nips, &pi);
-    e |= create_socket_for_ips(g_config.timed_listen_port, 1, 0, nips, &pi);
-    e |= create_socket_for_ips(g_config.timed_ssl_listen_port, 1, 1, nips, &pi);
+    e |= create_socket_for_ips(g_config.listen_port,
+            0, 0, sproto_termsend, nips, &pi);
+    e |= create_socket_for_ips(g_config.ssl_listen_port,
+            0, 1, sproto_termsend, nips, &pi);
+    e |= create_socket_for_ips(g_config.timed_listen_port,
+            1, 0, sproto_termsend, nips, &pi);
+    e |= create_socket_for_ips(g_config.timed_ssl_listen_port,
+            1, 1, sproto_termsend, nips, &pi);
+    e |= create_socket_for_ips(g_config.http_port,
+            0, 0, sproto_http, nips, &pi);
+    e |= create_socket_for_ips(g_config.http_upload_port,
+            0, 0, sproto_http_upload, nips, &pi);
 
     if (e) goto error;
 
+    /* http server lives in the same loop as upload server, but
+     * has its own connection slots, so downloads never take away
+     * upload slots
+     */
+
+    if (g_config.http_port > 0 && httpd_init() != 0)
+        goto error;
+
+    /* cache is only read by http server, no point in keeping
+     * anything in memory if nobody is going to read it
+     */
+
+    cache_init(g_config.http_port > 0 ? g_config.cache_size : 0);
+
+    if (limit_init() != 0)
+    {
+        el_print(ELF, "couldn't allocate memory for per source limits");
+        goto error;
+    }
+
+    if (autoban_init(time(NULL)) != 0)
+    {
+        el_print(ELF, "couldn't allocate memory for autoban");
+        goto error;
+    }
+
     /* seed random number generator for generating unique file name
      * for uploaded files. We don't need any cryptographic
      * security, so simple random seeded with current time is more
@@ -1304,6 +3096,59 @@ int server_init(void)
         goto error;
     }
 
+    /* packed store is always loaded, even when packing is off, so
+     * uploads packed earlier can still be downloaded and their
+     * names are not reused. Name starts with dot, so it never
+     * collides with generated names.
+     */
+
+    if (segstore_init(".seg", SEGSTORE_SEGMENT_MAX) != 0)
+    {
+        el_perror(ELF, "couldn't load packed store");
+        goto error;
+    }
+
+    /* upload index is not critical, uploads are stored without it
+     * just fine, only metadata is lost. Unless retention or search
+     * is on, expiry knows what and when to delete only from the
+     * index, and search index refers to uploads by index record.
+     */
+
+    upidx_ok = upidx_init(".upidx") == 0;
+    if (!upidx_ok)
+    {
+        if (expire_enabled())
+        {
+            el_perror(ELF, "couldn't open upload index %s/.upidx, "
+                    "needed for expiry", g_config.output_dir);
+            goto error;
+        }
+
+        if (g_config.search_max_size)
+        {
+            el_perror(ELF, "couldn't open upload index %s/.upidx, "
+                    "needed for search", g_config.output_dir);
+            goto error;
+        }
+
+        el_perror(ELE, "couldn't open upload index %s/.upidx, "
+                "uploads will not be indexed", g_config.output_dir);
+    }
+
+    if (expire_init(".upidx") != 0)
+    {
+        el_perror(ELF, "couldn't schedule uploads for expiry");
+        goto error;
+    }
+
+    /* search index is optional, without it, uploads are simply not
+     * searchable
+     */
+
+    if (g_config.search_max_size && search_init(".search") != 0)
+        el_perror(ELE, "couldn't open search index %s/.search",
+                g_config.output_dir);
+
     /* create new magical cookie, om nom nom, magics is optional
      * so do not exit when it fails
      */
@@ -1337,26 +3182,63 @@ error:
 void server_loop_forever(void)
 {
     fd_set    readfds;     /* set containing all server sockets to monitor */
+    fd_set    writefds;    /* set containing http clients we send data to */
     time_t    prev_flush;  /* time when flush was last called */
+    time_t    prev_stats;  /* time when stats were last dumped */
+    time_t    prev_compact;  /* time when packed store was compacted */
+    time_t    prev_expire; /* time when expired uploads were deleted */
+    time_t    prev_sweep;  /* time when autoban was swept */
     int       maxfd;       /* maximum fd value monitored in readfds */
+    int       reader;      /* id of this loop as ip list reader */
     sigset_t  sigblk;      /* signals to block */
     /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 
 
     sigemptyset(&sigblk);
     sigaddset(&sigblk, SIGALRM);
+    sigaddset(&sigblk, SIGHUP);
 
     prev_flush = 0;
+    prev_stats = 0;
+    prev_compact = 0;
+    prev_expire = 0;
+    prev_sweep = 0;
+
+    /* we are already daemonized and run with dropped privileges,
+     * so it's safe to start deleting files
+     */
+
+    if (expire_start() != 0)
+        el_perror(ELE, "couldn't start reaper, deleting files in server");
+
+    if ((reader = bnw_reader_add()) == -1)
+        el_perror(ELW, "couldn't register as ip list reader");
+
     el_print(ELN, "server initialized and started");
 
     for (;;)
     {
-        int       sact;     /* select activity, just select return value */
-        unsigned  i;        /* a simple interator for loop */
-        time_t    now;      /* current time from time() */
+        int             sact;  /* select activity, just select return value */
+        unsigned        i;     /* a simple interator for loop */
+        unsigned        k;     /* client slot, counted from 'first' */
+        int             pass;  /* 0 - short uploads, 1 - all clients */
+        unsigned        busy;  /* number of busy upload slots */
+        time_t          now;   /* current time from time() */
+        struct timeval  tv;    /* select timeout when http clients connected */
+        struct timeval *tvp;   /* select timeout, NULL to wait forever */
+        struct timespec mono;  /* current monotonic time */
+        double          wait;  /* time until first throttled client can read */
+        double          w;     /* time until current client can read */
         /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 
 
+        /* lookups from previous round are done, ip lists that
+         * were replaced before can be freed
+         */
+
+        if (reader != -1)
+            bnw_quiescent(reader);
+
         now = time(NULL);
         if ((now - prev_flush) >= 60)
         {
@@ -1368,6 +3250,54 @@ void server_loop_forever(void)
             prev_flush = now;
         }
 
+        if (g_config.stats_file[0] != '\0' && (now - prev_stats) >= 10)
+        {
+            stats_dump(g_config.stats_file);
+            prev_stats = now;
+        }
+
+        if ((now - prev_compact) >= 10)
+        {
+            /* reclaim space after removed packed uploads, one
+             * segment at a time, so we don't stall clients
+             */
+
+            segstore_compact();
+            prev_compact = now;
+        }
+
+        if (expire_enabled() && now != prev_expire)
+        {
+            /* small batch each second, so deleting loads of
+             * expired uploads doesn't starve clients
+             */
+
+            expire_run(now);
+            prev_expire = now;
+        }
+
+        if (autoban_enabled() && (now - prev_sweep) >= 60)
+        {
+            /* forget forgiven addresses, and store bans */
+
+            autoban_sweep(now);
+            prev_sweep = now;
+        }
+
+        if (g_sighup)
+        {
+            /* SIGHUP received, read list again, new list is used
+             * for connections accepted from now on, on error old
+             * list is kept
+             */
+
+            g_sighup = 0;
+            bnw_reload();
+
+            for (i = 0; i != nsi; ++i)
+                server_filter_attach(&si[i]);
+        }
+
         /* we may have multiple server sockets, so we cannot accept
          * in blocking fassion. Since number of server sockets will
          * be very small, we can use not so fast but highly
@@ -1377,6 +3307,7 @@ void server_loop_forever(void)
          */
 
         FD_ZERO(&readfds);
+        FD_ZERO(&writefds);
 
         for (i = 0, maxfd = 0; i != nsi; ++i)
         {
@@ -1398,15 +3329,53 @@ void server_loop_forever(void)
             maxfd = si[i].fd > maxfd ? si[i].fd : maxfd;
         }
 
-        for (i = 0; i != nci; ++i)
+        clock_gettime(CLOCK_MONOTONIC, &mono);
+        wait = 0.0;
+
+        for (i = 0, busy = 0; i != nci; ++i)
         {
             if (ci[i].cfd == -1)
                 continue;
 
+            ++busy;
+
+            /* client's source used up its bandwidth, don't watch
+             * client until there is enough to read, otherwise
+             * select would return right away over and over again
+             */
+
+            if ((w = limit_wait(&ci[i].lim, server_mono(&mono))) > 0.0)
+            {
+                wait = wait == 0.0 || w < wait ? w : wait;
+                ci[i].rate_held |= 1;
+                ++g_stats.limit_throttled;
+                continue;
+            }
+
             FD_SET(ci[i].cfd, &readfds);
             maxfd = ci[i].cfd > maxfd ? ci[i].cfd : maxfd;
         }
 
+        /* shorten timeouts when slots run out, and bring them back
+         * when load drops
+         */
+
+        server_scale_timeouts(busy);
+
+        /* oldest client waiting for slot needs to be turned away
+         * when its time is up, even if nothing else happens
+         */
+
+        if (nwq)
+        {
+            w = wq[wqhead].since + g_config.wait_timeout - server_mono(&mono);
+            w = w > 0.0 ? w : 0.001;
+            wait = wait == 0.0 || w < wait ? w : wait;
+        }
+
+        if (g_config.http_port > 0)
+            maxfd = httpd_fdset(&readfds, &writefds, maxfd);
+
         /* double SIGTERM received, we need to exit RIGHT NOW,
          * so no more client processsing
          */
@@ -1416,12 +3385,18 @@ void server_loop_forever(void)
 
         /* now we wait for activity, for server sockets activity
          * means we have an incoming connection. For client
-         * sockets, it means we have outstanding data to read. We
-         * pass NULL for timeout, because we want to wait
-         * indefinitely, and we are not interested in writefds (we
-         * don't write to any socket) nor exceptfds as exceptions
+         * sockets, it means we have outstanding data to read.
+         * writefds holds http clients that wait for response or
+         * file data, so we wake up when their socket can take
+         * more. We are not interested in exceptfds, as exceptions
          * don't occur on server sockets.
          *
+         * Timeout is NULL, so we wait indefinitely, unless
+         * something needs to happen at given time without any
+         * socket activity: idle http clients and expiry are
+         * checked once a second, throttled clients can read
+         * again, or oldest client in wait queue runs out of time.
+         *
          * We use SIGALRM to indicate that any of the client socket
          * has timed out and action must be taken. We don't want
          * SIGALRM to interrupt any of read()/write() call during
@@ -1439,14 +3414,44 @@ void server_loop_forever(void)
 
         sact = -1;
         if (g_sigalrm == 0)
-            sact = select(maxfd + 1, &readfds, NULL, NULL, NULL);
+        {
+            /* http clients are not covered by SIGALRM, when any
+             * of them is connected, wake up once a second to check
+             * for idle ones, expiry also needs to tick every second
+             */
+
+            tv.tv_sec = 1;
+            tv.tv_usec = 0;
+            tvp = (g_config.http_port > 0 && httpd_num_conn()) ||
+                expire_enabled() ? &tv : NULL;
+
+            /* throttled clients need to be woken up when they can
+             * read again, round up, so they surely can
+             */
+
+            if (wait > 0.0 && (tvp == NULL || wait < 1.0))
+            {
+                tv.tv_sec = (long)wait;
+                tv.tv_usec = (long)((wait - tv.tv_sec) * 1000000.0) + 1000;
+                if (tv.tv_usec >= 1000000)
+                {
+                    ++tv.tv_sec;
+                    tv.tv_usec -= 1000000;
+                }
+
+                tvp = &tv;
+            }
+
+            sact = select(maxfd + 1, &readfds, &writefds, NULL, tvp);
+        }
 
         sigprocmask(SIG_BLOCK, &sigblk, NULL);
 
-        if (sact == -1 && g_sigalrm == 0 && g_shutdown == 0)
+        if (sact == -1 && g_sigalrm == 0 && g_shutdown == 0 && g_sighup == 0)
         {
             /* if select has been interrupted by something we didn't
-             * expect (and we expect SIGALRM and SIGTERM for shutdown)
+             * expect (and we expect SIGALRM and SIGTERM for shutdown,
+             * and SIGHUP for list reload)
              * then it means critical error and we interrupt program,
              * since there is no clean way to avoid UB at this point.
              */
@@ -1466,8 +3471,30 @@ void server_loop_forever(void)
 
         if (sact > 0)
             for (i = 0; i != nsi; ++i)
-                if (FD_ISSET(si[i].fd, &readfds))
-                    server_process_connection(&si[i]);
+            {
+                long  n;  /* connections accepted from socket */
+                /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+                if (FD_ISSET(si[i].fd, &readfds) == 0)
+                    continue;
+
+                /* during burst, take as many waiting clients as
+                 * we can in one go, instead of going through
+                 * whole loop for each of them. Batch is limited,
+                 * so clients that are uploading are not starved.
+                 */
+
+                for (n = 0; n != g_config.accept_batch; ++n)
+                {
+                    if (si[i].proto == sproto_http)
+                    {
+                        if (httpd_accept(si[i].fd) != 0)
+                            break;
+                    }
+                    else if (server_process_connection(&si[i]) != 0)
+                        break;
+                }
+            }
 
         /* now let's check if which (if any) client sent us some
          * data, it could also be that some client has timed out
@@ -1476,14 +3503,58 @@ void server_loop_forever(void)
          * activity to know that.
          */
 
-        for (i = 0; i != nci; ++i)
-        {
-            if (ci[i].cfd == -1)
-                continue;
+        /* each round starts from next slot, so clients in low
+         * slots are not always served first. When short uploads
+         * are favoured, clients that sent less than short_upload
+         * bytes so far are served in first pass, so small pastes
+         * get their links quickly, even when big uploads keep
+         * server busy. Client served in first pass is taken out
+         * of readfds, so it's not read again in the second one.
+         */
 
-            if (g_sigalrm || (sact > 0 && FD_ISSET(ci[i].cfd, &readfds)))
-                server_process_client(&ci[i]);
-        }
+        pass = g_config.short_upload && g_sigalrm == 0 ? 0 : 1;
+        for (; pass != 2; ++pass)
+            for (k = 0; k != nci; ++k)
+            {
+                struct cinfo  *c;    /* client to process */
+                int            cfd;  /* client socket, c->cfd may change */
+                /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+                c = &ci[(first + k) % nci];
+                if ((cfd = c->cfd) == -1)
+                    continue;
+
+                if (pass == 0 && (c->proxy ||
+                            c->written >= (size_t)g_config.short_upload))
+                    continue;
+
+                if (g_sigalrm == 0 && (sact <= 0 || !FD_ISSET(cfd, &readfds)))
+                    continue;
+
+                if (c->proxy)
+                    server_proxy_client(c);
+                else
+                    server_process_client(c);
+
+                FD_CLR(cfd, &readfds);
+            }
+
+        if (nci)
+            first = (first + 1) % nci;
+
+        /* slots freed in this round go to clients waiting in
+         * queue
+         */
+
+        if (nwq)
+            server_wait_process();
+
+        /* send pending responses and read requests of http
+         * clients, this also drops idle http clients
+         */
+
+        if (g_config.http_port > 0)
+            httpd_process(&readfds, &writefds, sact);
 
         /* SIGALRM has been handled (if there was any) */
 
@@ -1535,6 +3606,29 @@ void server_destroy(void)
 
     free(si);
 
+    /* disconnect all http clients, there is no point in waiting
+     * for them to finish downloading
+     */
+
+    if (g_config.http_port > 0)
+        httpd_destroy();
+
+    /* http clients are gone, so nobody uses cache any more */
+
+    cache_destroy();
+    expire_destroy();
+    limit_destroy();
+    autoban_destroy();
+    proxy_destroy();
+    search_destroy();
+    segstore_destroy();
+    upidx_destroy();
+
+    /* final statistics, so they don't get lost on restart */
+
+    if (g_config.stats_file[0] != '\0')
+        stats_dump(g_config.stats_file);
+
     /* close magic cookie, don't let it leak, it's our and only our
      * cookie
      */
@@ -1554,8 +3648,17 @@ void server_destroy(void)
 
         close(ci[i].ffd);
         unlink(ci[i].fname);
+        free(ci[i].mem);
     }
 
+    /* and clients that still wait for slot */
+
+    for (; nwq; --nwq, wqhead = (wqhead + 1) % g_config.wait_queue)
+        close(wq[wqhead].acfd);
+
+    free(wq);
+    free(rbuf);
+
     /* if ssl port enabled, cleanup ssl */
 
     if (g_config.ssl_listen_port)
@@ -0,0 +1,203 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         -------------------------------------------------------------
+        / Runtime statistics. Modules bump counters in g_stats, and   \
+        | from time to time we dump them all into a text file, in     |
+        | format that can be scraped by prometheus node exporter or   |
+        \ simply read by a human with cat.                            /
+         -------------------------------------------------------------
+             \   ^__^
+              \  (oo)\_______
+                 (__)\       )\/\
+                     ||----w |
+                     ||     ||
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "feature.h"
+
+#include <embedlog.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "globals.h"
+#include "stats.h"
+
+
+/* ==========================================================================
+                                   _                __
+                     ____   _____ (_)_   __ ____ _ / /_ ___
+                    / __ \ / ___// /| | / // __ `// __// _ \
+                   / /_/ // /   / / | |/ // /_/ // /_ /  __/
+                  / .___//_/   /_/  |___/ \__,_/ \__/ \___/
+                 /_/
+               ____                     __   _
+              / __/__  __ ____   _____ / /_ (_)____   ____   _____
+             / /_ / / / // __ \ / ___// __// // __ \ / __ \ / ___/
+            / __// /_/ // / / // /__ / /_ / // /_/ // / / /(__  )
+           /_/   \__,_//_/ /_/ \___/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Reads listen queue counters from /proc/net/netstat. Kernel does not
+    count them per socket, so they are for whole host, but on a box that
+    only runs termsend, they are ours. Where there is no such file,
+    counters stay at 0.
+   ========================================================================== */
+
+
+static void stats_listen(void)
+{
+    FILE          *f;           /* /proc/net/netstat */
+    static char    name[8192];  /* line with names of counters */
+    static char    value[8192]; /* line with values of counters */
+    char          *n;           /* current name */
+    char          *v;           /* current value */
+    char          *nsave;       /* strtok_r() state for names */
+    char          *vsave;       /* strtok_r() state for values */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if ((f = fopen("/proc/net/netstat", "r")) == NULL)
+        return;
+
+    /* file is made of pairs of lines, first one names counters,
+     * second one has their values, in the same order
+     */
+
+    while (fgets(name, sizeof(name), f) && fgets(value, sizeof(value), f))
+    {
+        if (strncmp(name, "TcpExt:", 7) != 0)
+            continue;
+
+        n = strtok_r(name, " \n", &nsave);
+        v = strtok_r(value, " \n", &vsave);
+
+        while (n && v)
+        {
+            if (strcmp(n, "ListenOverflows") == 0)
+                g_stats.listen_overflows = strtoul(v, NULL, 10);
+            else if (strcmp(n, "ListenDrops") == 0)
+                g_stats.listen_drops = strtoul(v, NULL, 10);
+
+            n = strtok_r(NULL, " \n", &nsave);
+            v = strtok_r(NULL, " \n", &vsave);
+        }
+
+        break;
+    }
+
+    fclose(f);
+}
+
+
+/* ==========================================================================
+                       __     __ _          ____
+        ____   __  __ / /_   / /(_)_____   / __/__  __ ____   _____ _____
+       / __ \ / / / // __ \ / // // ___/  / /_ / / / // __ \ / ___// ___/
+      / /_/ // /_/ // /_/ // // // /__   / __// /_/ // / / // /__ (__  )
+     / .___/ \__,_//_.___//_//_/ \___/  /_/   \__,_//_/ /_/ \___//____/
+    /_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Writes all statistics into 'path'. Data is first written to temporary
+    file which is then renamed to 'path', so whoever reads the file, will
+    always see complete set of statistics.
+
+    returns
+            0       statistics dumped
+           -1       error, errno is set
+   ========================================================================== */
+
+
+int stats_dump
+(
+    const char    *path               /* where to store statistics */
+)
+{
+    FILE          *f;                 /* temporary stats file */
+    char           tmp[PATH_MAX + 5]; /* path to temporary file */
+    unsigned long  lookups;           /* total number of cache lookups */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    sprintf(tmp, "%s.tmp", path);
+    if ((f = fopen(tmp, "w")) == NULL)
+    {
+        el_perror(ELE, "couldn't open stats file %s", tmp);
+        return -1;
+    }
+
+    lookups = g_stats.cache_hits + g_stats.cache_misses;
+    stats_listen();
+
+#define STATS_PRINT(field) \
+    fprintf(f, "termsend_%s %lu\n", #field, g_stats.field)
+
+    STATS_PRINT(uploads);
+    STATS_PRINT(http_requests);
+    STATS_PRINT(cache_hits);
+    STATS_PRINT(cache_misses);
+    STATS_PRINT(cache_inserts);
+    STATS_PRINT(cache_evictions);
+    STATS_PRINT(cache_entries);
+    STATS_PRINT(cache_bytes);
+    STATS_PRINT(expired);
+    STATS_PRINT(expire_pending);
+    STATS_PRINT(store_bytes);
+    STATS_PRINT(limit_rejects);
+    STATS_PRINT(limit_throttled);
+    STATS_PRINT(limit_entries);
+    STATS_PRINT(autoban_bans);
+    STATS_PRINT(autoban_rejects);
+    STATS_PRINT(autoban_active);
+    STATS_PRINT(listen_overflows);
+    STATS_PRINT(listen_drops);
+    STATS_PRINT(wait_queued);
+    STATS_PRINT(wait_admitted);
+    STATS_PRINT(wait_expired);
+    STATS_PRINT(wait_depth);
+    STATS_PRINT(wait_msec);
+
+#undef STATS_PRINT
+
+    /* hit ratio can be calculated from counters above, but it's
+     * the one value everybody wants to see, so give it for free
+     */
+
+    fprintf(f, "termsend_cache_hit_ratio %.4f\n",
+            lookups ? (double)g_stats.cache_hits / lookups : 0.0);
+
+    if (fclose(f) != 0)
+    {
+        el_perror(ELE, "couldn't write stats file %s", tmp);
+        unlink(tmp);
+        return -1;
+    }
+
+    if (rename(tmp, path) != 0)
+    {
+        el_perror(ELE, "couldn't rename %s to %s", tmp, path);
+        unlink(tmp);
+        return -1;
+    }
+
+    return 0;
+}
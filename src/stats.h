@@ -0,0 +1,41 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef STATS_H
+#define STATS_H 1
+
+/* counters are only ever incremented, gauges reflect current state */
+
+struct stats
+{
+    unsigned long  uploads;          /* counter, finished uploads */
+    unsigned long  http_requests;    /* counter, processed http requests */
+    unsigned long  cache_hits;       /* counter, downloads served from cache */
+    unsigned long  cache_misses;     /* counter, downloads served from disk */
+    unsigned long  cache_inserts;    /* counter, uploads stored in cache */
+    unsigned long  cache_evictions;  /* counter, entries evicted from cache */
+    unsigned long  cache_entries;    /* gauge, number of cached uploads */
+    unsigned long  cache_bytes;      /* gauge, bytes held by cache */
+    unsigned long  expired;          /* counter, uploads deleted by expiry */
+    unsigned long  expire_pending;   /* gauge, uploads waiting for expiry */
+    unsigned long  store_bytes;      /* gauge, bytes of uploads not expired */
+    unsigned long  limit_rejects;    /* counter, connections over the limit */
+    unsigned long  limit_throttled;  /* counter, reads delayed by bandwidth */
+    unsigned long  limit_entries;    /* gauge, sources tracked by limits */
+    unsigned long  autoban_bans;     /* counter, addresses banned by autoban */
+    unsigned long  autoban_rejects;  /* counter, connections of banned ips */
+    unsigned long  autoban_active;   /* gauge, bans in force */
+    unsigned long  listen_overflows; /* counter, full accept queue, host wide */
+    unsigned long  listen_drops;     /* counter, dropped SYNs, host wide */
+    unsigned long  wait_queued;      /* counter, clients queued for slot */
+    unsigned long  wait_admitted;    /* counter, queued clients given slot */
+    unsigned long  wait_expired;     /* counter, queued clients turned away */
+    unsigned long  wait_depth;       /* gauge, clients waiting for slot */
+    unsigned long  wait_msec;        /* counter, time admitted clients waited */
+};
+
+int stats_dump(const char *path);
+
+#endif
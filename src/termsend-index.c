@@ -0,0 +1,262 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license. See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         ------------------------------------------------------------
+        / Command line tool to list and summarize uploads recorded   \
+        | in upload index, without walking output directory and      |
+        \ stating every single file in it.                           /
+         ------------------------------------------------------------
+          \
+           \ \_\_    _/_/
+            \    \__/
+                 (oo)\_______
+                 (__)\       )\/\
+                     ||----w |
+                     ||     ||
+   ==========================================================================
+      _               __            __           __   ____ _  __
+     (_)____   _____ / /__  __ ____/ /___   ____/ /  / __/(_)/ /___   _____
+    / // __ \ / ___// // / / // __  // _ \ / __  /  / /_ / // // _ \ / ___/
+   / // / / // /__ / // /_/ // /_/ //  __// /_/ /  / __// // //  __/(__  )
+  /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/ \__,_/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "feature.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "upidx.h"
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* filters given on command line */
+
+struct filter
+{
+    unsigned long long  since;    /* only uploads at or after that time */
+    unsigned long long  until;    /* only uploads before that time */
+    const char         *ip;       /* only uploads from this ip */
+    const char         *name;     /* only upload with this name */
+};
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Converts ip stored in record 'r' into string in 'buf'
+   ========================================================================== */
+
+
+static const char *ip_str
+(
+    const struct upidx_rec  *r,   /* record with ip */
+    char                    *buf  /* buffer for string, INET6_ADDRSTRLEN */
+)
+{
+    if (inet_ntop(r->family == 6 ? AF_INET6 : AF_INET, r->ip,
+                buf, INET6_ADDRSTRLEN) == NULL)
+        strcpy(buf, "?");
+
+    return buf;
+}
+
+
+/* ==========================================================================
+    Checks if record 'r' passes all filters in 'f'.
+   ========================================================================== */
+
+
+static int matches
+(
+    const struct upidx_rec  *r,    /* record to check */
+    const struct filter     *f,    /* filters to apply */
+    char                    *ipb   /* buffer for ip string */
+)
+{
+    if (r->ctime < f->since || r->ctime >= f->until)
+        return 0;
+
+    if (f->name && strncmp(r->name, f->name, sizeof(r->name)) != 0)
+        return 0;
+
+    if (f->ip && strcmp(ip_str(r, ipb), f->ip) != 0)
+        return 0;
+
+    return 1;
+}
+
+
+/* ==========================================================================
+    Prints usage
+   ========================================================================== */
+
+
+static void usage
+(
+    const char  *argv0  /* program name */
+)
+{
+    printf(
+"termsend-index - list uploads recorded in termsend upload index\n"
+"\n"
+"Usage: %s [-h | -v | options]\n"
+"\n"
+"options:\n"
+"\t-h                 prints this help and quits\n"
+"\t-v                 prints version and quits\n"
+"\t-f <path>          upload index to read\n"
+"\t-s <time>          only uploads created at or after time\n"
+"\t-u <time>          only uploads created before time\n"
+"\t-a <ip>            only uploads from ip\n"
+"\t-n <name>          only upload with name\n"
+"\t-S                 print summary instead of listing uploads\n"
+"\n"
+"time is number of seconds since epoch\n"
+"default index is /var/lib/termsend/.upidx\n", argv0);
+}
+
+
+/* ==========================================================================
+                                        _
+                           ____ ___   ____ _ (_)____
+                          / __ `__ \ / __ `// // __ \
+                         / / / / / // /_/ // // / / /
+                        /_/ /_/ /_/ \__,_//_//_/ /_/
+
+   ========================================================================== */
+
+
+int main
+(
+    int                      argc,     /* number of arguments */
+    char                    *argv[]    /* argument list */
+)
+{
+    struct upidx_map         m;        /* mapped index */
+    struct filter            f;        /* filters from command line */
+    const struct upidx_rec  *r;        /* current record */
+    const char              *path;     /* path to index file */
+    size_t                   i;        /* current record index */
+    unsigned long long       n;        /* number of matched records */
+    unsigned long long       bytes;    /* size of all matched uploads */
+    unsigned long long       first;    /* oldest matched upload time */
+    unsigned long long       last;     /* newest matched upload time */
+    unsigned long long       nflag[5]; /* uploads with each flag set */
+    int                      summary;  /* print only summary? */
+    int                      arg;      /* current option */
+    int                      j;        /* flag index */
+    char                     ipb[INET6_ADDRSTRLEN];  /* ip as string */
+    char                     flags[6]; /* flags as string */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    path = "/var/lib/termsend/.upidx";
+    memset(&f, 0, sizeof(f));
+    f.until = (unsigned long long)-1;
+    summary = 0;
+
+    while ((arg = getopt(argc, argv, "hvf:s:u:a:n:S")) != -1)
+    {
+        switch (arg)
+        {
+        case 'h': usage(argv[0]); return 0;
+        case 'v': printf("termsend-index " PACKAGE_VERSION "\n"); return 0;
+        case 'f': path = optarg; break;
+        case 's': f.since = strtoull(optarg, NULL, 10); break;
+        case 'u': f.until = strtoull(optarg, NULL, 10); break;
+        case 'a': f.ip = optarg; break;
+        case 'n': f.name = optarg; break;
+        case 'S': summary = 1; break;
+        default:
+            fprintf(stderr, "invalid option, check -h\n");
+            return 1;
+        }
+    }
+
+    if (upidx_map(&m, path) != 0)
+    {
+        fprintf(stderr, "couldn't open index %s: %s\n", path,
+                errno == EINVAL ? "not a termsend upload index" :
+                strerror(errno));
+        return 1;
+    }
+
+    n = bytes = last = 0;
+    first = (unsigned long long)-1;
+    memset(nflag, 0, sizeof(nflag));
+
+    for (i = 0; i != m.nrec; ++i)
+    {
+        r = &m.rec[i];
+        if (!matches(r, &f, ipb))
+            continue;
+
+        ++n;
+        bytes += r->size;
+        first = r->ctime < first ? r->ctime : first;
+        last = r->ctime > last ? r->ctime : last;
+
+        for (j = 0; j != 5; ++j)
+            nflag[j] += (r->flags >> j) & 1;
+
+        if (summary)
+            continue;
+
+        flags[0] = r->flags & UPIDX_SSL    ? 's' : '-';
+        flags[1] = r->flags & UPIDX_TIMED  ? 't' : '-';
+        flags[2] = r->flags & UPIDX_HTTP   ? 'h' : '-';
+        flags[3] = r->flags & UPIDX_PACKED ? 'p' : '-';
+        flags[4] = r->flags & UPIDX_DELETED ? 'd' : '-';
+        flags[5] = '\0';
+
+        printf("%llu\t%.*s\t%llu\t%s\t%u\t%s\t%.*s\n",
+                (unsigned long long)r->ctime,
+                (int)sizeof(r->name), r->name,
+                (unsigned long long)r->size, ip_str(r, ipb),
+                (unsigned)r->port, flags,
+                (int)sizeof(r->mime), r->mime[0] ? r->mime : "plain");
+    }
+
+    if (summary)
+    {
+        printf("uploads: %llu\n", n);
+        printf("bytes: %llu\n", bytes);
+        printf("first: %llu\n", n ? first : 0);
+        printf("last: %llu\n", last);
+        printf("ssl: %llu\n", nflag[0]);
+        printf("timed: %llu\n", nflag[1]);
+        printf("http: %llu\n", nflag[2]);
+        printf("packed: %llu\n", nflag[3]);
+        printf("deleted: %llu\n", nflag[4]);
+    }
+
+    upidx_unmap(&m);
+    return 0;
+}
@@ -0,0 +1,147 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license. See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         ------------------------------------------------------------
+        / Command line tool that compiles black or white list into   \
+        | binary image, that termsend can memory map and use as is,  |
+        \ without parsing and sorting millions of lines on startup.  /
+         ------------------------------------------------------------
+          \
+           \ \_\_    _/_/
+            \    \__/
+                 (oo)\_______
+                 (__)\       )\/\
+                     ||----w |
+                     ||     ||
+   ==========================================================================
+      _               __            __           __   ____ _  __
+     (_)____   _____ / /__  __ ____/ /___   ____/ /  / __/(_)/ /___   _____
+    / // __ \ / ___// // / / // __  // _ \ / __  /  / /_ / // // _ \ / ___/
+   / // / / // /__ / // /_/ // /_/ //  __// /_/ /  / __// // //  __/(__  )
+  /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/ \__,_/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "feature.h"
+
+#include <embedlog.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bnwlist.h"
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Prints usage
+   ========================================================================== */
+
+
+static void usage
+(
+    const char  *argv0  /* program name */
+)
+{
+    printf(
+"termsend-listc - compile black or white list into binary image\n"
+"\n"
+"Usage: %s [-h | -v | [-q] <list> <image>]\n"
+"\n"
+"options:\n"
+"\t-h                 prints this help and quits\n"
+"\t-v                 prints version and quits\n"
+"\t-q                 do not print summary of compiled list\n"
+"\n"
+"list can be text list or image compiled earlier\n", argv0);
+}
+
+
+/* ==========================================================================
+                                        _
+                           ____ ___   ____ _ (_)____
+                          / __ `__ \ / __ `// // __ \
+                         / / / / / // /_/ // // / / /
+                        /_/ /_/ /_/ \__,_//_//_/ /_/
+
+   ========================================================================== */
+
+
+int main
+(
+    int    argc,   /* number of arguments */
+    char  *argv[]  /* argument list */
+)
+{
+    int    quiet;  /* do not print summary */
+    int    arg;    /* current option */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    quiet = 0;
+
+    while ((arg = getopt(argc, argv, "hvq")) != -1)
+    {
+        switch (arg)
+        {
+        case 'h': usage(argv[0]); return 0;
+        case 'v': printf("termsend-listc " PACKAGE_VERSION "\n"); return 0;
+        case 'q': quiet = 1; break;
+        default:
+            fprintf(stderr, "invalid option, check -h\n");
+            return 1;
+        }
+    }
+
+    if (optind != argc - 2)
+    {
+        fprintf(stderr, "give list and image paths, check -h\n");
+        return 1;
+    }
+
+    /* bnw_init() treats missing list as no list at all,
+     * here it is an error
+     */
+
+    if (access(argv[optind], R_OK) != 0)
+    {
+        fprintf(stderr, "couldn't read list %s: %s\n", argv[optind],
+                strerror(errno));
+        return 1;
+    }
+
+    el_init();
+    el_option(EL_LEVEL, quiet ? EL_ERROR : EL_NOTICE);
+    el_option(EL_OUT, EL_OUT_STDERR);
+
+    if (bnw_init(argv[optind], 1) != 0)
+    {
+        fprintf(stderr, "couldn't load list %s: %s\n", argv[optind],
+                errno == EFAULT ? "malformed list, check messages above" :
+                strerror(errno));
+        return 1;
+    }
+
+    if (bnw_write_image(argv[optind + 1]) != 0)
+    {
+        fprintf(stderr, "couldn't write image %s: %s\n", argv[optind + 1],
+                strerror(errno));
+        bnw_destroy();
+        return 1;
+    }
+
+    bnw_destroy();
+    return 0;
+}
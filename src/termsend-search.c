@@ -0,0 +1,318 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license. See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         ------------------------------------------------------------
+        / Command line tool to find uploads containing given text,   \
+        | using trigram index, so only uploads that may contain text |
+        \ are read, instead of grepping whole output directory.      /
+         ------------------------------------------------------------
+          \
+           \ \_\_    _/_/
+            \    \__/
+                 (oo)\_______
+                 (__)\       )\/\
+                     ||----w |
+                     ||     ||
+   ==========================================================================
+      _               __            __           __   ____ _  __
+     (_)____   _____ / /__  __ ____/ /___   ____/ /  / __/(_)/ /___   _____
+    / // __ \ / ___// // / / // __  // _ \ / __  /  / /_ / // // _ \ / ___/
+   / // / / // /__ / // /_/ // /_/ //  __// /_/ /  / __// // //  __/(__  )
+  /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/ \__,_/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "feature.h"
+
+#include <embedlog.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if HAVE_LINUX_LIMITS_H
+#   include <linux/limits.h>
+#endif
+
+#include "search.h"
+#include "segstore.h"
+#include "upidx.h"
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Checks if 'data' contains 'pat', optionally ignoring case of ASCII
+    letters.
+   ========================================================================== */
+
+
+static int contains
+(
+    const unsigned char  *data,   /* data to look in */
+    size_t                len,    /* length of data */
+    const char           *pat,    /* pattern to look for */
+    int                   icase   /* ignore case? */
+)
+{
+    size_t                plen;   /* length of pattern */
+    size_t                i;      /* offset in data */
+    size_t                j;      /* offset in pattern */
+    int                   a;      /* byte from data */
+    int                   b;      /* byte from pattern */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    plen = strlen(pat);
+    for (i = 0; i + plen <= len; ++i)
+    {
+        for (j = 0; j != plen; ++j)
+        {
+            a = data[i + j];
+            b = (unsigned char)pat[j];
+
+            if (icase)
+            {
+                a = a >= 'A' && a <= 'Z' ? a + ('a' - 'A') : a;
+                b = b >= 'A' && b <= 'Z' ? b + ('a' - 'A') : b;
+            }
+
+            if (a != b)
+                break;
+        }
+
+        if (j == plen)
+            return 1;
+    }
+
+    return 0;
+}
+
+
+/* ==========================================================================
+    Reads content of upload described by 'r' from output dir 'dir'.
+    Packed uploads are read from segment store.
+
+    returns
+            content of upload, must be freed by caller
+            NULL on error, or when upload is gone
+   ========================================================================== */
+
+
+static unsigned char *read_upload
+(
+    const char              *dir,   /* output directory */
+    const struct upidx_rec  *r,     /* upload to read */
+    size_t                  *len    /* length of read upload */
+)
+{
+    unsigned char           *data;  /* content of upload */
+    char                     name[sizeof(r->name) + 1];  /* upload name */
+    char                     path[PATH_MAX + 64];  /* path to upload */
+    off_t                    off;   /* offset of data in file */
+    time_t                   mtime; /* not used */
+    int                      fd;    /* file with upload */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    sprintf(name, "%.*s", (int)sizeof(r->name), r->name);
+    off = 0;
+    *len = r->size;
+
+    if (r->flags & UPIDX_PACKED)
+        fd = segstore_open(name, &off, len, &mtime);
+    else
+    {
+        sprintf(path, "%s/%s", dir, name);
+        fd = open(path, O_RDONLY);
+    }
+
+    if (fd < 0)
+        return NULL;
+
+    if ((data = malloc(*len ? *len : 1)) == NULL ||
+            pread(fd, data, *len, off) != (ssize_t)*len)
+    {
+        free(data);
+        close(fd);
+        return NULL;
+    }
+
+    close(fd);
+    return data;
+}
+
+
+/* ==========================================================================
+    Prints usage
+   ========================================================================== */
+
+
+static void usage
+(
+    const char  *argv0  /* program name */
+)
+{
+    printf(
+"termsend-search - find uploads containing text\n"
+"\n"
+"Usage: %s [-h | -v | -m | [-d <dir>] [-i] <text>]\n"
+"\n"
+"options:\n"
+"\t-h                 prints this help and quits\n"
+"\t-v                 prints version and quits\n"
+"\t-d <dir>           termsend output directory\n"
+"\t-i                 ignore case of ASCII letters\n"
+"\t-m                 merge index segments and quit\n"
+"\n"
+"text must be at least 3 bytes long\n"
+"default directory is /var/lib/termsend\n", argv0);
+}
+
+
+/* ==========================================================================
+                                        _
+                           ____ ___   ____ _ (_)____
+                          / __ `__ \ / __ `// // __ \
+                         / / / / / // /_/ // // / / /
+                        /_/ /_/ /_/ \__,_//_//_/ /_/
+
+   ========================================================================== */
+
+
+int main
+(
+    int                      argc,     /* number of arguments */
+    char                    *argv[]    /* argument list */
+)
+{
+    struct upidx_map         m;        /* mapped upload index */
+    const struct upidx_rec  *r;        /* current record */
+    const char              *dir;      /* output directory */
+    unsigned long           *recs;     /* candidate records */
+    unsigned char           *data;     /* content of candidate */
+    size_t                   nrecs;    /* number of candidates */
+    size_t                   len;      /* length of data */
+    size_t                   i;        /* current candidate */
+    int                      icase;    /* ignore case? */
+    int                      merge;    /* merge segments? */
+    int                      arg;      /* current option */
+    int                      ret;      /* program exit code */
+    char                     path[PATH_MAX + 16];  /* path in output dir */
+    char                     idx[PATH_MAX + 16];   /* path to search index */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    dir = "/var/lib/termsend";
+    icase = 0;
+    merge = 0;
+
+    while ((arg = getopt(argc, argv, "hvd:im")) != -1)
+    {
+        switch (arg)
+        {
+        case 'h': usage(argv[0]); return 0;
+        case 'v': printf("termsend-search " PACKAGE_VERSION "\n"); return 0;
+        case 'd': dir = optarg; break;
+        case 'i': icase = 1; break;
+        case 'm': merge = 1; break;
+        default:
+            fprintf(stderr, "invalid option, check -h\n");
+            return 1;
+        }
+    }
+
+    if (strlen(dir) >= PATH_MAX)
+    {
+        fprintf(stderr, "directory path too long\n");
+        return 1;
+    }
+
+    if (!merge && optind != argc - 1)
+    {
+        fprintf(stderr, "give exactly one text to search for, check -h\n");
+        return 1;
+    }
+
+    el_init();
+    el_option(EL_LEVEL, EL_ERROR);
+    el_option(EL_OUT, EL_OUT_STDERR);
+
+    sprintf(idx, "%s/.search", dir);
+    sprintf(path, "%s/.upidx", dir);
+    if (upidx_map(&m, path) != 0)
+    {
+        fprintf(stderr, "couldn't open index %s: %s\n", path,
+                errno == EINVAL ? "not a termsend upload index" :
+                strerror(errno));
+        return 1;
+    }
+
+    if (merge)
+    {
+        ret = 0;
+        if (search_merge(idx, &m) != 0)
+        {
+            fprintf(stderr, "couldn't merge %s: %s\n", idx, strerror(errno));
+            ret = 1;
+        }
+
+        upidx_unmap(&m);
+        return ret;
+    }
+
+    if (search_query(idx, argv[optind], &recs, &nrecs) != 0)
+    {
+        fprintf(stderr, "couldn't search %s: %s\n", idx,
+                errno == EINVAL ? "text too short" : strerror(errno));
+        upidx_unmap(&m);
+        return 1;
+    }
+
+    /* store is only read here, nothing is ever modified */
+
+    sprintf(path, "%s/.seg", dir);
+    if (segstore_init(path, SEGSTORE_SEGMENT_MAX) != 0)
+        fprintf(stderr, "couldn't load packed store, packed uploads "
+                "will not be found\n");
+
+    /* index gives us uploads that have all trigrams of text,
+     * check if they really contain it
+     */
+
+    for (i = 0; i != nrecs; ++i)
+    {
+        if (recs[i] >= m.nrec)
+            continue;
+
+        r = &m.rec[recs[i]];
+        if (r->flags & UPIDX_DELETED)
+            continue;
+
+        if ((data = read_upload(dir, r, &len)) == NULL)
+            continue;
+
+        if (contains(data, len, argv[optind], icase))
+            printf("%.*s\n", (int)sizeof(r->name), r->name);
+
+        free(data);
+    }
+
+    segstore_destroy();
+    free(recs);
+    upidx_unmap(&m);
+    return 0;
+}
@@ -0,0 +1,431 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         -------------------------------------------------------------
+        / Upload index. Each finished upload appends one fixed size   \
+        | record with its metadata to the index file. Record is never |
+        | modified once written (except for deleted flag), so readers |
+        | can simply mmap() whole file and walk it like an array,     |
+        | without any locking and without touching output directory.  |
+        | Module has no other dependencies, so it can be used by      |
+        \ external tools too.                                         /
+         -------------------------------------------------------------
+             \   ^__^
+              \  (oo)\_______
+                 (__)\       )\/\
+                     ||----w |
+                     ||     ||
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "feature.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "upidx.h"
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+#define UPIDX_MAGIC    "TSUPIDX"
+#define UPIDX_VERSION  1
+
+/* header at the beginning of index file, records follow */
+
+struct upidx_hdr
+{
+    char           magic[8];      /* UPIDX_MAGIC */
+    uint32_t       version;       /* UPIDX_VERSION */
+    uint32_t       recsize;       /* sizeof(struct upidx_rec) */
+    unsigned char  reserved[16];  /* must be 0 */
+};
+
+/* compilation will fail here if struct sizes are not what we
+ * expect, file format must not depend on compiler mood
+ */
+
+typedef char upidx_rec_size_check[sizeof(struct upidx_rec) == 96 ? 1 : -1];
+typedef char upidx_hdr_size_check[sizeof(struct upidx_hdr) == 32 ? 1 : -1];
+
+static int    ifd = -1;  /* index file opened for writing */
+static off_t  iend;      /* size of index file, where next record goes */
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Checks if header 'h' describes index file we can read.
+
+    returns
+            0       header is valid
+           -1       header is invalid, errno is set
+
+    errno
+            EINVAL  file is not an index, or has incompatible format
+   ========================================================================== */
+
+
+static int upidx_check_hdr
+(
+    const struct upidx_hdr  *h  /* header to check */
+)
+{
+    if (memcmp(h->magic, UPIDX_MAGIC, sizeof(UPIDX_MAGIC)) != 0 ||
+            h->version != UPIDX_VERSION ||
+            h->recsize != sizeof(struct upidx_rec))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* ==========================================================================
+                       __     __ _          ____
+        ____   __  __ / /_   / /(_)_____   / __/__  __ ____   _____ _____
+       / __ \ / / / // __ \ / // // ___/  / /_ / / / // __ \ / ___// ___/
+      / /_/ // /_/ // /_/ // // // /__   / __// /_/ // / / // /__ (__  )
+     / .___/ \__,_//_.___//_//_/ \___/  /_/   \__,_//_/ /_/ \___//____/
+    /_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Opens index 'path' for writing new records. File is created when it
+    does not exist. Partial record, that could have been left by a crash,
+    is cut off.
+
+    returns
+            0       index opened
+           -1       error, errno is set
+
+    errno
+            EINVAL  file exists but it's not an index we can write to
+   ========================================================================== */
+
+
+int upidx_init
+(
+    const char        *path  /* path to index file */
+)
+{
+    struct upidx_hdr   h;    /* index file header */
+    struct stat        st;   /* index file info */
+    size_t             tail; /* size of partial record at the end */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    /* no O_APPEND, on some systems pwrite() ignores offset with
+     * that flag, and we need it to set deleted flag
+     */
+
+    if ((ifd = open(path, O_RDWR | O_CREAT, 0644)) < 0)
+        return -1;
+
+    if (fstat(ifd, &st) != 0)
+        goto error;
+
+    if (st.st_size == 0)
+    {
+        /* brand new index, write header */
+
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, UPIDX_MAGIC, sizeof(UPIDX_MAGIC));
+        h.version = UPIDX_VERSION;
+        h.recsize = sizeof(struct upidx_rec);
+
+        if (pwrite(ifd, &h, sizeof(h), 0) != sizeof(h))
+            goto error;
+
+        iend = sizeof(h);
+        return 0;
+    }
+
+    if (pread(ifd, &h, sizeof(h), 0) != sizeof(h))
+    {
+        errno = EINVAL;
+        goto error;
+    }
+
+    if (upidx_check_hdr(&h) != 0)
+        goto error;
+
+    tail = (st.st_size - sizeof(h)) % sizeof(struct upidx_rec);
+    if (tail && ftruncate(ifd, st.st_size - tail) != 0)
+        goto error;
+
+    iend = st.st_size - tail;
+    return 0;
+
+error:
+    close(ifd);
+    ifd = -1;
+    return -1;
+}
+
+
+/* ==========================================================================
+    Closes index opened with upidx_init()
+   ========================================================================== */
+
+
+void upidx_destroy(void)
+{
+    if (ifd != -1)
+        close(ifd);
+
+    ifd = -1;
+}
+
+
+/* ==========================================================================
+    Appends record 'rec' to the index. Number of the record is stored in
+    'recno', unless it's NULL. Does nothing when index is not opened.
+
+    returns
+            0       record appended, or index is disabled
+           -1       error, errno is set
+
+    errno
+            ENOENT  index is not opened, only when recno is not NULL
+   ========================================================================== */
+
+
+int upidx_add
+(
+    const struct upidx_rec  *rec,   /* record to append */
+    unsigned long           *recno  /* number of added record */
+)
+{
+    ssize_t                  w;     /* bytes written */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (ifd == -1)
+    {
+        /* caller that wants record number, wants to do something
+         * with record later, and there is no record to do it with
+         */
+
+        if (recno == NULL)
+            return 0;
+
+        errno = ENOENT;
+        return -1;
+    }
+
+    if ((w = pwrite(ifd, rec, sizeof(*rec), iend)) == sizeof(*rec))
+    {
+        if (recno)
+            *recno = (iend - sizeof(struct upidx_hdr)) / sizeof(*rec);
+
+        iend += sizeof(*rec);
+        return 0;
+    }
+
+    /* don't leave partial record, or readers would see garbage as
+     * a valid record once next one is appended
+     */
+
+    if (w > 0 && ftruncate(ifd, iend) != 0)
+        return -1;
+
+    /* short write, most likely disk is full */
+
+    if (w >= 0)
+        errno = ENOSPC;
+
+    return -1;
+}
+
+
+/* ==========================================================================
+    Reads record number 'recno' from index opened with upidx_init().
+
+    returns
+            0       record read
+           -1       error, errno is set
+
+    errno
+            ENOENT  index is not opened or there is no such record
+   ========================================================================== */
+
+
+int upidx_read
+(
+    unsigned long      recno,  /* number of record to read */
+    struct upidx_rec  *rec     /* read record will be stored here */
+)
+{
+    off_t              off;    /* offset of record in file */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    off = sizeof(struct upidx_hdr) + (off_t)recno * sizeof(*rec);
+    if (ifd == -1 || off + (off_t)sizeof(*rec) > iend)
+    {
+        errno = ENOENT;
+        return -1;
+    }
+
+    if (pread(ifd, rec, sizeof(*rec), off) != sizeof(*rec))
+        return -1;
+
+    return 0;
+}
+
+
+/* ==========================================================================
+    Sets UPIDX_DELETED flag in record 'recno'. That's the only change ever
+    made to existing record, it's single byte, so readers will either see
+    old or new flags, never garbage.
+
+    returns
+            0       record marked as deleted
+           -1       error, errno is set
+   ========================================================================== */
+
+
+int upidx_mark_deleted
+(
+    unsigned long      recno  /* number of record to mark */
+)
+{
+    struct upidx_rec   rec;   /* record to mark */
+    off_t              off;   /* offset of flags field in file */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (upidx_read(recno, &rec) != 0)
+        return -1;
+
+    rec.flags |= UPIDX_DELETED;
+    off = sizeof(struct upidx_hdr) + (off_t)recno * sizeof(rec);
+    off += offsetof(struct upidx_rec, flags);
+
+    if (pwrite(ifd, &rec.flags, sizeof(rec.flags), off) != sizeof(rec.flags))
+        return -1;
+
+    return 0;
+}
+
+
+/* ==========================================================================
+    Maps index 'path' into memory for reading. Records are available as
+    m->rec[0] .. m->rec[m->nrec - 1]. Records appended after mapping are
+    not visible, map again to see them.
+
+    returns
+            0       index mapped
+           -1       error, errno is set
+
+    errno
+            EINVAL  file is not an index or has incompatible format
+   ========================================================================== */
+
+
+int upidx_map
+(
+    struct upidx_map  *m,    /* mapped index */
+    const char        *path  /* path to index file */
+)
+{
+    struct stat        st;   /* index file info */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    memset(m, 0, sizeof(*m));
+    if ((m->fd = open(path, O_RDONLY)) < 0)
+        return -1;
+
+    if (fstat(m->fd, &st) != 0)
+        goto error;
+
+    if ((size_t)st.st_size < sizeof(struct upidx_hdr))
+    {
+        errno = EINVAL;
+        goto error;
+    }
+
+    m->maplen = st.st_size;
+    m->map = mmap(NULL, m->maplen, PROT_READ, MAP_SHARED, m->fd, 0);
+    if (m->map == MAP_FAILED)
+        goto error;
+
+    if (upidx_check_hdr(m->map) != 0)
+    {
+        munmap(m->map, m->maplen);
+        goto error;
+    }
+
+    /* records are read from start to the end, let kernel know
+     * so it can read ahead aggressively
+     */
+
+    posix_madvise(m->map, m->maplen, POSIX_MADV_SEQUENTIAL);
+
+    m->rec = (const struct upidx_rec *)
+        ((const unsigned char *)m->map + sizeof(struct upidx_hdr));
+    m->nrec = (m->maplen - sizeof(struct upidx_hdr)) / sizeof(*m->rec);
+    return 0;
+
+error:
+    close(m->fd);
+    m->fd = -1;
+    m->map = NULL;
+    return -1;
+}
+
+
+/* ==========================================================================
+    Unmaps index mapped with upidx_map()
+   ========================================================================== */
+
+
+void upidx_unmap
+(
+    struct upidx_map  *m  /* index to unmap */
+)
+{
+    if (m->map)
+        munmap(m->map, m->maplen);
+
+    if (m->fd != -1)
+        close(m->fd);
+
+    memset(m, 0, sizeof(*m));
+    m->fd = -1;
+}
@@ -0,0 +1,57 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef UPIDX_H
+#define UPIDX_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* listener and storage flags of upload */
+
+#define UPIDX_SSL     0x01  /* uploaded over ssl */
+#define UPIDX_TIMED   0x02  /* uploaded to timed port */
+#define UPIDX_HTTP    0x04  /* uploaded with http PUT/POST */
+#define UPIDX_PACKED  0x08  /* stored in packed segment store */
+#define UPIDX_DELETED 0x10  /* upload has been deleted (expired) */
+
+/* single upload record, exactly 96 bytes, stored in host byte
+ * order, so index is not portable between architectures
+ */
+
+struct upidx_rec
+{
+    char      name[32];  /* upload name, nul terminated */
+    char      mime[24];  /* mime subtype, empty when unknown */
+    uint64_t  size;      /* upload size in bytes */
+    uint64_t  ctime;     /* upload creation time, seconds since epoch */
+    uint8_t   ip[16];    /* source ip, in network byte order */
+    uint8_t   family;    /* ip version, 4 or 6 */
+    uint8_t   flags;     /* UPIDX_* flags */
+    uint16_t  port;      /* local port upload came in through */
+    uint32_t  reserved;  /* must be 0 */
+};
+
+/* read only view of the index */
+
+struct upidx_map
+{
+    int                      fd;      /* opened index file */
+    void                    *map;     /* whole mapped file */
+    size_t                   maplen;  /* size of map */
+    const struct upidx_rec  *rec;     /* first record */
+    size_t                   nrec;    /* number of records */
+};
+
+int upidx_init(const char *path);
+void upidx_destroy(void);
+int upidx_add(const struct upidx_rec *rec, unsigned long *recno);
+int upidx_read(unsigned long recno, struct upidx_rec *rec);
+int upidx_mark_deleted(unsigned long recno);
+
+int upidx_map(struct upidx_map *m, const char *path);
+void upidx_unmap(struct upidx_map *m);
+
+#endif
@@ -0,0 +1 @@
+../src/autoban.c
\ No newline at end of file
@@ -0,0 +1,283 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+
+    Microbenchmark of black and white list lookups. For lists from 1K up
+    to 10M entries (or up to number passed as first argument) it measures
+    time to load list, and average time of single and batched lookup.
+    Half of looked up addresses are on the list, half are random.
+
+    Build and run with "make bench" in tst directory.
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "feature.h"
+
+#include <arpa/inet.h>
+#include <embedlog.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bnwlist.h"
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+#define BENCH_LIST     "./bench-bnwlist.list"
+#define BENCH_QUERIES  (4 * 1024 * 1024)
+#define BENCH_CHUNK    1024
+
+static uint32_t  rng = 2463534242u;  /* state of xorshift generator */
+
+
+/* ==========================================================================
+                           _           ____
+             ____   _____ (_)_   __   / __/__  __ ____   _____ _____
+            / __ \ / ___// /| | / /  / /_ / / / // __ \ / ___// ___/
+           / /_/ // /   / / | |/ /  / __// /_/ // / / // /__ (__  )
+          / .___//_/   /_/  |___/  /_/   \__,_//_/ /_/ \___//____/
+         /_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Fast and repeatable pseudo random numbers, rand() is too slow to
+    generate 10M addresses and has only 31 bits on some systems.
+   ========================================================================== */
+
+
+static uint32_t bench_rand(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+
+/* ==========================================================================
+    Returns monotonic time in seconds
+   ========================================================================== */
+
+
+static double bench_now(void)
+{
+    struct timespec  ts;  /* current time */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/* ==========================================================================
+    Writes list of 'n' entries into BENCH_LIST, every tenth entry is
+    a prefix between /16 and /31, rest are single addresses. Some of
+    listed addresses are stored in 'listed' to be looked up later.
+   ========================================================================== */
+
+
+static int bench_gen_list
+(
+    size_t     n,        /* number of entries to generate */
+    uint32_t  *listed,   /* listed addresses, BENCH_QUERIES long */
+    size_t    *nlisted   /* number of addresses stored in listed */
+)
+{
+    FILE      *f;        /* list file */
+    size_t     i;        /* current entry */
+    uint32_t   ip;       /* generated address */
+    uint32_t   mask;     /* network mask of prefix */
+    int        plen;     /* prefix length */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if ((f = fopen(BENCH_LIST, "w")) == NULL)
+    {
+        perror("fopen(" BENCH_LIST ")");
+        return -1;
+    }
+
+    *nlisted = 0;
+
+    for (i = 0; i != n; ++i)
+    {
+        ip = bench_rand();
+        plen = i % 10 ? 32 : 16 + bench_rand() % 16;
+        mask = 0xffffffffu << (32 - plen);
+        ip &= mask;
+
+        fprintf(f, "%u.%u.%u.%u/%d\n", ip >> 24, (ip >> 16) & 0xff,
+            (ip >> 8) & 0xff, ip & 0xff, plen);
+
+        if (*nlisted != BENCH_QUERIES)
+            listed[(*nlisted)++] = ip | (bench_rand() & ~mask);
+    }
+
+    if (fclose(f) != 0)
+    {
+        perror("fclose(" BENCH_LIST ")");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* ==========================================================================
+    Runs benchmark for list with 'n' entries and prints results
+   ========================================================================== */
+
+
+static int bench_run
+(
+    size_t      n,        /* number of entries in list */
+    in_addr_t  *q,        /* space for queries, BENCH_QUERIES long */
+    int        *allowed   /* space for batch results, BENCH_CHUNK long */
+)
+{
+    size_t      nlisted;  /* number of listed addresses in q */
+    size_t      i;        /* current query */
+    double      start;    /* start of measured operation */
+    double      load;     /* time of loading list */
+    double      single;   /* time of single lookups */
+    double      batch;    /* time of batched lookups */
+    unsigned    sum;      /* sum of results, so lookups are not elided */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (bench_gen_list(n, q, &nlisted) != 0)
+        return -1;
+
+    start = bench_now();
+    if (bnw_init(BENCH_LIST, 1) != 0)
+    {
+        perror("bnw_init()");
+        return -1;
+    }
+    load = bench_now() - start;
+
+    /* every other query is listed address, shuffled through
+     * whole list, convert them to network endianess as server
+     * passes them
+     */
+
+    for (i = BENCH_QUERIES; i-- != 0;)
+    {
+        if (i % 2)
+            q[i] = q[(i / 2) % nlisted];
+        else
+            q[i] = bench_rand();
+
+        q[i] = htonl(q[i]);
+    }
+
+    for (i = BENCH_QUERIES; i > 1; --i)
+    {
+        in_addr_t  tmp;
+        size_t     j;
+        /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+        j = bench_rand() % i;
+        tmp = q[i - 1];
+        q[i - 1] = q[j];
+        q[j] = tmp;
+    }
+
+    sum = 0;
+    start = bench_now();
+    for (i = 0; i != BENCH_QUERIES; ++i)
+        sum += bnw_is_allowed(q[i]);
+    single = bench_now() - start;
+
+    start = bench_now();
+    for (i = 0; i != BENCH_QUERIES; i += BENCH_CHUNK)
+    {
+        size_t  j;
+        /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+        bnw_is_allowed_batch(q + i, allowed, BENCH_CHUNK);
+        for (j = 0; j != BENCH_CHUNK; ++j)
+            sum -= allowed[j];
+    }
+    batch = bench_now() - start;
+
+    printf("%10zu %12.1f %12.1f %12.1f%s\n", n, load * 1e3,
+        single * 1e9 / BENCH_QUERIES, batch * 1e9 / BENCH_QUERIES,
+        sum ? "  (batch and single results differ!)" : "");
+
+    bnw_destroy();
+    return sum ? -1 : 0;
+}
+
+
+/* ==========================================================================
+                                              _
+                           ____ ___   ____ _ (_)____
+                          / __ `__ \ / __ `// // __ \
+                         / / / / / // /_/ // // / / /
+                        /_/ /_/ /_/ \__,_//_//_/ /_/
+
+   ========================================================================== */
+
+
+int main
+(
+    int          argc,     /* number of arguments */
+    char        *argv[]    /* arguments */
+)
+{
+    in_addr_t   *q;        /* addresses to look up */
+    int         *allowed;  /* batch lookup results */
+    size_t       max;      /* biggest list to test */
+    size_t       n;        /* size of current list */
+    int          ret;      /* program exit code */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    max = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000000;
+
+    el_init();
+    el_option(EL_LEVEL, EL_ERROR);
+    el_option(EL_OUT, EL_OUT_STDERR);
+
+    q = malloc(BENCH_QUERIES * sizeof(*q));
+    allowed = malloc(BENCH_CHUNK * sizeof(*allowed));
+    if (q == NULL || allowed == NULL)
+    {
+        perror("malloc()");
+        return 1;
+    }
+
+    printf("%10s %12s %12s %12s\n", "entries", "load [ms]",
+        "single [ns]", "batch [ns]");
+
+    ret = 0;
+    for (n = 1000; n <= max && ret == 0; n *= 10)
+        ret = bench_run(n, q, allowed);
+
+    unlink(BENCH_LIST);
+    free(q);
+    free(allowed);
+    return ret ? 1 : 0;
+}
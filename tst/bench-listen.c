@@ -0,0 +1,432 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+
+    Benchmark of listening socket options. Forked server answers every
+    paste with a link, just like termsend does, and client measures time
+    from connect() to receiving the link, with plain listener, with
+    TCP_DEFER_ACCEPT and with TCP_FASTOPEN. Server also counts how many
+    times it was woken up for connection that had no data yet, and how
+    many idle connections (that never send anything) it had to accept.
+
+    Fast open is used only when net.ipv4.tcp_fastopen allows it for both
+    client and server (value 3), otherwise it falls back to normal
+    connect and results are the same as for plain listener.
+
+    Build and run with "make bench" in tst directory.
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "feature.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+#define BENCH_PASTES  2000
+#define BENCH_IDLE    50
+#define BENCH_PASTE   "int main(void) { return 0; }\ntermsend\n"
+#define BENCH_LINK    "http://localhost/c/2024-01-01/00-00-00-00000\n"
+
+/* listener options to benchmark */
+
+enum bench_mode
+{
+    mode_plain,
+    mode_defer,
+    mode_fastopen,
+    mode_max
+};
+
+static const char  *mode_name[mode_max] = { "plain", "defer", "fastopen" };
+static double       lat[BENCH_PASTES];  /* connect to link latencies */
+
+
+/* ==========================================================================
+                           _           ____
+             ____   _____ (_)_   __   / __/__  __ ____   _____ _____
+            / __ \ / ___// /| | / /  / /_ / / / // __ \ / ___// ___/
+           / /_/ // /   / / | |/ /  / __// /_/ // / / // /__ (__  )
+          / .___//_/   /_/  |___/  /_/   \__,_//_/ /_/ \___//____/
+         /_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Returns monotonic time in seconds
+   ========================================================================== */
+
+
+static double bench_now(void)
+{
+    struct timespec  ts;  /* current time */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/* ==========================================================================
+    Sorts latencies for percentiles
+   ========================================================================== */
+
+
+static int bench_comp
+(
+    const void  *a,  /* first latency */
+    const void  *b   /* second latency */
+)
+{
+    double       x = *(const double *)a;
+    double       y = *(const double *)b;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    return (x > y) - (x < y);
+}
+
+
+/* ==========================================================================
+    Creates listening socket on loopback with options for 'mode', port is
+    chosen by kernel and stored in 'sa'.
+   ========================================================================== */
+
+
+static int bench_listen
+(
+    enum bench_mode      mode,  /* options to set */
+    struct sockaddr_in  *sa     /* address socket is bound to */
+)
+{
+    int                  fd;    /* listening socket */
+    int                  opt;   /* option value */
+    socklen_t            salen; /* length of sa */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    memset(sa, 0, sizeof(*sa));
+    sa->sin_family = AF_INET;
+    sa->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    salen = sizeof(*sa);
+
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        return -1;
+
+    opt = mode == mode_defer ? 5 : 64;
+    if (mode == mode_defer)
+        setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &opt, sizeof(opt));
+    if (mode == mode_fastopen)
+        setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &opt, sizeof(opt));
+
+    if (bind(fd, (struct sockaddr *)sa, sizeof(*sa)) != 0 ||
+        listen(fd, 256) != 0 ||
+        getsockname(fd, (struct sockaddr *)sa, &salen) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+/* ==========================================================================
+    Server side. Accepts connections one by one, reads paste until it
+    ends with "termsend\n" and sends back link. Connections that have no
+    data when accepted are counted in 'early', and those that never send
+    anything in 'idle'. Both are sent to parent over 'pipefd' once
+    client closes its end of 'ctl'.
+   ========================================================================== */
+
+
+static void bench_server
+(
+    int            sfd,        /* listening socket */
+    int            pipefd,     /* where to send counters */
+    int            ctl         /* closed by parent when benchmark ends */
+)
+{
+    struct pollfd  pfd[2];     /* listener and control */
+    char           buf[4096];  /* received paste */
+    unsigned long  cnt[2];     /* early wakeups and idle connections */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    cnt[0] = cnt[1] = 0;
+    pfd[0].fd = sfd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = ctl;
+    pfd[1].events = POLLIN;
+
+    for (;;)
+    {
+        int      cfd;    /* accepted client */
+        ssize_t  r;      /* return from recv() */
+        size_t   got;    /* bytes of paste received */
+        /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+        if (poll(pfd, 2, -1) < 0)
+            continue;
+
+        if (pfd[1].revents)
+            break;
+
+        if ((cfd = accept(sfd, NULL, NULL)) < 0)
+            continue;
+
+        if (recv(cfd, buf, 1, MSG_PEEK | MSG_DONTWAIT) < 0)
+            ++cnt[0];
+
+        /* give idle client a moment, then drop it, like termsend
+         * would after timeout
+         */
+
+        got = 0;
+        for (;;)
+        {
+            struct pollfd  cp;  /* client to wait for */
+            /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+            cp.fd = cfd;
+            cp.events = POLLIN;
+            if (poll(&cp, 1, 50) == 0)
+            {
+                ++cnt[1];
+                break;
+            }
+
+            r = recv(cfd, buf + got, sizeof(buf) - got, 0);
+            if (r <= 0)
+                break;
+
+            got += r;
+            if (got >= 9 && memcmp(buf + got - 9, "termsend\n", 9) == 0)
+            {
+                (void)send(cfd, BENCH_LINK, sizeof(BENCH_LINK) - 1, 0);
+                break;
+            }
+        }
+
+        close(cfd);
+    }
+
+    (void)write(pipefd, cnt, sizeof(cnt));
+    _exit(0);
+}
+
+
+/* ==========================================================================
+    Client side. Uploads paste 'BENCH_PASTES' times and measures time to
+    get link back, then opens 'BENCH_IDLE' connections that send
+    nothing.
+   ========================================================================== */
+
+
+static int bench_client
+(
+    enum bench_mode      mode,  /* how to connect */
+    struct sockaddr_in  *sa     /* server to connect to */
+)
+{
+    int                  i;     /* current paste */
+    int                  fds[BENCH_IDLE];  /* idle connections */
+    char                 buf[256];         /* received link */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (i = 0; i != BENCH_PASTES; ++i)
+    {
+        int      fd;     /* connection to server */
+        double   start;  /* time of connect */
+        ssize_t  r;      /* sent or received bytes */
+        /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+        if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+            return -1;
+
+        start = bench_now();
+
+        /* with fast open, paste is sent together with SYN */
+
+        if (mode == mode_fastopen)
+            r = sendto(fd, BENCH_PASTE, sizeof(BENCH_PASTE) - 1,
+                    MSG_FASTOPEN, (struct sockaddr *)sa, sizeof(*sa));
+        else if (connect(fd, (struct sockaddr *)sa, sizeof(*sa)) == 0)
+            r = send(fd, BENCH_PASTE, sizeof(BENCH_PASTE) - 1, 0);
+        else
+            r = -1;
+
+        if (r != sizeof(BENCH_PASTE) - 1)
+        {
+            perror("send()");
+            close(fd);
+            return -1;
+        }
+
+        while ((r = recv(fd, buf, sizeof(buf), 0)) > 0)
+            if (buf[r - 1] == '\n')
+                break;
+
+        lat[i] = bench_now() - start;
+        close(fd);
+    }
+
+    for (i = 0; i != BENCH_IDLE; ++i)
+    {
+        fds[i] = socket(AF_INET, SOCK_STREAM, 0);
+        connect(fds[i], (struct sockaddr *)sa, sizeof(*sa));
+    }
+
+    /* let server accept (or not) idle connections */
+
+    usleep(BENCH_IDLE * 60 * 1000);
+
+    for (i = 0; i != BENCH_IDLE; ++i)
+        close(fds[i]);
+
+    return 0;
+}
+
+
+/* ==========================================================================
+    Runs benchmark for 'mode' and prints results
+   ========================================================================== */
+
+
+static int bench_run
+(
+    enum bench_mode     mode     /* listener options */
+)
+{
+    struct sockaddr_in  sa;      /* server address */
+    int                 sfd;     /* listening socket */
+    int                 pfd[2];  /* counters from server */
+    int                 ctl[2];  /* tells server to finish */
+    unsigned long       cnt[2];  /* early wakeups and idle accepts */
+    double              sum;     /* sum of latencies */
+    pid_t               pid;     /* server process */
+    int                 i;       /* current latency */
+    int                 ret;     /* return code */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if ((sfd = bench_listen(mode, &sa)) < 0)
+    {
+        perror("bench_listen()");
+        return -1;
+    }
+
+    if (pipe(pfd) != 0 || pipe(ctl) != 0)
+    {
+        perror("pipe()");
+        return -1;
+    }
+
+    if ((pid = fork()) == 0)
+    {
+        close(pfd[0]);
+        close(ctl[1]);
+        bench_server(sfd, pfd[1], ctl[0]);
+    }
+
+    close(sfd);
+    close(pfd[1]);
+    close(ctl[0]);
+
+    ret = bench_client(mode, &sa);
+    close(ctl[1]);
+    memset(cnt, 0, sizeof(cnt));
+    (void)read(pfd[0], cnt, sizeof(cnt));
+    close(pfd[0]);
+    waitpid(pid, NULL, 0);
+
+    if (ret != 0)
+        return -1;
+
+    qsort(lat, BENCH_PASTES, sizeof(*lat), bench_comp);
+    for (sum = 0, i = 0; i != BENCH_PASTES; ++i)
+        sum += lat[i];
+
+    printf("%10s %12.1f %12.1f %12.1f %8lu %8lu\n", mode_name[mode],
+        sum / BENCH_PASTES * 1e6, lat[BENCH_PASTES / 2] * 1e6,
+        lat[BENCH_PASTES * 99 / 100] * 1e6, cnt[0], cnt[1]);
+
+    return 0;
+}
+
+
+/* ==========================================================================
+                                              _
+                           ____ ___   ____ _ (_)____
+                          / __ `__ \ / __ `// // __ \
+                         / / / / / // /_/ // // / / /
+                        /_/ /_/ /_/ \__,_//_//_/ /_/
+
+   ========================================================================== */
+
+
+int main(void)
+{
+    FILE  *f;     /* tcp_fastopen sysctl */
+    int    tfo;   /* value of tcp_fastopen sysctl */
+    int    m;     /* current mode */
+    int    ret;   /* program exit code */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    signal(SIGPIPE, SIG_IGN);
+
+    tfo = 0;
+    if ((f = fopen("/proc/sys/net/ipv4/tcp_fastopen", "r")) != NULL)
+    {
+        if (fscanf(f, "%d", &tfo) != 1)
+            tfo = 0;
+        fclose(f);
+    }
+
+    if ((tfo & 3) != 3)
+        printf("net.ipv4.tcp_fastopen is %d, fastopen falls back to "
+            "normal connect, set it to 3 to measure it\n", tfo);
+
+    printf("%d pastes, %d idle connections\n", BENCH_PASTES, BENCH_IDLE);
+    printf("%10s %12s %12s %12s %8s %8s\n", "listener", "avg [us]",
+        "p50 [us]", "p99 [us]", "early", "idle");
+
+    ret = 0;
+    for (m = 0; m != mode_max && ret == 0; ++m)
+        ret = bench_run(m);
+
+    return ret ? 1 : 0;
+}
@@ -0,0 +1 @@
+../src/cache.c
\ No newline at end of file
@@ -0,0 +1 @@
+../src/expire.c
\ No newline at end of file
@@ -0,0 +1 @@
+../src/http.c
\ No newline at end of file
@@ -0,0 +1 @@
+../src/limit.c
\ No newline at end of file
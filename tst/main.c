@@ -24,8 +24,17 @@ static void test_check_ssl_enosys(void)
 
 int main(void)
 {
+    autoban_test_group();
     bnwlist_test_group();
+    cache_test_group();
     config_test_group();
+    expire_test_group();
+    http_test_group();
+    limit_test_group();
+    proxy_test_group();
+    search_test_group();
+    segstore_test_group();
+    upidx_test_group();
 #if HAVE_SSL == 0
     mt_run(test_check_ssl_enosys);
 #endif
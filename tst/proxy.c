@@ -0,0 +1 @@
+../src/proxy.c
\ No newline at end of file
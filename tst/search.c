@@ -0,0 +1 @@
+../src/search.c
\ No newline at end of file
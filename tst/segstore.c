@@ -0,0 +1 @@
+../src/segstore.c
\ No newline at end of file
@@ -0,0 +1,333 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+
+/* ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "mtest.h"
+#include "autoban.h"
+#include "globals.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+
+/* ==========================================================================
+                                   _                __
+                     ____   _____ (_)_   __ ____ _ / /_ ___
+                    / __ \ / ___// /| | / // __ `// __// _ \
+                   / /_/ // /   / / | |/ // /_/ // /_ /  __/
+                  / .___//_/   /_/  |___/ \__,_/ \__/ \___/
+                 /_/
+                                   _         __     __
+              _   __ ____ _ _____ (_)____ _ / /_   / /___   _____
+             | | / // __ `// ___// // __ `// __ \ / // _ \ / ___/
+             | |/ // /_/ // /   / // /_/ // /_/ // //  __/(__  )
+             |___/ \__,_//_/   /_/ \__,_//_.___//_/ \___//____/
+
+   ========================================================================== */
+
+
+#define BANS "./autoban-test"
+
+mt_defs_ext();
+
+
+/* ==========================================================================
+                                   _                __
+                     ____   _____ (_)_   __ ____ _ / /_ ___
+                    / __ \ / ___// /| | / // __ `// __// _ \
+                   / /_/ // /   / / | |/ // /_/ // /_ /  __/
+                  / .___//_/   /_/  |___/ \__,_/ \__/ \___/
+                 /_/
+               ____                     __   _
+              / __/__  __ ____   _____ / /_ (_)____   ____   _____
+             / /_ / / / // __ \ / ___// __// // __ \ / __ \ / ___/
+            / __// /_/ // / / // /__ / /_ / // /_/ // / / /(__  )
+           /_/   \__,_//_/ /_/ \___/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+static struct sockaddr *addr(const char *ip)
+{
+    static struct sockaddr_in   sa;
+    static struct sockaddr_in6  sa6;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    if (strchr(ip, ':'))
+    {
+        memset(&sa6, 0, sizeof(sa6));
+        sa6.sin6_family = AF_INET6;
+        inet_pton(AF_INET6, ip, &sa6.sin6_addr);
+        return (struct sockaddr *)&sa6;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = inet_addr(ip);
+    return (struct sockaddr *)&sa;
+}
+
+
+static int offense(const char *ip, time_t now)
+{
+    return autoban_offense(addr(ip), now);
+}
+
+
+static int banned(const char *ip, time_t now)
+{
+    return autoban_is_banned(addr(ip), now);
+}
+
+
+static void test_prepare(void)
+{
+    memset(&g_stats, 0, sizeof(g_stats));
+    memset(&g_config, 0, sizeof(g_config));
+    g_config.autoban_time = 100;
+    unlink(BANS);
+}
+
+
+static void test_cleanup(void)
+{
+    autoban_destroy();
+    unlink(BANS);
+}
+
+
+/* ==========================================================================
+                           __               __
+                          / /_ ___   _____ / /_ _____
+                         / __// _ \ / ___// __// ___/
+                        / /_ /  __/(__  )/ /_ (__  )
+                        \__/ \___//____/ \__//____/
+
+   ========================================================================== */
+
+
+static void autoban_disabled(void)
+{
+    int  i;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_fok(autoban_init(0));
+    mt_fail(autoban_enabled() == 0);
+
+    for (i = 0; i != 100; ++i)
+        mt_fail(offense("10.0.0.1", 0) == 0);
+
+    mt_fail(banned("10.0.0.1", 0) == 0);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void autoban_after_threshold(void)
+{
+    g_config.autoban_threshold = 3;
+    mt_fok(autoban_init(0));
+
+    mt_fail(offense("10.0.0.1", 0) == 0);
+    mt_fail(offense("10.0.0.1", 0) == 0);
+    mt_fail(banned("10.0.0.1", 0) == 0);
+    mt_fail(offense("10.0.0.1", 0) == 1);
+
+    mt_fail(banned("10.0.0.1", 1) == 1);
+    mt_fail(banned("10.0.0.2", 1) == 0);
+    mt_fail(g_stats.autoban_bans == 1);
+    mt_fail(g_stats.autoban_active == 1);
+    mt_fail(g_stats.autoban_rejects == 1);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void autoban_score_leaks(void)
+{
+    g_config.autoban_threshold = 2;
+    mt_fok(autoban_init(0));
+
+    /* first point leaks away before second one comes */
+
+    mt_fail(offense("10.0.0.1", 0) == 0);
+    mt_fail(offense("10.0.0.1", AUTOBAN_DECAY) == 0);
+    mt_fail(banned("10.0.0.1", AUTOBAN_DECAY) == 0);
+
+    mt_fail(offense("10.0.0.1", AUTOBAN_DECAY) == 1);
+    mt_fail(banned("10.0.0.1", AUTOBAN_DECAY) == 1);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void autoban_ban_expires(void)
+{
+    g_config.autoban_threshold = 1;
+    mt_fok(autoban_init(0));
+
+    mt_fail(offense("10.0.0.1", 0) == 1);
+    mt_fail(banned("10.0.0.1", 99) == 1);
+    mt_fail(banned("10.0.0.1", 100) == 0);
+    mt_fail(g_stats.autoban_active == 0);
+
+    /* and it can be banned again */
+
+    mt_fail(offense("10.0.0.1", 100) == 1);
+    mt_fail(banned("10.0.0.1", 101) == 1);
+    mt_fail(g_stats.autoban_bans == 2);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void autoban_ipv6(void)
+{
+    g_config.autoban_threshold = 1;
+    mt_fok(autoban_init(0));
+
+    mt_fail(offense("2001:db8::1", 0) == 1);
+    mt_fail(banned("2001:db8::1", 1) == 1);
+    mt_fail(banned("2001:db8::2", 1) == 0);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void autoban_full_table(void)
+{
+    char  ip[32];
+    int   i;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    g_config.autoban_threshold = 2;
+    mt_fok(autoban_init(0));
+
+    for (i = 0; i != AUTOBAN_SLOTS / 4 * 3; ++i)
+    {
+        sprintf(ip, "10.%d.%d.1", i >> 8, i & 0xff);
+        offense(ip, 0);
+    }
+
+    /* no room, and nothing to forget yet */
+
+    mt_fail(offense("1.1.1.1", 0) == 0);
+    mt_fail(offense("1.1.1.1", 0) == 0);
+    mt_fail(banned("1.1.1.1", 0) == 0);
+
+    /* all points leaked away, so all of them can be forgotten */
+
+    mt_fail(offense("1.1.1.1", AUTOBAN_DECAY) == 0);
+    mt_fail(offense("1.1.1.1", AUTOBAN_DECAY) == 1);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void autoban_persistence(void)
+{
+    FILE  *f;
+    char   line[128];
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    g_config.autoban_threshold = 1;
+    strcpy(g_config.autoban_file, BANS);
+    mt_fok(autoban_init(0));
+    mt_fail(offense("10.0.0.1", 0) == 1);
+    mt_fail(offense("2001:db8::1", 10) == 1);
+    autoban_destroy();
+
+    f = fopen(BANS, "r");
+    mt_assert(f != NULL);
+    mt_fail(fgets(line, sizeof(line), f) != NULL);
+    mt_fail(fgets(line, sizeof(line), f) != NULL);
+    mt_fail(fgets(line, sizeof(line), f) == NULL);
+    fclose(f);
+
+    mt_fok(autoban_init(50));
+    mt_fail(g_stats.autoban_active == 2);
+    mt_fail(banned("10.0.0.1", 50) == 1);
+    mt_fail(banned("2001:db8::1", 50) == 1);
+    autoban_destroy();
+
+    /* ipv4 ban expired before restart */
+
+    mt_fok(autoban_init(105));
+    mt_fail(g_stats.autoban_active == 1);
+    mt_fail(banned("10.0.0.1", 105) == 0);
+    mt_fail(banned("2001:db8::1", 105) == 1);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void autoban_malformed_file(void)
+{
+    FILE  *f;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    f = fopen(BANS, "w");
+    fprintf(f, "garbage\n10.0.0.300 100\n\n10.0.0.2 100\n");
+    fclose(f);
+
+    g_config.autoban_threshold = 1;
+    strcpy(g_config.autoban_file, BANS);
+    mt_fok(autoban_init(0));
+    mt_fail(g_stats.autoban_active == 1);
+    mt_fail(banned("10.0.0.2", 0) == 1);
+}
+
+
+/* ==========================================================================
+             __               __
+            / /_ ___   _____ / /_   ____ _ _____ ____   __  __ ____
+           / __// _ \ / ___// __/  / __ `// ___// __ \ / / / // __ \
+          / /_ /  __/(__  )/ /_   / /_/ // /   / /_/ // /_/ // /_/ /
+          \__/ \___//____/ \__/   \__, //_/    \____/ \__,_// .___/
+                                 /____/                    /_/
+   ========================================================================== */
+
+
+void autoban_test_group()
+{
+    mt_prepare_test = &test_prepare;
+    mt_cleanup_test = &test_cleanup;
+
+    mt_run(autoban_disabled);
+    mt_run(autoban_after_threshold);
+    mt_run(autoban_score_leaks);
+    mt_run(autoban_ban_expires);
+    mt_run(autoban_ipv6);
+    mt_run(autoban_full_table);
+    mt_run(autoban_persistence);
+    mt_run(autoban_malformed_file);
+}
@@ -14,12 +14,21 @@
    ========================================================================== */
 
 
+#ifdef HAVE_CONFIG_H
+#   include "termsend.h"
+#endif
+
 #include "mtest.h"
 #include "bnwlist.h"
 
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
@@ -45,6 +54,10 @@
 
 #define IPTESTNUM 1000
 #define BNWFILE "/tmp/termsend-test-bnwlist"
+#define BNWIMAGE "/tmp/termsend-test-bnwlist.image"
+#define BNWLIST1 "/tmp/termsend-test-bnwlist.1"
+#define BNWLIST2 "/tmp/termsend-test-bnwlist.2"
+#define BNWLIST3 "/tmp/termsend-test-bnwlist.3"
 mt_defs_ext();
 
 static int bnwfd;
@@ -78,6 +91,10 @@ static void test_cleanup(void)
     close(bnwfd);
     bnw_destroy();
     unlink(BNWFILE);
+    unlink(BNWIMAGE);
+    unlink(BNWLIST1);
+    unlink(BNWLIST2);
+    unlink(BNWLIST3);
 }
 
 
@@ -91,6 +108,96 @@ static void add_ip
 }
 
 
+static int allowed6
+(
+    const char       *ip
+)
+{
+    struct in6_addr   a;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    inet_pton(AF_INET6, ip, &a);
+    return bnw_is_allowed6(&a);
+}
+
+
+static void write_list
+(
+    const char  *path,
+    const char  *entries
+)
+{
+    FILE        *f;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    f = fopen(path, "w");
+    fputs(entries, f);
+    fclose(f);
+}
+
+
+#if HAVE_LINUX_FILTER_H
+
+/* ==========================================================================
+    Creates listening socket on 127.0.0.1 with current list attached as
+    kernel filter, and checks if connection to it can be made.
+
+    returns
+            1       connection was made
+            0       connection didn't complete in 300ms
+           -1       error
+   ========================================================================== */
+
+
+static int filter_connects(void)
+{
+    struct sockaddr_in  sa;
+    socklen_t           salen;
+    struct pollfd       pfd;
+    int                 sfd;
+    int                 cfd;
+    int                 ret;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = inet_addr("127.0.0.1");
+    salen = sizeof(sa);
+    ret = -1;
+    cfd = -1;
+
+    if ((sfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        return -1;
+
+    if (bind(sfd, (struct sockaddr *)&sa, sizeof(sa)) != 0 ||
+        listen(sfd, 1) != 0 ||
+        getsockname(sfd, (struct sockaddr *)&sa, &salen) != 0 ||
+        bnw_filter_attach(sfd) != 0)
+        goto out;
+
+    if ((cfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        goto out;
+
+    fcntl(cfd, F_SETFL, O_NONBLOCK);
+    if (connect(cfd, (struct sockaddr *)&sa, sizeof(sa)) != 0 &&
+        errno != EINPROGRESS)
+        goto out;
+
+    pfd.fd = cfd;
+    pfd.events = POLLOUT;
+    ret = poll(&pfd, 1, 300);
+
+out:
+    if (cfd >= 0)
+        close(cfd);
+    close(sfd);
+    return ret;
+}
+
+#endif
+
+
 /* ==========================================================================
                            __               __
                           / /_ ___   _____ / /_ _____
@@ -507,6 +614,1012 @@ static void bnw_empty_lines_in_list(void)
 
 
 
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_no_newline_at_end(void)
+{
+    add_ip("10.1.1.1");
+    (void) write(bnwfd, "10.1.1.2", 8);
+
+    mt_fok(bnw_init(BNWFILE, 1));
+    mt_fail(bnw_is_allowed(inet_addr("10.1.1.1")) == 1);
+    mt_fail(bnw_is_allowed(inet_addr("10.1.1.2")) == 1);
+    mt_fail(bnw_is_allowed(inet_addr("10.1.1.3")) == 0);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_cidr_whitelist_is_allowed(void)
+{
+    add_ip("10.0.0.0/8");
+    add_ip("192.168.1.0/24");
+    add_ip("1.2.3.4/32");
+
+    mt_fok(bnw_init(BNWFILE, 1));
+    mt_fail(bnw_is_allowed(inet_addr("10.0.0.0")) == 1);
+    mt_fail(bnw_is_allowed(inet_addr("10.255.1.2")) == 1);
+    mt_fail(bnw_is_allowed(inet_addr("10.255.255.255")) == 1);
+    mt_fail(bnw_is_allowed(inet_addr("9.255.255.255")) == 0);
+    mt_fail(bnw_is_allowed(inet_addr("11.0.0.0")) == 0);
+    mt_fail(bnw_is_allowed(inet_addr("192.168.1.77")) == 1);
+    mt_fail(bnw_is_allowed(inet_addr("192.168.2.1")) == 0);
+    mt_fail(bnw_is_allowed(inet_addr("1.2.3.4")) == 1);
+    mt_fail(bnw_is_allowed(inet_addr("1.2.3.5")) == 0);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_cidr_longest_prefix_wins(void)
+{
+    add_ip("10.0.0.0/8");
+    add_ip("!10.1.0.0/16");
+    add_ip("10.1.2.0/24");
+    add_ip("!10.1.2.3");
+
+    mt_fok(bnw_init(BNWFILE, -1));
+    mt_fail(bnw_is_allowed(inet_addr("10.0.0.1")) == 0);
+    mt_fail(bnw_is_allowed(inet_addr("10.1.0.1")) == 1);
+    mt_fail(bnw_is_allowed(inet_addr("10.1.2.2")) == 0);
+    mt_fail(bnw_is_allowed(inet_addr("10.1.2.3")) == 1);
+    mt_fail(bnw_is_allowed(inet_addr("10.1.2.4")) == 0);
+    mt_fail(bnw_is_allowed(inet_addr("10.1.3.0")) == 1);
+    mt_fail(bnw_is_allowed(inet_addr("10.1.255.255")) == 1);
+    mt_fail(bnw_is_allowed(inet_addr("10.2.0.0")) == 0);
+    mt_fail(bnw_is_allowed(inet_addr("11.0.0.0")) == 1);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_cidr_whole_space(void)
+{
+    add_ip("!127.0.0.1");
+    add_ip("0.0.0.0/0");
+
+    mt_fok(bnw_init(BNWFILE, -1));
+    mt_fail(bnw_is_allowed(inet_addr("0.0.0.0")) == 0);
+    mt_fail(bnw_is_allowed(inet_addr("127.0.0.0")) == 0);
+    mt_fail(bnw_is_allowed(inet_addr("127.0.0.1")) == 1);
+    mt_fail(bnw_is_allowed(inet_addr("127.0.0.2")) == 0);
+    mt_fail(bnw_is_allowed(inet_addr("255.255.255.255")) == 0);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_cidr_exception_wins_same_prefix(void)
+{
+    add_ip("10.1.0.0/16");
+    add_ip("!10.1.0.0/16");
+
+    mt_fok(bnw_init(BNWFILE, 1));
+    mt_fail(bnw_is_allowed(inet_addr("10.1.0.1")) == 0);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_cidr_bad_entries(void)
+{
+    const char  *bad[] = { "10.0.0.1/8", "10.0.0.0/33", "10.0.0.0/",
+        "10.0.0.0/a", "10.0.0.0/-1", "10.0.0.0/8/8", "!", "10.0.0./24",
+        "!!10.0.0.0/8", "10.0.0.0/ 8" };
+    size_t       i;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (i = 0; i != sizeof(bad) / sizeof(*bad); ++i)
+    {
+        (void) ftruncate(bnwfd, 0);
+        lseek(bnwfd, 0, SEEK_SET);
+        add_ip("10.1.1.1");
+        add_ip(bad[i]);
+        mt_ferr(bnw_init(BNWFILE, 1), EFAULT);
+    }
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_cidr_random_test(void)
+{
+#define NUMPREFIXES 300
+    uint32_t        lo[NUMPREFIXES];
+    uint32_t        mask[NUMPREFIXES];
+    int             plen[NUMPREFIXES];
+    int             except[NUMPREFIXES];
+    uint32_t        ip;
+    int             i;
+    int             j;
+    int             best;
+    int             listed;
+    char            sip[32];
+    char            entry[40];
+    struct in_addr  a;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    /* keep prefixes inside 10.0.0.0/12 so they overlap a lot */
+
+    for (i = 0; i != NUMPREFIXES; ++i)
+    {
+        plen[i] = 12 + rand() % 21;
+        mask[i] = 0xffffffffu << (32 - plen[i]);
+        lo[i] = (0x0a000000u | (rand() & 0x000fffff)) & mask[i];
+        except[i] = rand() % 3 == 0;
+
+        a.s_addr = htonl(lo[i]);
+        inet_ntop(AF_INET, &a, sip, sizeof(sip));
+        sprintf(entry, "%s%s/%d", except[i] ? "!" : "", sip, plen[i]);
+        add_ip(entry);
+    }
+
+    mt_fok(bnw_init(BNWFILE, 1));
+
+    for (i = 0; i != 100000; ++i)
+    {
+        /* half of checks right at prefix boundaries, where
+         * mistakes are most likely
+         */
+
+        j = rand() % NUMPREFIXES;
+        switch (rand() % 4)
+        {
+        case 0: ip = lo[j] - 1; break;
+        case 1: ip = lo[j] | ~mask[j]; break;
+        case 2: ip = (lo[j] | ~mask[j]) + 1; break;
+        default: ip = 0x0a000000u | (rand() & 0x000fffff); break;
+        }
+
+        best = -1;
+        for (j = 0; j != NUMPREFIXES; ++j)
+        {
+            if ((ip & mask[j]) != lo[j])
+                continue;
+
+            if (best == -1 || plen[j] > plen[best] ||
+                    (plen[j] == plen[best] && except[j]))
+                best = j;
+        }
+
+        listed = best != -1 && except[best] == 0;
+        mt_fail(bnw_is_allowed(htonl(ip)) == listed);
+    }
+}
+
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_all_tree_sizes(void)
+{
+    char       entry[40];
+    int        n;
+    int        i;
+    in_addr_t  ip;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    /* every other address is listed, so ranges are not merged,
+     * and list has exactly n ranges
+     */
+
+    for (n = 1; n != 70; ++n)
+    {
+        (void) ftruncate(bnwfd, 0);
+        lseek(bnwfd, 0, SEEK_SET);
+
+        for (i = 0; i != n; ++i)
+        {
+            sprintf(entry, "10.0.0.%d", 2 * i + 1);
+            add_ip(entry);
+        }
+
+        mt_fok(bnw_init(BNWFILE, 1));
+
+        for (i = 0; i != 2 * n + 2; ++i)
+        {
+            ip = htonl(0x0a000000u + i);
+            mt_fail(bnw_is_allowed(ip) == (i % 2 == 1 && i < 2 * n + 1));
+        }
+
+        bnw_destroy();
+    }
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_batch_matches_single(void)
+{
+    in_addr_t  ips[1000];
+    int        allowed[1000];
+    char       entry[40];
+    int        m;
+    int        i;
+    int        n;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (i = 0; i != 777; ++i)
+    {
+        sprintf(entry, "10.%d.%d.0/24", i / 256, i % 256);
+        add_ip(entry);
+    }
+
+    for (m = -1; m <= 1; ++m)
+    {
+        mt_fok(bnw_init(BNWFILE, m));
+
+        /* odd sizes to check batches that are not full */
+
+        for (n = 0; n != 20; ++n)
+        {
+            for (i = 0; i != n * 37 % 1000; ++i)
+                ips[i] = htonl(0x0a000000u | (rand() & 0x0003ffff));
+
+            bnw_is_allowed_batch(ips, allowed, n * 37 % 1000);
+
+            for (i = 0; i != n * 37 % 1000; ++i)
+                mt_fail(allowed[i] == bnw_is_allowed(ips[i]));
+        }
+
+        bnw_destroy();
+    }
+}
+
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_image_same_answers(void)
+{
+    static in_addr_t  ips[10000];
+    static int        text[10000];
+    int               allowed[10000];
+    char              entry[40];
+    int               i;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (i = 0; i != 1000; ++i)
+    {
+        /* /24 networks with single ips in and out of them */
+
+        sprintf(entry, "%s10.%d.%d.%d/%d", i % 7 ? "" : "!",
+            rand() % 4, rand() % 256, i % 2 ? 0 : rand() % 256,
+            i % 2 ? 24 : 32);
+        add_ip(entry);
+    }
+
+    mt_fok(bnw_init(BNWFILE, 1));
+
+    for (i = 0; i != 10000; ++i)
+    {
+        ips[i] = htonl(0x0a000000u | (rand() & 0x0003ffff));
+        text[i] = bnw_is_allowed(ips[i]);
+    }
+
+    mt_fok(bnw_write_image(BNWIMAGE));
+    bnw_destroy();
+
+    mt_fok(bnw_init(BNWIMAGE, 1));
+    bnw_is_allowed_batch(ips, allowed, 10000);
+
+    for (i = 0; i != 10000; ++i)
+    {
+        mt_fail(bnw_is_allowed(ips[i]) == text[i]);
+        mt_fail(allowed[i] == text[i]);
+    }
+
+    /* image can be compiled from image */
+
+    mt_fok(bnw_write_image(BNWIMAGE));
+    bnw_destroy();
+    mt_fok(bnw_init(BNWIMAGE, -1));
+
+    for (i = 0; i != 10000; ++i)
+        mt_fail(bnw_is_allowed(ips[i]) == !text[i]);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_image_empty_list(void)
+{
+    mt_fok(bnw_init(BNWFILE, 1));
+    mt_fok(bnw_write_image(BNWIMAGE));
+    bnw_destroy();
+
+    mt_fok(bnw_init(BNWIMAGE, 1));
+    mt_fail(bnw_is_allowed(inet_addr("10.1.1.1")) == 0);
+    mt_fail(bnw_is_allowed(inet_addr("0.0.0.0")) == 0);
+    bnw_destroy();
+
+    mt_fok(bnw_init(BNWIMAGE, -1));
+    mt_fail(bnw_is_allowed(inet_addr("10.1.1.1")) == 1);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_image_broken(void)
+{
+    unsigned char  buf[1024];
+    ssize_t        len;
+    int            fd;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    add_ip("10.1.1.0/24");
+    add_ip("10.1.3.0/24");
+    mt_fok(bnw_init(BNWFILE, 1));
+    mt_fok(bnw_write_image(BNWIMAGE));
+    bnw_destroy();
+
+    fd = open(BNWIMAGE, O_RDONLY);
+    len = read(fd, buf, sizeof(buf));
+    close(fd);
+    mt_assert(len > 64);
+
+    /* flipped bit in data */
+
+    buf[64 + 4] ^= 1;
+    fd = open(BNWIMAGE, O_WRONLY | O_TRUNC);
+    (void) write(fd, buf, len);
+    close(fd);
+    mt_ferr(bnw_init(BNWIMAGE, 1), EFAULT);
+    buf[64 + 4] ^= 1;
+
+    /* truncated image */
+
+    fd = open(BNWIMAGE, O_WRONLY | O_TRUNC);
+    (void) write(fd, buf, len - 1);
+    close(fd);
+    mt_ferr(bnw_init(BNWIMAGE, 1), EINVAL);
+
+    /* unknown version */
+
+    buf[8] += 1;
+    fd = open(BNWIMAGE, O_WRONLY | O_TRUNC);
+    (void) write(fd, buf, len);
+    close(fd);
+    mt_ferr(bnw_init(BNWIMAGE, 1), EINVAL);
+    buf[8] -= 1;
+
+    /* and fixed one loads fine */
+
+    fd = open(BNWIMAGE, O_WRONLY | O_TRUNC);
+    (void) write(fd, buf, len);
+    close(fd);
+    mt_fok(bnw_init(BNWIMAGE, 1));
+    mt_fail(bnw_is_allowed(inet_addr("10.1.1.7")) == 1);
+    mt_fail(bnw_is_allowed(inet_addr("10.1.2.7")) == 0);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_reload_picks_up_changes(void)
+{
+    add_ip("10.1.1.1");
+    mt_fok(bnw_init(BNWFILE, 1));
+    mt_fail(bnw_is_allowed(inet_addr("10.1.1.1")) == 1);
+    mt_fail(bnw_is_allowed(inet_addr("10.2.2.2")) == 0);
+
+    (void) ftruncate(bnwfd, 0);
+    (void) lseek(bnwfd, 0, SEEK_SET);
+    add_ip("10.2.2.0/24");
+    mt_fok(bnw_reload());
+    mt_fail(bnw_is_allowed(inet_addr("10.1.1.1")) == 0);
+    mt_fail(bnw_is_allowed(inet_addr("10.2.2.2")) == 1);
+
+    /* image works too, and previous list gets freed */
+
+    mt_fok(bnw_write_image(BNWIMAGE));
+    mt_fok(bnw_init(BNWIMAGE, 1));
+    add_ip("10.3.3.3");
+    mt_fok(rename(BNWFILE, BNWIMAGE));
+    mt_fok(bnw_reload());
+    mt_fail(bnw_is_allowed(inet_addr("10.2.2.2")) == 1);
+    mt_fail(bnw_is_allowed(inet_addr("10.3.3.3")) == 1);
+    mt_fail(bnw_is_allowed(inet_addr("10.1.1.1")) == 0);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_reload_keeps_old_list(void)
+{
+    add_ip("10.1.1.1");
+    mt_fok(bnw_init(BNWFILE, -1));
+
+    add_ip("10.1.1");
+    mt_ferr(bnw_reload(), EFAULT);
+    mt_fail(bnw_is_allowed(inet_addr("10.1.1.1")) == 0);
+    mt_fail(bnw_is_allowed(inet_addr("10.2.2.2")) == 1);
+
+    /* list disappeared, it is not taken as turned off filter */
+
+    unlink(BNWFILE);
+    mt_ferr(bnw_reload(), ENOENT);
+    mt_fail(bnw_is_allowed(inet_addr("10.1.1.1")) == 0);
+    mt_fail(bnw_is_allowed(inet_addr("10.2.2.2")) == 1);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_reload_relative_path(void)
+{
+    mt_fok(bnw_init("./termsend-test-bnwlist", 1));
+    mt_ferr(bnw_reload(), EINVAL);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_reload_no_filter(void)
+{
+    mt_fok(bnw_init(NULL, 0));
+    mt_fok(bnw_reload());
+    mt_fail(bnw_is_allowed(inet_addr("10.1.1.1")) == 1);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_lists_deny_inside_allow(void)
+{
+    write_list(BNWLIST1, "10.1.1.5\n10.1.2.0/24\n");
+    write_list(BNWLIST2, "10.1.0.0/16\n");
+    mt_fok(bnw_init_lists("deny:" BNWLIST1 ",allow:" BNWLIST2));
+
+    mt_fail(bnw_is_allowed(inet_addr("10.1.1.5")) == 0);
+    mt_fail(bnw_is_allowed(inet_addr("10.1.1.4")) == 1);
+    mt_fail(bnw_is_allowed(inet_addr("10.1.1.6")) == 1);
+    mt_fail(bnw_is_allowed(inet_addr("10.1.2.0")) == 0);
+    mt_fail(bnw_is_allowed(inet_addr("10.1.2.255")) == 0);
+    mt_fail(bnw_is_allowed(inet_addr("10.1.3.0")) == 1);
+    mt_fail(bnw_is_allowed(inet_addr("10.1.255.255")) == 1);
+
+    /* there is allow list, so everything else is denied */
+
+    mt_fail(bnw_is_allowed(inet_addr("10.0.255.255")) == 0);
+    mt_fail(bnw_is_allowed(inet_addr("10.2.0.0")) == 0);
+    mt_fail(bnw_is_allowed(inet_addr("0.0.0.0")) == 0);
+    mt_fail(bnw_is_allowed(inet_addr("255.255.255.255")) == 0);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_lists_precedence(void)
+{
+    write_list(BNWLIST1, "10.1.1.5\n");
+    write_list(BNWLIST2, "10.1.0.0/16\n");
+
+    /* same lists as above, but this time allow list goes first */
+
+    mt_fok(bnw_init_lists("allow:" BNWLIST1 ",deny:" BNWLIST2));
+    mt_fail(bnw_is_allowed(inet_addr("10.1.1.5")) == 1);
+    mt_fail(bnw_is_allowed(inet_addr("10.1.1.6")) == 0);
+    mt_fail(bnw_is_allowed(inet_addr("10.2.0.0")) == 0);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_lists_only_deny(void)
+{
+    write_list(BNWLIST1, "10.1.1.5\n");
+    write_list(BNWLIST2, "10.2.0.0/16\n255.255.255.255\n");
+    mt_fok(bnw_init_lists("deny:" BNWLIST1 ",deny:" BNWLIST2));
+
+    mt_fail(bnw_is_allowed(inet_addr("10.1.1.5")) == 0);
+    mt_fail(bnw_is_allowed(inet_addr("10.2.3.4")) == 0);
+    mt_fail(bnw_is_allowed(inet_addr("255.255.255.255")) == 0);
+    mt_fail(bnw_is_allowed(inet_addr("10.1.1.6")) == 1);
+    mt_fail(bnw_is_allowed(inet_addr("0.0.0.0")) == 1);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_lists_random_test(void)
+{
+#define LISTPREFIXES 100
+    const char     *path[3] = { BNWLIST1, BNWLIST2, BNWLIST3 };
+    const int       allow[3] = { 0, 1, 0 };
+    uint32_t        lo[3][LISTPREFIXES];
+    uint32_t        mask[3][LISTPREFIXES];
+    uint32_t        ip;
+    int             plen;
+    int             i;
+    int             j;
+    int             k;
+    int             expected;
+    char            sip[32];
+    FILE           *f;
+    struct in_addr  a;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (k = 0; k != 3; ++k)
+    {
+        f = fopen(path[k], "w");
+        mt_assert(f != NULL);
+
+        for (i = 0; i != LISTPREFIXES; ++i)
+        {
+            plen = 12 + rand() % 21;
+            mask[k][i] = 0xffffffffu << (32 - plen);
+            lo[k][i] = (0x0a000000u | (rand() & 0x000fffff)) & mask[k][i];
+
+            a.s_addr = htonl(lo[k][i]);
+            inet_ntop(AF_INET, &a, sip, sizeof(sip));
+            fprintf(f, "%s/%d\n", sip, plen);
+        }
+
+        fclose(f);
+    }
+
+    mt_fok(bnw_init_lists("deny:" BNWLIST1 ",allow:" BNWLIST2
+        ",deny:" BNWLIST3));
+
+    for (i = 0; i != 100000; ++i)
+    {
+        k = rand() % 3;
+        j = rand() % LISTPREFIXES;
+        switch (rand() % 4)
+        {
+        case 0: ip = lo[k][j] - 1; break;
+        case 1: ip = lo[k][j] | ~mask[k][j]; break;
+        case 2: ip = (lo[k][j] | ~mask[k][j]) + 1; break;
+        default: ip = 0x0a000000u | (rand() & 0x000fffff); break;
+        }
+
+        /* first list that has ip decides, deny by default */
+
+        expected = 0;
+        for (k = 0; k != 3; ++k)
+        {
+            for (j = 0; j != LISTPREFIXES; ++j)
+                if ((ip & mask[k][j]) == lo[k][j])
+                    break;
+
+            if (j != LISTPREFIXES)
+            {
+                expected = allow[k];
+                break;
+            }
+        }
+
+        mt_fail(bnw_is_allowed(htonl(ip)) == expected);
+    }
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_lists_bad_spec(void)
+{
+    write_list(BNWLIST1, "10.1.1.5\n");
+
+    mt_ferr(bnw_init_lists(NULL), EINVAL);
+    mt_ferr(bnw_init_lists(""), EINVAL);
+    mt_ferr(bnw_init_lists(","), EINVAL);
+    mt_ferr(bnw_init_lists("block:" BNWLIST1), EINVAL);
+    mt_ferr(bnw_init_lists("allow:termsend-test-bnwlist.1"), EINVAL);
+    mt_ferr(bnw_init_lists("allow:" BNWLIST1 ",deny:" BNWLIST2), ENOENT);
+
+    /* images are already in tree order, they cannot be combined */
+
+    mt_fok(bnw_init(BNWLIST1, 1));
+    mt_fok(bnw_write_image(BNWIMAGE));
+    mt_ferr(bnw_init_lists("allow:" BNWIMAGE), EINVAL);
+
+    write_list(BNWLIST2, "10.1.1\n");
+    mt_ferr(bnw_init_lists("allow:" BNWLIST1 ",deny:" BNWLIST2), EFAULT);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_lists_reload(void)
+{
+    write_list(BNWLIST1, "10.1.1.5\n");
+    write_list(BNWLIST2, "10.1.0.0/16\n");
+    mt_fok(bnw_init_lists("deny:" BNWLIST1 ",allow:" BNWLIST2));
+    mt_fail(bnw_is_allowed(inet_addr("10.1.1.5")) == 0);
+    mt_fail(bnw_is_allowed(inet_addr("10.1.1.6")) == 1);
+
+    write_list(BNWLIST1, "10.1.1.6\n");
+    mt_fok(bnw_reload());
+    mt_fail(bnw_is_allowed(inet_addr("10.1.1.5")) == 1);
+    mt_fail(bnw_is_allowed(inet_addr("10.1.1.6")) == 0);
+
+    unlink(BNWLIST2);
+    mt_ferr(bnw_reload(), ENOENT);
+    mt_fail(bnw_is_allowed(inet_addr("10.1.1.5")) == 1);
+    mt_fail(bnw_is_allowed(inet_addr("10.1.1.6")) == 0);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+struct reader_arg
+{
+    int            stop;     /* set when reader should finish */
+    unsigned long  lookups;  /* lookups done by reader */
+    int            bad;      /* wrong answers reader got */
+};
+
+
+static void *reader_thread
+(
+    void               *arg
+)
+{
+    struct reader_arg  *r = arg;
+    int                 id;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    if ((id = bnw_reader_add()) == -1)
+    {
+        r->bad = 1;
+        return NULL;
+    }
+
+    while (!__atomic_load_n(&r->stop, __ATOMIC_ACQUIRE))
+    {
+        /* both addresses are on every version of the list */
+
+        r->bad += bnw_is_allowed(inet_addr("10.9.9.9")) != 0;
+        r->bad += bnw_is_allowed(inet_addr("10.8.8.8")) != 1;
+        __atomic_add_fetch(&r->lookups, 1, __ATOMIC_RELAXED);
+        bnw_quiescent(id);
+    }
+
+    return NULL;
+}
+
+
+static void bnw_reload_concurrent_lookups(void)
+{
+    struct reader_arg  r;
+    pthread_t          t;
+    FILE              *f;
+    int                v;
+    int                i;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    write_list(BNWLIST1, "10.9.9.9\n");
+    mt_fok(bnw_init(BNWLIST1, -1));
+
+    memset(&r, 0, sizeof(r));
+    mt_assert(pthread_create(&t, NULL, reader_thread, &r) == 0);
+    while (__atomic_load_n(&r.lookups, __ATOMIC_RELAXED) == 0)
+        usleep(1000);
+
+    /* every reload replaces list that reader may be walking
+     * right now, it must not be freed under its feet
+     */
+
+    for (v = 0; v != 200; ++v)
+    {
+        f = fopen(BNWLIST1, "w");
+        fputs("10.9.9.9\n", f);
+        for (i = 0; i != 2000; ++i)
+            fprintf(f, "11.%d.%d.0/24\n", (i + v) / 256, (i + v) % 256);
+
+        fclose(f);
+        mt_fok(bnw_reload());
+    }
+
+    __atomic_store_n(&r.stop, 1, __ATOMIC_RELEASE);
+    pthread_join(t, NULL);
+
+    mt_fail(r.bad == 0);
+    mt_fail(r.lookups > 0);
+    mt_fail(bnw_is_allowed(inet_addr("11.0.199.1")) == 0);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_ipv6_whitelist_is_allowed(void)
+{
+    add_ip("2001:db8::1");
+    add_ip("2001:db8:1::/48");
+    add_ip("10.0.0.1");
+
+    mt_fok(bnw_init(BNWFILE, 1));
+    mt_fail(allowed6("2001:db8::1") == 1);
+    mt_fail(allowed6("2001:db8::2") == 0);
+    mt_fail(allowed6("2001:db8::") == 0);
+    mt_fail(allowed6("2001:db8:1::") == 1);
+    mt_fail(allowed6("2001:db8:1:ffff:ffff:ffff:ffff:ffff") == 1);
+    mt_fail(allowed6("2001:db8:2::") == 0);
+    mt_fail(allowed6("2001:db8:0:ffff:ffff:ffff:ffff:ffff") == 0);
+    mt_fail(allowed6("::ffff:10.0.0.1") == 0);
+
+    /* ipv4 and ipv6 entries do not mix */
+
+    mt_fail(bnw_is_allowed(inet_addr("10.0.0.1")) == 1);
+    mt_fail(bnw_is_allowed(inet_addr("10.0.0.2")) == 0);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_ipv6_longest_prefix_wins(void)
+{
+    add_ip("::/0");
+    add_ip("!2001:db8::/32");
+    add_ip("2001:db8:0:1::/64");
+    add_ip("!2001:db8:0:1::1");
+
+    mt_fok(bnw_init(BNWFILE, -1));
+    mt_fail(allowed6("::") == 0);
+    mt_fail(allowed6("ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff") == 0);
+    mt_fail(allowed6("2001:db8::") == 1);
+    mt_fail(allowed6("2001:db8:ffff::1") == 1);
+    mt_fail(allowed6("2001:db8:0:1::") == 0);
+    mt_fail(allowed6("2001:db8:0:1::1") == 1);
+    mt_fail(allowed6("2001:db8:0:1::2") == 0);
+    mt_fail(allowed6("2001:db8:0:2::") == 1);
+    mt_fail(allowed6("2001:db9::") == 0);
+
+    /* there is no ipv4 entry, so all of them are allowed */
+
+    mt_fail(bnw_is_allowed(inet_addr("10.0.0.1")) == 1);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_ipv6_bad_entries(void)
+{
+    const char  *bad[] = { "2001:db8::1/64", "2001:db8::/129",
+        "2001:db8::/", "2001:db8:::1", "2001:db8::g", "!!2001:db8::",
+        "2001:db8::/a", "2001:db8::/32/32", "1:2:3:4:5:6:7:8:9" };
+    size_t       i;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (i = 0; i != sizeof(bad) / sizeof(*bad); ++i)
+    {
+        (void) ftruncate(bnwfd, 0);
+        lseek(bnwfd, 0, SEEK_SET);
+        add_ip("2001:db8::1");
+        add_ip(bad[i]);
+        mt_ferr(bnw_init(BNWFILE, 1), EFAULT);
+    }
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_ipv6_image_same_answers(void)
+{
+    static struct in6_addr  ips[2000];
+    static int              text[2000];
+    char                    entry[64];
+    int                     i;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (i = 0; i != 200; ++i)
+    {
+        sprintf(entry, "%s2001:db8:%x:%x::%s", i % 7 ? "" : "!",
+            rand() % 4, rand() % 16, i % 2 ? "/64" : "1");
+        add_ip(entry);
+    }
+
+    add_ip("10.0.0.0/8");
+    mt_fok(bnw_init(BNWFILE, 1));
+
+    for (i = 0; i != 2000; ++i)
+    {
+        memset(&ips[i], 0, sizeof(ips[i]));
+        ips[i].s6_addr[0] = 0x20;
+        ips[i].s6_addr[1] = 0x01;
+        ips[i].s6_addr[2] = 0x0d;
+        ips[i].s6_addr[3] = 0xb8;
+        ips[i].s6_addr[5] = rand() % 4;
+        ips[i].s6_addr[7] = rand() % 16;
+        ips[i].s6_addr[15] = rand() % 2;
+        text[i] = bnw_is_allowed6(&ips[i]);
+    }
+
+    mt_fok(bnw_write_image(BNWIMAGE));
+    bnw_destroy();
+    mt_fok(bnw_init(BNWIMAGE, 1));
+
+    for (i = 0; i != 2000; ++i)
+        mt_fail(bnw_is_allowed6(&ips[i]) == text[i]);
+
+    mt_fail(bnw_is_allowed(inet_addr("10.1.2.3")) == 1);
+    mt_fail(bnw_is_allowed(inet_addr("11.1.2.3")) == 0);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_ipv6_lists(void)
+{
+    write_list(BNWLIST1, "2001:db8:1::5\n10.1.1.5\n");
+    write_list(BNWLIST2, "2001:db8::/32\n10.1.0.0/16\n");
+    mt_fok(bnw_init_lists("deny:" BNWLIST1 ",allow:" BNWLIST2));
+
+    mt_fail(allowed6("2001:db8:1::5") == 0);
+    mt_fail(allowed6("2001:db8:1::4") == 1);
+    mt_fail(allowed6("2001:db8:1::6") == 1);
+    mt_fail(allowed6("2001:db8::") == 1);
+    mt_fail(allowed6("2001:db8:ffff:ffff:ffff:ffff:ffff:ffff") == 1);
+    mt_fail(allowed6("2001:db9::") == 0);
+    mt_fail(allowed6("::") == 0);
+    mt_fail(bnw_is_allowed(inet_addr("10.1.1.5")) == 0);
+    mt_fail(bnw_is_allowed(inet_addr("10.1.1.6")) == 1);
+}
+
+
+#if HAVE_LINUX_FILTER_H
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_filter_blacklisted(void)
+{
+    add_ip("10.0.0.0/8");
+    add_ip("127.0.0.1");
+    mt_fok(bnw_init(BNWFILE, -1));
+    mt_fail(filter_connects() == 0);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_filter_not_blacklisted(void)
+{
+    add_ip("10.0.0.0/8");
+    add_ip("127.0.0.2");
+    mt_fok(bnw_init(BNWFILE, -1));
+    mt_fail(filter_connects() == 1);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_filter_whitelisted(void)
+{
+    add_ip("127.0.0.0/8");
+    mt_fok(bnw_init(BNWFILE, 1));
+    mt_fail(filter_connects() == 1);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_filter_not_whitelisted(void)
+{
+    add_ip("10.0.0.1");
+    mt_fok(bnw_init(BNWFILE, 1));
+    mt_fail(filter_connects() == 0);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_filter_too_big(void)
+{
+    char  entry[32];
+    int   sfd;
+    int   i;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (i = 0; i != 2000; ++i)
+    {
+        sprintf(entry, "10.%d.%d.1", i / 200, i % 200);
+        add_ip(entry);
+    }
+
+    mt_fok(bnw_init(BNWFILE, -1));
+    sfd = socket(AF_INET, SOCK_STREAM, 0);
+    mt_ferr(bnw_filter_attach(sfd), E2BIG);
+    close(sfd);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void bnw_filter_no_list(void)
+{
+    int   sfd;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    mt_fok(bnw_init(NULL, 0));
+    sfd = socket(AF_INET, SOCK_STREAM, 0);
+    mt_ferr(bnw_filter_attach(sfd), ENOENT);
+    close(sfd);
+}
+
+#endif
+
+
+
 /* ==========================================================================
              __               __
             / /_ ___   _____ / /_   ____ _ _____ ____   __  __ ____
@@ -542,4 +1655,40 @@ void bnwlist_test_group()
     mt_run(bnw_non_existing_list);
     mt_run(bnw_no_read_access);
     mt_run(bnw_empty_lines_in_list);
+    mt_run(bnw_no_newline_at_end);
+    mt_run(bnw_cidr_whitelist_is_allowed);
+    mt_run(bnw_cidr_longest_prefix_wins);
+    mt_run(bnw_cidr_whole_space);
+    mt_run(bnw_cidr_exception_wins_same_prefix);
+    mt_run(bnw_cidr_bad_entries);
+    mt_run(bnw_cidr_random_test);
+    mt_run(bnw_all_tree_sizes);
+    mt_run(bnw_batch_matches_single);
+    mt_run(bnw_image_same_answers);
+    mt_run(bnw_image_empty_list);
+    mt_run(bnw_image_broken);
+    mt_run(bnw_reload_picks_up_changes);
+    mt_run(bnw_reload_keeps_old_list);
+    mt_run(bnw_reload_relative_path);
+    mt_run(bnw_reload_no_filter);
+    mt_run(bnw_lists_deny_inside_allow);
+    mt_run(bnw_lists_precedence);
+    mt_run(bnw_lists_only_deny);
+    mt_run(bnw_lists_random_test);
+    mt_run(bnw_lists_bad_spec);
+    mt_run(bnw_lists_reload);
+    mt_run(bnw_reload_concurrent_lookups);
+    mt_run(bnw_ipv6_whitelist_is_allowed);
+    mt_run(bnw_ipv6_longest_prefix_wins);
+    mt_run(bnw_ipv6_bad_entries);
+    mt_run(bnw_ipv6_image_same_answers);
+    mt_run(bnw_ipv6_lists);
+#if HAVE_LINUX_FILTER_H
+    mt_run(bnw_filter_blacklisted);
+    mt_run(bnw_filter_not_blacklisted);
+    mt_run(bnw_filter_whitelisted);
+    mt_run(bnw_filter_not_whitelisted);
+    mt_run(bnw_filter_too_big);
+    mt_run(bnw_filter_no_list);
+#endif
 }
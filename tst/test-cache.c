@@ -0,0 +1,358 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+
+/* ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "mtest.h"
+#include "cache.h"
+#include "globals.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* ==========================================================================
+                                   _                __
+                     ____   _____ (_)_   __ ____ _ / /_ ___
+                    / __ \ / ___// /| | / // __ `// __// _ \
+                   / /_/ // /   / / | |/ // /_/ // /_ /  __/
+                  / .___//_/   /_/  |___/ \__,_/ \__/ \___/
+                 /_/
+                                   _         __     __
+              _   __ ____ _ _____ (_)____ _ / /_   / /___   _____
+             | | / // __ `// ___// // __ `// __ \ / // _ \ / ___/
+             | |/ // /_/ // /   / // /_/ // /_/ // //  __/(__  )
+             |___/ \__,_//_/   /_/ \__,_//_.___//_/ \___//____/
+
+   ========================================================================== */
+
+
+mt_defs_ext();
+
+
+/* ==========================================================================
+                                   _                __
+                     ____   _____ (_)_   __ ____ _ / /_ ___
+                    / __ \ / ___// /| | / // __ `// __// _ \
+                   / /_/ // /   / / | |/ // /_/ // /_ /  __/
+                  / .___//_/   /_/  |___/ \__,_/ \__/ \___/
+                 /_/
+               ____                     __   _
+              / __/__  __ ____   _____ / /_ (_)____   ____   _____
+             / /_ / / / // __ \ / ___// __// // __ \ / __ \ / ___/
+            / __// /_/ // / / // /__ / /_ / // /_/ // / / /(__  )
+           /_/   \__,_//_/ /_/ \___/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+static void test_prepare(void)
+{
+    memset(&g_stats, 0, sizeof(g_stats));
+
+    /* 8 entries of 800 bytes fit into cache */
+
+    cache_init(800 * 8);
+}
+
+
+static void test_cleanup(void)
+{
+    cache_destroy();
+}
+
+
+static int put
+(
+    const char     *name,
+    size_t          len
+)
+{
+    unsigned char  *data;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    data = malloc(len);
+    memset(data, name[0], len);
+    return cache_put(name, data, len, 1337);
+}
+
+
+static int is_cached
+(
+    const char          *name
+)
+{
+    struct cache_entry  *e;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    if ((e = cache_get(name)) == NULL)
+        return 0;
+
+    /* lookup sets reference bit, clear it so checking does not
+     * change outcome of next eviction
+     */
+
+    e->ref = 0;
+    cache_release(e);
+    return 1;
+}
+
+
+/* ==========================================================================
+                           __               __
+                          / /_ ___   _____ / /_ _____
+                         / __// _ \ / ___// __// ___/
+                        / /_ /  __/(__  )/ /_ (__  )
+                        \__/ \___//____/ \__//____/
+
+   ========================================================================== */
+
+
+static void cache_put_and_get(void)
+{
+    struct cache_entry  *e;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_fok(put("abc", 100));
+    e = cache_get("abc");
+    mt_assert(e != NULL);
+    mt_fail(e->len == 100);
+    mt_fail(e->mtime == 1337);
+    mt_fail(e->data[0] == 'a' && e->data[99] == 'a');
+    cache_release(e);
+    mt_fail(g_stats.cache_hits == 1);
+    mt_fail(g_stats.cache_entries == 1);
+    mt_fail(g_stats.cache_bytes == 100);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void cache_miss(void)
+{
+    mt_fok(put("abc", 100));
+    mt_fail(cache_get("abd") == NULL);
+    mt_fail(g_stats.cache_misses == 1);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void cache_too_big_entry(void)
+{
+    mt_ferr(put("abc", 801), EINVAL);
+    mt_fail(is_cached("abc") == 0);
+    mt_fok(put("abd", 800));
+    mt_fail(is_cached("abd") == 1);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void cache_empty_entry(void)
+{
+    mt_ferr(put("abc", 0), EINVAL);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void cache_disabled(void)
+{
+    cache_destroy();
+    cache_init(0);
+    mt_fail(cache_max_entry() == 0);
+    mt_ferr(put("abc", 1), EINVAL);
+    mt_fail(cache_get("abc") == NULL);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void cache_evict_oldest(void)
+{
+    char  name[2];
+    int   i;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    name[1] = '\0';
+    for (i = 0; i != 8; ++i)
+    {
+        name[0] = 'a' + i;
+        mt_fok(put(name, 800));
+    }
+
+    mt_fok(put("i", 800));
+    mt_fail(is_cached("a") == 0);
+    mt_fail(is_cached("b") == 1);
+    mt_fail(is_cached("i") == 1);
+    mt_fail(g_stats.cache_evictions == 1);
+    mt_fail(g_stats.cache_bytes == 800 * 8);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void cache_evict_second_chance(void)
+{
+    struct cache_entry  *e;
+    char                 name[2];
+    int                  i;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    name[1] = '\0';
+    for (i = 0; i != 8; ++i)
+    {
+        name[0] = 'a' + i;
+        mt_fok(put(name, 800));
+    }
+
+    /* "a" was recently read, so "b" should go instead */
+
+    e = cache_get("a");
+    cache_release(e);
+
+    mt_fok(put("i", 800));
+    mt_fail(is_cached("a") == 1);
+    mt_fail(is_cached("b") == 0);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void cache_pinned_not_evicted(void)
+{
+    struct cache_entry  *e[8];
+    char                 name[2];
+    int                  i;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    name[1] = '\0';
+    for (i = 0; i != 8; ++i)
+    {
+        name[0] = 'a' + i;
+        mt_fok(put(name, 800));
+        e[i] = cache_get(name);
+    }
+
+    /* everything is being sent, nothing can be evicted */
+
+    mt_ferr(put("i", 800), ENOSPC);
+    mt_fail(is_cached("i") == 0);
+
+    cache_release(e[3]);
+    mt_fok(put("i", 800));
+    mt_fail(is_cached("d") == 0);
+    mt_fail(is_cached("i") == 1);
+
+    for (i = 0; i != 8; ++i)
+        if (i != 3)
+            cache_release(e[i]);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void cache_remove_entry(void)
+{
+    mt_fok(put("abc", 100));
+    mt_fok(put("abd", 100));
+    cache_remove("abc");
+    mt_fail(is_cached("abc") == 0);
+    mt_fail(is_cached("abd") == 1);
+    mt_fail(g_stats.cache_entries == 1);
+    mt_fail(g_stats.cache_bytes == 100);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void cache_remove_pinned(void)
+{
+    struct cache_entry  *e;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_fok(put("abc", 100));
+    e = cache_get("abc");
+    cache_remove("abc");
+
+    /* entry is not reachable anymore, but memory still must be
+     * valid for the one who is sending it
+     */
+
+    mt_fail(is_cached("abc") == 0);
+    mt_fail(e->data[0] == 'a');
+    cache_release(e);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void cache_remove_last(void)
+{
+    mt_fok(put("abc", 100));
+    cache_remove("abc");
+    mt_fok(put("abd", 100));
+    mt_fail(is_cached("abd") == 1);
+}
+
+
+/* ==========================================================================
+             __               __
+            / /_ ___   _____ / /_   ____ _ _____ ____   __  __ ____
+           / __// _ \ / ___// __/  / __ `// ___// __ \ / / / // __ \
+          / /_ /  __/(__  )/ /_   / /_/ // /   / /_/ // /_/ // /_/ /
+          \__/ \___//____/ \__/   \__, //_/    \____/ \__,_// .___/
+                                 /____/                    /_/
+   ========================================================================== */
+
+
+void cache_test_group()
+{
+    mt_prepare_test = &test_prepare;
+    mt_cleanup_test = &test_cleanup;
+
+    mt_run(cache_put_and_get);
+    mt_run(cache_miss);
+    mt_run(cache_too_big_entry);
+    mt_run(cache_empty_entry);
+    mt_run(cache_disabled);
+    mt_run(cache_evict_oldest);
+    mt_run(cache_evict_second_chance);
+    mt_run(cache_pinned_not_evicted);
+    mt_run(cache_remove_entry);
+    mt_run(cache_remove_pinned);
+    mt_run(cache_remove_last);
+}
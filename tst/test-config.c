@@ -73,10 +73,43 @@ static void test_prepare(void)
     config.max_connections = 10;
     config.max_timeout = 60;
     config.timed_max_timeout = 3;
+    config.http_port = 0;
+    config.http_max_connections = 64;
+    config.cache_size = 8 * 1024 * 1024; /* 8MiB */
+    config.http_upload_port = 0;
+    config.pack_max_size = 0;
+    config.expire_max_age = 0;
+    config.expire_min_age = 0;
+    config.store_budget = 0;
+    config.search_max_size = 0;
+    config.ip_conn_rate = 0;
+    config.ip_max_conn = 0;
+    config.ip_bandwidth = 0;
+    config.net_conn_rate = 0;
+    config.net_max_conn = 0;
+    config.net_bandwidth = 0;
+    config.autoban_threshold = 0;
+    config.autoban_time = 3600;
+    config.reject_rate = 0;
+    config.backlog = 256;
+    config.defer_accept = 0;
+    config.fastopen = 0;
+    config.accept_batch = 16;
+    config.read_budget = 262144;
+    config.short_upload = 0;
+    config.min_rate = 0;
+    config.rate_window = 30;
+    config.upload_deadline = 0;
+    config.wait_queue = 0;
+    config.wait_timeout = 10;
+    config.busy_threshold = 0;
+    config.busy_timeout = 5;
     config.pem_pass_file[0] = '\0';
     config.ft_based_url = 0;
+    config.kernel_filter = 0;
     strcpy(config.domain, "localhost");
     strcpy(config.bind_ip, "0.0.0.0");
+    strcpy(config.proxy_trusted, "127.0.0.1,::1");
     strcpy(config.user, "termsend");
     strcpy(config.group, "termsend");
     strcpy(config.query_log, "/var/log/termsend-query.log");
@@ -214,6 +247,42 @@ static void config_long_opts(void)
         "--output-dir=/tmp",
         "--list-file=./main.c",
         "--ft-based-url",
+        "--http-port=8080",
+        "--http-max-connections=5",
+        "--cache-size=4096",
+        "--stats-file=/stats",
+        "--http-upload-port=8081",
+        "--pack-max-size=1024",
+        "--expire-max-age=86400",
+        "--expire-min-age=3600",
+        "--store-budget=1048576",
+        "--search-max-size=65536",
+        "--ip-conn-rate=30",
+        "--ip-max-conn=2",
+        "--ip-bandwidth=65536",
+        "--net-conn-rate=120",
+        "--net-max-conn=8",
+        "--net-bandwidth=262144",
+        "--autoban-threshold=5",
+        "--autoban-time=600",
+        "--reject-rate=100",
+        "--backlog=4096",
+        "--defer-accept=5",
+        "--fastopen=64",
+        "--accept-batch=32",
+        "--read-budget=16384",
+        "--short-upload=4096",
+        "--min-rate=512",
+        "--rate-window=60",
+        "--upload-deadline=3600",
+        "--wait-queue=64",
+        "--wait-timeout=5",
+        "--busy-threshold=75",
+        "--busy-timeout=3",
+        "--autoban-file=/autoban",
+        "--proxy-ports=100,8081",
+        "--proxy-trusted=10.0.0.0/8,fd00::/8",
+        "--kernel-filter",
 #if HAVE_SSL
         "--timed-ssl-listen-port=103",
         "--ssl-listen-port=101",
@@ -239,6 +308,42 @@ static void config_long_opts(void)
     config.max_timeout = 20;
     config.timed_max_timeout = 7;
     config.ft_based_url = 1;
+    config.kernel_filter = 1;
+    config.http_port = 8080;
+    config.http_max_connections = 5;
+    config.cache_size = 4096;
+    config.http_upload_port = 8081;
+    config.pack_max_size = 1024;
+    config.expire_max_age = 86400;
+    config.expire_min_age = 3600;
+    config.store_budget = 1048576;
+    config.search_max_size = 65536;
+    config.ip_conn_rate = 30;
+    config.ip_max_conn = 2;
+    config.ip_bandwidth = 65536;
+    config.net_conn_rate = 120;
+    config.net_max_conn = 8;
+    config.net_bandwidth = 262144;
+    config.autoban_threshold = 5;
+    config.autoban_time = 600;
+    config.reject_rate = 100;
+    config.backlog = 4096;
+    config.defer_accept = 5;
+    config.fastopen = 64;
+    config.accept_batch = 32;
+    config.read_budget = 16384;
+    config.short_upload = 4096;
+    config.min_rate = 512;
+    config.rate_window = 60;
+    config.upload_deadline = 3600;
+    config.wait_queue = 64;
+    config.wait_timeout = 5;
+    config.busy_threshold = 75;
+    config.busy_timeout = 3;
+    strcpy(config.stats_file, "/stats");
+    strcpy(config.autoban_file, "/autoban");
+    strcpy(config.proxy_ports, "100,8081");
+    strcpy(config.proxy_trusted, "10.0.0.0/8,fd00::/8");
     strcpy(config.domain, "http://termsend.bofc.pl");
     strcpy(config.bind_ip, "0.0.0.0,1.3.3.7");
     strcpy(config.user, "kur");
@@ -0,0 +1,389 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+
+/* ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "mtest.h"
+#include "expire.h"
+#include "globals.h"
+#include "segstore.h"
+#include "upidx.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+
+/* ==========================================================================
+                                   _                __
+                     ____   _____ (_)_   __ ____ _ / /_ ___
+                    / __ \ / ___// /| | / // __ `// __// _ \
+                   / /_/ // /   / / | |/ // /_/ // /_ /  __/
+                  / .___//_/   /_/  |___/ \__,_/ \__/ \___/
+                 /_/
+                                   _         __     __
+              _   __ ____ _ _____ (_)____ _ / /_   / /___   _____
+             | | / // __ `// ___// // __ `// __ \ / // _ \ / ___/
+             | |/ // /_/ // /   / // /_/ // /_/ // //  __/(__  )
+             |___/ \__,_//_/   /_/ \__,_//_.___//_/ \___//____/
+
+   ========================================================================== */
+
+
+#define IDX   "./expire-test-idx"
+#define SDIR  "./expire-test-seg"
+#define NUP   (EXPIRE_BATCH + 2)
+
+mt_defs_ext();
+
+
+/* ==========================================================================
+                                   _                __
+                     ____   _____ (_)_   __ ____ _ / /_ ___
+                    / __ \ / ___// /| | / // __ `// __// _ \
+                   / /_/ // /   / / | |/ // /_/ // /_ /  __/
+                  / .___//_/   /_/  |___/ \__,_/ \__/ \___/
+                 /_/
+               ____                     __   _
+              / __/__  __ ____   _____ / /_ (_)____   ____   _____
+             / /_ / / / // __ \ / ___// __// // __ \ / __ \ / ___/
+            / __// /_/ // / / // /__ / /_ / // /_/ // / / /(__  )
+           /_/   \__,_//_/ /_/ \___/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+static void name(char *buf, int i)
+{
+    sprintf(buf, "expire-test-%d", i);
+}
+
+
+static int exists(int i)
+{
+    char  fname[32];
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    name(fname, i);
+    return access(fname, F_OK) == 0;
+}
+
+
+/* creates upload file 'i' with 'size' bytes, created at 'ctime' and
+ * adds it to the index and expiry
+ */
+
+static void upload(int i, unsigned long size, time_t ctime)
+{
+    struct upidx_rec  rec;
+    unsigned long     recno;
+    FILE             *f;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    memset(&rec, 0, sizeof(rec));
+    name(rec.name, i);
+    rec.size = size;
+    rec.ctime = ctime;
+    rec.family = 4;
+
+    f = fopen(rec.name, "w");
+    fclose(f);
+
+    upidx_add(&rec, &recno);
+    expire_add(recno, ctime, size);
+}
+
+
+static void test_prepare(void)
+{
+    int  i;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    for (i = 0; i != NUP; ++i)
+    {
+        char  fname[32];
+        name(fname, i);
+        unlink(fname);
+    }
+
+    unlink(IDX);
+    memset(&g_stats, 0, sizeof(g_stats));
+    memset(&g_config, 0, sizeof(g_config));
+    g_config.max_size = 1000;
+    upidx_init(IDX);
+}
+
+
+static void test_cleanup(void)
+{
+    int  i;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    expire_destroy();
+    upidx_destroy();
+    unlink(IDX);
+
+    for (i = 0; i != NUP; ++i)
+    {
+        char  fname[32];
+        name(fname, i);
+        unlink(fname);
+    }
+}
+
+
+/* ==========================================================================
+                           __               __
+                          / /_ ___   _____ / /_ _____
+                         / __// _ \ / ___// __// ___/
+                        / /_ /  __/(__  )/ /_ (__  )
+                        \__/ \___//____/ \__//____/
+
+   ========================================================================== */
+
+
+static void expire_disabled(void)
+{
+    mt_fok(expire_init(IDX));
+    upload(0, 10, 0);
+    expire_run(1000000);
+    mt_fail(exists(0));
+    mt_fail(g_stats.expire_pending == 0);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void expire_by_age(void)
+{
+    struct upidx_map  m;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    g_config.expire_max_age = 100;
+    mt_fok(expire_init(IDX));
+    upload(0, 10, 0);
+    upload(1, 10, 50);
+    mt_fail(g_stats.expire_pending == 2);
+    mt_fail(g_stats.store_bytes == 20);
+
+    expire_run(99);
+    mt_fail(exists(0));
+    mt_fail(exists(1));
+
+    expire_run(100);
+    mt_fail(!exists(0));
+    mt_fail(exists(1));
+    mt_fail(g_stats.expired == 1);
+    mt_fail(g_stats.expire_pending == 1);
+    mt_fail(g_stats.store_bytes == 10);
+
+    mt_fok(upidx_map(&m, IDX));
+    mt_assert(m.nrec == 2);
+    mt_fail(m.rec[0].flags & UPIDX_DELETED);
+    mt_fail(!(m.rec[1].flags & UPIDX_DELETED));
+    upidx_unmap(&m);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void expire_scaled_by_size(void)
+{
+    /* biggest upload lives min age, empty one max age */
+
+    g_config.expire_max_age = 100;
+    g_config.expire_min_age = 10;
+    mt_fok(expire_init(IDX));
+    upload(0, 0, 0);
+    upload(1, 1000, 0);
+    upload(2, 500, 0);
+
+    expire_run(10);
+    mt_fail(exists(0));
+    mt_fail(!exists(1));
+    mt_fail(exists(2));
+
+    /* half of max size lives 10 + 90 * 0.5^3 */
+
+    expire_run(20);
+    mt_fail(exists(2));
+    expire_run(21);
+    mt_fail(!exists(2));
+    mt_fail(exists(0));
+
+    expire_run(100);
+    mt_fail(!exists(0));
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void expire_over_budget(void)
+{
+    g_config.store_budget = 100;
+    mt_fok(expire_init(IDX));
+    upload(0, 60, 10);
+    upload(1, 60, 20);
+    upload(2, 60, 30);
+
+    /* no max age, so only budget matters, oldest go first */
+
+    expire_run(0);
+    mt_fail(!exists(0));
+    mt_fail(!exists(1));
+    mt_fail(exists(2));
+    mt_fail(g_stats.store_bytes == 60);
+    mt_fail(g_stats.expired == 2);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void expire_in_batches(void)
+{
+    int  i;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    g_config.expire_max_age = 1;
+    mt_fok(expire_init(IDX));
+    for (i = 0; i != NUP; ++i)
+        upload(i, 1, 0);
+
+    expire_run(10);
+    mt_fail(g_stats.expired == EXPIRE_BATCH);
+    mt_fail(g_stats.expire_pending == NUP - EXPIRE_BATCH);
+
+    expire_run(11);
+    mt_fail(g_stats.expired == NUP);
+    for (i = 0; i != NUP; ++i)
+        mt_fail(!exists(i));
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void expire_rebuilt_from_index(void)
+{
+    g_config.expire_max_age = 100;
+    mt_fok(expire_init(IDX));
+    upload(0, 10, 0);
+    upload(1, 20, 50);
+    upload(2, 30, 10);
+    expire_run(100);
+    mt_fail(!exists(0));
+
+    /* restart, deleted upload must not be scheduled again */
+
+    expire_destroy();
+    upidx_destroy();
+    mt_fok(upidx_init(IDX));
+    mt_fok(expire_init(IDX));
+    mt_fail(g_stats.expire_pending == 2);
+    mt_fail(g_stats.store_bytes == 50);
+
+    expire_run(110);
+    mt_fail(!exists(2));
+    mt_fail(exists(1));
+    mt_fail(g_stats.expired == 2);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void expire_packed(void)
+{
+    struct upidx_rec  rec;
+    unsigned long     recno;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    g_config.expire_max_age = 100;
+    mt_fok(expire_init(IDX));
+    mt_fok(segstore_init(SDIR, 1000));
+
+    memset(&rec, 0, sizeof(rec));
+    strcpy(rec.name, "packed");
+    rec.size = 3;
+    rec.flags = UPIDX_PACKED;
+    mt_fok(segstore_put(rec.name, "abc", 3, 0));
+    mt_fok(upidx_add(&rec, &recno));
+    expire_add(recno, 0, 3);
+
+    expire_run(100);
+    mt_fail(segstore_exists("packed") == 0);
+
+    segstore_destroy();
+    unlink(SDIR "/00000000");
+    unlink(SDIR "/index");
+    rmdir(SDIR);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void expire_with_reaper(void)
+{
+    g_config.expire_max_age = 100;
+    mt_fok(expire_init(IDX));
+    mt_fok(expire_start());
+    upload(0, 10, 0);
+    upload(1, 10, 0);
+    expire_run(100);
+    mt_fail(g_stats.expired == 2);
+
+    /* destroy waits for reaper to finish its job */
+
+    expire_destroy();
+    mt_fail(!exists(0));
+    mt_fail(!exists(1));
+}
+
+
+/* ==========================================================================
+             __               __
+            / /_ ___   _____ / /_   ____ _ _____ ____   __  __ ____
+           / __// _ \ / ___// __/  / __ `// ___// __ \ / / / // __ \
+          / /_ /  __/(__  )/ /_   / /_/ // /   / /_/ // /_/ // /_/ /
+          \__/ \___//____/ \__/   \__, //_/    \____/ \__,_// .___/
+                                 /____/                    /_/
+   ========================================================================== */
+
+
+void expire_test_group()
+{
+    mt_prepare_test = &test_prepare;
+    mt_cleanup_test = &test_cleanup;
+
+    mt_run(expire_disabled);
+    mt_run(expire_by_age);
+    mt_run(expire_scaled_by_size);
+    mt_run(expire_over_budget);
+    mt_run(expire_in_batches);
+    mt_run(expire_rebuilt_from_index);
+    mt_run(expire_packed);
+    mt_run(expire_with_reaper);
+}
@@ -6,7 +6,16 @@
 #ifndef TEST_GROUP_LIST
 #define TEST_GROUP_LIST 1
 
+void autoban_test_group();
 void bnwlist_test_group();
+void cache_test_group();
 void config_test_group();
+void expire_test_group();
+void http_test_group();
+void limit_test_group();
+void proxy_test_group();
+void search_test_group();
+void segstore_test_group();
+void upidx_test_group();
 
 #endif
@@ -0,0 +1,619 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+
+/* ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "http.h"
+#include "mtest.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+/* ==========================================================================
+                                   _                __
+                     ____   _____ (_)_   __ ____ _ / /_ ___
+                    / __ \ / ___// /| | / // __ `// __// _ \
+                   / /_/ // /   / / | |/ // /_/ // /_ /  __/
+                  / .___//_/   /_/  |___/ \__,_/ \__/ \___/
+                 /_/
+                                   _         __     __
+              _   __ ____ _ _____ (_)____ _ / /_   / /___   _____
+             | | / // __ `// ___// // __ `// __ \ / // _ \ / ___/
+             | |/ // /_/ // /   / // /_/ // /_/ // //  __/(__  )
+             |___/ \__,_//_/   /_/ \__,_//_.___//_/ \___//____/
+
+   ========================================================================== */
+
+
+mt_defs_ext();
+
+
+/* ==========================================================================
+                                   _                __
+                     ____   _____ (_)_   __ ____ _ / /_ ___
+                    / __ \ / ___// /| | / // __ `// __// _ \
+                   / /_/ // /   / / | |/ // /_/ // /_ /  __/
+                  / .___//_/   /_/  |___/ \__,_/ \__/ \___/
+                 /_/
+               ____                     __   _
+              / __/__  __ ____   _____ / /_ (_)____   ____   _____
+             / /_ / / / // __ \ / ___// __// // __ \ / __ \ / ___/
+            / __// /_/ // / / // /__ / /_ / // /_/ // / / /(__  )
+           /_/   \__,_//_/ /_/ \___/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* parses request 'head' in a copy, since parser modifies buffer, copy
+ * is static, so 'req' can still point to it after function returns
+ */
+
+static int parse
+(
+    const char           *head,
+    struct http_request  *req
+)
+{
+    static char           buf[4096];
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    strcpy(buf, head);
+    return http_parse_request(buf, strlen(buf), req);
+}
+
+
+/* decodes chunked 'in' in one go, decoded payload is in 'out', with
+ * its length in 'len'
+ */
+
+static int chunked
+(
+    const char     *in,
+    char           *out,
+    size_t         *len
+)
+{
+    struct http_chunked  ch;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    http_chunked_init(&ch);
+    strcpy(out, in);
+    *len = strlen(in);
+    return http_chunked_decode(&ch, (unsigned char *)out, len);
+}
+
+
+/* ==========================================================================
+                           __               __
+                          / /_ ___   _____ / /_ _____
+                         / __// _ \ / ___// __// ___/
+                        / /_ /  __/(__  )/ /_ (__  )
+                        \__/ \___//____/ \__//____/
+
+   ========================================================================== */
+
+
+static void http_request_end_found(void)
+{
+    const char  *crlf = "GET / HTTP/1.1\r\nHost: a\r\n\r\nbody";
+    const char  *lf = "GET / HTTP/1.1\nHost: a\n\nbody";
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_fail(http_request_end(crlf, strlen(crlf)) == 27);
+    mt_fail(http_request_end(lf, strlen(lf)) == 24);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void http_request_end_incomplete(void)
+{
+    const char  *h = "GET / HTTP/1.1\r\nHost: a\r\n\r\n";
+    size_t       i;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    for (i = 0; i != strlen(h); ++i)
+        mt_fail(http_request_end(h, i) == -1);
+
+    mt_fail(http_request_end("", 0) == -1);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void http_parse_request_ok(void)
+{
+    struct http_request  req;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_fok(parse("GET /x-c/abcde HTTP/1.1\r\n"
+                "Host:  example.com \t\r\n"
+                "Range:bytes=0-1\r\n"
+                "X-Empty:\r\n"
+                "\r\n", &req));
+
+    mt_fail(strcmp(req.method, "GET") == 0);
+    mt_fail(strcmp(req.target, "/x-c/abcde") == 0);
+    mt_fail(req.minor == 1);
+    mt_fail(req.nhdr == 3);
+    mt_fail(strcmp(http_header(&req, "host"), "example.com") == 0);
+    mt_fail(strcmp(http_header(&req, "RANGE"), "bytes=0-1") == 0);
+    mt_fail(strcmp(http_header(&req, "x-empty"), "") == 0);
+    mt_fail(http_header(&req, "Connection") == NULL);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void http_parse_request_leading_empty_line(void)
+{
+    struct http_request  req;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_fok(parse("\r\nPUT / HTTP/1.0\n\n", &req));
+    mt_fail(strcmp(req.method, "PUT") == 0);
+    mt_fail(req.minor == 0);
+    mt_fail(req.nhdr == 0);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void http_parse_request_malformed(void)
+{
+    struct http_request  req;
+    size_t               i;
+    const char          *bad[] =
+    {
+        "GET\r\n\r\n",
+        "GET /\r\n\r\n",
+        "GET / HTTP/2.0\r\n\r\n",
+        "GET / HTTP/1.x\r\n\r\n",
+        "GET / http/1.1\r\n\r\n",
+        "GET / HTTP/1.1\r\nHost\r\n\r\n",
+        "GET / HTTP/1.1\r\nHost : a\r\n\r\n",
+        "GET / HTTP/1.1\r\nHost\t: a\r\n\r\n",
+        "GET / HTTP/1.1\r\n: a\r\n\r\n",
+        "GET / HTTP/1.1\r\nHost: a\r\n",
+        "GET / HTTP/1.1\r\nHost: a",
+        "GET / HTTP/1.1",
+        "\r\n\r\n",
+        ""
+    };
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    for (i = 0; i != sizeof(bad) / sizeof(*bad); ++i)
+        mt_fail(parse(bad[i], &req) == -1);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void http_parse_request_too_many_headers(void)
+{
+    struct http_request  req;
+    char                 head[4096];
+    int                  i;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    strcpy(head, "GET / HTTP/1.1\r\n");
+    for (i = 0; i != HTTP_MAX_HEADERS + 8; ++i)
+        sprintf(head + strlen(head), "X-%d: %d\r\n", i, i);
+
+    strcat(head, "\r\n");
+
+    /* headers that don't fit are ignored, but still must be valid */
+
+    mt_fok(parse(head, &req));
+    mt_fail(req.nhdr == HTTP_MAX_HEADERS);
+    mt_fail(strcmp(http_header(&req, "X-0"), "0") == 0);
+    mt_fail(http_header(&req, "X-32") == NULL);
+
+    strcpy(head + strlen(head) - 2, "broken\r\n\r\n");
+    mt_fail(parse(head, &req) == -1);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void http_keep_alive_versions(void)
+{
+    struct http_request  req;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_fok(parse("GET / HTTP/1.1\r\n\r\n", &req));
+    mt_fail(http_keep_alive(&req) == 1);
+    mt_fok(parse("GET / HTTP/1.1\r\nConnection: Close\r\n\r\n", &req));
+    mt_fail(http_keep_alive(&req) == 0);
+    mt_fok(parse("GET / HTTP/1.0\r\n\r\n", &req));
+    mt_fail(http_keep_alive(&req) == 0);
+    mt_fok(parse("GET / HTTP/1.0\r\nConnection: keep-alive\r\n\r\n", &req));
+    mt_fail(http_keep_alive(&req) == 1);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void http_date_roundtrip(void)
+{
+    char         buf[HTTP_DATE_LEN];
+    size_t       i;
+    time_t       t[] = { 0, 784111777, 951782400, 1700000000 };
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    http_format_date(784111777, buf);
+    mt_fail(strcmp(buf, "Sun, 06 Nov 1994 08:49:37 GMT") == 0);
+    http_format_date(951782400, buf);
+    mt_fail(strcmp(buf, "Tue, 29 Feb 2000 00:00:00 GMT") == 0);
+
+    for (i = 0; i != sizeof(t) / sizeof(*t); ++i)
+    {
+        http_format_date(t[i], buf);
+        mt_fail(http_parse_date(buf) == t[i]);
+    }
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void http_date_malformed(void)
+{
+    size_t       i;
+    const char  *bad[] =
+    {
+        "Sunday, 06-Nov-94 08:49:37 GMT",
+        "Sun Nov  6 08:49:37 1994",
+        "Sun, 06 Foo 1994 08:49:37 GMT",
+        "Sun, 06 nov 1994 08:49:37 GMT",
+        "Sun, 00 Nov 1994 08:49:37 GMT",
+        "Sun, 32 Nov 1994 08:49:37 GMT",
+        "Sun, 06 Nov 1994 24:49:37 GMT",
+        "Sun, 06 Nov 1994 08:60:37 GMT",
+        "Sun, 06 Nov 1994 08:49:61 GMT",
+        "Sun, 06 Nov 1994 08:-1:37 GMT",
+        "Sun, 06 Nov 1994 -1:49:37 GMT",
+        "Sun, 06 Nov 1994 08:49:-1 GMT",
+        "Sun, 06 Nov -994 08:49:37 GMT",
+        "Sun, 06 Nov 1994 08:49:37 UTC",
+        "Sun, 06 Nov 1994 08:49:37 GMTX",
+        "Sun, 06 Nov 1994 08:49:37",
+        "Sun 06 Nov 1994 08:49:37 GMT ",
+        ""
+    };
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    for (i = 0; i != sizeof(bad) / sizeof(*bad); ++i)
+        mt_fail(http_parse_date(bad[i]) == -1);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void http_range_valid(void)
+{
+    off_t  f;
+    off_t  l;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_fok(http_parse_range("bytes=0-499", 1000, &f, &l));
+    mt_fail(f == 0 && l == 499);
+    mt_fok(http_parse_range("bytes=500-", 1000, &f, &l));
+    mt_fail(f == 500 && l == 999);
+    mt_fok(http_parse_range("bytes=-200", 1000, &f, &l));
+    mt_fail(f == 800 && l == 999);
+    mt_fok(http_parse_range("bytes=-2000", 1000, &f, &l));
+    mt_fail(f == 0 && l == 999);
+    mt_fok(http_parse_range("bytes=900-2000", 1000, &f, &l));
+    mt_fail(f == 900 && l == 999);
+    mt_fok(http_parse_range("bytes=999-999", 1000, &f, &l));
+    mt_fail(f == 999 && l == 999);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void http_range_not_satisfiable(void)
+{
+    off_t  f;
+    off_t  l;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_fail(http_parse_range("bytes=-0", 1000, &f, &l) == -1);
+    mt_fail(http_parse_range("bytes=1000-", 1000, &f, &l) == -1);
+    mt_fail(http_parse_range("bytes=1000-2000", 1000, &f, &l) == -1);
+    mt_fail(http_parse_range("bytes=0-", 0, &f, &l) == -1);
+    mt_fail(http_parse_range("bytes=-5", 0, &f, &l) == -1);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void http_range_ignored(void)
+{
+    off_t        f;
+    off_t        l;
+    size_t       i;
+    const char  *ign[] =
+    {
+        "bytes=0-1,5-6",
+        "bytes=-1,-2",
+        "bytes=5-1",
+        "bytes=a-",
+        "bytes=-a",
+        "bytes= 0-1",
+        "bytes=0-1x",
+        "bytes=0 -1",
+        "bytes=",
+        "bytes=-",
+        "bytes=--1",
+        "items=0-1",
+        "bytes=99999999999999999999-",
+        "bytes=0-99999999999999999999",
+        "bytes=-99999999999999999999",
+        ""
+    };
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    for (i = 0; i != sizeof(ign) / sizeof(*ign); ++i)
+        mt_fail(http_parse_range(ign[i], 1000, &f, &l) == 1);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void http_content_length_values(void)
+{
+    size_t       i;
+    const char  *bad[] =
+    {
+        "", "-1", "+5", "12a", "12 ", " 12", "0x10", "1e3",
+        "99999999999999999999", "92233720368547758070"
+    };
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_fail(http_content_length("0") == 0);
+    mt_fail(http_content_length("1024") == 1024);
+    mt_fail(http_content_length("0001024") == 1024);
+
+    for (i = 0; i != sizeof(bad) / sizeof(*bad); ++i)
+        mt_fail(http_content_length(bad[i]) == -1);
+
+    /* right on the edge of off_t */
+
+    if (sizeof(off_t) == 8)
+    {
+        mt_fail(http_content_length("9223372036854775807") ==
+                (off_t)9223372036854775807ll);
+        mt_fail(http_content_length("9223372036854775808") == -1);
+        mt_fail(http_content_length("9223372036854775810") == -1);
+    }
+    else
+    {
+        mt_fail(http_content_length("2147483647") == 2147483647l);
+        mt_fail(http_content_length("2147483648") == -1);
+    }
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void http_chunked_simple(void)
+{
+    char    out[256];
+    size_t  len;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_fail(chunked("5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n", out, &len) == 1);
+    mt_fail(len == 11);
+    mt_fail(memcmp(out, "hello world", 11) == 0);
+
+    /* bare LF, upper case hex */
+
+    mt_fail(chunked("A\n0123456789\n0\n\n", out, &len) == 1);
+    mt_fail(len == 10);
+    mt_fail(memcmp(out, "0123456789", 10) == 0);
+
+    /* empty body */
+
+    mt_fail(chunked("0\r\n\r\n", out, &len) == 1);
+    mt_fail(len == 0);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void http_chunked_extensions_and_trailers(void)
+{
+    char    out[256];
+    size_t  len;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_fail(chunked("5;name=\"a;b\"\r\nhello\r\n"
+                "3 ; x\r\nabc\r\n"
+                "0;last\r\n"
+                "X-Sum: 1\r\n"
+                "X-Other: 2\r\n"
+                "\r\n"
+                "ignored", out, &len) == 1);
+    mt_fail(len == 8);
+    mt_fail(memcmp(out, "helloabc", 8) == 0);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void http_chunked_byte_by_byte(void)
+{
+    const char           *in = "5;x=y\r\nhello\r\n1a\r\n"
+                               "abcdefghijklmnopqrstuvwxyz\r\n0\r\nT: v\r\n\r\n";
+    char                  out[256];
+    struct http_chunked   ch;
+    unsigned char         c;
+    size_t                len;
+    size_t                i;
+    size_t                n;
+    int                   ret;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    http_chunked_init(&ch);
+    ret = 0;
+    n = 0;
+
+    for (i = 0; i != strlen(in); ++i)
+    {
+        c = in[i];
+        len = 1;
+        ret = http_chunked_decode(&ch, &c, &len);
+
+        mt_assert(ret != -1);
+        mt_assert(ret == 0 || i == strlen(in) - 1);
+        if (len)
+            out[n++] = c;
+    }
+
+    mt_fail(ret == 1);
+    mt_fail(n == 31);
+    mt_fail(memcmp(out, "helloabcdefghijklmnopqrstuvwxyz", 31) == 0);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void http_chunked_incomplete(void)
+{
+    char    out[256];
+    size_t  len;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_fail(chunked("5\r\nhel", out, &len) == 0);
+    mt_fail(len == 3);
+    mt_fail(chunked("5\r\nhello\r\n0\r\n", out, &len) == 0);
+    mt_fail(len == 5);
+    mt_fail(chunked("", out, &len) == 0);
+    mt_fail(len == 0);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void http_chunked_malformed(void)
+{
+    char         out[256];
+    size_t       len;
+    size_t       i;
+    const char  *bad[] =
+    {
+        /* data not followed by CRLF */
+
+        "5\r\nhelloX\r\n0\r\n\r\n",
+        "5\r\nhello\r\r0\r\n\r\n",
+
+        /* no chunk size, or not a hex number */
+
+        "\r\nhello\r\n",
+        ";x\r\n",
+        "g\r\n",
+        "-1\r\n",
+        "0x5\r\n",
+        "5x\r\n",
+
+        /* chunk size that would overflow */
+
+        "ffffffffffffffff\r\n",
+        "10000000000000000\r\n",
+        "00000000000000005\r\n"
+    };
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    for (i = 0; i != sizeof(bad) / sizeof(*bad); ++i)
+        mt_fail(chunked(bad[i], out, &len) == -1);
+
+    /* biggest chunk size we accept */
+
+    mt_fail(chunked("fffffffffffffff\r\nabc", out, &len) == 0);
+    mt_fail(len == 3);
+}
+
+
+/* ==========================================================================
+             __               __
+            / /_ ___   _____ / /_   ____ _ _____ ____   __  __ ____
+           / __// _ \ / ___// __/  / __ `// ___// __ \ / / / // __ \
+          / /_ /  __/(__  )/ /_   / /_/ // /   / /_/ // /_/ // /_/ /
+          \__/ \___//____/ \__/   \__, //_/    \____/ \__,_// .___/
+                                 /____/                    /_/
+   ========================================================================== */
+
+
+void http_test_group()
+{
+    /* http parsers keep no state, nothing to prepare nor clean */
+
+    mt_prepare_test = NULL;
+    mt_cleanup_test = NULL;
+
+    mt_run(http_request_end_found);
+    mt_run(http_request_end_incomplete);
+    mt_run(http_parse_request_ok);
+    mt_run(http_parse_request_leading_empty_line);
+    mt_run(http_parse_request_malformed);
+    mt_run(http_parse_request_too_many_headers);
+    mt_run(http_keep_alive_versions);
+    mt_run(http_date_roundtrip);
+    mt_run(http_date_malformed);
+    mt_run(http_range_valid);
+    mt_run(http_range_not_satisfiable);
+    mt_run(http_range_ignored);
+    mt_run(http_content_length_values);
+    mt_run(http_chunked_simple);
+    mt_run(http_chunked_extensions_and_trailers);
+    mt_run(http_chunked_byte_by_byte);
+    mt_run(http_chunked_incomplete);
+    mt_run(http_chunked_malformed);
+}
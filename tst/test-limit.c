@@ -0,0 +1,361 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+
+/* ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "mtest.h"
+#include "globals.h"
+#include "limit.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+
+
+/* ==========================================================================
+                                   _                __
+                     ____   _____ (_)_   __ ____ _ / /_ ___
+                    / __ \ / ___// /| | / // __ `// __// _ \
+                   / /_/ // /   / / | |/ // /_/ // /_ /  __/
+                  / .___//_/   /_/  |___/ \__,_/ \__/ \___/
+                 /_/
+                                   _         __     __
+              _   __ ____ _ _____ (_)____ _ / /_   / /___   _____
+             | | / // __ `// ___// // __ `// __ \ / // _ \ / ___/
+             | |/ // /_/ // /   / // /_/ // /_/ // //  __/(__  )
+             |___/ \__,_//_/   /_/ \__,_//_.___//_/ \___//____/
+
+   ========================================================================== */
+
+
+mt_defs_ext();
+
+
+/* ==========================================================================
+                                   _                __
+                     ____   _____ (_)_   __ ____ _ / /_ ___
+                    / __ \ / ___// /| | / // __ `// __// _ \
+                   / /_/ // /   / / | |/ // /_/ // /_ /  __/
+                  / .___//_/   /_/  |___/ \__,_/ \__/ \___/
+                 /_/
+               ____                     __   _
+              / __/__  __ ____   _____ / /_ (_)____   ____   _____
+             / /_ / / / // __ \ / ___// __// // __ \ / __ \ / ___/
+            / __// /_/ // / / // /__ / /_ / // /_/ // / / /(__  )
+           /_/   \__,_//_/ /_/ \___/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+static int conn
+(
+    struct limit_client  *lc,
+    const char           *ip,
+    double                now
+)
+{
+    struct sockaddr_in    sa;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = inet_addr(ip);
+    return limit_connect(lc, (struct sockaddr *)&sa, now);
+}
+
+
+static void test_prepare(void)
+{
+    memset(&g_stats, 0, sizeof(g_stats));
+    memset(&g_config, 0, sizeof(g_config));
+    g_config.max_connections = 10;
+}
+
+
+static void test_cleanup(void)
+{
+    limit_destroy();
+}
+
+
+/* ==========================================================================
+                           __               __
+                          / /_ ___   _____ / /_ _____
+                         / __// _ \ / ___// __// ___/
+                        / /_ /  __/(__  )/ /_ (__  )
+                        \__/ \___//____/ \__//____/
+
+   ========================================================================== */
+
+
+static void limit_disabled(void)
+{
+    struct limit_client  lc;
+    int                  i;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_fok(limit_init());
+    mt_fail(limit_enabled() == 0);
+
+    for (i = 0; i != 100; ++i)
+        mt_fok(conn(&lc, "10.0.0.1", 0.0));
+
+    mt_fail(limit_quota(&lc, 8192, 0.0) == 8192);
+    mt_fail(limit_wait(&lc, 0.0) == 0.0);
+    limit_disconnect(&lc);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void limit_ip_max_conn(void)
+{
+    struct limit_client  lc[3];
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    g_config.ip_max_conn = 2;
+    mt_fok(limit_init());
+
+    mt_fok(conn(&lc[0], "10.0.0.1", 0.0));
+    mt_fok(conn(&lc[1], "10.0.0.1", 0.0));
+    mt_ferr(conn(&lc[2], "10.0.0.1", 0.0), EBUSY);
+    mt_fok(conn(&lc[2], "10.0.0.2", 0.0));
+    limit_disconnect(&lc[2]);
+
+    /* slot freed, ip can connect again */
+
+    limit_disconnect(&lc[0]);
+    mt_fok(conn(&lc[0], "10.0.0.1", 0.0));
+    mt_fail(g_stats.limit_rejects == 1);
+
+    limit_disconnect(&lc[0]);
+    limit_disconnect(&lc[1]);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void limit_net_max_conn(void)
+{
+    struct limit_client  lc[4];
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    g_config.net_max_conn = 2;
+    mt_fok(limit_init());
+
+    mt_fok(conn(&lc[0], "10.0.0.1", 0.0));
+    mt_fok(conn(&lc[1], "10.0.0.2", 0.0));
+    mt_ferr(conn(&lc[2], "10.0.0.3", 0.0), EBUSY);
+    mt_fok(conn(&lc[3], "10.0.1.3", 0.0));
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void limit_conn_rate(void)
+{
+    struct limit_client  lc;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    /* 2 per minute, and both can be used at once */
+
+    g_config.ip_conn_rate = 2;
+    mt_fok(limit_init());
+
+    mt_fok(conn(&lc, "10.0.0.1", 100.0));
+    limit_disconnect(&lc);
+    mt_fok(conn(&lc, "10.0.0.1", 100.0));
+    limit_disconnect(&lc);
+    mt_ferr(conn(&lc, "10.0.0.1", 100.0), EAGAIN);
+    mt_ferr(conn(&lc, "10.0.0.1", 129.0), EAGAIN);
+    mt_fok(conn(&lc, "10.0.0.1", 130.0));
+    limit_disconnect(&lc);
+
+    /* other ip is not affected */
+
+    mt_fok(conn(&lc, "10.0.0.2", 130.0));
+    limit_disconnect(&lc);
+    mt_fail(g_stats.limit_rejects == 2);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void limit_bandwidth(void)
+{
+    struct limit_client  lc;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    g_config.ip_bandwidth = 1000;
+    mt_fok(limit_init());
+    mt_fok(conn(&lc, "10.0.0.1", 0.0));
+
+    mt_fail(limit_wait(&lc, 0.0) == 0.0);
+    mt_fail(limit_quota(&lc, 8192, 0.0) == 1000);
+    limit_consume(&lc, 1000);
+    mt_fail(limit_quota(&lc, 8192, 0.0) == 0);
+    mt_fail(limit_wait(&lc, 0.0) == 1.0);
+
+    /* half a second later there is half of bandwidth, but that's
+     * not enough to wake client up yet
+     */
+
+    mt_fail(limit_quota(&lc, 8192, 0.5) == 500);
+    mt_fail(limit_wait(&lc, 0.5) == 0.5);
+    mt_fail(limit_wait(&lc, 1.0) == 0.0);
+
+    /* bucket never holds more than a second of bandwidth */
+
+    mt_fail(limit_quota(&lc, 8192, 100.0) == 1000);
+    limit_disconnect(&lc);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void limit_net_bandwidth(void)
+{
+    struct limit_client  lc[3];
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    g_config.ip_bandwidth = 4096;
+    g_config.net_bandwidth = 6144;
+    mt_fok(limit_init());
+    mt_fok(conn(&lc[0], "10.0.0.1", 0.0));
+    mt_fok(conn(&lc[1], "10.0.0.2", 0.0));
+    mt_fok(conn(&lc[2], "10.0.1.1", 0.0));
+
+    mt_fail(limit_quota(&lc[0], 8192, 0.0) == 4096);
+    limit_consume(&lc[0], 4096);
+
+    /* second ip has whole own bandwidth, but network is limited */
+
+    mt_fail(limit_quota(&lc[1], 8192, 0.0) == 2048);
+    limit_consume(&lc[1], 2048);
+    mt_fail(limit_wait(&lc[1], 0.0) > 0.0);
+
+    /* other network is not affected */
+
+    mt_fail(limit_quota(&lc[2], 8192, 0.0) == 4096);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void limit_evicts_oldest(void)
+{
+    struct limit_client  busy;
+    struct limit_client  old;
+    struct limit_client  lc;
+    char                 ip[32];
+    int                  i;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    g_config.ip_conn_rate = 1;
+    g_config.ip_max_conn = 1;
+    mt_fok(limit_init());
+
+    /* 'busy' stays connected all the time, 'old' is used up */
+
+    mt_fok(conn(&busy, "1.1.1.1", 0.0));
+    mt_fok(conn(&old, "2.2.2.2", 0.0));
+    limit_disconnect(&old);
+    mt_ferr(conn(&old, "2.2.2.2", 0.0), EAGAIN);
+
+    /* every ip takes two entries, so that fills table few times */
+
+    for (i = 0; i != 4 * LIMIT_MIN_ENTRIES; ++i)
+    {
+        sprintf(ip, "10.%d.%d.1", (i >> 8) & 0xff, i & 0xff);
+        mt_fok(conn(&lc, ip, 0.0));
+        limit_disconnect(&lc);
+    }
+
+    mt_fail(g_stats.limit_entries <= LIMIT_MIN_ENTRIES / 4 * 3);
+
+    /* 'old' was forgotten, 'busy' was not */
+
+    mt_fok(conn(&old, "2.2.2.2", 0.0));
+    mt_ferr(conn(&lc, "1.1.1.1", 0.0), EBUSY);
+    limit_disconnect(&busy);
+    limit_disconnect(&old);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void limit_ipv6_prefix(void)
+{
+    struct sockaddr_in6  sa;
+    struct limit_client  lc[3];
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    g_config.net_max_conn = 1;
+    mt_fok(limit_init());
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin6_family = AF_INET6;
+    inet_pton(AF_INET6, "2001:db8:0:1::1", &sa.sin6_addr);
+    mt_fok(limit_connect(&lc[0], (struct sockaddr *)&sa, 0.0));
+
+    /* same /64 */
+
+    inet_pton(AF_INET6, "2001:db8:0:1:ffff::2", &sa.sin6_addr);
+    mt_ferr(limit_connect(&lc[1], (struct sockaddr *)&sa, 0.0), EBUSY);
+
+    inet_pton(AF_INET6, "2001:db8:0:2::1", &sa.sin6_addr);
+    mt_fok(limit_connect(&lc[2], (struct sockaddr *)&sa, 0.0));
+}
+
+
+/* ==========================================================================
+             __               __
+            / /_ ___   _____ / /_   ____ _ _____ ____   __  __ ____
+           / __// _ \ / ___// __/  / __ `// ___// __ \ / / / // __ \
+          / /_ /  __/(__  )/ /_   / /_/ // /   / /_/ // /_/ // /_/ /
+          \__/ \___//____/ \__/   \__, //_/    \____/ \__,_// .___/
+                                 /____/                    /_/
+   ========================================================================== */
+
+
+void limit_test_group()
+{
+    mt_prepare_test = &test_prepare;
+    mt_cleanup_test = &test_cleanup;
+
+    mt_run(limit_disabled);
+    mt_run(limit_ip_max_conn);
+    mt_run(limit_net_max_conn);
+    mt_run(limit_conn_rate);
+    mt_run(limit_bandwidth);
+    mt_run(limit_net_bandwidth);
+    mt_run(limit_evicts_oldest);
+    mt_run(limit_ipv6_prefix);
+}
@@ -0,0 +1,464 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+
+/* ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "mtest.h"
+#include "proxy.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+
+
+/* ==========================================================================
+                                   _                __
+                     ____   _____ (_)_   __ ____ _ / /_ ___
+                    / __ \ / ___// /| | / // __ `// __// _ \
+                   / /_/ // /   / / | |/ // /_/ // /_ /  __/
+                  / .___//_/   /_/  |___/ \__,_/ \__/ \___/
+                 /_/
+                                   _         __     __
+              _   __ ____ _ _____ (_)____ _ / /_   / /___   _____
+             | | / // __ `// ___// // __ `// __ \ / // _ \ / ___/
+             | |/ // /_/ // /   / // /_/ // /_/ // //  __/(__  )
+             |___/ \__,_//_/   /_/ \__,_//_.___//_/ \___//____/
+
+   ========================================================================== */
+
+
+mt_defs_ext();
+
+static const unsigned char v2_sig[12] =
+{
+    0x0d, 0x0a, 0x0d, 0x0a, 0x00, 0x0d, 0x0a, 0x51, 0x55, 0x49, 0x54, 0x0a
+};
+
+
+/* ==========================================================================
+                                   _                __
+                     ____   _____ (_)_   __ ____ _ / /_ ___
+                    / __ \ / ___// /| | / // __ `// __// _ \
+                   / /_/ // /   / / | |/ // /_/ // /_ /  __/
+                  / .___//_/   /_/  |___/ \__,_/ \__/ \___/
+                 /_/
+               ____                     __   _
+              / __/__  __ ____   _____ / /_ (_)____   ____   _____
+             / /_ / / / // __ \ / ___// __// // __ \ / __ \ / ___/
+            / __// /_/ // / / // /__ / /_ / // /_/ // / / /(__  )
+           /_/   \__,_//_/ /_/ \___/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+static struct sockaddr *addr(const char *ip)
+{
+    static struct sockaddr_in   sa;
+    static struct sockaddr_in6  sa6;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    if (strchr(ip, ':'))
+    {
+        memset(&sa6, 0, sizeof(sa6));
+        sa6.sin6_family = AF_INET6;
+        inet_pton(AF_INET6, ip, &sa6.sin6_addr);
+        return (struct sockaddr *)&sa6;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = inet_addr(ip);
+    return (struct sockaddr *)&sa;
+}
+
+
+static int parse
+(
+    const void               *buf,
+    size_t                    len,
+    struct sockaddr_storage  *src,
+    size_t                   *hlen
+)
+{
+    return proxy_parse(buf, len, src, hlen);
+}
+
+
+/* builds v2 header with command 'cmd', family 'fam' and 'alen' bytes
+ * of addresses, returns length of whole header
+ */
+
+static size_t v2
+(
+    unsigned char  *buf,
+    int             cmd,
+    int             fam,
+    size_t          alen
+)
+{
+    memcpy(buf, v2_sig, sizeof(v2_sig));
+    buf[12] = 0x20 | cmd;
+    buf[13] = fam;
+    buf[14] = alen >> 8;
+    buf[15] = alen & 0xff;
+    memset(buf + 16, 0, alen);
+    return 16 + alen;
+}
+
+
+static void test_cleanup(void)
+{
+    proxy_destroy();
+}
+
+
+/* ==========================================================================
+                           __               __
+                          / /_ ___   _____ / /_ _____
+                         / __// _ \ / ___// __// ___/
+                        / /_ /  __/(__  )/ /_ (__  )
+                        \__/ \___//____/ \__//____/
+
+   ========================================================================== */
+
+
+static void proxy_trusted_networks(void)
+{
+    mt_fok(proxy_init("10.0.0.0/8,192.168.1.1,fd00::/8,::1"));
+
+    mt_fail(proxy_trusted(addr("10.0.0.0")) == 1);
+    mt_fail(proxy_trusted(addr("10.255.255.255")) == 1);
+    mt_fail(proxy_trusted(addr("11.0.0.0")) == 0);
+    mt_fail(proxy_trusted(addr("192.168.1.1")) == 1);
+    mt_fail(proxy_trusted(addr("192.168.1.2")) == 0);
+    mt_fail(proxy_trusted(addr("fd12::1")) == 1);
+    mt_fail(proxy_trusted(addr("fe00::1")) == 0);
+    mt_fail(proxy_trusted(addr("::1")) == 1);
+    mt_fail(proxy_trusted(addr("::2")) == 0);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void proxy_nobody_trusted(void)
+{
+    mt_fok(proxy_init(""));
+    mt_fail(proxy_trusted(addr("127.0.0.1")) == 0);
+    mt_fail(proxy_trusted(addr("::1")) == 0);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void proxy_bad_trusted(void)
+{
+    const char  *bad[] = { "10.0.0.1/8", "10.0.0.0/33", "10.0.0.0/",
+        "::/129", "::1/a", "example.com", "10.0.0.0/8,fd00::1/8" };
+    size_t       i;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    for (i = 0; i != sizeof(bad) / sizeof(*bad); ++i)
+        mt_ferr(proxy_init(bad[i]), EINVAL);
+
+    mt_fail(proxy_trusted(addr("10.0.0.1")) == 0);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void proxy_v1_tcp4(void)
+{
+    const char               *h = "PROXY TCP4 1.2.3.4 5.6.7.8 1234 80\r\nhi";
+    struct sockaddr_storage   src;
+    struct sockaddr_in       *sin;
+    size_t                    hlen;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_fok(parse(h, strlen(h), &src, &hlen));
+    mt_fail(hlen == strlen(h) - 2);
+
+    sin = (struct sockaddr_in *)&src;
+    mt_fail(sin->sin_family == AF_INET);
+    mt_fail(sin->sin_addr.s_addr == inet_addr("1.2.3.4"));
+    mt_fail(ntohs(sin->sin_port) == 1234);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void proxy_v1_tcp6(void)
+{
+    const char               *h = "PROXY TCP6 2001:db8::1 ::1 4321 80\r\n";
+    struct sockaddr_storage   src;
+    struct sockaddr_in6      *sin6;
+    struct in6_addr           a;
+    size_t                    hlen;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_fok(parse(h, strlen(h), &src, &hlen));
+    mt_fail(hlen == strlen(h));
+
+    sin6 = (struct sockaddr_in6 *)&src;
+    inet_pton(AF_INET6, "2001:db8::1", &a);
+    mt_fail(sin6->sin6_family == AF_INET6);
+    mt_fail(memcmp(&sin6->sin6_addr, &a, sizeof(a)) == 0);
+    mt_fail(ntohs(sin6->sin6_port) == 4321);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void proxy_v1_unknown(void)
+{
+    const char               *h = "PROXY UNKNOWN\r\n";
+    struct sockaddr_storage   src;
+    size_t                    hlen;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_fok(parse(h, strlen(h), &src, &hlen));
+    mt_fail(hlen == strlen(h));
+    mt_fail(src.ss_family == AF_UNSPEC);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void proxy_v1_partial(void)
+{
+    const char               *h = "PROXY TCP4 1.2.3.4 5.6.7.8 1234 80\r\n";
+    struct sockaddr_storage   src;
+    size_t                    hlen;
+    size_t                    i;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    for (i = 0; i != strlen(h); ++i)
+        mt_ferr(parse(h, i, &src, &hlen), EAGAIN);
+
+    mt_fok(parse(h, i, &src, &hlen));
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void proxy_v1_malformed(void)
+{
+    const char  *bad[] = {
+        "PROXY TCP4 1.2.3.4 5.6.7.8 1234 80\n",
+        "PROXY TCP4 1.2.3.4 5.6.7.8 1234\r\n",
+        "PROXY TCP4 1.2.3.4 5.6.7.8 1234 80 1\r\n",
+        "PROXY TCP4 1.2.3.4  5.6.7.8 1234 80\r\n",
+        "PROXY TCP4 1.2.3 5.6.7.8 1234 80\r\n",
+        "PROXY TCP4 ::1 5.6.7.8 1234 80\r\n",
+        "PROXY TCP6 1.2.3.4 ::1 1234 80\r\n",
+        "PROXY TCP4 1.2.3.4 5.6.7.8 65536 80\r\n",
+        "PROXY TCP4 1.2.3.4 5.6.7.8 -1 80\r\n",
+        "PROXY UDP4 1.2.3.4 5.6.7.8 1234 80\r\n",
+        "PROXY\r\n",
+        "GET / HTTP/1.1\r\n",
+        "proxy TCP4 1.2.3.4 5.6.7.8 1234 80\r\n" };
+    char                      lng[200];
+    struct sockaddr_storage   src;
+    size_t                    hlen;
+    size_t                    i;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    for (i = 0; i != sizeof(bad) / sizeof(*bad); ++i)
+        mt_ferr(parse(bad[i], strlen(bad[i]), &src, &hlen), EINVAL);
+
+    /* no end of line where it should already be */
+
+    memset(lng, 'a', sizeof(lng));
+    memcpy(lng, "PROXY ", 6);
+    mt_ferr(parse(lng, sizeof(lng), &src, &hlen), EINVAL);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void proxy_v2_tcp4(void)
+{
+    unsigned char             h[64];
+    struct sockaddr_storage   src;
+    struct sockaddr_in       *sin;
+    size_t                    len;
+    size_t                    hlen;
+    size_t                    i;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    /* 12 bytes of addresses and ports, and 3 bytes TLV */
+
+    len = v2(h, 1, 0x11, 15);
+    h[16] = 1; h[17] = 2; h[18] = 3; h[19] = 4;
+    h[24] = 0x04; h[25] = 0xd2;
+    h[28] = 0x04;
+
+    for (i = 0; i != len; ++i)
+        mt_ferr(parse(h, i, &src, &hlen), EAGAIN);
+
+    mt_fok(parse(h, len, &src, &hlen));
+    mt_fail(hlen == len);
+
+    sin = (struct sockaddr_in *)&src;
+    mt_fail(sin->sin_family == AF_INET);
+    mt_fail(sin->sin_addr.s_addr == inet_addr("1.2.3.4"));
+    mt_fail(ntohs(sin->sin_port) == 1234);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void proxy_v2_tcp6(void)
+{
+    unsigned char             h[64];
+    struct sockaddr_storage   src;
+    struct sockaddr_in6      *sin6;
+    struct in6_addr           a;
+    size_t                    len;
+    size_t                    hlen;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    len = v2(h, 1, 0x21, 36);
+    inet_pton(AF_INET6, "2001:db8::1", &a);
+    memcpy(h + 16, &a, 16);
+    h[48] = 0x10; h[49] = 0xe1;
+
+    mt_fok(parse(h, len, &src, &hlen));
+    mt_fail(hlen == len);
+
+    sin6 = (struct sockaddr_in6 *)&src;
+    mt_fail(sin6->sin6_family == AF_INET6);
+    mt_fail(memcmp(&sin6->sin6_addr, &a, sizeof(a)) == 0);
+    mt_fail(ntohs(sin6->sin6_port) == 4321);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void proxy_v2_local_and_unspec(void)
+{
+    unsigned char             h[256];
+    struct sockaddr_storage   src;
+    size_t                    len;
+    size_t                    hlen;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    /* health check of balancer */
+
+    len = v2(h, 0, 0x00, 0);
+    mt_fok(parse(h, len, &src, &hlen));
+    mt_fail(hlen == 16);
+    mt_fail(src.ss_family == AF_UNSPEC);
+
+    /* unix socket addresses, we cannot use them */
+
+    len = v2(h, 1, 0x31, 216);
+    mt_fok(parse(h, len, &src, &hlen));
+    mt_fail(hlen == len);
+    mt_fail(src.ss_family == AF_UNSPEC);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void proxy_v2_malformed(void)
+{
+    unsigned char             h[64];
+    struct sockaddr_storage   src;
+    size_t                    len;
+    size_t                    hlen;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    /* wrong version */
+
+    len = v2(h, 1, 0x11, 12);
+    h[12] = 0x11;
+    mt_ferr(parse(h, len, &src, &hlen), EINVAL);
+
+    /* unknown command */
+
+    len = v2(h, 2, 0x11, 12);
+    mt_ferr(parse(h, len, &src, &hlen), EINVAL);
+
+    /* addresses don't fit */
+
+    len = v2(h, 1, 0x11, 11);
+    mt_ferr(parse(h, len, &src, &hlen), EINVAL);
+    len = v2(h, 1, 0x21, 35);
+    mt_ferr(parse(h, len, &src, &hlen), EINVAL);
+
+    /* header longer than we accept */
+
+    v2(h, 1, 0x11, 12);
+    h[14] = 0xff;
+    mt_ferr(parse(h, 16, &src, &hlen), EINVAL);
+
+    /* broken signature */
+
+    len = v2(h, 1, 0x11, 12);
+    h[11] = 0;
+    mt_ferr(parse(h, len, &src, &hlen), EINVAL);
+}
+
+
+/* ==========================================================================
+             __               __
+            / /_ ___   _____ / /_   ____ _ _____ ____   __  __ ____
+           / __// _ \ / ___// __/  / __ `// ___// __ \ / / / // __ \
+          / /_ /  __/(__  )/ /_   / /_/ // /   / /_/ // /_/ // /_/ /
+          \__/ \___//____/ \__/   \__, //_/    \____/ \__,_// .___/
+                                 /____/                    /_/
+   ========================================================================== */
+
+
+void proxy_test_group()
+{
+    mt_cleanup_test = &test_cleanup;
+
+    mt_run(proxy_trusted_networks);
+    mt_run(proxy_nobody_trusted);
+    mt_run(proxy_bad_trusted);
+    mt_run(proxy_v1_tcp4);
+    mt_run(proxy_v1_tcp6);
+    mt_run(proxy_v1_unknown);
+    mt_run(proxy_v1_partial);
+    mt_run(proxy_v1_malformed);
+    mt_run(proxy_v2_tcp4);
+    mt_run(proxy_v2_tcp6);
+    mt_run(proxy_v2_local_and_unspec);
+    mt_run(proxy_v2_malformed);
+}
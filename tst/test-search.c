@@ -0,0 +1,403 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+
+/* ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "mtest.h"
+#include "search.h"
+#include "upidx.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/* ==========================================================================
+                                   _                __
+                     ____   _____ (_)_   __ ____ _ / /_ ___
+                    / __ \ / ___// /| | / // __ `// __// _ \
+                   / /_/ // /   / / | |/ // /_/ // /_ /  __/
+                  / .___//_/   /_/  |___/ \__,_/ \__/ \___/
+                 /_/
+                                   _         __     __
+              _   __ ____ _ _____ (_)____ _ / /_   / /___   _____
+             | | / // __ `// ___// // __ `// __ \ / // _ \ / ___/
+             | |/ // /_/ // /   / // /_/ // /_/ // //  __/(__  )
+             |___/ \__,_//_/   /_/ \__,_//_.___//_/ \___//____/
+
+   ========================================================================== */
+
+
+#define SDIR "./search-test"
+#define IDX  "./search-test-idx"
+
+mt_defs_ext();
+
+
+/* ==========================================================================
+                                   _                __
+                     ____   _____ (_)_   __ ____ _ / /_ ___
+                    / __ \ / ___// /| | / // __ `// __// _ \
+                   / /_/ // /   / / | |/ // /_/ // /_ /  __/
+                  / .___//_/   /_/  |___/ \__,_/ \__/ \___/
+                 /_/
+               ____                     __   _
+              / __/__  __ ____   _____ / /_ (_)____   ____   _____
+             / /_ / / / // __ \ / ___// __// // __ \ / __ \ / ___/
+            / __// /_/ // / / // /__ / /_ / // /_/ // / / /(__  )
+           /_/   \__,_//_/ /_/ \___/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+static void remove_index(void)
+{
+    DIR            *d;     /* index directory */
+    struct dirent  *de;    /* directory entry */
+    char            path[512];  /* path to file to remove */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    unlink(IDX);
+    if ((d = opendir(SDIR)) == NULL)
+        return;
+
+    while ((de = readdir(d)) != NULL)
+    {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+
+        sprintf(path, "%s/%s", SDIR, de->d_name);
+        unlink(path);
+    }
+
+    closedir(d);
+    rmdir(SDIR);
+}
+
+
+static int num_segments(void)
+{
+    DIR            *d;     /* index directory */
+    struct dirent  *de;    /* directory entry */
+    int             n;     /* number of segments */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if ((d = opendir(SDIR)) == NULL)
+        return -1;
+
+    n = 0;
+    while ((de = readdir(d)) != NULL)
+        n += strlen(de->d_name) == 17;
+
+    closedir(d);
+    return n;
+}
+
+
+static int add(unsigned long recno, const char *text)
+{
+    return search_add(recno, text, strlen(text));
+}
+
+
+/* runs query and checks if exactly records r0, r1 and r2 were
+ * found, -1 means there should be no such record
+ */
+
+static int found(const char *pat, long r0, long r1, long r2)
+{
+    unsigned long  *recs;
+    size_t          nrecs;
+    size_t          n;
+    int             ok;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    if (search_query(SDIR, pat, &recs, &nrecs) != 0)
+        return 0;
+
+    n = (r0 != -1) + (r1 != -1) + (r2 != -1);
+    ok = nrecs == n;
+    if (ok && n > 0) ok = recs[0] == (unsigned long)r0;
+    if (ok && n > 1) ok = recs[1] == (unsigned long)r1;
+    if (ok && n > 2) ok = recs[2] == (unsigned long)r2;
+
+    free(recs);
+    return ok;
+}
+
+
+static void test_prepare(void)
+{
+    remove_index();
+    search_init(SDIR);
+}
+
+
+static void test_cleanup(void)
+{
+    search_destroy();
+    remove_index();
+}
+
+
+/* ==========================================================================
+                           __               __
+                          / /_ ___   _____ / /_ _____
+                         / __// _ \ / ___// __// ___/
+                        / /_ /  __/(__  )/ /_ (__  )
+                        \__/ \___//____/ \__//____/
+
+   ========================================================================== */
+
+
+static void search_empty(void)
+{
+    mt_fail(found("abc", -1, -1, -1));
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void search_from_journal(void)
+{
+    mt_fok(add(0, "segmentation fault (core dumped)"));
+    mt_fok(add(1, "all good here"));
+    mt_fok(add(2, "another segmentation fault"));
+
+    mt_fail(found("segmentation", 0, 2, -1));
+    mt_fail(found("good", 1, -1, -1));
+    mt_fail(found("nothing", -1, -1, -1));
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void search_ignores_case(void)
+{
+    mt_fok(add(0, "Kernel PANIC"));
+    mt_fail(found("kernel panic", 0, -1, -1));
+    mt_fail(found("KERNEL", 0, -1, -1));
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void search_candidates_only(void)
+{
+    /* has all trigrams of "abcd", but not "abcd" itself, caller
+     * must verify
+     */
+
+    mt_fok(add(0, "abcxbcd"));
+    mt_fail(found("abcd", 0, -1, -1));
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void search_skips_binary(void)
+{
+    mt_fok(search_add(0, "bin\0ary", 7));
+    mt_fok(add(1, "xy"));
+    mt_fail(found("bin", -1, -1, -1));
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void search_short_pattern(void)
+{
+    unsigned long  *recs;
+    size_t          nrecs;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_ferr(search_query(SDIR, "ab", &recs, &nrecs), EINVAL);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void search_from_segment(void)
+{
+    struct stat  st;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_fok(add(0, "error: out of memory"));
+    mt_fok(add(1, "error: disk full"));
+    mt_fok(search_flush());
+    mt_fail(num_segments() == 1);
+
+    mt_fok(stat(SDIR "/journal", &st));
+    mt_fail(st.st_size == 0);
+
+    mt_fok(add(2, "error: out of luck"));
+    mt_fail(found("error", 0, 1, 2));
+    mt_fail(found("out of", 0, 2, -1));
+    mt_fail(found("disk", 1, -1, -1));
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void search_journal_reload(void)
+{
+    int  fd;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_fok(add(0, "first upload"));
+    mt_fok(add(1, "second upload"));
+    search_destroy();
+
+    /* crash in the middle of writing record */
+
+    fd = open(SDIR "/journal", O_WRONLY | O_APPEND);
+    mt_fail(write(fd, "garbage", 7) == 7);
+    close(fd);
+
+    mt_fok(search_init(SDIR));
+    mt_fok(add(2, "third upload"));
+
+    /* postings from journal were loaded, so they end up in segment */
+
+    mt_fok(search_flush());
+    mt_fail(found("upload", 0, 1, 2));
+    mt_fail(found("second", 1, -1, -1));
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void search_new_segment_after_restart(void)
+{
+    mt_fok(add(0, "first upload"));
+    mt_fok(search_flush());
+    search_destroy();
+
+    mt_fok(search_init(SDIR));
+    mt_fok(add(1, "second upload"));
+    mt_fok(search_flush());
+    mt_fail(num_segments() == 2);
+    mt_fail(found("upload", 0, 1, -1));
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void search_merge_segments(void)
+{
+    mt_fok(add(0, "first upload"));
+    mt_fok(search_flush());
+    mt_fok(add(1, "second upload"));
+    mt_fok(search_flush());
+    mt_fok(add(2, "third upload"));
+    mt_fok(search_flush());
+    mt_fail(num_segments() == 3);
+
+    mt_fok(search_merge(SDIR, NULL));
+    mt_fail(num_segments() == 1);
+    mt_fail(found("upload", 0, 1, 2));
+    mt_fail(found("third", 2, -1, -1));
+
+    /* new segment must not collide with merged one */
+
+    mt_fok(add(3, "fourth upload"));
+    mt_fok(search_flush());
+    mt_fail(num_segments() == 2);
+    mt_fail(found("fourth", 3, -1, -1));
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void search_merge_drops_deleted(void)
+{
+    struct upidx_rec  rec;
+    struct upidx_map  m;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    memset(&rec, 0, sizeof(rec));
+    mt_fok(upidx_init(IDX));
+    mt_fok(upidx_add(&rec, NULL));
+    mt_fok(upidx_add(&rec, NULL));
+    mt_fok(upidx_mark_deleted(0));
+    upidx_destroy();
+
+    mt_fok(add(0, "first upload"));
+    mt_fok(add(1, "second upload"));
+    mt_fok(search_flush());
+
+    mt_fok(upidx_map(&m, IDX));
+    mt_fok(search_merge(SDIR, &m));
+    upidx_unmap(&m);
+
+    mt_fail(num_segments() == 1);
+    mt_fail(found("upload", 1, -1, -1));
+    mt_fail(found("first", -1, -1, -1));
+}
+
+
+/* ==========================================================================
+             __               __
+            / /_ ___   _____ / /_   ____ _ _____ ____   __  __ ____
+           / __// _ \ / ___// __/  / __ `// ___// __ \ / / / // __ \
+          / /_ /  __/(__  )/ /_   / /_/ // /   / /_/ // /_/ // /_/ /
+          \__/ \___//____/ \__/   \__, //_/    \____/ \__,_// .___/
+                                 /____/                    /_/
+   ========================================================================== */
+
+
+void search_test_group()
+{
+    mt_prepare_test = &test_prepare;
+    mt_cleanup_test = &test_cleanup;
+
+    mt_run(search_empty);
+    mt_run(search_from_journal);
+    mt_run(search_ignores_case);
+    mt_run(search_candidates_only);
+    mt_run(search_skips_binary);
+    mt_run(search_short_pattern);
+    mt_run(search_from_segment);
+    mt_run(search_journal_reload);
+    mt_run(search_new_segment_after_restart);
+    mt_run(search_merge_segments);
+    mt_run(search_merge_drops_deleted);
+}
@@ -0,0 +1,519 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+
+/* ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "mtest.h"
+#include "segstore.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/* ==========================================================================
+                                   _                __
+                     ____   _____ (_)_   __ ____ _ / /_ ___
+                    / __ \ / ___// /| | / // __ `// __// _ \
+                   / /_/ // /   / / | |/ // /_/ // /_ /  __/
+                  / .___//_/   /_/  |___/ \__,_/ \__/ \___/
+                 /_/
+                                   _         __     __
+              _   __ ____ _ _____ (_)____ _ / /_   / /___   _____
+             | | / // __ `// ___// // __ `// __ \ / // _ \ / ___/
+             | |/ // /_/ // /   / // /_/ // /_/ // //  __/(__  )
+             |___/ \__,_//_/   /_/ \__,_//_.___//_/ \___//____/
+
+   ========================================================================== */
+
+
+#define SDIR "./segstore-test"
+
+/* small segments, so we can test segment switching and compaction
+ * without writing megabytes of data
+ */
+
+#define SEGMAX 1000
+
+mt_defs_ext();
+
+
+/* ==========================================================================
+                                   _                __
+                     ____   _____ (_)_   __ ____ _ / /_ ___
+                    / __ \ / ___// /| | / // __ `// __// _ \
+                   / /_/ // /   / / | |/ // /_/ // /_ /  __/
+                  / .___//_/   /_/  |___/ \__,_/ \__/ \___/
+                 /_/
+               ____                     __   _
+              / __/__  __ ____   _____ / /_ (_)____   ____   _____
+             / /_ / / / // __ \ / ___// __// // __ \ / __ \ / ___/
+            / __// /_/ // / / // /__ / /_ / // /_/ // / / /(__  )
+           /_/   \__,_//_/ /_/ \___/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+static void remove_store(void)
+{
+    DIR            *d;     /* store directory */
+    struct dirent  *de;    /* directory entry */
+    char            path[512];  /* path to file to remove */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if ((d = opendir(SDIR)) == NULL)
+        return;
+
+    while ((de = readdir(d)) != NULL)
+    {
+        if (de->d_name[0] == '.')
+            continue;
+
+        sprintf(path, "%s/%s", SDIR, de->d_name);
+        unlink(path);
+    }
+
+    closedir(d);
+    rmdir(SDIR);
+}
+
+
+static void test_prepare(void)
+{
+    remove_store();
+    segstore_init(SDIR, SEGMAX);
+}
+
+
+static void test_cleanup(void)
+{
+    segstore_destroy();
+    remove_store();
+}
+
+
+static int put
+(
+    const char     *name,
+    size_t          len
+)
+{
+    unsigned char  *data;
+    int             ret;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    data = malloc(len + 1);
+    memset(data, name[0], len);
+    ret = segstore_put(name, data, len, 1337);
+    free(data);
+    return ret;
+}
+
+
+/* checks if 'name' is in store, has 'len' bytes and all of them are
+ * first letter of its name
+ */
+
+static int check
+(
+    const char     *name,
+    size_t          len
+)
+{
+    unsigned char   buf[SEGMAX];
+    off_t           off;
+    size_t          plen;
+    time_t          mtime;
+    size_t          i;
+    int             fd;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    if ((fd = segstore_open(name, &off, &plen, &mtime)) < 0)
+        return 0;
+
+    if (plen != len || mtime != 1337 ||
+            pread(fd, buf, plen, off) != (ssize_t)plen)
+    {
+        close(fd);
+        return 0;
+    }
+
+    close(fd);
+
+    for (i = 0; i != len; ++i)
+        if (buf[i] != (unsigned char)name[0])
+            return 0;
+
+    return 1;
+}
+
+
+static void reload(void)
+{
+    segstore_destroy();
+    segstore_init(SDIR, SEGMAX);
+}
+
+
+/* ==========================================================================
+                           __               __
+                          / /_ ___   _____ / /_ _____
+                         / __// _ \ / ___// __// ___/
+                        / /_ /  __/(__  )/ /_ (__  )
+                        \__/ \___//____/ \__//____/
+
+   ========================================================================== */
+
+
+static void segstore_put_and_open(void)
+{
+    mt_fok(put("abc", 100));
+    mt_fok(put("def", 200));
+    mt_fail(check("abc", 100));
+    mt_fail(check("def", 200));
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void segstore_open_missing(void)
+{
+    off_t   off;
+    size_t  len;
+    time_t  mtime;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_fok(put("abc", 100));
+    mt_ferr(segstore_open("abd", &off, &len, &mtime), ENOENT);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void segstore_empty_store(void)
+{
+    struct stat  st;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    /* nothing should be created until something is stored */
+
+    mt_fail(segstore_exists("abc") == 0);
+    mt_fail(stat(SDIR, &st) == -1 && errno == ENOENT);
+    mt_fok(segstore_compact());
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void segstore_exists_entry(void)
+{
+    mt_fok(put("abc", 100));
+    mt_fail(segstore_exists("abc") == 1);
+    mt_fail(segstore_exists("ab") == 0);
+    mt_fail(segstore_exists("abcd") == 0);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void segstore_invalid_len(void)
+{
+    mt_ferr(put("abc", 0), EINVAL);
+    mt_ferr(put("abc", SEGMAX + 1), EINVAL);
+    mt_fok(put("abc", SEGMAX));
+    mt_fail(check("abc", SEGMAX));
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void segstore_replace(void)
+{
+    unsigned char  data[10];
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    memset(data, 'x', sizeof(data));
+    mt_fok(segstore_put("abc", data, sizeof(data), 1337));
+    mt_fok(put("abc", 50));
+    mt_fail(check("abc", 50));
+    reload();
+    mt_fail(check("abc", 50));
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void segstore_remove_entry(void)
+{
+    mt_fok(put("abc", 100));
+    mt_fok(put("def", 100));
+    mt_fok(segstore_remove("abc"));
+    mt_fail(segstore_exists("abc") == 0);
+    mt_fail(check("def", 100));
+    mt_ferr(segstore_remove("abc"), ENOENT);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void segstore_reload(void)
+{
+    mt_fok(put("abc", 100));
+    mt_fok(put("def", 600));
+    mt_fok(put("ghi", 600));
+    mt_fok(segstore_remove("abc"));
+    reload();
+    mt_fail(segstore_exists("abc") == 0);
+    mt_fail(check("def", 600));
+    mt_fail(check("ghi", 600));
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void segstore_new_segment(void)
+{
+    struct stat  st;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_fok(put("abc", 600));
+    mt_fok(put("def", 600));
+    mt_fail(stat(SDIR "/00000000", &st) == 0 && st.st_size == 600);
+    mt_fail(stat(SDIR "/00000001", &st) == 0 && st.st_size == 600);
+    mt_fail(check("abc", 600));
+    mt_fail(check("def", 600));
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void segstore_compact_segment(void)
+{
+    struct stat  st;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_fok(put("abc", 400));
+    mt_fok(put("def", 400));
+    mt_fok(put("ghi", 400));
+
+    /* segment 0 is only half dead, and that is enough */
+
+    mt_fok(segstore_remove("abc"));
+    mt_fok(segstore_compact());
+
+    mt_fail(stat(SDIR "/00000000", &st) == -1 && errno == ENOENT);
+    mt_fail(stat(SDIR "/00000001", &st) == 0 && st.st_size == 800);
+    mt_fail(check("def", 400));
+    mt_fail(check("ghi", 400));
+
+    reload();
+    mt_fail(segstore_exists("abc") == 0);
+    mt_fail(check("def", 400));
+    mt_fail(check("ghi", 400));
+
+    /* index still has records that point to removed segment, that
+     * must not stop compaction of other segments
+     */
+
+    mt_fok(segstore_compact());
+    mt_fok(put("jkl", 400));
+    mt_fok(segstore_remove("def"));
+    mt_fok(segstore_compact());
+
+    mt_fail(stat(SDIR "/00000001", &st) == -1 && errno == ENOENT);
+    mt_fail(check("ghi", 400));
+    mt_fail(check("jkl", 400));
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void segstore_compact_nothing(void)
+{
+    struct stat  st;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_fok(put("abc", 400));
+    mt_fok(put("def", 400));
+    mt_fok(put("ghi", 400));
+    mt_fok(segstore_compact());
+    mt_fail(stat(SDIR "/00000000", &st) == 0 && st.st_size == 800);
+    mt_fail(check("abc", 400));
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void segstore_compact_dead_active(void)
+{
+    struct stat  st;
+    int          i;
+    int          ok;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_fok(put("abc", 400));
+    mt_fok(put("def", 700));
+    mt_fok(segstore_remove("def"));
+
+    /* enough garbage records to force index rewrite, segment 2
+     * is started on the way and ends up with nothing live in it
+     */
+
+    for (ok = 1, i = 0; i != 520; ++i)
+        ok &= put("x", 1) == 0 && segstore_remove("x") == 0;
+
+    mt_fail(ok);
+    mt_fail(stat(SDIR "/00000002", &st) == 0);
+    mt_fok(segstore_compact());
+
+    mt_fail(stat(SDIR "/00000001", &st) == -1 && errno == ENOENT);
+    mt_fail(stat(SDIR "/00000002", &st) == -1 && errno == ENOENT);
+    mt_fail(stat(SDIR "/00000000", &st) == 0 && st.st_size == 400);
+    mt_fail(check("abc", 400));
+
+    /* after restart, store must not know about removed segments,
+     * and new data must still be stored fine
+     */
+
+    reload();
+    mt_fok(put("ghi", 100));
+    mt_fail(check("abc", 400));
+    mt_fail(check("ghi", 100));
+    mt_fail(stat(SDIR "/00000002", &st) == -1 && errno == ENOENT);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void segstore_partial_record(void)
+{
+    int  fd;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    /* simulate crash in the middle of writing index record and
+     * segment data
+     */
+
+    mt_fok(put("abc", 100));
+    segstore_destroy();
+
+    fd = open(SDIR "/index", O_WRONLY | O_APPEND);
+    mt_fail(write(fd, "garbage", 7) == 7);
+    close(fd);
+
+    fd = open(SDIR "/00000000", O_WRONLY | O_APPEND);
+    mt_fail(write(fd, "garbage", 7) == 7);
+    close(fd);
+
+    segstore_init(SDIR, SEGMAX);
+    mt_fail(check("abc", 100));
+    mt_fok(put("def", 100));
+    reload();
+    mt_fail(check("abc", 100));
+    mt_fail(check("def", 100));
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void segstore_many_entries(void)
+{
+    char  name[8];
+    int   i;
+    int   ok;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    /* enough to grow hash table few times */
+
+    for (i = 0; i != 5000; ++i)
+    {
+        sprintf(name, "%c%d", 'a' + i % 26, i);
+        if (put(name, 10) != 0)
+            break;
+    }
+
+    mt_fail(i == 5000);
+
+    for (ok = 1, i = 0; i != 5000; ++i)
+    {
+        sprintf(name, "%c%d", 'a' + i % 26, i);
+        ok &= check(name, 10);
+    }
+
+    mt_fail(ok);
+}
+
+
+/* ==========================================================================
+             __               __
+            / /_ ___   _____ / /_   ____ _ _____ ____   __  __ ____
+           / __// _ \ / ___// __/  / __ `// ___// __ \ / / / // __ \
+          / /_ /  __/(__  )/ /_   / /_/ // /   / /_/ // /_/ // /_/ /
+          \__/ \___//____/ \__/   \__, //_/    \____/ \__,_// .___/
+                                 /____/                    /_/
+   ========================================================================== */
+
+
+void segstore_test_group()
+{
+    mt_prepare_test = &test_prepare;
+    mt_cleanup_test = &test_cleanup;
+
+    mt_run(segstore_put_and_open);
+    mt_run(segstore_open_missing);
+    mt_run(segstore_empty_store);
+    mt_run(segstore_exists_entry);
+    mt_run(segstore_invalid_len);
+    mt_run(segstore_replace);
+    mt_run(segstore_remove_entry);
+    mt_run(segstore_reload);
+    mt_run(segstore_new_segment);
+    mt_run(segstore_compact_segment);
+    mt_run(segstore_compact_nothing);
+    mt_run(segstore_compact_dead_active);
+    mt_run(segstore_partial_record);
+    mt_run(segstore_many_entries);
+}
@@ -774,6 +774,225 @@ test_mixed_timeouts()
 ## ==========================================================================
 
 
+test_http_download_slow()
+{
+    # download takes about 8 seconds, much longer than inactivity
+    # timeout, but client keeps receiving all the time, so it must
+    # not be disconnected. File must be big enough to not fit in
+    # socket buffers.
+
+    dd if=/dev/urandom of="${updir}/slowdl" bs=1048576 count=32 2>/dev/null
+    mt_fail "curl -sf --limit-rate 4m -o \"${data}\" \
+        http://${server}:61341/slowdl"
+    mt_fail "cmp \"${updir}/slowdl\" \"${data}\""
+}
+
+
+## ==========================================================================
+## ==========================================================================
+
+
+test_http_put()
+{
+    randstr 1000 > "${data}"
+    file="$(curl -sf -T "${data}" http://${server}:61342/ | get_file)"
+    mt_fail "diff ${updir}/${file} ${data}"
+}
+
+
+## ==========================================================================
+## ==========================================================================
+
+
+test_http_post()
+{
+    randstr 1000 > "${data}"
+    file="$(curl -sf --data-binary @"${data}" http://${server}:61342/ | \
+        get_file)"
+    mt_fail "diff ${updir}/${file} ${data}"
+}
+
+
+## ==========================================================================
+## ==========================================================================
+
+
+test_http_chunked()
+{
+    randstr 1000 > "${data}"
+    file="$(cat "${data}" | curl -sf -H "Transfer-Encoding: chunked" \
+        -T - http://${server}:61342/ | get_file)"
+    mt_fail "diff ${updir}/${file} ${data}"
+}
+
+
+## ==========================================================================
+## ==========================================================================
+
+
+test_http_expect_continue()
+{
+    randstr 1000 > "${data}"
+    file="$(curl -sf -H "Expect: 100-continue" -T "${data}" \
+        http://${server}:61342/ | get_file)"
+    mt_fail "diff ${updir}/${file} ${data}"
+}
+
+
+## ==========================================================================
+## ==========================================================================
+
+
+test_http_too_big()
+{
+    randstr 1025 > "${data}"
+    out="$(curl -s -w "%{http_code}" -T "${data}" http://${server}:61342/)"
+    mt_fail "[ \"${out}\" = \"file too big, max length is 1024 bytes
+413\" ]"
+}
+
+
+## ==========================================================================
+#   Sends $2 bytes, one byte every $1 seconds, without ending string, and
+#   prints last line of reply from the server
+## ==========================================================================
+
+
+trickle()
+{
+    {
+        for i in $(seq 1 1 ${2})
+        do
+            printf "a"
+            sleep ${1}
+        done
+    } | ${nc} ${server} 61337 2>/dev/null | tail -n1
+}
+
+
+## ==========================================================================
+## ==========================================================================
+
+
+test_min_rate()
+{
+    # client is never inactive for long, but sends way too little
+
+    out="$(trickle 0.5 12)"
+    mt_fail "[ \"${out}\" = \"upload too slow, minimum rate is 100 bytes per second\" ]"
+}
+
+
+## ==========================================================================
+## ==========================================================================
+
+
+test_min_rate_fast_enough()
+{
+    randstr 1000 > "${data}"
+    file="$(termsend "${data}" | get_file)"
+    mt_fail "diff ${updir}/${file} ${data}"
+}
+
+
+## ==========================================================================
+## ==========================================================================
+
+
+test_upload_deadline()
+{
+    start=$(date +%s)
+    out="$(trickle 0.5 12)"
+    took=$(( $(date +%s) - start ))
+
+    mt_fail "[ \"${out}\" = \"upload took longer than 2 seconds\" ]"
+    mt_fail "[ ${took} -lt 5 ]"
+}
+
+
+## ==========================================================================
+#   Takes the only upload slot for $1 seconds, runs in background
+## ==========================================================================
+
+
+hold_slot()
+{
+    { printf "held\n"; sleep ${1}; echo termsend; } | \
+        ${nc} ${server} 61337 >/dev/null 2>&1 &
+    sleep 0.3
+}
+
+
+## ==========================================================================
+## ==========================================================================
+
+
+test_wait_queue_fifo()
+{
+    # two clients wait for slot, first one that came, gets it first
+
+    printf "first\n" > "${data}.1"
+    printf "second\n" > "${data}.2"
+
+    hold_slot 1.5
+    termsend_nc 61337 "${data}.1" > "${data}.out1" &
+    sleep 0.3
+    termsend_nc 61337 "${data}.2" > "${data}.out2" &
+    wait
+
+    file1="$(cat "${data}.out1" | get_file)"
+    file2="$(cat "${data}.out2" | get_file)"
+    mt_fail "diff ${updir}/${file1} ${data}.1"
+    mt_fail "diff ${updir}/${file2} ${data}.2"
+
+    log=./termsend-test/termsend-query.log
+    line1="$(grep -n "\] ${file1}$" ${log} | cut -d: -f1)"
+    line2="$(grep -n "\] ${file2}$" ${log} | cut -d: -f1)"
+    mt_fail "[ -n \"${line1}\" ] && [ -n \"${line2}\" ]"
+    mt_fail "[ ${line1:-1} -lt ${line2:-0} ]"
+}
+
+
+## ==========================================================================
+## ==========================================================================
+
+
+test_wait_queue_expired()
+{
+    # slot is not freed before wait timeout, client is turned away
+
+    randstr 10 > "${data}"
+    hold_slot 2.5
+    out="$(termsend_nc 61337 "${data}" | tail -n1)"
+    wait
+
+    mt_fail "[ \"${out}\" = \"all upload slots are taken, try again later\" ]"
+    mt_fail "[ $(ls ${updir} | wc -l) -eq 1 ]"
+}
+
+
+## ==========================================================================
+## ==========================================================================
+
+
+test_wait_queue_gone()
+{
+    # client disconnects while it waits, no upload is created for it
+
+    hold_slot 1.5
+    printf "" | ${nc} ${server} 61337 >/dev/null 2>&1 &
+    wait
+
+    mt_fail "grep \"rejected: gone while waiting\" \
+        ./termsend-test/termsend-query.log"
+    mt_fail "[ $(ls ${updir} | wc -l) -eq 1 ]"
+}
+
+
+## ==========================================================================
+## ==========================================================================
+
+
 check_sanitizer_logs()
 {
     if grep "==ERROR: " ${0}.log
@@ -895,6 +1114,38 @@ then
     run_tests
 fi
 
+# tests below check server features, not client programs, so they
+# are run only once
+
+ssl_test=none
+prog_test=nc
+timed_test=0
+
+if type curl > /dev/null
+then
+    g_args="--http-port=61341"
+    mt_run_named test_http_download_slow "test_http_download_slow"
+    g_args="--http-upload-port=61342"
+    mt_run_named test_http_put "test_http_put"
+    mt_run_named test_http_post "test_http_post"
+    mt_run_named test_http_chunked "test_http_chunked"
+    mt_run_named test_http_expect_continue "test_http_expect_continue"
+    mt_run_named test_http_too_big "test_http_too_big"
+    g_args=""
+fi
+
+g_args="--min-rate=100 --rate-window=2"
+mt_run_named test_min_rate "test_min_rate"
+mt_run_named test_min_rate_fast_enough "test_min_rate_fast_enough"
+g_args="--upload-deadline=2"
+mt_run_named test_upload_deadline "test_upload_deadline"
+g_args="-m1 --wait-queue=2 --wait-timeout=10"
+mt_run_named test_wait_queue_fifo "test_wait_queue_fifo"
+mt_run_named test_wait_queue_gone "test_wait_queue_gone"
+g_args="-m1 --wait-queue=2 --wait-timeout=1"
+mt_run_named test_wait_queue_expired "test_wait_queue_expired"
+g_args=""
+
 if [ "x${optional_tests}" = "x1" ]
 then
     # these tests are optional as they need precise environment and
@@ -0,0 +1,335 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+
+/* ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "mtest.h"
+#include "upidx.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+
+/* ==========================================================================
+                                   _                __
+                     ____   _____ (_)_   __ ____ _ / /_ ___
+                    / __ \ / ___// /| | / // __ `// __// _ \
+                   / /_/ // /   / / | |/ // /_/ // /_ /  __/
+                  / .___//_/   /_/  |___/ \__,_/ \__/ \___/
+                 /_/
+                                   _         __     __
+              _   __ ____ _ _____ (_)____ _ / /_   / /___   _____
+             | | / // __ `// ___// // __ `// __ \ / // _ \ / ___/
+             | |/ // /_/ // /   / // /_/ // /_/ // //  __/(__  )
+             |___/ \__,_//_/   /_/ \__,_//_.___//_/ \___//____/
+
+   ========================================================================== */
+
+
+#define IDX "./upidx-test"
+
+mt_defs_ext();
+
+
+/* ==========================================================================
+                                   _                __
+                     ____   _____ (_)_   __ ____ _ / /_ ___
+                    / __ \ / ___// /| | / // __ `// __// _ \
+                   / /_/ // /   / / | |/ // /_/ // /_ /  __/
+                  / .___//_/   /_/  |___/ \__,_/ \__/ \___/
+                 /_/
+               ____                     __   _
+              / __/__  __ ____   _____ / /_ (_)____   ____   _____
+             / /_ / / / // __ \ / ___// __// // __ \ / __ \ / ___/
+            / __// /_/ // / / // /__ / /_ / // /_/ // / / /(__  )
+           /_/   \__,_//_/ /_/ \___/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+static void test_prepare(void)
+{
+    unlink(IDX);
+    upidx_init(IDX);
+}
+
+
+static void test_cleanup(void)
+{
+    upidx_destroy();
+    unlink(IDX);
+}
+
+
+static int add
+(
+    const char        *name,
+    unsigned long      size
+)
+{
+    struct upidx_rec   rec;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    memset(&rec, 0, sizeof(rec));
+    strcpy(rec.name, name);
+    strcpy(rec.mime, "x-c");
+    rec.size = size;
+    rec.ctime = 1337;
+    rec.family = 4;
+    rec.ip[0] = 10;
+    rec.ip[3] = 1;
+    rec.flags = UPIDX_SSL | UPIDX_PACKED;
+    rec.port = 1337;
+    return upidx_add(&rec, NULL);
+}
+
+
+/* ==========================================================================
+                           __               __
+                          / /_ ___   _____ / /_ _____
+                         / __// _ \ / ___// __// ___/
+                        / /_ /  __/(__  )/ /_ (__  )
+                        \__/ \___//____/ \__//____/
+
+   ========================================================================== */
+
+
+static void upidx_empty(void)
+{
+    struct upidx_map  m;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_fok(upidx_map(&m, IDX));
+    mt_fail(m.nrec == 0);
+    upidx_unmap(&m);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void upidx_add_and_map(void)
+{
+    struct upidx_map  m;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_fok(add("abc", 10));
+    mt_fok(add("def", 20));
+    mt_fok(upidx_map(&m, IDX));
+    mt_assert(m.nrec == 2);
+    mt_fail(strcmp(m.rec[0].name, "abc") == 0);
+    mt_fail(strcmp(m.rec[1].name, "def") == 0);
+    mt_fail(strcmp(m.rec[1].mime, "x-c") == 0);
+    mt_fail(m.rec[0].size == 10);
+    mt_fail(m.rec[1].size == 20);
+    mt_fail(m.rec[1].ctime == 1337);
+    mt_fail(m.rec[1].ip[0] == 10 && m.rec[1].ip[3] == 1);
+    mt_fail(m.rec[1].flags == (UPIDX_SSL | UPIDX_PACKED));
+    mt_fail(m.rec[1].port == 1337);
+    upidx_unmap(&m);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void upidx_reopen_appends(void)
+{
+    struct upidx_map  m;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_fok(add("abc", 10));
+    upidx_destroy();
+    mt_fok(upidx_init(IDX));
+    mt_fok(add("def", 20));
+    mt_fok(upidx_map(&m, IDX));
+    mt_assert(m.nrec == 2);
+    mt_fail(strcmp(m.rec[0].name, "abc") == 0);
+    mt_fail(strcmp(m.rec[1].name, "def") == 0);
+    upidx_unmap(&m);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void upidx_partial_record(void)
+{
+    struct upidx_map  m;
+    int               fd;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_fok(add("abc", 10));
+    upidx_destroy();
+
+    /* crash in the middle of writing record */
+
+    fd = open(IDX, O_WRONLY | O_APPEND);
+    mt_fail(write(fd, "garbage", 7) == 7);
+    close(fd);
+
+    /* reader ignores partial record */
+
+    mt_fok(upidx_map(&m, IDX));
+    mt_fail(m.nrec == 1);
+    upidx_unmap(&m);
+
+    /* and writer cuts it off */
+
+    mt_fok(upidx_init(IDX));
+    mt_fok(add("def", 20));
+    mt_fok(upidx_map(&m, IDX));
+    mt_assert(m.nrec == 2);
+    mt_fail(strcmp(m.rec[1].name, "def") == 0);
+    upidx_unmap(&m);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void upidx_not_an_index(void)
+{
+    struct upidx_map  m;
+    FILE             *f;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    upidx_destroy();
+    f = fopen(IDX, "w");
+    fprintf(f, "this is not an index, but it's long enough to have header");
+    fclose(f);
+
+    mt_ferr(upidx_init(IDX), EINVAL);
+    mt_ferr(upidx_map(&m, IDX), EINVAL);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void upidx_missing(void)
+{
+    struct upidx_map  m;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_ferr(upidx_map(&m, "./upidx-test-missing"), ENOENT);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void upidx_disabled(void)
+{
+    /* adding to not opened index is a no-op */
+
+    struct upidx_rec  rec;
+    unsigned long     recno;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    upidx_destroy();
+    mt_fok(add("abc", 10));
+
+    /* but caller asking for record number must know it's not there */
+
+    memset(&rec, 0, sizeof(rec));
+    mt_ferr(upidx_add(&rec, &recno), ENOENT);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void upidx_recno_and_read(void)
+{
+    struct upidx_rec  rec;
+    unsigned long     recno;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_fok(add("abc", 10));
+    memset(&rec, 0, sizeof(rec));
+    strcpy(rec.name, "def");
+    mt_fok(upidx_add(&rec, &recno));
+    mt_fail(recno == 1);
+
+    mt_fok(upidx_read(0, &rec));
+    mt_fail(strcmp(rec.name, "abc") == 0);
+    mt_fok(upidx_read(1, &rec));
+    mt_fail(strcmp(rec.name, "def") == 0);
+    mt_ferr(upidx_read(2, &rec), ENOENT);
+}
+
+
+/* ==========================================================================
+   ========================================================================== */
+
+
+static void upidx_mark_deleted_flag(void)
+{
+    struct upidx_map  m;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+    mt_fok(add("abc", 10));
+    mt_fok(add("def", 20));
+    mt_fok(upidx_mark_deleted(0));
+    mt_ferr(upidx_mark_deleted(2), ENOENT);
+
+    /* appending after marking must not overwrite anything */
+
+    mt_fok(add("ghi", 30));
+
+    mt_fok(upidx_map(&m, IDX));
+    mt_assert(m.nrec == 3);
+    mt_fail(m.rec[0].flags == (UPIDX_SSL | UPIDX_PACKED | UPIDX_DELETED));
+    mt_fail(m.rec[1].flags == (UPIDX_SSL | UPIDX_PACKED));
+    mt_fail(strcmp(m.rec[2].name, "ghi") == 0);
+    upidx_unmap(&m);
+}
+
+
+/* ==========================================================================
+             __               __
+            / /_ ___   _____ / /_   ____ _ _____ ____   __  __ ____
+           / __// _ \ / ___// __/  / __ `// ___// __ \ / / / // __ \
+          / /_ /  __/(__  )/ /_   / /_/ // /   / /_/ // /_/ // /_/ /
+          \__/ \___//____/ \__/   \__, //_/    \____/ \__,_// .___/
+                                 /____/                    /_/
+   ========================================================================== */
+
+
+void upidx_test_group()
+{
+    mt_prepare_test = &test_prepare;
+    mt_cleanup_test = &test_cleanup;
+
+    mt_run(upidx_empty);
+    mt_run(upidx_add_and_map);
+    mt_run(upidx_reopen_appends);
+    mt_run(upidx_partial_record);
+    mt_run(upidx_not_an_index);
+    mt_run(upidx_missing);
+    mt_run(upidx_disabled);
+    mt_run(upidx_recno_and_read);
+    mt_run(upidx_mark_deleted_flag);
+}
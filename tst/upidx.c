@@ -0,0 +1 @@
+../src/upidx.c
\ No newline at end of file